@@ -37,12 +37,36 @@ st_index(shardcache_storage_index_item_t *index, size_t isize, void *priv)
     return isize;
 }
 
+static size_t
+st_index_page(shardcache_storage_index_item_t *index, size_t isize, uint64_t *cursor, void *priv)
+{
+    // the cursor is simply the number of the next key
+    size_t count = 0;
+    while (count < isize && *cursor < FAKE_KEYS_NUMBERS) {
+        char key[50];
+
+        snprintf(key, sizeof(key), FAKE_KEYS_FORMAT, (int)*cursor);
+
+        index[count].key  = strndup(key, sizeof(key));
+        index[count].klen = strlen(key);
+        index[count].vlen = strlen(key);
+        count++;
+        (*cursor)++;
+    }
+
+    if (*cursor >= FAKE_KEYS_NUMBERS)
+        *cursor = 0;
+
+    return count;
+}
+
 int
 storage_init(shardcache_storage_t *storage, const char **options)
 {
     storage->fetch  = st_fetch;
     storage->count  = st_count;
     storage->index  = st_index;
+    storage->index_page = st_index_page;
     storage->shared = 1;
     storage->global = 1;
 
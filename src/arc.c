@@ -5,7 +5,6 @@
 #include <memory.h>
 #include <stddef.h>
 
-#include <hashtable.h>
 #include <refcnt.h>
 
 #include <atomic_defs.h>
@@ -13,6 +12,7 @@
 #include "shardcache_internal.h" // for MUTEX_* macros
 
 #include "arc.h"
+#include "arc_index.h"
 
 
 #define LIKELY(__e) __builtin_expect((__e), 1)
@@ -60,27 +60,100 @@ typedef struct __arc_object {
     char buf[32];
     void *key;
     size_t klen;
+    uint64_t hash;
     refcnt_node_t *node;
     int async;
     int locked;
+    int unlinked; // removed from the index
+    int refs; // long-lived references (only used in epoch mode)
+    int marker; // placeholder parked in a list by arc_remove_prefix()
+    uint64_t retired_epoch;
+    struct __arc_object *retired_next;
 } arc_object_t;
 #pragma pack(pop)
 
+/* Per-thread epoch record, used when the cache runs in epoch mode.
+ * A thread pins the current global epoch while it's referencing objects
+ * obtained from the index and releases it (setting its epoch to 0)
+ * when done. Retired objects can be released once no thread is still
+ * pinning an epoch older or equal to the one they have been retired in */
+typedef struct __arc_epoch_slot {
+    uint64_t epoch; // 0 when the thread is quiescent
+    int nesting;    // accessed only by the owner thread
+    int in_use;
+    struct __arc_epoch_slot *next;
+    char pad[64 - sizeof(uint64_t) - 2 * sizeof(int) - sizeof(void *)];
+} arc_epoch_slot_t;
+
+#define ARC_EPOCH_RECLAIM_THRESHOLD 64
+
+// max number of objects handed to the demote callback by a single arc_balance()
+#define ARC_DEMOTE_BATCH 64
+
+// max number of objects visited by arc_remove_prefix() before releasing the lock
+#define ARC_REMOVE_PREFIX_BATCH 1024
+
+/* A prefix being removed by arc_remove_prefix(). While the lists are
+ * unlocked between two batches, the objects which would jump past the
+ * marker of the walk (hits moving them to the head of a list) are
+ * checked against the prefixes being removed by arc_move() */
+typedef struct __arc_prefix_removal {
+    const void *prefix;
+    size_t plen;
+    struct __arc_prefix_removal *next;
+} arc_prefix_removal_t;
+
+/* Memory which lock-free readers might still be accessing
+ * (the tables replaced when the index is resized) */
+typedef struct __arc_retired_mem {
+    void *ptr;
+    uint64_t retired_epoch;
+    struct __arc_retired_mem *next;
+} arc_retired_mem_t;
+
+// resources handed out by arc_retain_resource() in epoch mode are tagged
+// so that arc_release_resource() can tell them from the ones pinned by
+// the calling thread
+#define ARC_RESOURCE_RETAINED_FLAG   ((uintptr_t)0x01)
+#define ARC_RESOURCE_IS_RETAINED(r)  (((uintptr_t)(r)) & ARC_RESOURCE_RETAINED_FLAG)
+#define ARC_RESOURCE_OBJ(r)          ((arc_object_t *)(((uintptr_t)(r)) & ~ARC_RESOURCE_RETAINED_FLAG))
+
 /* The actual cache. */
 struct __arc {
     struct __arc_ops *ops;
-    hashtable_t *hash;
+    arc_index_t *index;
 
     size_t c, p;
     size_t cos;
     struct __arc_state mrug, mru, mfu, mfug;
 
+    // objects bigger than large_threshold are kept in their own
+    // pool (LRU), bounded by large_c, instead of the arc lists
+    struct __arc_state large;
+    size_t large_threshold;
+    size_t large_c;
+
     int needs_balance;
     int loose_mode;
 
     pthread_mutex_t lock;
 
+    // prefixes being removed (protected by the lock)
+    arc_prefix_removal_t *removals;
+
+    int reclaim_mode;
+
     refcnt_t *refcnt;
+
+    // epoch mode
+    volatile uint64_t epoch;
+    size_t epoch_id;       // index of the slots of the cache in the thread tables
+    uint64_t epoch_serial; // tells the cache from a destroyed one with the same id
+    arc_epoch_slot_t *epoch_slots;
+    arc_object_t *retired;
+    arc_retired_mem_t *retired_mem;
+    size_t num_retired;
+    size_t reclaim_at;
 };
 
 
@@ -90,6 +163,382 @@ struct __arc {
 #define ARC_OBJ_BASE_SIZE(o) (sizeof(arc_object_t) + (((o)->key == (o)->buf) ? 0 : (o)->klen))
 
 static int arc_move(arc_t *cache, arc_object_t *obj, arc_state_t *state);
+static void arc_epoch_retire(arc_t *cache, arc_object_t *obj);
+
+static void
+arc_object_free(arc_t *cache, arc_object_t *obj)
+{
+    if (obj->ptr && cache->ops->evict)
+        cache->ops->evict(obj->ptr, cache->ops->priv);
+
+    if (obj->key != obj->buf)
+        free(obj->key);
+
+    free(obj);
+}
+
+/**********************************************************************
+ * Epoch based reclamation
+ */
+/* The epoch slots of a thread, one per cache (indexed by the id of the
+ * cache). All the caches share a single thread-specific key, the number
+ * of keys a process can create is limited (PTHREAD_KEYS_MAX) */
+typedef struct {
+    uint64_t serial; // the serial of the cache owning the slot
+    arc_epoch_slot_t *slot;
+} arc_epoch_tls_entry_t;
+
+typedef struct {
+    arc_epoch_tls_entry_t *entries;
+    size_t size;
+} arc_epoch_tls_t;
+
+static pthread_once_t arc_epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t arc_epoch_key;
+static int arc_epoch_key_error = 0;
+
+// the caches running in epoch mode, indexed by their id
+// (ids are reused, serials are not)
+static pthread_mutex_t arc_epoch_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static arc_t **arc_epoch_registry = NULL;
+static size_t arc_epoch_registry_size = 0;
+static uint64_t arc_epoch_serial = 0;
+
+static void
+arc_epoch_tls_release(void *ptr)
+{
+    // called when a thread which used any cache exits, the slots of
+    // the caches already destroyed are gone and must not be touched
+    arc_epoch_tls_t *tls = (arc_epoch_tls_t *)ptr;
+    size_t i;
+    MUTEX_LOCK(&arc_epoch_registry_lock);
+    for (i = 0; i < tls->size && i < arc_epoch_registry_size; i++) {
+        arc_epoch_slot_t *slot = tls->entries[i].slot;
+        arc_t *cache = arc_epoch_registry[i];
+        if (!slot || !cache || cache->epoch_serial != tls->entries[i].serial)
+            continue;
+        slot->nesting = 0;
+        ATOMIC_SET(slot->epoch, 0);
+        ATOMIC_SET(slot->in_use, 0);
+    }
+    MUTEX_UNLOCK(&arc_epoch_registry_lock);
+    free(tls->entries);
+    free(tls);
+}
+
+static void
+arc_epoch_key_init()
+{
+    arc_epoch_key_error = pthread_key_create(&arc_epoch_key, arc_epoch_tls_release);
+}
+
+static int
+arc_epoch_register(arc_t *cache)
+{
+    int rc = pthread_once(&arc_epoch_once, arc_epoch_key_init);
+    if (rc != 0 || arc_epoch_key_error != 0)
+        return -1;
+
+    MUTEX_LOCK(&arc_epoch_registry_lock);
+    size_t i;
+    for (i = 0; i < arc_epoch_registry_size; i++) {
+        if (!arc_epoch_registry[i])
+            break;
+    }
+    if (i == arc_epoch_registry_size) {
+        size_t size = arc_epoch_registry_size ? arc_epoch_registry_size * 2 : 16;
+        arc_t **registry = realloc(arc_epoch_registry, size * sizeof(arc_t *));
+        if (!registry) {
+            MUTEX_UNLOCK(&arc_epoch_registry_lock);
+            return -1;
+        }
+        memset(registry + arc_epoch_registry_size, 0, (size - arc_epoch_registry_size) * sizeof(arc_t *));
+        arc_epoch_registry = registry;
+        arc_epoch_registry_size = size;
+    }
+    cache->epoch_id = i;
+    cache->epoch_serial = ++arc_epoch_serial;
+    arc_epoch_registry[i] = cache;
+    MUTEX_UNLOCK(&arc_epoch_registry_lock);
+    return 0;
+}
+
+static void
+arc_epoch_unregister(arc_t *cache)
+{
+    // once out of the registry the exiting threads won't touch
+    // the slots of the cache anymore
+    MUTEX_LOCK(&arc_epoch_registry_lock);
+    arc_epoch_registry[cache->epoch_id] = NULL;
+    MUTEX_UNLOCK(&arc_epoch_registry_lock);
+}
+
+// the slot of the calling thread, NULL if the thread never used the cache
+static inline arc_epoch_slot_t *
+arc_epoch_slot_get(arc_t *cache)
+{
+    arc_epoch_tls_t *tls = pthread_getspecific(arc_epoch_key);
+    if (LIKELY(tls && cache->epoch_id < tls->size &&
+               tls->entries[cache->epoch_id].serial == cache->epoch_serial))
+    {
+        return tls->entries[cache->epoch_id].slot;
+    }
+    return NULL;
+}
+
+static void
+arc_epoch_slot_set(arc_t *cache, arc_epoch_slot_t *slot)
+{
+    arc_epoch_tls_t *tls = pthread_getspecific(arc_epoch_key);
+    if (!tls) {
+        tls = calloc(1, sizeof(arc_epoch_tls_t));
+        if (!tls)
+            return;
+        if (pthread_setspecific(arc_epoch_key, tls) != 0) {
+            free(tls);
+            return;
+        }
+    }
+    if (cache->epoch_id >= tls->size) {
+        size_t size = cache->epoch_id + 16;
+        arc_epoch_tls_entry_t *entries = realloc(tls->entries, size * sizeof(arc_epoch_tls_entry_t));
+        if (!entries)
+            return;
+        memset(entries + tls->size, 0, (size - tls->size) * sizeof(arc_epoch_tls_entry_t));
+        tls->entries = entries;
+        tls->size = size;
+    }
+    tls->entries[cache->epoch_id].serial = cache->epoch_serial;
+    tls->entries[cache->epoch_id].slot = slot;
+}
+
+static inline arc_epoch_slot_t *
+arc_epoch_slot(arc_t *cache)
+{
+    arc_epoch_slot_t *slot = arc_epoch_slot_get(cache);
+    if (LIKELY(slot != NULL))
+        return slot;
+
+    MUTEX_LOCK(&cache->lock);
+    for (slot = cache->epoch_slots; slot; slot = slot->next) {
+        if (!ATOMIC_READ(slot->in_use))
+            break;
+    }
+    if (!slot) {
+        slot = calloc(1, sizeof(arc_epoch_slot_t));
+        slot->next = cache->epoch_slots;
+        cache->epoch_slots = slot;
+    }
+    slot->nesting = 0;
+    ATOMIC_SET(slot->epoch, 0);
+    ATOMIC_SET(slot->in_use, 1);
+    MUTEX_UNLOCK(&cache->lock);
+
+    // if the slot can't be recorded it stays in use (quiescent when
+    // not pinned) and the next call will get a new one
+    arc_epoch_slot_set(cache, slot);
+    return slot;
+}
+
+static inline void
+arc_epoch_enter(arc_t *cache)
+{
+    arc_epoch_slot_t *slot = arc_epoch_slot(cache);
+    // NOTE: ATOMIC_SET() implies a full barrier, so the pinned epoch
+    //       is visible to the reclaimer before we access the index
+    if (slot->nesting++ == 0)
+        ATOMIC_SET(slot->epoch, cache->epoch);
+}
+
+static inline void
+arc_epoch_exit(arc_t *cache)
+{
+    arc_epoch_slot_t *slot = arc_epoch_slot_get(cache);
+    if (LIKELY(slot && slot->nesting > 0) && --slot->nesting == 0)
+        ATOMIC_SET(slot->epoch, 0);
+}
+
+// NOTE: must be called with the cache lock held
+static arc_object_t *
+arc_epoch_reclaim(arc_t *cache)
+{
+    uint64_t epoch = cache->epoch;
+    uint64_t min_epoch = epoch + 1;
+    int can_advance = 1;
+
+    arc_epoch_slot_t *slot;
+    for (slot = cache->epoch_slots; slot; slot = slot->next) {
+        uint64_t pinned = ATOMIC_READ(slot->epoch);
+        if (!pinned)
+            continue;
+        if (pinned < min_epoch)
+            min_epoch = pinned;
+        if (pinned != epoch)
+            can_advance = 0;
+    }
+
+    if (can_advance)
+        ATOMIC_INCREMENT(cache->epoch);
+
+    // an object retired in epoch N can be released once all the threads
+    // have pinned an epoch newer than N (or are quiescent) and nobody
+    // holds a long-lived reference to it
+    arc_object_t *to_free = NULL;
+    arc_object_t **prev = &cache->retired;
+    arc_object_t *obj = cache->retired;
+    while (obj) {
+        arc_object_t *next = obj->retired_next;
+        if (obj->retired_epoch < min_epoch && ATOMIC_READ(obj->refs) == 0) {
+            *prev = next;
+            obj->retired_next = to_free;
+            to_free = obj;
+            cache->num_retired--;
+        } else {
+            prev = &obj->retired_next;
+        }
+        obj = next;
+    }
+
+    arc_retired_mem_t **prev_mem = &cache->retired_mem;
+    arc_retired_mem_t *mem = cache->retired_mem;
+    while (mem) {
+        arc_retired_mem_t *next = mem->next;
+        if (mem->retired_epoch < min_epoch) {
+            *prev_mem = next;
+            free(mem->ptr);
+            free(mem);
+        } else {
+            prev_mem = &mem->next;
+        }
+        mem = next;
+    }
+
+    cache->reclaim_at = cache->num_retired + ARC_EPOCH_RECLAIM_THRESHOLD;
+    return to_free;
+}
+
+static inline void
+arc_epoch_free_list(arc_t *cache, arc_object_t *list)
+{
+    while (list) {
+        arc_object_t *next = list->retired_next;
+        arc_object_free(cache, list);
+        list = next;
+    }
+}
+
+static void
+arc_epoch_retire(arc_t *cache, arc_object_t *obj)
+{
+    arc_object_t *to_free = NULL;
+    MUTEX_LOCK(&cache->lock);
+    obj->retired_epoch = cache->epoch;
+    obj->retired_next = cache->retired;
+    cache->retired = obj;
+    if (++cache->num_retired >= cache->reclaim_at)
+        to_free = arc_epoch_reclaim(cache);
+    MUTEX_UNLOCK(&cache->lock);
+    arc_epoch_free_list(cache, to_free);
+}
+
+// called by the index when a table is replaced by a resize
+static void
+arc_epoch_retire_mem(void *ptr, void *priv)
+{
+    arc_t *cache = (arc_t *)priv;
+    arc_retired_mem_t *mem = malloc(sizeof(arc_retired_mem_t));
+    mem->ptr = ptr;
+    MUTEX_LOCK(&cache->lock);
+    mem->retired_epoch = cache->epoch;
+    mem->next = cache->retired_mem;
+    cache->retired_mem = mem;
+    MUTEX_UNLOCK(&cache->lock);
+}
+
+/**********************************************************************
+ * Object references.
+ * In refcnt mode each reference is counted on the refcnt node of the object,
+ * in epoch mode the references taken by arc_lookup() are represented by the
+ * epoch pinned by the calling thread
+ */
+static inline void
+arc_pin(arc_t *cache)
+{
+    if (cache->reclaim_mode == ARC_RECLAIM_EPOCH)
+        arc_epoch_enter(cache);
+}
+
+static inline void
+arc_unpin(arc_t *cache)
+{
+    if (cache->reclaim_mode == ARC_RECLAIM_EPOCH)
+        arc_epoch_exit(cache);
+}
+
+static int
+arc_object_match(void *value, const void *key, size_t klen, void *priv)
+{
+    arc_object_t *obj = (arc_object_t *)value;
+    return (obj->klen == klen && memcmp(obj->key, key, klen) == 0);
+}
+
+static void *
+retain_obj_cb(void *value, void *priv)
+{
+    retain_ref(((arc_t *)priv)->refcnt, ((arc_object_t *)value)->node);
+    return value;
+}
+
+// in epoch mode the caller must have pinned the epoch (arc_pin())
+static inline arc_object_t *
+arc_object_get(arc_t *cache, const void *key, size_t len, uint64_t hash)
+{
+    // only in epoch mode the lookups don't take any lock
+    if (cache->reclaim_mode == ARC_RECLAIM_EPOCH)
+        return arc_index_get(cache->index, key, len, hash);
+
+    // NOTE: the refcount of the object (if found) is increased while its key
+    //       is still locked in the index, so it can't be released meanwhile.
+    //       Nothing prevents a lock-free lookup from retaining an object
+    //       which is being released (its refcnt node might be gone already)
+    return arc_index_get_locked(cache->index, key, len, hash, retain_obj_cb, cache);
+}
+
+static inline void
+arc_object_retain(arc_t *cache, arc_object_t *obj)
+{
+    if (cache->reclaim_mode == ARC_RECLAIM_REFCNT)
+        retain_ref(cache->refcnt, obj->node);
+}
+
+static inline void
+arc_object_release(arc_t *cache, arc_object_t *obj)
+{
+    if (cache->reclaim_mode == ARC_RECLAIM_EPOCH)
+        arc_epoch_exit(cache);
+    else
+        release_ref(cache->refcnt, obj->node);
+}
+
+// drop the reference held by the index (the object has been removed from it)
+static inline void
+arc_object_unlink(arc_t *cache, arc_object_t *obj)
+{
+    if (cache->reclaim_mode == ARC_RECLAIM_EPOCH)
+        arc_epoch_retire(cache, obj);
+    else
+        release_ref(cache->refcnt, obj->node);
+}
+
+// drop the reference for an object which never made it into the index
+static inline void
+arc_object_discard(arc_t *cache, arc_object_t *obj)
+{
+    if (cache->reclaim_mode == ARC_RECLAIM_EPOCH)
+        arc_object_free(cache, obj);
+    else
+        release_ref(cache->refcnt, obj->node);
+}
 
 
 
@@ -108,7 +557,7 @@ arc_list_destroy(arc_t *cache, arc_list_t *head)
         arc_object_t *obj = arc_list_entry(pos, arc_object_t, head);
         pos = pos->next;
         tmp->prev = tmp->next = NULL;
-        release_ref(cache->refcnt, obj->node);
+        arc_object_unlink(cache, obj);
     }
 }
 
@@ -155,12 +604,30 @@ arc_list_move_to_head(arc_list_t *head, arc_list_t *list)
     arc_list_prepend(head, list);
 }
 
-/* Return the LRU element from the given state. */
+/* Return the LRU element from the given state (skipping the markers),
+ * NULL if the list holds no objects. */
 static inline arc_object_t *
 arc_state_lru(arc_state_t *state)
 {
-    arc_list_t *head = state->head.prev;
-    return arc_list_entry(head, arc_object_t, head);
+    arc_list_t *pos;
+    arc_list_each_prev(pos, &state->head) {
+        arc_object_t *obj = arc_list_entry(pos, arc_object_t, head);
+        if (LIKELY(!obj->marker))
+            return obj;
+    }
+    return NULL;
+}
+
+// NOTE: must be called with the cache lock held
+static inline int
+arc_prefix_removing(arc_t *cache, arc_object_t *obj)
+{
+    arc_prefix_removal_t *removal;
+    for (removal = cache->removals; removal; removal = removal->next) {
+        if (obj->klen >= removal->plen && memcmp(obj->key, removal->prefix, removal->plen) == 0)
+            return 1;
+    }
+    return 0;
 }
 
 /* Balance the lists so that we can fit an object with the given size into
@@ -171,14 +638,18 @@ arc_balance(arc_t *cache)
     if (!ATOMIC_READ(cache->needs_balance))
         return;
 
+    // objects dropped from the ghost lists are retained and
+    // handed to the demote callback once the lock is released
+    arc_resource_t demoted[ARC_DEMOTE_BATCH];
+    int num_demoted = 0;
+
     MUTEX_LOCK(&cache->lock);
     /* First move objects from MRU/MFU to their respective ghost lists. */
     while (cache->mru.size + cache->mfu.size > cache->c) {
-        if (cache->mru.size > cache->p) {
-            arc_object_t *obj = arc_state_lru(&cache->mru);
+        arc_object_t *obj = NULL;
+        if (cache->mru.size > cache->p && (obj = arc_state_lru(&cache->mru))) {
             arc_move(cache, obj, &cache->mrug);
-        } else if (cache->mfu.size > cache->c - cache->p) {
-            arc_object_t *obj = arc_state_lru(&cache->mfu);
+        } else if (cache->mfu.size > cache->c - cache->p && (obj = arc_state_lru(&cache->mfu))) {
             arc_move(cache, obj, &cache->mfug);
         } else {
             break;
@@ -187,31 +658,59 @@ arc_balance(arc_t *cache)
 
     /* Then start removing objects from the ghost lists. */
     while (cache->mrug.size + cache->mfug.size > cache->c) {
+        arc_object_t *obj = NULL;
         if (cache->mfug.size > cache->p) {
-            arc_object_t *obj = arc_state_lru(&cache->mfug);
-            arc_move(cache, obj, NULL);
+            obj = arc_state_lru(&cache->mfug);
         } else if (cache->mrug.size > cache->c - cache->p) {
-            arc_object_t *obj = arc_state_lru(&cache->mrug);
-            arc_move(cache, obj, NULL);
-        } else {
-            break;
+            obj = arc_state_lru(&cache->mrug);
         }
+        if (!obj)
+            break;
+        if (cache->ops->demote && num_demoted < ARC_DEMOTE_BATCH)
+            demoted[num_demoted++] = arc_retain_resource(cache, obj);
+        arc_move(cache, obj, NULL);
+    }
+
+    /* The large objects are evicted from their own pool (LRU). */
+    while (cache->large.size > cache->large_c) {
+        arc_object_t *obj = arc_state_lru(&cache->large);
+        if (!obj)
+            break;
+        if (cache->ops->demote && num_demoted < ARC_DEMOTE_BATCH)
+            demoted[num_demoted++] = arc_retain_resource(cache, obj);
+        arc_move(cache, obj, NULL);
     }
 
     ATOMIC_SET(cache->needs_balance, 0);
     MUTEX_UNLOCK(&cache->lock);
+
+    int i;
+    for (i = 0; i < num_demoted; i++) {
+        cache->ops->demote(ARC_RESOURCE_OBJ(demoted[i])->ptr, cache->ops->priv);
+        arc_release_resource(cache, demoted[i]);
+    }
 }
 
 void
 arc_update_resource_size(arc_t *cache, arc_resource_t res, size_t size)
 {
-    arc_object_t *obj = (arc_object_t *)res;
+    arc_object_t *obj = ARC_RESOURCE_OBJ(res);
     if (obj) {
         MUTEX_LOCK(&cache->lock);
         arc_state_t *state = ATOMIC_READ(obj->state);
-        if (LIKELY(state == &cache->mru || state == &cache->mfu)) {
+        if (LIKELY(state == &cache->mru || state == &cache->mfu || state == &cache->large)) {
             ATOMIC_DECREASE(state->size, obj->size);
             obj->size = ARC_OBJ_BASE_SIZE(obj) + cache->cos + size;
+            if (state != &cache->large && cache->large_threshold && size >= cache->large_threshold) {
+                // the object turned out to be big (while being fetched
+                // asynchronously), move it to the large pool
+                arc_list_remove(&obj->head);
+                ATOMIC_DECREMENT(state->count);
+                state = &cache->large;
+                arc_list_prepend(&obj->head, &state->head);
+                ATOMIC_INCREMENT(state->count);
+                ATOMIC_SET(obj->state, state);
+            }
             ATOMIC_INCREASE(state->size, obj->size);
         }
         ATOMIC_INCREMENT(cache->needs_balance);
@@ -245,7 +744,7 @@ arc_move(arc_t *cache, arc_object_t *obj, arc_state_t *state)
     // In the second conditional instead we handle a specific corner case which
     // happens when concurring threads access an item which has been just fetched
     // but also dropped (so its state is NULL).
-    // If a thread entering arc_lookup() manages to get the object out of the hashtable
+    // If a thread entering arc_lookup() manages to get the object out of the index
     // before it's being deleted it will try putting the object to the mfu list without checking first
     // if it was already in a list or not (new objects should be first moved to the 
     // mru list and not the mfu one)
@@ -254,6 +753,11 @@ arc_move(arc_t *cache, arc_object_t *obj, arc_state_t *state)
         return 0;
     }
 
+    // an object hit while a prefix is being removed might move past the
+    // marker of the walk (or to a list already visited), so it's dropped here
+    if (UNLIKELY(cache->removals != NULL) && state && obj_state && arc_prefix_removing(cache, obj))
+        state = NULL;
+
     if (LIKELY(obj_state != NULL)) {
 
         if (LIKELY(obj_state == state)) {
@@ -265,6 +769,15 @@ arc_move(arc_t *cache, arc_object_t *obj, arc_state_t *state)
             return 0;
         }
 
+        if (UNLIKELY(obj_state == &cache->large && state != NULL)) {
+            // objects in the large pool don't move across the lists,
+            // a hit just refreshes their position in the pool
+            if (LIKELY(obj_state->head.next != &obj->head))
+                arc_list_move_to_head(&obj->head, &obj_state->head);
+            MUTEX_UNLOCK(&cache->lock);
+            return 0;
+        }
+
         // if the state is not NULL
         // (and the object is not going to be being removed)
         // move the ^ (p) marker
@@ -289,8 +802,10 @@ arc_move(arc_t *cache, arc_object_t *obj, arc_state_t *state)
     }
 
     if (state == NULL) {
-        if (ht_delete_if_equals(cache->hash, (void *)obj->key, obj->klen, obj, sizeof(arc_object_t)) == 0)
-            release_ref(cache->refcnt, obj->node);
+        if (arc_index_delete_if_equals(cache->index, obj->key, obj->klen, obj->hash, obj) == 0) {
+            obj->unlinked = 1;
+            arc_object_unlink(cache, obj);
+        }
     } else if (state == &cache->mrug || state == &cache->mfug) {
         obj->async = 0;
         arc_list_prepend(&obj->head, &state->head);
@@ -311,21 +826,36 @@ arc_move(arc_t *cache, arc_object_t *obj, arc_state_t *state)
             case 1:
             case -1:
             {
-                if (ht_delete_if_equals(cache->hash, (void *)obj->key, obj->klen, obj, sizeof(arc_object_t)) == 0)
-                    release_ref(cache->refcnt, obj->node);
+                if (arc_index_delete_if_equals(cache->index, obj->key, obj->klen, obj->hash, obj) == 0) {
+                    obj->unlinked = 1;
+                    arc_object_unlink(cache, obj);
+                }
                 return rc;
             }
             default:
             {
-                if (size >= cache->c) {
+                int large = (cache->large_threshold && size >= cache->large_threshold);
+                if (size >= (large ? cache->large_c : cache->c)) {
                     // the (single) object doesn't fit in the cache, let's return it
                     // to the getter without (re)adding it to the cache
-                    if (ht_delete_if_equals(cache->hash, (void *)obj->key, obj->klen, obj, sizeof(arc_object_t)) == 0)
-                        release_ref(cache->refcnt, obj->node);
+                    if (arc_index_delete_if_equals(cache->index, obj->key, obj->klen, obj->hash, obj) == 0) {
+                        obj->unlinked = 1;
+                        arc_object_unlink(cache, obj);
+                    }
                     return 1;
                 }
                 MUTEX_LOCK(&cache->lock);
+                if (UNLIKELY(obj->unlinked)) {
+                    // the object has been removed from the cache before
+                    // we started fetching it, return it to the getter
+                    // without adding it to any list
+                    obj->locked = 0;
+                    MUTEX_UNLOCK(&cache->lock);
+                    return 1;
+                }
                 obj->size = ARC_OBJ_BASE_SIZE(obj) + cache->cos + size;
+                if (large)
+                    state = &cache->large;
                 arc_list_prepend(&obj->head, &state->head);
                 ATOMIC_INCREMENT(state->count);
                 ATOMIC_SET(obj->state, state);
@@ -380,14 +910,17 @@ terminate_node_callback(refcnt_node_t *node, void *priv)
 
 /* Create a new cache. */
 arc_t *
-arc_create(arc_ops_t *ops, size_t c, size_t cached_object_size, size_t *lists_size[4], int loose_mode)
+arc_create(arc_ops_t *ops,
+           size_t c,
+           size_t cached_object_size,
+           size_t *lists_size[5],
+           int loose_mode,
+           int reclaim_mode)
 {
     arc_t *cache = calloc(1, sizeof(arc_t));
 
     cache->ops = ops;
 
-    cache->hash = ht_create(1<<16, 1<<22, NULL);
-
     cache->c = c >> 1;
     cache->p = cache->c >> 1;
     cache->cos = cached_object_size;
@@ -396,15 +929,39 @@ arc_create(arc_ops_t *ops, size_t c, size_t cached_object_size, size_t *lists_si
     arc_list_init(&cache->mru.head);
     arc_list_init(&cache->mfu.head);
     arc_list_init(&cache->mfug.head);
+    arc_list_init(&cache->large.head);
 
     lists_size[0] = &cache->mru.size;
     lists_size[1] = &cache->mfu.size;
     lists_size[2] = &cache->mrug.size;
     lists_size[3] = &cache->mfug.size;
+    lists_size[4] = &cache->large.size;
 
     MUTEX_INIT_RECURSIVE(&cache->lock);
 
-    cache->refcnt = refcnt_create(1<<8, terminate_node_callback, free_node_ptr_callback);
+    cache->loose_mode = loose_mode;
+    cache->reclaim_mode = reclaim_mode;
+    if (reclaim_mode == ARC_RECLAIM_EPOCH) {
+        cache->epoch = 1;
+        cache->reclaim_at = ARC_EPOCH_RECLAIM_THRESHOLD;
+        if (arc_epoch_register(cache) != 0) {
+            MUTEX_DESTROY(&cache->lock);
+            free(cache);
+            return NULL;
+        }
+    } else {
+        cache->refcnt = refcnt_create(1<<8, terminate_node_callback, free_node_ptr_callback);
+    }
+
+    // size the index for the number of objects we expect to hold, it will
+    // grow incrementally if needed. In refcnt mode all the lookups lock the
+    // key in the index, so the tables replaced by a resize can be released
+    // right away, while in epoch mode they need to be retired
+    size_t size_hint = MIN(c / (sizeof(arc_object_t) + cached_object_size), 1<<16);
+    cache->index = arc_index_create(size_hint,
+                                    arc_object_match,
+                                    reclaim_mode == ARC_RECLAIM_EPOCH ? arc_epoch_retire_mem : NULL,
+                                    cache);
     return cache;
 }
 
@@ -416,71 +973,106 @@ arc_destroy(arc_t *cache)
     arc_list_destroy(cache, &cache->mru.head);
     arc_list_destroy(cache, &cache->mfu.head);
     arc_list_destroy(cache, &cache->mfug.head);
-    ht_destroy(cache->hash);
-    refcnt_destroy(cache->refcnt);
+    arc_list_destroy(cache, &cache->large.head);
+    arc_index_destroy(cache->index);
+    if (cache->reclaim_mode == ARC_RECLAIM_EPOCH) {
+        // nobody can be referencing the objects anymore
+        arc_epoch_free_list(cache, cache->retired);
+        while (cache->retired_mem) {
+            arc_retired_mem_t *next = cache->retired_mem->next;
+            free(cache->retired_mem->ptr);
+            free(cache->retired_mem);
+            cache->retired_mem = next;
+        }
+        arc_epoch_unregister(cache);
+        while (cache->epoch_slots) {
+            arc_epoch_slot_t *next = cache->epoch_slots->next;
+            free(cache->epoch_slots);
+            cache->epoch_slots = next;
+        }
+    } else {
+        refcnt_destroy(cache->refcnt);
+    }
     MUTEX_DESTROY(&cache->lock);
     free(cache);
 }
 
-static void *
-retain_obj_cb(void *data, size_t dlen, void *user)
-{
-    retain_ref(((arc_t *)user)->refcnt, ((arc_object_t *)data)->node);
-    return data;
-}
-
 void
 arc_drop_resource(arc_t *cache, arc_resource_t res)
 {
-    arc_object_t *obj = (arc_object_t *)res;
+    arc_object_t *obj = ARC_RESOURCE_OBJ(res);
     if (obj) {
         arc_move(cache, obj, NULL);
-        release_ref(cache->refcnt, obj->node);
+        arc_release_resource(cache, res);
     }
 }
 
+uint64_t
+arc_hash_key(const void *key, size_t len)
+{
+    return arc_index_hash(key, len);
+}
+
 void
-arc_remove(arc_t *cache, const void *key, size_t len)
+arc_remove(arc_t *cache, const void *key, size_t len, uint64_t hash)
 {
-    arc_object_t *obj = ht_get_deep_copy(cache->hash, (void *)key, len, NULL, retain_obj_cb, cache);
+    arc_pin(cache);
+    arc_object_t *obj = arc_object_get(cache, key, len, hash);
     if (obj) {
         arc_move(cache, obj, NULL);
-        release_ref(cache->refcnt, obj->node);
+        arc_object_release(cache, obj);
+    } else {
+        arc_unpin(cache);
     }
 }
 
-/* Lookup an object with the given key. */
+/* Release a resource previously obtained via arc_lookup() or arc_retain_resource() */
 void
 arc_release_resource(arc_t *cache, arc_resource_t res)
 {
-    arc_object_t *obj = (arc_object_t *)res;
-    release_ref(cache->refcnt, obj->node);
+    arc_object_t *obj = ARC_RESOURCE_OBJ(res);
+    if (ARC_RESOURCE_IS_RETAINED(res)) {
+        // a long-lived reference, the object will be released by the
+        // reclaimer once retired and not referenced anymore
+        ATOMIC_DECREMENT(obj->refs);
+        return;
+    }
+    arc_object_release(cache, obj);
 }
 
-/* Lookup an object with the given key. */
-void
+/* Retain a resource so that it can be referenced beyond the scope of the
+ * current thread (and released by any thread) */
+arc_resource_t
 arc_retain_resource(arc_t *cache, arc_resource_t res)
 {
-    arc_object_t *obj = (arc_object_t *)res;
+    arc_object_t *obj = ARC_RESOURCE_OBJ(res);
+
+    if (cache->reclaim_mode == ARC_RECLAIM_EPOCH) {
+        ATOMIC_INCREMENT(obj->refs);
+        return (arc_resource_t)((uintptr_t)obj | ARC_RESOURCE_RETAINED_FLAG);
+    }
 
     retain_ref(cache->refcnt, obj->node);
+    return obj;
 }
 
 /* Initialize a new object with this function. */
 static inline arc_object_t *
-arc_object_create(arc_t *cache, const void *key, size_t len)
+arc_object_create(arc_t *cache, const void *key, size_t len, uint64_t hash)
 {
     arc_object_t *obj = calloc(1, sizeof(arc_object_t) + cache->cos);
 
     arc_list_init(&obj->head);
 
-    obj->node = new_node(cache->refcnt, obj, cache);
+    if (cache->reclaim_mode == ARC_RECLAIM_REFCNT)
+        obj->node = new_node(cache->refcnt, obj, cache);
     if (len > sizeof(obj->buf))
         obj->key = malloc(len);
     else
         obj->key = obj->buf;
     memcpy(obj->key, key, len);
     obj->klen = len;
+    obj->hash = hash;
 
     obj->size = ARC_OBJ_BASE_SIZE(obj) + cache->cos;
 
@@ -491,16 +1083,16 @@ arc_object_create(arc_t *cache, const void *key, size_t len)
 
 // the returned object is retained, the caller must call arc_release_resource(obj) to release it
 arc_resource_t 
-arc_lookup(arc_t *cache, const void *key, size_t len, void **valuep, int async)
+arc_lookup(arc_t *cache, const void *key, size_t len, uint64_t hash, void **valuep, int async)
 {
-    // NOTE: this is an atomic operation ensured by the hashtable implementation,
-    //       we don't do any real copy in our callback but we just increase the refcount
-    //       of the object (if found)
-    arc_object_t *obj = ht_get_deep_copy(cache->hash, (void *)key, len, NULL, retain_obj_cb, cache);
+    arc_pin(cache);
+
+    arc_object_t *obj = arc_object_get(cache, key, len, hash);
     if (obj) {
         if (!cache->loose_mode || UNLIKELY(ATOMIC_READ(obj->state) != &cache->mfu)) {
             if (UNLIKELY(arc_move(cache, obj, &cache->mfu) == -1)) {
                 fprintf(stderr, "Can't move the object into the cache\n");
+                arc_object_release(cache, obj);
                 return NULL;
             }
         }
@@ -512,28 +1104,30 @@ arc_lookup(arc_t *cache, const void *key, size_t len, void **valuep, int async)
         return obj;
     }
 
-    obj = arc_object_create(cache, key, len);
-    if (!obj)
+    obj = arc_object_create(cache, key, len, hash);
+    if (!obj) {
+        arc_unpin(cache);
         return NULL;
+    }
 
     // let our cache user initialize the underlying object
-    cache->ops->init(key, len, async, (arc_resource_t)obj, obj->ptr, cache->ops->priv);
+    cache->ops->init(key, len, hash, async, (arc_resource_t)obj, obj->ptr, cache->ops->priv);
     obj->async = async;
 
-    retain_ref(cache->refcnt, obj->node);
-    // NOTE: atomicity here is ensured by the hashtable implementation
-    int rc = ht_set_if_not_exists(cache->hash, (void *)key, len, obj, sizeof(arc_object_t));
+    arc_object_retain(cache, obj);
+    // NOTE: atomicity here is ensured by the index implementation
+    int rc = arc_index_set_if_not_exists(cache->index, key, len, hash, obj);
     switch(rc) {
         case -1:
-            fprintf(stderr, "Can't set the new value in the internal hashtable\n");
-            release_ref(cache->refcnt, obj->node);
+            fprintf(stderr, "Can't set the new value in the internal index\n");
+            arc_object_discard(cache, obj);
             break;
         case 1:
             // the object has been created in the meanwhile
-            release_ref(cache->refcnt, obj->node);
+            arc_object_discard(cache, obj);
             // XXX - yes, we have to release it twice
-            release_ref(cache->refcnt, obj->node);
-            return arc_lookup(cache, key, len, valuep, async);
+            arc_object_release(cache, obj);
+            return arc_lookup(cache, key, len, hash, valuep, async);
         case 0:
             /* New objects are always moved to the MRU list. */
             rc  = arc_move(cache, obj, &cache->mru);
@@ -544,71 +1138,72 @@ arc_lookup(arc_t *cache, const void *key, size_t len, void **valuep, int async)
             }
             break;
         default:
-            fprintf(stderr, "Unknown return code from ht_set_if_not_exists() : %d\n", rc);
-            release_ref(cache->refcnt, obj->node);
+            fprintf(stderr, "Unknown return code from arc_index_set_if_not_exists() : %d\n", rc);
+            arc_object_discard(cache, obj);
             break;
     } 
-    release_ref(cache->refcnt, obj->node);
+    arc_object_release(cache, obj);
     return NULL;
 }
 
-static void *
-update_obj_cb(void *data, size_t dlen, void *user)
-{
-    arc_object_t *obj = (arc_object_t *)data;
-    arc_t *cache = (arc_t *)user;
-    cache->ops->store(obj->ptr, data, dlen, cache->ops->priv);
-    //retain_ref(cache->refcnt, obj->node);
-    return data;
-}
-
 int
-arc_load(arc_t *cache, const void *key, size_t klen, void *valuep, size_t vlen)
+arc_load(arc_t *cache, const void *key, size_t klen, uint64_t hash, void *valuep, size_t vlen)
 {
-    arc_object_t *obj = ht_get_deep_copy(cache->hash, (void *)key, klen, NULL, update_obj_cb, cache);
+    arc_pin(cache);
+    arc_object_t *obj = arc_object_get(cache, key, klen, hash);
     if (obj) {
-        //release_ref(cache->refcnt, obj->node);
+        // the object is referenced (not locked in the index) while
+        // the value is stored, the store callback does its own locking
+        cache->ops->store(obj->ptr, valuep, vlen, cache->ops->priv);
+        arc_object_release(cache, obj);
         return 1;
     }
 
-    obj = arc_object_create(cache, key, klen);
-    if (!obj)
+    obj = arc_object_create(cache, key, klen, hash);
+    if (!obj) {
+        arc_unpin(cache);
         return -1;
+    }
 
     // let our cache user initialize the underlying object
-    cache->ops->init(key, klen, 0, (arc_resource_t)obj, obj->ptr, cache->ops->priv);
+    cache->ops->init(key, klen, hash, 0, (arc_resource_t)obj, obj->ptr, cache->ops->priv);
     cache->ops->store(obj->ptr, valuep, vlen, cache->ops->priv);
 
-    retain_ref(cache->refcnt, obj->node);
-    // NOTE: atomicity here is ensured by the hashtable implementation
-    int rc = ht_set_if_not_exists(cache->hash, (void *)key, klen, obj, sizeof(arc_object_t));
+    arc_object_retain(cache, obj);
+    // NOTE: atomicity here is ensured by the index implementation
+    int rc = arc_index_set_if_not_exists(cache->index, key, klen, hash, obj);
     switch(rc) {
         case -1:
-            fprintf(stderr, "Can't set the new value in the internal hashtable\n");
-            release_ref(cache->refcnt, obj->node);
+            fprintf(stderr, "Can't set the new value in the internal index\n");
+            arc_object_discard(cache, obj);
             break;
         case 1:
             // the object has been created in the meanwhile
-            release_ref(cache->refcnt, obj->node);
+            arc_object_discard(cache, obj);
             // XXX - yes, we have to release it twice
-            release_ref(cache->refcnt, obj->node);
-            return arc_load(cache, key, klen, valuep, vlen);
+            arc_object_release(cache, obj);
+            return arc_load(cache, key, klen, hash, valuep, vlen);
         case 0:
+            // the loaded object is put in the mru list as if it was
+            // just fetched, so that it's accounted and can be evicted
+            if (arc_move(cache, obj, &cache->mru) == 0)
+                arc_balance(cache);
             break;
         default:
-            fprintf(stderr, "Unknown return code from ht_set_if_not_exists() : %d\n", rc);
-            release_ref(cache->refcnt, obj->node);
+            fprintf(stderr, "Unknown return code from arc_index_set_if_not_exists() : %d\n", rc);
+            arc_object_discard(cache, obj);
             rc = -1;
     }
 
-    release_ref(cache->refcnt, obj->node);
+    arc_object_release(cache, obj);
     return rc;
 }
 
 size_t
 arc_size(arc_t *cache)
 {
-    return ATOMIC_READ(cache->mru.size) + ATOMIC_READ(cache->mfu.size);
+    return ATOMIC_READ(cache->mru.size) + ATOMIC_READ(cache->mfu.size) +
+           ATOMIC_READ(cache->large.size);
 }
 
 size_t
@@ -623,6 +1218,18 @@ arc_mfu_size(arc_t *cache)
     return ATOMIC_READ(cache->mfu.size);
 }
 
+size_t
+arc_large_size(arc_t *cache)
+{
+    return ATOMIC_READ(cache->large.size);
+}
+
+uint64_t
+arc_large_count(arc_t *cache)
+{
+    return ATOMIC_READ(cache->large.count);
+}
+
 size_t
 arc_mrug_size(arc_t *cache)
 {
@@ -648,13 +1255,129 @@ uint64_t
 arc_count(arc_t *cache)
 {
     return ATOMIC_READ(cache->mru.count) + ATOMIC_READ(cache->mfu.count) +
-           ATOMIC_READ(cache->mrug.count) + ATOMIC_READ(cache->mfug.count);
+           ATOMIC_READ(cache->mrug.count) + ATOMIC_READ(cache->mfug.count) +
+           ATOMIC_READ(cache->large.count);
+}
+
+void
+arc_set_size(arc_t *cache, size_t c)
+{
+    MUTEX_LOCK(&cache->lock);
+    // half of the budget goes to the ghost lists (as in arc_create())
+    cache->c = c >> 1;
+    if (cache->p > cache->c)
+        cache->p = cache->c >> 1;
+    // evict the exceeding objects on the next access
+    ATOMIC_INCREMENT(cache->needs_balance);
+    MUTEX_UNLOCK(&cache->lock);
+}
+
+void
+arc_set_large_pool(arc_t *cache, size_t threshold, size_t size)
+{
+    MUTEX_LOCK(&cache->lock);
+    cache->large_threshold = threshold;
+    cache->large_c = threshold ? size : 0;
+    // shrink the pool, if necessary, on the next access
+    ATOMIC_INCREMENT(cache->needs_balance);
+    MUTEX_UNLOCK(&cache->lock);
+}
+
+int
+arc_foreach_mfu(arc_t *cache, int max, arc_foreach_callback_t cb, void *priv)
+{
+    if (max <= 0)
+        return 0;
+
+    arc_resource_t *objs = malloc(sizeof(arc_resource_t) * max);
+    int count = 0;
+
+    // objects in the lists are referenced by the index,
+    // so they can be safely retained while the lists are locked
+    MUTEX_LOCK(&cache->lock);
+    arc_list_t *pos;
+    arc_list_each(pos, &cache->mfu.head) {
+        if (count == max)
+            break;
+        arc_object_t *obj = arc_list_entry(pos, arc_object_t, head);
+        if (obj->marker)
+            continue;
+        objs[count++] = arc_retain_resource(cache, obj);
+    }
+    MUTEX_UNLOCK(&cache->lock);
+
+    int i;
+    int stop = 0;
+    for (i = 0; i < count; i++) {
+        arc_object_t *obj = ARC_RESOURCE_OBJ(objs[i]);
+        if (!stop && cb(obj->key, obj->klen, obj->hash, objs[i], priv) != 0)
+            stop = 1;
+        arc_release_resource(cache, objs[i]);
+    }
+
+    free(objs);
+    return count;
+}
+
+int
+arc_remove_prefix(arc_t *cache, const void *prefix, size_t plen)
+{
+    arc_state_t *states[] = { &cache->mru, &cache->mfu, &cache->mrug, &cache->mfug, &cache->large };
+    arc_prefix_removal_t removal = { prefix, plen, NULL };
+    int removed = 0;
+    int i;
+
+    // the lists are walked in batches, releasing the lock in between so that
+    // the lookups are not stalled for the whole scan. A marker is parked in
+    // the list where the walk resumes from: objects are only inserted at the
+    // head of the lists, so the walk never visits more objects than the list
+    // was holding when it started, whatever happens while it's unlocked
+    arc_object_t marker;
+    memset(&marker, 0, sizeof(marker));
+    marker.marker = 1;
+
+    MUTEX_LOCK(&cache->lock);
+    removal.next = cache->removals;
+    cache->removals = &removal;
+
+    for (i = 0; i < sizeof(states) / sizeof(states[0]); i++) {
+        uint64_t budget = ATOMIC_READ(states[i]->count);
+        int visited = 0;
+        arc_list_t *pos = states[i]->head.next;
+        while (pos && pos != &states[i]->head && budget) {
+            arc_object_t *obj = arc_list_entry(pos, arc_object_t, head);
+            // arc_move() is going to unlink the object from the list
+            pos = pos->next;
+            if (obj->marker) // parked by a concurrent removal
+                continue;
+            budget--;
+            if (obj->klen >= plen && memcmp(obj->key, prefix, plen) == 0) {
+                arc_move(cache, obj, NULL);
+                removed++;
+            }
+            if (++visited % ARC_REMOVE_PREFIX_BATCH == 0 && pos != &states[i]->head) {
+                arc_list_insert(&marker.head, pos->prev, pos);
+                MUTEX_UNLOCK(&cache->lock);
+                MUTEX_LOCK(&cache->lock);
+                pos = marker.head.next;
+                arc_list_remove(&marker.head);
+            }
+        }
+    }
+
+    arc_prefix_removal_t **prev = &cache->removals;
+    while (*prev != &removal)
+        prev = &(*prev)->next;
+    *prev = removal.next;
+    MUTEX_UNLOCK(&cache->lock);
+
+    return removed;
 }
 
 void *
 arc_get_resource_ptr(arc_resource_t res)
 {
-    return ((arc_object_t *)res)->ptr;
+    return ARC_RESOURCE_OBJ(res)->ptr;
 }
 
 // vim: tabstop=4 shiftwidth=4 expandtab:
@@ -8,20 +8,44 @@
 #ifndef __ARC_H__
 #define __ARC_H__
 #include <sys/types.h>
+#include <stdint.h>
 
 typedef struct __arc arc_t;
 
 typedef void * arc_resource_t;
 
+/**
+ * @brief Reclamation modes for the cached objects
+ *
+ * ARC_RECLAIM_REFCNT : each reference to an object (including the ones
+ *                      taken by arc_lookup()) is counted on its refcnt node
+ *                      and the object is released by the refcnt garbage
+ *                      collector once not referenced anymore.
+ *                      Lookups briefly lock the index stripe of the key
+ *                      to retain the object
+ *
+ * ARC_RECLAIM_EPOCH  : lookups don't take any lock, they only pin a
+ *                      per-thread epoch, objects removed from the cache
+ *                      are released once all the threads have moved past
+ *                      the epoch in which they have been removed.
+ *                      Resources returned by arc_lookup() are bound to the
+ *                      calling thread and MUST be released by the same thread,
+ *                      arc_retain_resource() must be used to obtain a resource
+ *                      which can be released by a different thread
+ */
+#define ARC_RECLAIM_REFCNT 0
+#define ARC_RECLAIM_EPOCH  1
+
 typedef struct __arc_ops {
     /**
      * @brief Initialize a new object.
      *
      * The size of the new object has been provided to arc_create()
      * ptr will point to a prealloc'd memory where the cached object is stored
-     * and needs to be initialized by this callback
+     * and needs to be initialized by this callback.
+     * hash is the one the object is indexed by (as returned by arc_hash_key())
      */
-    void (*init) (const void *key, size_t klen, int async, arc_resource_t res, void *ptr, void *priv);
+    void (*init) (const void *key, size_t klen, uint64_t hash, int async, arc_resource_t res, void *ptr, void *priv);
     
     /**
      * @brief Fetch the data associated with the object.
@@ -41,7 +65,17 @@ typedef struct __arc_ops {
      * The callback CAN free all data associated with the object and the object itself
      */
     void (*evict) (void *obj, void *priv);
-    
+
+    /**
+     * @brief This function (optional) is called when an object is being
+     * dropped from the cache to make room for new ones (as opposed to being
+     * explicitly removed) so that it can be moved to a slower tier.
+     *
+     * The object is still valid while the callback runs and the cache
+     * is not locked
+     */
+    void (*demote) (void *obj, void *priv);
+
     //! Pointer to private data which will provided to all callbacks
     void *priv;
 } arc_ops_t;
@@ -49,11 +83,18 @@ typedef struct __arc_ops {
 /**
  * @brief Create an ARC cache instance
  *
- * @param ops : A valid pointer to an initialized arc_ops_t structure
- * @param c   : The size of the cache
- * @return    : A valid pointer to an initialized arc_t structure
+ * @param ops          : A valid pointer to an initialized arc_ops_t structure
+ * @param c            : The size of the cache
+ * @param reclaim_mode : The reclamation mode (ARC_RECLAIM_REFCNT or ARC_RECLAIM_EPOCH)
+ * @return    : A valid pointer to an initialized arc_t structure,
+ *              NULL if the epoch tracking can't be set up
  */
-arc_t *arc_create(arc_ops_t *ops, size_t c, size_t cached_object_size, size_t *lists_size[4], int loose_mode);
+arc_t *arc_create(arc_ops_t *ops,
+                  size_t c,
+                  size_t cached_object_size,
+                  size_t *lists_size[5],
+                  int loose_mode,
+                  int reclaim_mode);
 
 /**
  * @brief Release an existing ARC cache instance
@@ -61,6 +102,17 @@ arc_t *arc_create(arc_ops_t *ops, size_t c, size_t cached_object_size, size_t *l
  */
 void arc_destroy(arc_t *cache);
 
+/**
+ * @brief Compute the hash of a key as expected by arc_lookup(),
+ *        arc_load() and arc_remove()
+ * @note Callers doing more than one operation on the same key
+ *       should compute the hash once and reuse it
+ * @param key    : The key
+ * @param klen   : The length of the key
+ * @return The 64bit hash of the key
+ */
+uint64_t arc_hash_key(const void *key, size_t klen);
+
 /**
  * @brief Lookup an object in the cache.
  *
@@ -70,6 +122,7 @@ void arc_destroy(arc_t *cache);
  * @param cache  : A valid pointer to an initialized arc_t structure
  * @param key    : The key
  * @param klen   : The length of the key
+ * @param hash   : The hash of the key (as returned by arc_hash_key())
  * @param valuep : a reference to the pointer where to copy the retrieved value
  * @return An opaque ARC resource which needs to be released using arc_release_resource()
  *         once the object is not going to be referenced anymore
@@ -78,16 +131,42 @@ void arc_destroy(arc_t *cache);
  *       a cached object (which is contained in an ARC resource) it will be retained until
  *       the caller releases it using the arc_release_resource() function
  */
-arc_resource_t arc_lookup(arc_t *cache, const void *key, size_t klen, void **valuep, int async);
+arc_resource_t arc_lookup(arc_t *cache, const void *key, size_t klen, uint64_t hash, void **valuep, int async);
 
-int arc_load(arc_t *cache, const void *key, size_t klen, void *valuep, size_t vlen);
+int arc_load(arc_t *cache, const void *key, size_t klen, uint64_t hash, void *valuep, size_t vlen);
+
+/**
+ * @brief Callback called by arc_foreach_mfu() for each visited object
+ * @param key    : The key of the object
+ * @param klen   : The length of the key
+ * @param hash   : The hash of the key
+ * @param res    : The (retained) ARC resource holding the object
+ * @param priv   : The private pointer passed to arc_foreach_mfu()
+ * @return 0 to go ahead, -1 to stop the iteration
+ */
+typedef int (*arc_foreach_callback_t)(const void *key, size_t klen, uint64_t hash, arc_resource_t res, void *priv);
+
+/**
+ * @brief Walk the objects in the mfu list, starting from the most recently used
+ * @param cache  : A valid pointer to an initialized arc_t structure
+ * @param max    : The maximum number of objects to visit
+ * @param cb     : The callback to call for each object
+ * @param priv   : A private pointer passed to the callback
+ * @return The number of objects collected from the mfu list
+ * @note The objects are retained while the list is locked and the callback
+ *       is called once the lock has been released, so it's safe to access
+ *       the objects (through arc_get_resource_ptr()) from the callback
+ */
+int arc_foreach_mfu(arc_t *cache, int max, arc_foreach_callback_t cb, void *priv);
 
 /**
  * @brief Release the resource previously alloc'd by arc_lookup()
+ *        or arc_retain_resource()
  * @note  The retain count will be decreased by 1.\nThe underlying
  *        resources will be free'd if the retain reaches 0
  * @param cache  : A valid pointer to an initialized arc_t structure
  * @param res    : An opaque ARC resource previously returned by arc_lookup()
+ *                 or by arc_retain_resource()
  */
 void arc_release_resource(arc_t *cache, arc_resource_t res);
 
@@ -96,10 +175,11 @@ void arc_release_resource(arc_t *cache, arc_resource_t res);
  * @note  The retain count will be increased by 1
  * @param cache  : A valid pointer to an initialized arc_t structure
  * @param res    : An opaque ARC resource to retain
+ * @return The retained resource, which can be released by any thread
  * @note Retained resources MUST be released calling arc_release_resource()
- *       once it is not going to be referenced anymore
+ *       on the returned resource once it is not going to be referenced anymore
  */
-void arc_retain_resource(arc_t *cache, arc_resource_t res);
+arc_resource_t arc_retain_resource(arc_t *cache, arc_resource_t res);
 
 void arc_drop_resource(arc_t *cache, arc_resource_t res);
 
@@ -112,8 +192,24 @@ void *arc_get_resource_ptr(arc_resource_t res);
  * @param cache  : A valid pointer to an initialized arc_t structure
  * @param key    : The key
  * @param klen   : The length of the key
+ * @param hash   : The hash of the key (as returned by arc_hash_key())
+ */
+void arc_remove(arc_t *cache, const void *key, size_t klen, uint64_t hash);
+
+/**
+ * @brief Remove all the items whose key starts with the given prefix
+ * @note the items are completely removed from the cache (as by arc_remove()),
+ *       items being fetched while the lists are visited are not affected
+ * @note the lists are visited in batches, releasing the cache lock in between,
+ *       so items added while the prefix is being removed might be kept.
+ *       Items hit meanwhile are dropped as soon as they are moved, the
+ *       walk visits each item at most once per list
+ * @param cache  : A valid pointer to an initialized arc_t structure
+ * @param prefix : The prefix
+ * @param plen   : The length of the prefix
+ * @return The number of removed items
  */
-void arc_remove(arc_t *cache, const void *key, size_t klen);
+int arc_remove_prefix(arc_t *cache, const void *prefix, size_t plen);
 
 /**
  * @brief Force eviction of an item which, if in the mru or mfu list,
@@ -167,6 +263,46 @@ size_t arc_mrug_size(arc_t *cache);
  */
 size_t arc_mfug_size(arc_t *cache);
 
+/**
+ * @brief Returns the size of the large objects pool
+ * @param cache  : A valid pointer to an initialized arc_t structure
+ * @return The actual size of the large objects pool
+ */
+size_t arc_large_size(arc_t *cache);
+
+/**
+ * @brief Returns the number of objects in the large objects pool
+ * @param cache  : A valid pointer to an initialized arc_t structure
+ * @return The number of objects in the large objects pool
+ */
+uint64_t arc_large_count(arc_t *cache);
+
+/**
+ * @brief Change the size of the cache
+ * @param cache  : A valid pointer to an initialized arc_t structure
+ * @param c      : The new size (as provided to arc_create())
+ * @note If the cache shrinks the exceeding objects are evicted
+ *       on the next access
+ */
+void arc_set_size(arc_t *cache, size_t c);
+
+/**
+ * @brief Configure the pool for the large objects
+ *
+ * Objects whose size is greater or equal to the threshold are not put
+ * in the mru/mfu lists but in a separate pool with its own budget
+ * (evicted in LRU order) so that a few big values can't flush the
+ * frequently accessed small ones out of the cache
+ *
+ * @param cache     : A valid pointer to an initialized arc_t structure
+ * @param threshold : The minimum size of the objects to keep in the pool
+ *                    (0 disables the pool)
+ * @param size      : The size of the pool
+ * @note The size of the pool is not accounted in the size of the cache
+ *       provided to arc_create()
+ */
+void arc_set_large_pool(arc_t *cache, size_t threshold, size_t size);
+
 /**
  * @brief Get the size for all the lists at once
  * @param cache  : A valid pointer to an initialized arc_t structure
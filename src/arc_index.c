@@ -0,0 +1,563 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic_defs.h>
+
+#include "arc_index.h"
+
+#ifndef LIKELY
+#define LIKELY(__e) __builtin_expect((__e), 1)
+#endif
+#ifndef UNLIKELY
+#define UNLIKELY(__e) __builtin_expect((__e), 0)
+#endif
+
+#define ARC_INDEX_GROUP_SIZE 8
+#define ARC_INDEX_MIN_GROUPS 64
+#define ARC_INDEX_NUM_STRIPES 1024
+// number of groups migrated by each writer while a resize is in progress
+#define ARC_INDEX_MIGRATE_STEP 4
+
+#define ARC_INDEX_TAG_EMPTY   0x00
+#define ARC_INDEX_TAG_DELETED 0x01
+#define ARC_INDEX_TAG_FULL    0x80
+#define ARC_INDEX_TAG(__h) (ARC_INDEX_TAG_FULL | ((__h) & 0x7f))
+
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_LOW7 0x7f7f7f7f7f7f7f7fULL
+
+// tag bytes are stored in memory order, so the index of the byte
+// in the group depends on the endianness
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SWAR_INDEX(__m) (7 - (__builtin_ctzll(__m) >> 3))
+#else
+#define SWAR_INDEX(__m) (__builtin_ctzll(__m) >> 3)
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#define ARC_INDEX_CPU_RELAX() __asm__ __volatile__("pause")
+#else
+#define ARC_INDEX_CPU_RELAX()
+#endif
+
+#define LOAD_ACQUIRE(__p) __atomic_load_n(&(__p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(__p, __v) __atomic_store_n(&(__p), (__v), __ATOMIC_RELEASE)
+
+typedef struct {
+    uint64_t hash;
+    void *value;
+} arc_index_entry_t;
+
+typedef struct {
+    union {
+        uint64_t word;
+        uint8_t bytes[ARC_INDEX_GROUP_SIZE];
+    } tags;
+    arc_index_entry_t entries[ARC_INDEX_GROUP_SIZE];
+} arc_index_group_t;
+
+typedef struct {
+    size_t num_groups; // always a power of 2
+    size_t mask;
+    arc_index_group_t groups[];
+} arc_index_table_t;
+
+typedef struct {
+    int lock;
+    char pad[60];
+} arc_index_stripe_t;
+
+struct __arc_index {
+    arc_index_table_t *table;     // where new items are inserted
+    arc_index_table_t *old_table; // the table being migrated (if any)
+    uint64_t generation;          // incremented each time the tables are swapped
+    size_t used;                  // slots of the current table claimed at least once
+    size_t max_used;              // resize threshold for the current table
+    size_t migrate_next;
+    size_t migrated;
+    int migrators;
+    size_t count;
+    int resizing;
+    arc_index_match_callback_t match;
+    arc_index_free_callback_t free_table;
+    void *priv;
+    arc_index_stripe_t stripes[ARC_INDEX_NUM_STRIPES];
+};
+
+/*
+ * Returns a word with the high bit set in each byte of 'word' equal to 'byte'
+ * (exact, no false positives caused by the borrow propagation)
+ */
+static inline uint64_t
+swar_match(uint64_t word, uint8_t byte)
+{
+    uint64_t x = word ^ (SWAR_ONES * byte);
+    return ~(((x & SWAR_LOW7) + SWAR_LOW7) | x | SWAR_LOW7);
+}
+
+static inline arc_index_stripe_t *
+arc_index_stripe(arc_index_t *index, uint64_t hash)
+{
+    return &index->stripes[(hash >> 32) & (ARC_INDEX_NUM_STRIPES - 1)];
+}
+
+static inline void
+arc_index_stripe_lock(arc_index_stripe_t *stripe)
+{
+    while (__sync_lock_test_and_set(&stripe->lock, 1)) {
+        while (*(volatile int *)&stripe->lock)
+            ARC_INDEX_CPU_RELAX();
+    }
+}
+
+static inline void
+arc_index_stripe_unlock(arc_index_stripe_t *stripe)
+{
+    __sync_lock_release(&stripe->lock);
+}
+
+static void
+arc_index_lock_all(arc_index_t *index)
+{
+    int i;
+    for (i = 0; i < ARC_INDEX_NUM_STRIPES; i++)
+        arc_index_stripe_lock(&index->stripes[i]);
+}
+
+static void
+arc_index_unlock_all(arc_index_t *index)
+{
+    int i;
+    for (i = ARC_INDEX_NUM_STRIPES - 1; i >= 0; i--)
+        arc_index_stripe_unlock(&index->stripes[i]);
+}
+
+static arc_index_table_t *
+arc_index_table_create(size_t num_groups)
+{
+    arc_index_table_t *table = calloc(1, sizeof(arc_index_table_t) +
+                                         num_groups * sizeof(arc_index_group_t));
+    if (!table)
+        return NULL;
+    table->num_groups = num_groups;
+    table->mask = num_groups - 1;
+    return table;
+}
+
+static inline size_t
+arc_index_table_size(arc_index_table_t *table)
+{
+    return sizeof(arc_index_table_t) + table->num_groups * sizeof(arc_index_group_t);
+}
+
+/*
+ * A group terminates a probe sequence if it contains a slot which
+ * has never been claimed (slots claimed at least once become DELETED
+ * when removed, so they never terminate a probe)
+ */
+static inline int
+arc_index_group_has_free_slot(arc_index_group_t *group, uint64_t word)
+{
+    uint64_t m = swar_match(word, ARC_INDEX_TAG_EMPTY);
+    while (m) {
+        int idx = SWAR_INDEX(m);
+        // the tag must be checked again after the value, the slot might
+        // have been claimed and released since 'word' has been loaded
+        if (!LOAD_ACQUIRE(group->entries[idx].value) &&
+            LOAD_ACQUIRE(group->tags.bytes[idx]) == ARC_INDEX_TAG_EMPTY)
+        {
+            return 1;
+        }
+        m &= m - 1;
+    }
+    return 0;
+}
+
+static inline arc_index_entry_t *
+arc_index_table_find(arc_index_t *index,
+                     arc_index_table_t *table,
+                     const void *key,
+                     size_t klen,
+                     uint64_t hash,
+                     arc_index_group_t **groupp,
+                     void **valuep)
+{
+    uint8_t tag = ARC_INDEX_TAG(hash);
+    size_t g = (hash >> 7) & table->mask;
+    size_t i;
+
+    for (i = 0; i <= table->mask; i++) {
+        arc_index_group_t *group = &table->groups[g];
+        uint64_t word = LOAD_ACQUIRE(group->tags.word);
+        uint64_t m = swar_match(word, tag);
+        while (m) {
+            arc_index_entry_t *entry = &group->entries[SWAR_INDEX(m)];
+            void *value = LOAD_ACQUIRE(entry->value);
+            if (value && entry->hash == hash && index->match(value, key, klen, index->priv)) {
+                if (groupp)
+                    *groupp = group;
+                *valuep = value;
+                return entry;
+            }
+            m &= m - 1;
+        }
+        if (LIKELY(arc_index_group_has_free_slot(group, word)))
+            break;
+        g = (g + i + 1) & table->mask; // triangular probing
+    }
+    return NULL;
+}
+
+// NOTE: must be called with the stripe owning the hash locked
+//       and only on the current table
+static int
+arc_index_table_insert(arc_index_t *index, arc_index_table_t *table, uint64_t hash, void *value)
+{
+    uint8_t tag = ARC_INDEX_TAG(hash);
+    size_t g = (hash >> 7) & table->mask;
+    size_t i;
+
+    for (i = 0; i <= table->mask; i++) {
+        arc_index_group_t *group = &table->groups[g];
+        uint64_t word = LOAD_ACQUIRE(group->tags.word);
+        uint64_t m = swar_match(word, ARC_INDEX_TAG_EMPTY) |
+                     swar_match(word, ARC_INDEX_TAG_DELETED);
+        while (m) {
+            int idx = SWAR_INDEX(m);
+            arc_index_entry_t *entry = &group->entries[idx];
+            // slots are claimed by setting the value, the tag is published
+            // only once the hash is in place
+            if (__sync_bool_compare_and_swap(&entry->value, NULL, value)) {
+                int was_empty = (group->tags.bytes[idx] == ARC_INDEX_TAG_EMPTY);
+                entry->hash = hash;
+                STORE_RELEASE(group->tags.bytes[idx], tag);
+                if (was_empty)
+                    ATOMIC_INCREMENT(index->used);
+                return 0;
+            }
+            m &= m - 1;
+        }
+        g = (g + i + 1) & table->mask;
+    }
+    return -1;
+}
+
+static inline void
+arc_index_entry_clear(arc_index_group_t *group, arc_index_entry_t *entry)
+{
+    STORE_RELEASE(group->tags.bytes[entry - group->entries], ARC_INDEX_TAG_DELETED);
+    STORE_RELEASE(entry->value, NULL);
+}
+
+static void
+arc_index_finish_resize(arc_index_t *index, arc_index_table_t *old_table)
+{
+    arc_index_lock_all(index);
+    STORE_RELEASE(index->old_table, NULL);
+    ATOMIC_INCREMENT(index->generation);
+    arc_index_unlock_all(index);
+
+    // wait for other writers which might still be walking the old table
+    // (the caller is a migrator itself)
+    while (ATOMIC_READ(index->migrators) > 1)
+        ARC_INDEX_CPU_RELAX();
+
+    ATOMIC_SET(index->resizing, 0);
+
+    if (index->free_table)
+        index->free_table(old_table, index->priv);
+    else
+        free(old_table);
+}
+
+static void
+arc_index_migrate(arc_index_t *index, int steps)
+{
+    ATOMIC_INCREMENT(index->migrators);
+
+    arc_index_table_t *old_table = LOAD_ACQUIRE(index->old_table);
+
+    while (old_table && steps--) {
+        size_t g = __sync_fetch_and_add(&index->migrate_next, 1);
+        if (g >= old_table->num_groups)
+            break;
+
+        arc_index_group_t *group = &old_table->groups[g];
+        int idx;
+        for (idx = 0; idx < ARC_INDEX_GROUP_SIZE; idx++) {
+            if (!(LOAD_ACQUIRE(group->tags.bytes[idx]) & ARC_INDEX_TAG_FULL))
+                continue;
+
+            // nothing is inserted in the old table anymore, so the hash of
+            // a full slot can't change under our feet (it can only be removed)
+            arc_index_entry_t *entry = &group->entries[idx];
+            uint64_t hash = entry->hash;
+            arc_index_stripe_t *stripe = arc_index_stripe(index, hash);
+            arc_index_stripe_lock(stripe);
+            if (group->tags.bytes[idx] & ARC_INDEX_TAG_FULL) {
+                // the new table can't be full since it's at least as big as
+                // the old one and it's not going to be replaced before the
+                // migration completes
+                arc_index_table_insert(index, index->table, hash, entry->value);
+                arc_index_entry_clear(group, entry);
+            }
+            arc_index_stripe_unlock(stripe);
+        }
+
+        if (__sync_add_and_fetch(&index->migrated, 1) == old_table->num_groups) {
+            arc_index_finish_resize(index, old_table);
+            break;
+        }
+    }
+
+    ATOMIC_DECREMENT(index->migrators);
+}
+
+static inline size_t
+arc_index_max_used(size_t num_groups)
+{
+    // 7/8 max load factor
+    return ((num_groups * ARC_INDEX_GROUP_SIZE) / 8) * 7;
+}
+
+static void
+arc_index_start_resize(arc_index_t *index)
+{
+    if (!__sync_bool_compare_and_swap(&index->resizing, 0, 1))
+        return;
+
+    // the current table can't be replaced (nor released) by anyone else
+    // until we are done with the resize
+    arc_index_table_t *table = LOAD_ACQUIRE(index->table);
+    size_t num_groups = table->num_groups;
+    // if most of the used slots are tombstones there is no need to grow,
+    // rehashing at the same size is enough to get rid of them
+    if (ATOMIC_READ(index->count) >= (num_groups * ARC_INDEX_GROUP_SIZE) / 2)
+        num_groups <<= 1;
+
+    arc_index_table_t *new_table = arc_index_table_create(num_groups);
+    if (!new_table) {
+        ATOMIC_SET(index->resizing, 0);
+        return;
+    }
+
+    arc_index_lock_all(index);
+    index->migrate_next = 0;
+    index->migrated = 0;
+    index->used = 0;
+    index->max_used = arc_index_max_used(num_groups);
+    STORE_RELEASE(index->old_table, table);
+    STORE_RELEASE(index->table, new_table);
+    ATOMIC_INCREMENT(index->generation);
+    arc_index_unlock_all(index);
+}
+
+static inline void
+arc_index_maintain(arc_index_t *index)
+{
+    if (UNLIKELY(LOAD_ACQUIRE(index->old_table) != NULL)) {
+        arc_index_migrate(index, ARC_INDEX_MIGRATE_STEP);
+        return;
+    }
+
+    if (UNLIKELY(ATOMIC_READ(index->used) > ATOMIC_READ(index->max_used)))
+        arc_index_start_resize(index);
+}
+
+arc_index_t *
+arc_index_create(size_t size_hint,
+                 arc_index_match_callback_t match,
+                 arc_index_free_callback_t free_table,
+                 void *priv)
+{
+    arc_index_t *index = calloc(1, sizeof(arc_index_t));
+    if (!index)
+        return NULL;
+
+    // keep the load factor below 7/8 for the expected number of items
+    size_t num_groups = ARC_INDEX_MIN_GROUPS;
+    while (num_groups * ARC_INDEX_GROUP_SIZE * 7 < size_hint * 8)
+        num_groups <<= 1;
+
+    index->table = arc_index_table_create(num_groups);
+    if (!index->table) {
+        free(index);
+        return NULL;
+    }
+
+    index->max_used = arc_index_max_used(num_groups);
+    index->match = match;
+    index->free_table = free_table;
+    index->priv = priv;
+    return index;
+}
+
+void
+arc_index_destroy(arc_index_t *index)
+{
+    free(index->table);
+    free(index->old_table);
+    free(index);
+}
+
+/*
+ * MurmurHash64A (Austin Appleby, public domain)
+ */
+uint64_t
+arc_index_hash(const void *key, size_t klen)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    const unsigned char *data = (const unsigned char *)key;
+    const unsigned char *end = data + (klen & ~(size_t)7);
+    uint64_t h = 0x5bd1e995ULL ^ (klen * m);
+
+    while (data != end) {
+        uint64_t k;
+        memcpy(&k, data, sizeof(k));
+        data += sizeof(k);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (klen & 7) {
+        case 7: h ^= (uint64_t)data[6] << 48; // fall through
+        case 6: h ^= (uint64_t)data[5] << 40; // fall through
+        case 5: h ^= (uint64_t)data[4] << 32; // fall through
+        case 4: h ^= (uint64_t)data[3] << 24; // fall through
+        case 3: h ^= (uint64_t)data[2] << 16; // fall through
+        case 2: h ^= (uint64_t)data[1] << 8;  // fall through
+        case 1: h ^= (uint64_t)data[0];
+                h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+void *
+arc_index_get(arc_index_t *index, const void *key, size_t klen, uint64_t hash)
+{
+    for (;;) {
+        void *value = NULL;
+        uint64_t generation = LOAD_ACQUIRE(index->generation);
+        arc_index_table_t *old_table = LOAD_ACQUIRE(index->old_table);
+        arc_index_table_t *table = LOAD_ACQUIRE(index->table);
+
+        if (old_table && arc_index_table_find(index, old_table, key, klen, hash, NULL, &value))
+            return value;
+
+        if (arc_index_table_find(index, table, key, klen, hash, NULL, &value))
+            return value;
+
+        // a miss is reliable only if the tables haven't been swapped meanwhile
+        if (LIKELY(LOAD_ACQUIRE(index->generation) == generation))
+            return NULL;
+    }
+}
+
+void *
+arc_index_get_locked(arc_index_t *index,
+                     const void *key,
+                     size_t klen,
+                     uint64_t hash,
+                     arc_index_get_callback_t cb,
+                     void *cb_priv)
+{
+    void *value = NULL;
+    arc_index_stripe_t *stripe = arc_index_stripe(index, hash);
+
+    arc_index_stripe_lock(stripe);
+    if ((index->old_table && arc_index_table_find(index, index->old_table, key, klen, hash, NULL, &value)) ||
+        arc_index_table_find(index, index->table, key, klen, hash, NULL, &value))
+    {
+        if (cb)
+            value = cb(value, cb_priv);
+    }
+    arc_index_stripe_unlock(stripe);
+
+    return value;
+}
+
+int
+arc_index_set_if_not_exists(arc_index_t *index,
+                            const void *key,
+                            size_t klen,
+                            uint64_t hash,
+                            void *value)
+{
+    void *existing = NULL;
+    int rc = 1;
+    arc_index_stripe_t *stripe = arc_index_stripe(index, hash);
+
+    arc_index_stripe_lock(stripe);
+    if (!(index->old_table && arc_index_table_find(index, index->old_table, key, klen, hash, NULL, &existing)) &&
+        !arc_index_table_find(index, index->table, key, klen, hash, NULL, &existing))
+    {
+        rc = arc_index_table_insert(index, index->table, hash, value);
+        if (rc == 0)
+            ATOMIC_INCREMENT(index->count);
+    }
+    arc_index_stripe_unlock(stripe);
+
+    arc_index_maintain(index);
+
+    return rc;
+}
+
+int
+arc_index_delete_if_equals(arc_index_t *index,
+                           const void *key,
+                           size_t klen,
+                           uint64_t hash,
+                           void *value)
+{
+    arc_index_group_t *group = NULL;
+    arc_index_entry_t *entry = NULL;
+    void *existing = NULL;
+    int rc = -1;
+    arc_index_stripe_t *stripe = arc_index_stripe(index, hash);
+
+    arc_index_stripe_lock(stripe);
+    if (index->old_table)
+        entry = arc_index_table_find(index, index->old_table, key, klen, hash, &group, &existing);
+    if (!entry)
+        entry = arc_index_table_find(index, index->table, key, klen, hash, &group, &existing);
+    if (entry && existing == value) {
+        arc_index_entry_clear(group, entry);
+        ATOMIC_DECREMENT(index->count);
+        rc = 0;
+    }
+    arc_index_stripe_unlock(stripe);
+
+    if (rc == 0)
+        arc_index_maintain(index);
+
+    return rc;
+}
+
+size_t
+arc_index_count(arc_index_t *index)
+{
+    return ATOMIC_READ(index->count);
+}
+
+size_t
+arc_index_memory_usage(arc_index_t *index)
+{
+    size_t size;
+    arc_index_lock_all(index);
+    size = sizeof(arc_index_t) + arc_index_table_size(index->table);
+    if (index->old_table)
+        size += arc_index_table_size(index->old_table);
+    arc_index_unlock_all(index);
+    return size;
+}
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
@@ -0,0 +1,123 @@
+/**
+ * @file arc_index.h
+ * @brief Concurrent open-addressing index used by the ARC cache
+ *
+ * Slots are organized in groups of 8, each group carrying a word of 8 tag
+ * bytes (7 bits of the hash plus a 'full' bit) which are probed all at once
+ * (SWAR). Lookups through arc_index_get() don't take any lock, insertions
+ * and deletions are serialized per key by a set of striped locks and the
+ * table grows incrementally (each writer migrates a few groups from the
+ * old table).
+ *
+ * @note The index only stores pointers to the values. Keys are compared
+ *       through the match callback provided at creation time, which is
+ *       expected to compare the key stored in the value itself.
+ */
+#ifndef __ARC_INDEX_H__
+#define __ARC_INDEX_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+typedef struct __arc_index arc_index_t;
+
+/**
+ * @brief Callback used to check if a value stored in the index
+ *        matches a given key
+ * @return 1 if the value matches the key, 0 otherwise
+ */
+typedef int (*arc_index_match_callback_t)(void *value, const void *key, size_t klen, void *priv);
+
+/**
+ * @brief Callback used to release the memory of a table replaced by a
+ *        resize once it's not referenced by any writer anymore.
+ *        Lock-free readers might still be accessing it, so whoever uses
+ *        arc_index_get() must defer the actual release until they are done.
+ *        If not provided the memory will be released immediately
+ */
+typedef void (*arc_index_free_callback_t)(void *ptr, void *priv);
+
+/**
+ * @brief Callback called by arc_index_get_locked() while the stripe
+ *        owning the key is locked
+ * @return The pointer returned to the caller of arc_index_get_locked()
+ */
+typedef void *(*arc_index_get_callback_t)(void *value, void *priv);
+
+/**
+ * @brief Create a new index
+ * @param size_hint  The expected number of items
+ * @param match      The callback used to compare keys
+ * @param free_table The callback used to release the retired tables (optional)
+ * @param priv       The private pointer passed to the callbacks
+ * @return A newly initialized index
+ */
+arc_index_t *arc_index_create(size_t size_hint,
+                              arc_index_match_callback_t match,
+                              arc_index_free_callback_t free_table,
+                              void *priv);
+
+/**
+ * @brief Release all the resources used by the index
+ * @note The values are not touched
+ */
+void arc_index_destroy(arc_index_t *index);
+
+/**
+ * @brief Compute the 64bit hash used to address a key in the index
+ */
+uint64_t arc_index_hash(const void *key, size_t klen);
+
+/**
+ * @brief Lookup a value without locking
+ * @note The caller must ensure that the returned value (and any table
+ *       released in the meanwhile) is not freed while being referenced
+ */
+void *arc_index_get(arc_index_t *index, const void *key, size_t klen, uint64_t hash);
+
+/**
+ * @brief Lookup a value and call cb on it while the key is locked
+ * @return The value returned by cb, NULL if the key is not found
+ */
+void *arc_index_get_locked(arc_index_t *index,
+                           const void *key,
+                           size_t klen,
+                           uint64_t hash,
+                           arc_index_get_callback_t cb,
+                           void *cb_priv);
+
+/**
+ * @brief Set the value for a key only if not already present
+ * @return 0 if the value has been set, 1 if the key already exists,
+ *         -1 in case of errors
+ */
+int arc_index_set_if_not_exists(arc_index_t *index,
+                                const void *key,
+                                size_t klen,
+                                uint64_t hash,
+                                void *value);
+
+/**
+ * @brief Remove a key only if the stored value is the one provided
+ * @return 0 if the key has been removed, -1 otherwise
+ */
+int arc_index_delete_if_equals(arc_index_t *index,
+                               const void *key,
+                               size_t klen,
+                               uint64_t hash,
+                               void *value);
+
+/**
+ * @brief Returns the number of items in the index
+ */
+size_t arc_index_count(arc_index_t *index);
+
+/**
+ * @brief Returns the amount of memory used by the index (in bytes)
+ */
+size_t arc_index_memory_usage(arc_index_t *index);
+
+#endif /* __ARC_INDEX_H__ */
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
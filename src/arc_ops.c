@@ -56,11 +56,84 @@ arc_ops_fetch_from_peer_notify_listener_error(void *item, uint32_t idx, void *us
 typedef struct
 {
     cached_object_t *obj;
+    arc_resource_t res;
     shardcache_t *cache;
+    arc_t *arc;
     char *peer_addr;
     int fd;
+    struct timeval deadline;  // the deadline the fetch was sent with (unset if none)
+    shardcache_trace_t trace; // the trace context the fetch was sent with
+    int retry;
 } shc_fetch_async_arg_t;
 
+static int arc_ops_fetch_from_peer_async_cb(char *peer,
+                                            void *key,
+                                            size_t klen,
+                                            void *data,
+                                            size_t len,
+                                            int status,
+                                            void *priv);
+
+// The fetch carries the deadline of the requester which triggered it,
+// but more requesters might have joined while it was in flight.
+// If nothing has been received and the deadline sent along expired
+// (so the peer most likely dropped the request), the fetch is sent
+// again with the budget left to the latest of the listeners.
+// Must be called with the object lock held
+static int
+arc_ops_fetch_from_peer_should_retry(shc_fetch_async_arg_t *arg)
+{
+    cached_object_t *obj = arg->obj;
+    return (!obj->dlen && obj->listeners && list_count(obj->listeners) &&
+            timerisset(&arg->deadline) &&
+            shardcache_deadline_left(&arg->deadline) == -1 &&
+            shardcache_deadline_left(&obj->deadline) != -1);
+}
+
+static int
+arc_ops_fetch_from_peer_retry(shc_fetch_async_arg_t *arg)
+{
+    cached_object_t *obj = arg->obj;
+    shardcache_t *cache = arg->cache;
+
+    int deadline = shardcache_deadline_left(&obj->deadline);
+    if (deadline < 0)
+        return -1;
+
+    if (shardcache_log_level() >= LOG_DEBUG) {
+        char keystr[1024];
+        KEY2STR(obj->key, obj->klen, keystr, sizeof(keystr));
+        SHC_DEBUG2("Fetching data for key %s from peer %s again (deadline: %d)",
+                   keystr, arg->peer_addr, deadline);
+    }
+
+    arg->deadline = obj->deadline;
+    arg->retry = 0;
+    arg->fd = shardcache_get_connection_for_peer(cache, arg->peer_addr);
+    async_read_wrk_t *wrk = NULL;
+    int rc = fetch_from_peer_async(arg->peer_addr,
+                                   (char *)cache->auth,
+                                   SHC_HDR_CSIGNATURE_SIP,
+                                   obj->key,
+                                   obj->klen,
+                                   0,
+                                   0,
+                                   deadline,
+                                   arg->trace.id ? &arg->trace : NULL,
+                                   arc_ops_fetch_from_peer_async_cb,
+                                   arg,
+                                   arg->fd,
+                                   &wrk);
+    if (rc != 0) {
+        if (arg->fd >= 0)
+            close(arg->fd);
+        return -1;
+    }
+
+    shardcache_queue_async_read_wrk(cache, wrk);
+    return 0;
+}
+
 static int
 arc_ops_fetch_from_peer_async_cb(char *peer,
                                  void *key,
@@ -72,7 +145,9 @@ arc_ops_fetch_from_peer_async_cb(char *peer,
 {
     shc_fetch_async_arg_t *arg = (shc_fetch_async_arg_t *)priv;
     cached_object_t *obj = arg->obj;
+    arc_resource_t res = arg->res;
     shardcache_t *cache = arg->cache;
+    arc_t *arc = arg->arc;
     char *peer_addr = arg->peer_addr;
     int fd = arg->fd;
     int total_len = 0;
@@ -93,22 +168,36 @@ arc_ops_fetch_from_peer_async_cb(char *peer,
         COBJ_UNSET_FLAG(obj, COBJ_FLAG_FETCHING);
         MUTEX_UNLOCK(&obj->lock);
         free(arg);
-        arc_release_resource(cache->arc, obj->res);
+        arc_release_resource(arc, res);
         return -1;
     }
     if (status == -1) {
-        list_foreach_value(obj->listeners, arc_ops_fetch_from_peer_notify_listener_error, obj);
         if (fd >= 0)
             close(fd);
+        if (arc_ops_fetch_from_peer_should_retry(arg) && arc_ops_fetch_from_peer_retry(arg) == 0) {
+            MUTEX_UNLOCK(&obj->lock);
+            return -1;
+        }
+        list_foreach_value(obj->listeners, arc_ops_fetch_from_peer_notify_listener_error, obj);
         COBJ_UNSET_FLAG(obj, COBJ_FLAG_FETCHING);
         MUTEX_UNLOCK(&obj->lock);
-        arc_drop_resource(cache->arc, obj->res);
+        arc_drop_resource(arc, res);
         free(arg);
         return -1;
     } else if (status == 1) {
 
         if (fd >= 0)
             shardcache_release_connection_for_peer(cache, peer_addr, fd);
+
+        if (arg->retry) {
+            // see arc_ops_fetch_from_peer_should_retry()
+            if (arc_ops_fetch_from_peer_retry(arg) == 0) {
+                MUTEX_UNLOCK(&obj->lock);
+                return 0;
+            }
+            list_foreach_value(obj->listeners, arc_ops_fetch_from_peer_notify_listener_error, obj);
+            COBJ_SET_FLAG(obj, COBJ_FLAG_DROP);
+        }
         free(arg);
 
         COBJ_UNSET_FLAG(obj, COBJ_FLAG_FETCHING);
@@ -117,9 +206,9 @@ arc_ops_fetch_from_peer_async_cb(char *peer,
         MUTEX_UNLOCK(&obj->lock);
 
         if (drop)
-            arc_drop_resource(cache->arc, obj->res);
+            arc_drop_resource(arc, res);
         else
-            arc_release_resource(cache->arc, obj->res);
+            arc_release_resource(arc, res);
 
         return 0;
     } else if (len) {
@@ -146,6 +235,12 @@ arc_ops_fetch_from_peer_async_cb(char *peer,
         MUTEX_UNLOCK(&obj->lock);
         return 0;
     } else {
+        if (arc_ops_fetch_from_peer_should_retry(arg)) {
+            // wait for the connection to be released before retrying
+            arg->retry = 1;
+            MUTEX_UNLOCK(&obj->lock);
+            return 0;
+        }
         list_foreach_value(obj->listeners, arc_ops_fetch_from_peer_notify_listener_complete, obj);
         COBJ_SET_FLAG(obj, COBJ_FLAG_COMPLETE);
         COBJ_UNSET_FLAG(obj, COBJ_FLAG_FETCHING);
@@ -155,10 +250,11 @@ arc_ops_fetch_from_peer_async_cb(char *peer,
                       COBJ_CHECK_FLAGS(obj, COBJ_FLAG_EVICTED);
 
         if (total_len && !COBJ_CHECK_FLAGS(obj, COBJ_FLAG_DROP)) {
-            arc_update_resource_size(cache->arc, obj->res, (obj->data == obj->dbuf) ? 0 : total_len);
+            arc_update_resource_size(arc, obj->res, (obj->data == obj->dbuf) ? 0 : total_len);
 
-            if (cache->expire_time > 0 && !evicted && !cache->lazy_expiration)
-                shardcache_schedule_expiration(cache, key, klen, cache->expire_time, 0);
+            int expire_time = SHARDCACHE_NS_OPTION(cache, obj->ns, expire_time);
+            if (expire_time > 0 && !evicted && !cache->lazy_expiration)
+                shardcache_schedule_expiration(cache, key, klen, expire_time, 0);
 
         }
         if (!total_len)
@@ -171,33 +267,63 @@ arc_ops_fetch_from_peer_async_cb(char *peer,
 
 
 static int
-arc_ops_fetch_from_peer(shardcache_t *cache, cached_object_t *obj, char *peer)
+arc_ops_fetch_from_peer(shardcache_partition_t *part, cached_object_t *obj, shardcache_node_t *node)
 {
+    shardcache_t *cache = part->cache;
+    arc_t *arc = shardcache_partition_arc(part, obj->ns);
+    int force_caching = SHARDCACHE_NS_OPTION(cache, obj->ns, force_caching);
     int rc = -1;
-    if (shardcache_log_level() >= LOG_DEBUG) {
+
+    if (!node) {
         char keystr[1024];
         KEY2STR(obj->key, obj->klen, keystr, sizeof(keystr));
-        SHC_DEBUG2("Fetching data for key %s from peer %s", keystr, peer); 
+        SHC_ERROR("Can't find the node owning the key %s", keystr);
+        return rc;
     }
 
-    shardcache_node_t *node = shardcache_node_select(cache, peer);
-    if (!peer) {
-        SHC_ERROR("Can't find address for node %s\n", peer);
-        return rc;
+    if (shardcache_log_level() >= LOG_DEBUG) {
+        char keystr[1024];
+        KEY2STR(obj->key, obj->klen, keystr, sizeof(keystr));
+        SHC_DEBUG2("Fetching data for key %s from peer %s", keystr, shardcache_node_get_label(node)); 
     }
+
     char *peer_addr = shardcache_node_get_address(node);
 
+    if (shardcache_fetch_timing) {
+        shardcache_fetch_timing->source |= SLOWLOG_SOURCE_PEER;
+        snprintf(shardcache_fetch_timing->peer, sizeof(shardcache_fetch_timing->peer), "%s", peer_addr);
+    }
+
+    shardcache_hotkeys_track(cache, SHARDCACHE_HOTKEYS_FETCHES, obj->key, obj->klen, obj->hash, 1);
+
     // another peer is responsible for this item, let's get the value from there
 
+    // forward the budget left to the requester (if any)
+    int deadline = shardcache_deadline_left(shardcache_fetch_deadline);
+    if (deadline < 0)
+        deadline = 0;
+
     int fd = shardcache_get_connection_for_peer(cache, peer_addr);
     if (COBJ_CHECK_FLAGS(obj, COBJ_FLAG_ASYNC)) {
         shc_fetch_async_arg_t *arg = malloc(sizeof(shc_fetch_async_arg_t));
         arg->obj = obj;
         arg->cache = cache;
+        arg->arc = arc;
         arg->peer_addr = peer_addr;
         arg->fd = fd;
+        arg->retry = 0;
+        timerclear(&arg->deadline);
+        if (shardcache_fetch_deadline)
+            arg->deadline = *shardcache_fetch_deadline;
+        obj->deadline = arg->deadline;
+        memset(&arg->trace, 0, sizeof(arg->trace));
+        if (shardcache_request_trace)
+            arg->trace = *shardcache_request_trace;
+        obj->trace_id = arg->trace.id;
+        obj->trace_flags = arg->trace.flags;
         async_read_wrk_t *wrk = NULL;
-        arc_retain_resource(cache->arc, obj->res);
+        // the resource will be released by the async i/o thread
+        arg->res = arc_retain_resource(arc, obj->res);
         rc = fetch_from_peer_async(peer_addr,
                                    (char *)cache->auth,
                                    SHC_HDR_CSIGNATURE_SIP,
@@ -205,6 +331,8 @@ arc_ops_fetch_from_peer(shardcache_t *cache, cached_object_t *obj, char *peer)
                                    obj->klen,
                                    0,
                                    0,
+                                   deadline,
+                                   arg->trace.id ? &arg->trace : NULL,
                                    arc_ops_fetch_from_peer_async_cb,
                                    arg,
                                    fd,
@@ -213,7 +341,8 @@ arc_ops_fetch_from_peer(shardcache_t *cache, cached_object_t *obj, char *peer)
             // Keep the remote object in the cache only 10% of the time.
             // This is the same logic applied by groupcache to determine hot keys.
             // Better approaches are possible but maybe unnecessary.
-            if (!cache->force_caching && random() % 10 != 0)
+            // Nothing is kept once the memory limit has been reached.
+            if ((!force_caching && random() % 10 != 0) || ATOMIC_READ(cache->mem_pressure))
                 COBJ_SET_FLAG(obj, COBJ_FLAG_DROP);
             else
                 COBJ_UNSET_FLAG(obj, COBJ_FLAG_DROP);
@@ -232,13 +361,13 @@ arc_ops_fetch_from_peer(shardcache_t *cache, cached_object_t *obj, char *peer)
             }
             if (fd >= 0)
                 close(fd);
-            arc_release_resource(cache->arc, obj->res);
+            arc_release_resource(arc, arg->res);
 
             free(arg);
         }
     } else { 
         fbuf_t value = FBUF_STATIC_INITIALIZER;
-        rc = fetch_from_peer(peer_addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, obj->key, obj->klen, &value, fd);
+        rc = fetch_from_peer(peer_addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, obj->key, obj->klen, deadline, shardcache_request_trace, &value, fd);
         COBJ_UNSET_FLAG(obj, COBJ_FLAG_FETCHING);
         if (rc == 0) {
             shardcache_release_connection_for_peer(cache, peer_addr, fd);
@@ -246,7 +375,7 @@ arc_ops_fetch_from_peer(shardcache_t *cache, cached_object_t *obj, char *peer)
                 obj->data = fbuf_data(&value);
                 obj->dlen = fbuf_used(&value);
                 COBJ_SET_FLAG(obj, COBJ_FLAG_COMPLETE);
-                if (!cache->force_caching && rand() % 10 != 0)
+                if ((!force_caching && rand() % 10 != 0) || ATOMIC_READ(cache->mem_pressure))
                     COBJ_SET_FLAG(obj, COBJ_FLAG_DROP);
                 else
                     COBJ_UNSET_FLAG(obj, COBJ_FLAG_DROP);
@@ -263,7 +392,7 @@ arc_ops_fetch_from_peer(shardcache_t *cache, cached_object_t *obj, char *peer)
 }
 
 void
-arc_ops_init(const void *key, size_t len, int async, arc_resource_t res, void *ptr, void *priv)
+arc_ops_init(const void *key, size_t len, uint64_t hash, int async, arc_resource_t res, void *ptr, void *priv)
 {
     // NOTE: the arc subsystem already allocates for us the memory where the
     // cached object needs to be stored. Such size was specified at creation time
@@ -276,9 +405,12 @@ arc_ops_init(const void *key, size_t len, int async, arc_resource_t res, void *p
     else
         obj->key = obj->kbuf;
     memcpy(obj->key, key, obj->klen);
+    obj->hash = hash;
     obj->data = NULL;
+    timerclear(&obj->deadline);
     COBJ_UNSET_FLAG(obj, COBJ_FLAG_COMPLETE);
     obj->res = res;
+    obj->ns = shardcache_namespace(((shardcache_partition_t *)priv)->cache, key, len);
     if (async) {
         COBJ_SET_FLAG(obj, COBJ_FLAG_ASYNC);
         obj->listeners = list_create();
@@ -300,11 +432,60 @@ arc_ops_fetch_copy_volatile_object_cb(void *ptr, size_t len, void *user)
     return (void *)obj;
 }
 
+// serve the object from the l2 cache (if enabled and holding the key),
+// the expiration time is adjusted to the time the object has been loaded at.
+// Returns 1 if the data has been loaded, 0 otherwise
+static int
+arc_ops_fetch_from_l2(shardcache_t *cache, cached_object_t *obj, time_t *expire)
+{
+    l2cache_t *l2 = ATOMIC_READ(cache->l2);
+    if (!l2) {
+        obj->l2_version = 0;
+        return 0;
+    }
+
+    // taken before loading the data, so that if the key is removed
+    // meanwhile the (stale) object won't be admitted to the l2 cache
+    obj->l2_version = l2cache_version(l2);
+
+    void *data = NULL;
+    size_t dlen = 0;
+    time_t ts = 0;
+    if (l2cache_get(l2, obj->key, obj->klen, obj->hash, &data, &dlen, &ts) != 0)
+        return 0;
+
+    int expire_time = SHARDCACHE_NS_OPTION(cache, obj->ns, expire_time);
+    if (expire_time > 0) {
+        time_t age = time(NULL) - ts;
+        if (age >= expire_time) {
+            free(data);
+            l2cache_remove(l2, obj->key, obj->klen, obj->hash);
+            obj->l2_version = l2cache_version(l2);
+            return 0;
+        }
+        *expire = expire_time - age;
+    }
+
+    if (dlen > sizeof(obj->dbuf)) {
+        obj->data = data;
+    } else {
+        memcpy(obj->dbuf, data, dlen);
+        obj->data = obj->dbuf;
+        free(data);
+    }
+    obj->dlen = dlen;
+    obj->ts.tv_sec = ts;
+    obj->ts.tv_usec = 0;
+
+    return 1;
+}
+
 int
 arc_ops_fetch(void *item, size_t *size, void * priv)
 {
     cached_object_t *obj = (cached_object_t *)item;
-    shardcache_t *cache = (shardcache_t *)priv;
+    shardcache_partition_t *part = (shardcache_partition_t *)priv;
+    shardcache_t *cache = part->cache;
 
     MUTEX_LOCK(&obj->lock);
 
@@ -312,33 +493,42 @@ arc_ops_fetch(void *item, size_t *size, void * priv)
         MUTEX_UNLOCK(&obj->lock);
         return 1;
     } else if (obj->data) {
+        // already loaded (see arc_ops_store())
+        *size = (obj->data == obj->dbuf) ? 0 : obj->dlen;
         MUTEX_UNLOCK(&obj->lock);
         return 0;
     }
 
+    if (UNLIKELY(shardcache_deadline_left(shardcache_fetch_deadline) == -1)) {
+        // the requester already gave up, there is no point in
+        // querying the peers or the storage on its behalf
+        ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_DROPPED_REQUESTS].value);
+        MUTEX_UNLOCK(&obj->lock);
+        return -1;
+    }
+
     COBJ_SET_FLAG(obj, COBJ_FLAG_FETCHING);
+    obj->trace_id = 0;
 
-    ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_CACHE_MISSES].value);
+    SHARDCACHE_NS_COUNTER_INCREMENT(cache, obj->ns, SHARDCACHE_COUNTER_CACHE_MISSES);
 
     // this object is not evicted anymore (if it eventually was)
     COBJ_UNSET_FLAG(obj, COBJ_FLAG_EVICTED);
     COBJ_UNSET_FLAG(obj, COBJ_FLAG_EVICT);
-    char node_name[1024];
-    size_t node_len = sizeof(node_name);
-    memset(node_name, 0, node_len);
+
+    time_t expire = SHARDCACHE_NS_OPTION(cache, obj->ns, expire_time);
+    int l2_hit = arc_ops_fetch_from_l2(cache, obj, &expire);
+
+    shardcache_node_t *owner = NULL;
     // if we are not the owner try asking to the peer responsible for this data
-    if (!shardcache_test_ownership(cache, obj->key, obj->klen, node_name, &node_len))
+    if (!l2_hit && !shardcache_owner_lookup(cache, obj->key, obj->klen, 0, &owner))
     {
         int done = 1;
-        int ret = arc_ops_fetch_from_peer(cache, obj, node_name);
+        int ret = arc_ops_fetch_from_peer(part, obj, owner);
         if (ret == -1) {
-            int check = shardcache_test_migration_ownership(cache,
-                                                            obj->key,
-                                                            obj->klen,
-                                                            node_name,
-                                                            &node_len);
+            int check = shardcache_owner_lookup(cache, obj->key, obj->klen, 1, &owner);
             if (check == 0) {
-                ret = arc_ops_fetch_from_peer(cache, obj, node_name);
+                ret = arc_ops_fetch_from_peer(part, obj, owner);
             }
 
             if (check == 1 || (ret == -1 && cache->storage.global)) {
@@ -350,14 +540,14 @@ arc_ops_fetch(void *item, size_t *size, void * priv)
             }
         }
         if (done) {
-            ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_FETCH_REMOTE].value);
+            SHARDCACHE_NS_COUNTER_INCREMENT(cache, obj->ns, SHARDCACHE_COUNTER_FETCH_REMOTE);
             if (ret == 0) {
-                ATOMIC_SET(cache->cnt[SHARDCACHE_COUNTER_CACHED_ITEMS].value, arc_count(cache->arc));
+                ATOMIC_SET(cache->cnt[SHARDCACHE_COUNTER_CACHED_ITEMS].value, shardcache_cached_items(cache));
                 gettimeofday(&obj->ts, NULL);
                 *size = (obj->data == obj->dbuf) ? 0 : obj->dlen;
                 int drop = COBJ_CHECK_FLAGS(obj, COBJ_FLAG_DROP|COBJ_FLAG_COMPLETE);
                 MUTEX_UNLOCK(&obj->lock);
-                ATOMIC_SET(cache->cnt[SHARDCACHE_COUNTER_CACHED_ITEMS].value, arc_count(cache->arc));
+                ATOMIC_SET(cache->cnt[SHARDCACHE_COUNTER_CACHED_ITEMS].value, shardcache_cached_items(cache));
                 return drop ? 1 : 0;
             }
             MUTEX_UNLOCK(&obj->lock);
@@ -370,43 +560,60 @@ arc_ops_fetch(void *item, size_t *size, void * priv)
     if (shardcache_log_level() >= LOG_DEBUG)
         KEY2STR(obj->key, obj->klen, keystr, sizeof(keystr));
 
-    ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_FETCH_LOCAL].value);
-
-    // we are responsible for this item ... 
-    // let's first check if it's among the volatile keys otherwise
-    // fetch it from the storage
-    ht_get_deep_copy(cache->volatile_storage,
-                     obj->key,
-                     obj->klen,
-                     NULL,
-                     arc_ops_fetch_copy_volatile_object_cb,
-                     obj);
-    if (obj->data && obj->dlen) {
-        SHC_DEBUG3("Found volatile value %s (%lu) for key %s",
-               shardcache_hex_escape(obj->data, obj->dlen, DEBUG_DUMP_MAXSIZE, 0),
-               (unsigned long)obj->dlen, keystr);
-    } else if (cache->use_persistent_storage && cache->storage.fetch) {
-        int rc = cache->storage.fetch(obj->key, obj->klen, &obj->data, &obj->dlen, cache->storage.priv);
-        if (rc == -1) {
-            if (COBJ_CHECK_FLAGS(obj, COBJ_FLAG_ASYNC) && obj->listeners)
-                list_foreach_value(obj->listeners, arc_ops_fetch_from_peer_notify_listener_error, obj);
-            SHC_ERROR("Fetch storage callback returned an error (%d)", rc);
-            ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_ERRORS].value);
-            COBJ_UNSET_FLAG(obj, COBJ_FLAG_FETCHING);
-            COBJ_SET_FLAG(obj, COBJ_FLAG_DROP);
-            MUTEX_UNLOCK(&obj->lock);
-            return -1;
-        }
+    if (!l2_hit) {
+        SHARDCACHE_NS_COUNTER_INCREMENT(cache, obj->ns, SHARDCACHE_COUNTER_FETCH_LOCAL);
+
+        // we are responsible for this item ... 
+        // let's first check if it's among the volatile keys otherwise
+        // fetch it from the storage
+        ht_get_deep_copy(part->volatile_storage,
+                         obj->key,
+                         obj->klen,
+                         NULL,
+                         arc_ops_fetch_copy_volatile_object_cb,
+                         obj);
         if (obj->data && obj->dlen) {
-            SHC_DEBUG3("Fetch storage callback returned value %s (%lu) for key %s",
+            SHC_DEBUG3("Found volatile value %s (%lu) for key %s",
                    shardcache_hex_escape(obj->data, obj->dlen, DEBUG_DUMP_MAXSIZE, 0),
                    (unsigned long)obj->dlen, keystr);
-        } else {
-            SHC_DEBUG3("Fetch storage callback returned an empty value for key %s", keystr);
+        } else if (cache->use_persistent_storage && cache->storage.fetch &&
+                   !shardcache_storage_maybe_has(cache, obj->hash))
+        {
+            SHC_DEBUG3("Key %s filtered out, not in the storage", keystr);
+        } else if (cache->use_persistent_storage && cache->storage.fetch) {
+            struct timeval fetch_start, fetch_end, fetch_time;
+            if (shardcache_fetch_timing)
+                gettimeofday(&fetch_start, NULL);
+            int rc = cache->storage.fetch(obj->key, obj->klen, &obj->data, &obj->dlen, cache->storage.priv);
+            if (shardcache_fetch_timing) {
+                gettimeofday(&fetch_end, NULL);
+                timersub(&fetch_end, &fetch_start, &fetch_time);
+                shardcache_fetch_timing->source |= SLOWLOG_SOURCE_STORAGE;
+                shardcache_fetch_timing->storage_usecs += fetch_time.tv_sec * 1000000 + fetch_time.tv_usec;
+            }
+            if (rc == -1) {
+                if (COBJ_CHECK_FLAGS(obj, COBJ_FLAG_ASYNC) && obj->listeners)
+                    list_foreach_value(obj->listeners, arc_ops_fetch_from_peer_notify_listener_error, obj);
+                SHC_ERROR("Fetch storage callback returned an error (%d)", rc);
+                ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_ERRORS].value);
+                COBJ_UNSET_FLAG(obj, COBJ_FLAG_FETCHING);
+                COBJ_SET_FLAG(obj, COBJ_FLAG_DROP);
+                MUTEX_UNLOCK(&obj->lock);
+                return -1;
+            }
+            if (obj->data && obj->dlen) {
+                SHC_DEBUG3("Fetch storage callback returned value %s (%lu) for key %s",
+                       shardcache_hex_escape(obj->data, obj->dlen, DEBUG_DUMP_MAXSIZE, 0),
+                       (unsigned long)obj->dlen, keystr);
+            } else {
+                SHC_DEBUG3("Fetch storage callback returned an empty value for key %s", keystr);
+                if (!obj->data && cache->keyfilter)
+                    keyfilter_false_positive(cache->keyfilter);
+            }
         }
-    }
 
-    gettimeofday(&obj->ts, NULL);
+        gettimeofday(&obj->ts, NULL);
+    }
 
     COBJ_SET_FLAG(obj, COBJ_FLAG_COMPLETE);
     COBJ_UNSET_FLAG(obj, COBJ_FLAG_FETCHING);
@@ -436,12 +643,12 @@ arc_ops_fetch(void *item, size_t *size, void * priv)
     int evicted = (COBJ_CHECK_FLAGS(obj, COBJ_FLAG_EVICT) ||
                    COBJ_CHECK_FLAGS(obj, COBJ_FLAG_EVICTED));
 
-    if (cache->expire_time > 0 && !evicted && !cache->lazy_expiration)
-        shardcache_schedule_expiration(cache, obj->key, obj->klen, cache->expire_time, 0);
+    if (expire > 0 && !evicted && !cache->lazy_expiration)
+        shardcache_schedule_expiration(cache, obj->key, obj->klen, expire, 0);
 
     MUTEX_UNLOCK(&obj->lock);
 
-    ATOMIC_SET(cache->cnt[SHARDCACHE_COUNTER_CACHED_ITEMS].value, arc_count(cache->arc));
+    ATOMIC_SET(cache->cnt[SHARDCACHE_COUNTER_CACHED_ITEMS].value, shardcache_cached_items(cache));
 
     return evicted;
 }
@@ -451,7 +658,8 @@ void
 arc_ops_store(void *item, void *data, size_t size, void *priv)
 {
     cached_object_t *obj = (cached_object_t *)item;
-    //shardcache_t *cache = (shardcache_t *)priv;
+    shardcache_partition_t *part = (shardcache_partition_t *)priv;
+    l2cache_t *l2 = ATOMIC_READ(part->cache->l2);
     MUTEX_LOCK(&obj->lock); // XXX - this shouldn't be really necessary
 
     if (obj->data && obj->data != obj->dbuf)
@@ -460,15 +668,52 @@ arc_ops_store(void *item, void *data, size_t size, void *priv)
     obj->data = (size > sizeof(obj->dbuf)) ? malloc(size) : obj->dbuf;
     memcpy(obj->data, data, size);
     obj->dlen = size;
+    gettimeofday(&obj->ts, NULL);
+    COBJ_SET_FLAG(obj, COBJ_FLAG_COMPLETE);
+    obj->l2_version = l2 ? l2cache_version(l2) : 0;
 
     MUTEX_UNLOCK(&obj->lock);
 }
 
+void
+arc_ops_demote(void *item, void *priv)
+{
+    cached_object_t *obj = (cached_object_t *)item;
+    shardcache_partition_t *part = (shardcache_partition_t *)priv;
+    l2cache_t *l2 = ATOMIC_READ(part->cache->l2);
+
+    if (!l2)
+        return;
+
+    MUTEX_LOCK(&obj->lock);
+    // only complete objects which are not going to be dropped anyway are
+    // worth being written (volatile keys are already kept in memory)
+    if (COBJ_CHECK_FLAGS(obj, COBJ_FLAG_COMPLETE) &&
+        !COBJ_CHECK_FLAGS(obj, COBJ_FLAG_FETCHING) &&
+        !COBJ_CHECK_FLAGS(obj, COBJ_FLAG_DROP) &&
+        !COBJ_CHECK_FLAGS(obj, COBJ_FLAG_EVICT) &&
+        !COBJ_CHECK_FLAGS(obj, COBJ_FLAG_EVICTED) &&
+        obj->data && obj->dlen &&
+        !ht_exists(part->volatile_storage, obj->key, obj->klen))
+    {
+        l2cache_admit(l2,
+                      obj->key,
+                      obj->klen,
+                      obj->hash,
+                      obj->data,
+                      obj->dlen,
+                      obj->ts.tv_sec,
+                      obj->l2_version);
+    }
+    MUTEX_UNLOCK(&obj->lock);
+}
+
 void
 arc_ops_evict(void *item, void *priv)
 {
     cached_object_t *obj = (cached_object_t *)item;
-    shardcache_t *cache = (shardcache_t *)priv;
+    shardcache_partition_t *part = (shardcache_partition_t *)priv;
+    shardcache_t *cache = part->cache;
 
     MUTEX_LOCK(&obj->lock); // XXX - this shouldn't be really necessary
                             // TODO : try removing it and see what happens
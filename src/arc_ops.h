@@ -8,6 +8,7 @@
 typedef struct {
     void *key;   // The key (weak reference to the actual key stored in the arc resource)
     size_t klen; // The length of the key
+    uint64_t hash; // The hash of the key (as returned by arc_hash_key())
     char kbuf[32];
 
     // internal storage for data which doesn't exceeds 256 bytes.
@@ -28,6 +29,12 @@ typedef struct {
     linked_list_t *listeners; // list of listeners which will be notified
                               // while the object data is being retreived
 
+    struct timeval deadline; // the latest deadline among the requesters waiting
+                             // for the peer fetch (unset if any has none)
+
+    uint64_t trace_id;   // the trace the fetch has been forwarded with (0 if none)
+    uint8_t trace_flags; // (the requesters joining it are linked to it)
+
     uint16_t flags;
     #define COBJ_FLAG_ASYNC    (1)
     #define COBJ_FLAG_COMPLETE (1<<1)
@@ -40,6 +47,11 @@ typedef struct {
                           // synchronized using this lock
 
     arc_resource_t res;
+
+    uint64_t l2_version; // the l2 cache version (see l2cache_version())
+                         // when the object has been loaded
+
+    shardcache_namespace_t *ns; // the namespace of the key (NULL if none)
 } cached_object_t;
 #pragma pack(pop)
 
@@ -52,10 +64,11 @@ typedef struct {
     void *priv;
 } shardcache_get_listener_t;
 
-void arc_ops_init(const void *key, size_t len, int async, arc_resource_t res, void *ptr, void *priv);
+void arc_ops_init(const void *key, size_t len, uint64_t hash, int async, arc_resource_t res, void *ptr, void *priv);
 int arc_ops_fetch(void *item, size_t *size, void * priv);
 void arc_ops_evict(void *item, void *priv);
 void arc_ops_store(void *item, void *data, size_t size, void *priv);
+void arc_ops_demote(void *item, void *priv);
 
 // vim: tabstop=4 shiftwidth=4 expandtab:
 /* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
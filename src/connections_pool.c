@@ -2,6 +2,7 @@
 #include <pthread.h>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 
 
 #include <fbuf.h>
@@ -26,6 +27,8 @@ struct __connections_pool_s {
     int check;
     int expire_time;
     int fds_limit;
+    int min_warm;
+    connections_pool_stats_t stats;
 };
 
 struct __connection_pool_entry_s {
@@ -92,14 +95,21 @@ get_connection_queue(connections_pool_t *cc, char *addr)
 {
     static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
+    // the queues are never removed from the table, so the lock is
+    // needed only when the first connection to 'addr' is opened
+    size_t alen = strlen(addr);
+    queue_t *connection_queue = ht_get(cc->table, addr, alen, NULL);
+    if (connection_queue)
+        return connection_queue;
+
     pthread_mutex_lock(&lock);
-    queue_t *connection_queue = ht_get(cc->table, addr, strlen(addr), NULL);
+    connection_queue = ht_get(cc->table, addr, alen, NULL);
     if (!connection_queue) {
         // there is no queue, so we are the first one opening a connection to 'addr'
         connection_queue = queue_create();
         queue_set_bpool_size(connection_queue, cc->max_spare);
         queue_set_free_value_callback(connection_queue, free_connection);
-        if (ht_set(cc->table, addr, strlen(addr), connection_queue, 0) != 0) {
+        if (ht_set(cc->table, addr, alen, connection_queue, 0) != 0) {
             // ERRORS
             queue_destroy(connection_queue);
             pthread_mutex_unlock(&lock);
@@ -170,6 +180,22 @@ write_noop(connections_pool_t *cc, int fd, int flags)
     return rc;
 }
 
+// true if the peer closed (or reset) the connection,
+// checked without blocking and without consuming any data
+static int
+is_connection_closed(int fd)
+{
+    char byte;
+    int rb = recv(fd, &byte, 1, MSG_PEEK|MSG_DONTWAIT);
+    if (rb == 0)
+        return 1;
+    if (rb == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        return 1;
+    // nothing should be pending on an idle connection,
+    // if there is something the connection is out of sync anyway
+    return (rb > 0);
+}
+
 int
 connections_pool_get(connections_pool_t *cc, char *addr)
 {
@@ -183,8 +209,9 @@ connections_pool_get(connections_pool_t *cc, char *addr)
         struct timeval last_access = entry->last_access;
         free(entry);
         int flags = fcntl(fd, F_GETFL, 0);
-        if (flags == -1) {
+        if (flags == -1 || is_connection_closed(fd)) {
             close(fd);
+            ATOMIC_INCREMENT(cc->stats.dropped);
             entry = queue_pop_left(connection_queue);
             continue;
         }
@@ -233,6 +260,61 @@ connections_pool_add(connections_pool_t *cc, char *addr, int fd)
     }
 }
 
+int
+connections_pool_refresh(connections_pool_t *cc, char *addr)
+{
+    queue_t *connection_queue = get_connection_queue(cc, addr);
+    if (!connection_queue)
+        return -1;
+
+    // probe the connections currently idle, the ones still alive go back
+    // to the tail of the queue (and are considered as just used since
+    // the NOOP keeps them from being idled out by the expire time)
+    int count = queue_count(connection_queue);
+    while (count--) {
+        connection_pool_entry_t *entry = queue_pop_left(connection_queue);
+        if (!entry)
+            break;
+
+        ATOMIC_INCREMENT(cc->stats.probes);
+
+        char noop = SHC_HDR_NOOP;
+        if (!is_connection_closed(entry->fd) &&
+            send(entry->fd, &noop, 1, MSG_DONTWAIT) == 1)
+        {
+            gettimeofday(&entry->last_access, NULL);
+            if (queue_push_right(connection_queue, entry) == 0)
+                continue;
+        } else {
+            ATOMIC_INCREMENT(cc->stats.dropped);
+        }
+        close(entry->fd);
+        free(entry);
+    }
+
+    int min_warm = ATOMIC_READ(cc->min_warm);
+    int max_spare = ATOMIC_READ(cc->max_spare);
+    if (min_warm > max_spare)
+        min_warm = max_spare;
+
+    int missing = min_warm - queue_count(connection_queue);
+    while (missing-- > 0) {
+        int fd = connect_to_peer(addr, ATOMIC_READ(cc->tcp_timeout));
+        if (fd < 0)
+            break;
+        ATOMIC_INCREMENT(cc->stats.warmed);
+        connections_pool_add(cc, addr, fd);
+    }
+
+    return queue_count(connection_queue);
+}
+
+connections_pool_stats_t *
+connections_pool_stats(connections_pool_t *cc)
+{
+    return &cc->stats;
+}
+
 int
 connections_pool_tcp_timeout(connections_pool_t *cc, int new_value)
 {
@@ -266,6 +348,17 @@ connections_pool_max_spare(connections_pool_t *cc, int new_value)
     return old_value;
 }
 
+int
+connections_pool_min_warm(connections_pool_t *cc, int new_value)
+{
+    int old_value = ATOMIC_READ(cc->min_warm);
+
+    if (new_value >= 0)
+        ATOMIC_SET(cc->min_warm, new_value);
+
+    return old_value;
+}
+
 int
 connections_pool_check(connections_pool_t *cc, int new_value)
 {
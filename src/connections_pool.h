@@ -1,6 +1,8 @@
 #ifndef __CONNECTIONS_POOL_H__
 #define __CONNECTIONS_POOL_H__
 
+#include <stdint.h>
+
 typedef struct __connections_pool_s connections_pool_t;
 
 typedef struct __connection_pool_entry_s connection_pool_entry_t;
@@ -12,6 +14,20 @@ void connections_pool_add(connections_pool_t *cc, char *addr, int fd);
 int connections_pool_tcp_timeout(connections_pool_t *cc, int new_value);
 int connections_pool_check(connections_pool_t *cc, int new_value);
 int connections_pool_expire_time(connections_pool_t *cc, int new_value);
+int connections_pool_min_warm(connections_pool_t *cc, int new_value);
+
+// probe (without blocking) the idle connections to 'addr', dropping the ones
+// closed by the peer, and connect new ones up to the minimum of warm connections.
+// Returns the number of idle connections available for 'addr' (-1 on errors)
+int connections_pool_refresh(connections_pool_t *cc, char *addr);
+
+typedef struct {
+    uint64_t probes;  // idle connections probed
+    uint64_t dropped; // connections found closed by the peer
+    uint64_t warmed;  // connections established ahead of time
+} connections_pool_stats_t;
+
+connections_pool_stats_t *connections_pool_stats(connections_pool_t *cc);
 
 #endif
 
@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic_defs.h>
+
+#include "keyfilter.h"
+
+// the minimum number of keys a filter is sized for
+#define KEYFILTER_CAPACITY_MIN (1<<16)
+
+#define KEYFILTER_HASHES_MAX 16
+
+// the readers in a grace period are counted on separate cache lines
+#define KEYFILTER_READER_STRIPES 64
+
+#define LOAD_ACQUIRE(__p) __atomic_load_n(&(__p), __ATOMIC_ACQUIRE)
+
+#ifndef UNLIKELY
+#define UNLIKELY(__e) __builtin_expect((__e), 0)
+#endif
+
+typedef struct {
+    uint64_t *bits;
+    uint64_t nbits;
+    uint64_t bits_set;
+    uint64_t items;
+    int nhashes;
+    size_t capacity;
+} keyfilter_bloom_t;
+
+typedef struct {
+    int count[2]; // readers which entered in each phase
+    char pad[64 - 2 * sizeof(int)];
+} keyfilter_readers_t;
+
+/* The current and building filters are published through atomic pointers,
+ * the lookups don't take any lock. The readers are counted (per phase) while
+ * accessing the filters, a replaced (or discarded) filter is released once
+ * the readers which might have seen it are gone: the phase is flipped and
+ * the readers which entered in the previous one are waited for */
+struct __keyfilter {
+    keyfilter_bloom_t *current;
+    keyfilter_bloom_t *building;
+    int phase;
+    keyfilter_readers_t readers[KEYFILTER_READER_STRIPES];
+    double fp_rate;
+    int ready;
+    keyfilter_stats_t stats;
+};
+
+// to size the filters without linking libm
+#define KEYFILTER_LN2 0.6931471805599453
+
+static keyfilter_bloom_t *
+keyfilter_bloom_create(size_t capacity, double fp_rate)
+{
+    if (capacity < KEYFILTER_CAPACITY_MIN)
+        capacity = KEYFILTER_CAPACITY_MIN;
+
+    // the number of hashes is -log2(fp_rate)
+    int nhashes = 0;
+    double p = 1.0;
+    while (p > fp_rate && nhashes < KEYFILTER_HASHES_MAX) {
+        p /= 2;
+        nhashes++;
+    }
+    if (!nhashes)
+        nhashes = 1;
+
+    keyfilter_bloom_t *bloom = calloc(1, sizeof(keyfilter_bloom_t));
+    bloom->capacity = capacity;
+    bloom->nhashes = nhashes;
+    // m = n * k / ln(2)
+    bloom->nbits = ((uint64_t)((double)capacity * nhashes / KEYFILTER_LN2) + 63) & ~63ULL;
+    bloom->bits = calloc(bloom->nbits / 64, sizeof(uint64_t));
+    return bloom;
+}
+
+static void
+keyfilter_bloom_destroy(keyfilter_bloom_t *bloom)
+{
+    free(bloom->bits);
+    free(bloom);
+}
+
+// double hashing, the second hash is derived from the first one
+// and forced to be odd so that it's never a multiple of the size
+#define KEYFILTER_BLOOM_HASH2(__h) ((((__h) >> 29) ^ ((__h) * 0x9E3779B97F4A7C15ULL)) | 1)
+
+static void
+keyfilter_bloom_set(keyfilter_bloom_t *bloom, uint64_t hash)
+{
+    uint64_t h2 = KEYFILTER_BLOOM_HASH2(hash);
+    int i;
+    for (i = 0; i < bloom->nhashes; i++) {
+        uint64_t bit = (hash + i * h2) % bloom->nbits;
+        uint64_t mask = 1ULL << (bit & 63);
+        uint64_t prev = __sync_fetch_and_or(&bloom->bits[bit >> 6], mask);
+        if (!(prev & mask))
+            ATOMIC_INCREMENT(bloom->bits_set);
+    }
+}
+
+static void
+keyfilter_bloom_add(keyfilter_bloom_t *bloom, uint64_t hash)
+{
+    keyfilter_bloom_set(bloom, hash);
+    ATOMIC_INCREMENT(bloom->items);
+}
+
+static int
+keyfilter_bloom_check(keyfilter_bloom_t *bloom, uint64_t hash)
+{
+    uint64_t h2 = KEYFILTER_BLOOM_HASH2(hash);
+    int i;
+    for (i = 0; i < bloom->nhashes; i++) {
+        uint64_t bit = (hash + i * h2) % bloom->nbits;
+        if (!(ATOMIC_READ(bloom->bits[bit >> 6]) & (1ULL << (bit & 63))))
+            return 0;
+    }
+    return 1;
+}
+
+// the false-positive rate is the probability of all the probed
+// bits being set: (bits_set / nbits) ^ nhashes
+static uint64_t
+keyfilter_bloom_fp_rate_ppm(keyfilter_bloom_t *bloom)
+{
+    double fill = (double)ATOMIC_READ(bloom->bits_set) / bloom->nbits;
+    double p = 1.0;
+    int i;
+    for (i = 0; i < bloom->nhashes; i++)
+        p *= fill;
+    return (uint64_t)(p * 1000000);
+}
+
+keyfilter_t *
+keyfilter_create(double fp_rate)
+{
+    keyfilter_t *kf = calloc(1, sizeof(keyfilter_t));
+    kf->fp_rate = (fp_rate > 0 && fp_rate < 1) ? fp_rate : 0.01;
+    return kf;
+}
+
+void
+keyfilter_destroy(keyfilter_t *kf)
+{
+    if (kf->current)
+        keyfilter_bloom_destroy(kf->current);
+    if (kf->building)
+        keyfilter_bloom_destroy(kf->building);
+    free(kf);
+}
+
+static __thread int keyfilter_reader_stripe = -1;
+static int keyfilter_reader_next = 0;
+
+static inline int *
+keyfilter_read_begin(keyfilter_t *kf)
+{
+    if (UNLIKELY(keyfilter_reader_stripe < 0))
+        keyfilter_reader_stripe = ATOMIC_INCREMENT(keyfilter_reader_next) % KEYFILTER_READER_STRIPES;
+    int *count = &kf->readers[keyfilter_reader_stripe].count[LOAD_ACQUIRE(kf->phase) & 1];
+    // NOTE: the increment is a full barrier, the filters are loaded after it
+    __sync_add_and_fetch(count, 1);
+    return count;
+}
+
+static inline void
+keyfilter_read_end(int *count)
+{
+    __sync_sub_and_fetch(count, 1);
+}
+
+// NOTE: must be called by the rebuilding thread only, after the filter
+//       to release has been unpublished
+static void
+keyfilter_synchronize(keyfilter_t *kf)
+{
+    int phase = LOAD_ACQUIRE(kf->phase) & 1;
+    ATOMIC_SET(kf->phase, phase ^ 1);
+
+    // the readers entering from now on go to the other phase
+    // and can only see the filters as they are now
+    int i;
+    for (i = 0; i < KEYFILTER_READER_STRIPES; i++) {
+        while (ATOMIC_READ(kf->readers[i].count[phase]))
+            usleep(10);
+    }
+}
+
+// NOTE: the building filter is read first, keyfilter_rebuild_end() publishes
+//       it as the current one before clearing it, so whatever the order of
+//       the swap the key ends up in the filter which is going to be current
+#define KEYFILTER_SNAPSHOT(__kf, __current, __building) { \
+    (__building) = LOAD_ACQUIRE((__kf)->building); \
+    (__current) = LOAD_ACQUIRE((__kf)->current); \
+    if ((__building) == (__current)) \
+        (__building) = NULL; \
+}
+
+void
+keyfilter_add(keyfilter_t *kf, uint64_t hash)
+{
+    keyfilter_bloom_t *current, *building;
+    int *readers = keyfilter_read_begin(kf);
+    KEYFILTER_SNAPSHOT(kf, current, building);
+    if (current) {
+        keyfilter_bloom_add(current, hash);
+        ATOMIC_SET(kf->stats.items, ATOMIC_READ(current->items));
+        ATOMIC_SET(kf->stats.fp_rate_ppm, keyfilter_bloom_fp_rate_ppm(current));
+    }
+    // the key might have been stored after the scan visited
+    // the part of the index where it belongs
+    if (building)
+        keyfilter_bloom_add(building, hash);
+    keyfilter_read_end(readers);
+}
+
+void
+keyfilter_commit(keyfilter_t *kf, uint64_t hash)
+{
+    // a rebuild might have started (or even completed) after the key
+    // was added, with the scan going past the key before it was stored.
+    // Setting the bits again doesn't count the key twice
+    keyfilter_bloom_t *current, *building;
+    int *readers = keyfilter_read_begin(kf);
+    KEYFILTER_SNAPSHOT(kf, current, building);
+    if (current)
+        keyfilter_bloom_set(current, hash);
+    if (building)
+        keyfilter_bloom_set(building, hash);
+    keyfilter_read_end(readers);
+}
+
+void
+keyfilter_remove(keyfilter_t *kf, uint64_t hash)
+{
+    ATOMIC_INCREMENT(kf->stats.removed);
+}
+
+int
+keyfilter_check(keyfilter_t *kf, uint64_t hash)
+{
+    int rc = 1;
+    int *readers = keyfilter_read_begin(kf);
+    keyfilter_bloom_t *current = LOAD_ACQUIRE(kf->current);
+    if (current && LOAD_ACQUIRE(kf->ready)) {
+        ATOMIC_INCREMENT(kf->stats.checks);
+        rc = keyfilter_bloom_check(current, hash);
+        if (!rc)
+            ATOMIC_INCREMENT(kf->stats.negatives);
+    }
+    keyfilter_read_end(readers);
+    return rc;
+}
+
+void
+keyfilter_false_positive(keyfilter_t *kf)
+{
+    // lookups done before the filter was ready didn't check it
+    if (ATOMIC_READ(kf->ready))
+        ATOMIC_INCREMENT(kf->stats.false_positives);
+}
+
+int
+keyfilter_rebuild_begin(keyfilter_t *kf, size_t capacity)
+{
+    if (LOAD_ACQUIRE(kf->building))
+        return -1;
+
+    keyfilter_bloom_t *building = keyfilter_bloom_create(capacity, kf->fp_rate);
+    if (!ATOMIC_CAS(kf->building, NULL, building)) {
+        keyfilter_bloom_destroy(building);
+        return -1;
+    }
+    return 0;
+}
+
+void
+keyfilter_rebuild_add(keyfilter_t *kf, uint64_t hash)
+{
+    // only the rebuilding thread replaces the building filter
+    keyfilter_bloom_add(kf->building, hash);
+}
+
+void
+keyfilter_rebuild_end(keyfilter_t *kf, int success)
+{
+    // only the rebuilding thread replaces the filters
+    keyfilter_bloom_t *building = LOAD_ACQUIRE(kf->building);
+    keyfilter_bloom_t *old = building;
+    if (success) {
+        old = kf->current;
+        ATOMIC_SET(kf->current, building);
+        ATOMIC_SET(kf->ready, 1);
+        ATOMIC_SET(kf->stats.items, ATOMIC_READ(building->items));
+        ATOMIC_SET(kf->stats.removed, 0);
+        ATOMIC_SET(kf->stats.fp_rate_ppm, keyfilter_bloom_fp_rate_ppm(building));
+        ATOMIC_INCREMENT(kf->stats.rebuilds);
+    }
+    ATOMIC_SET(kf->building, NULL);
+
+    if (old) {
+        keyfilter_synchronize(kf);
+        keyfilter_bloom_destroy(old);
+    }
+}
+
+int
+keyfilter_needs_rebuild(keyfilter_t *kf)
+{
+    int rc = 1;
+    int *readers = keyfilter_read_begin(kf);
+    keyfilter_bloom_t *current = LOAD_ACQUIRE(kf->current);
+    if (LOAD_ACQUIRE(kf->building)) {
+        rc = 0;
+    } else if (current && LOAD_ACQUIRE(kf->ready)) {
+        uint64_t target_ppm = kf->fp_rate * 1000000;
+        // too many keys have been added since the filter has been built,
+        // or too many of the keys it holds are gone
+        rc = (keyfilter_bloom_fp_rate_ppm(current) > 2 * target_ppm ||
+              ATOMIC_READ(kf->stats.removed) > current->capacity / 2);
+    }
+    keyfilter_read_end(readers);
+    return rc;
+}
+
+keyfilter_stats_t *
+keyfilter_stats(keyfilter_t *kf)
+{
+    return &kf->stats;
+}
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
@@ -0,0 +1,117 @@
+/**
+ * @file keyfilter.h
+ * @brief Membership filter of the keys stored in the persistent storage
+ *
+ * A Bloom filter (indexed by the hash of the keys) telling if a key is
+ * definitely not in the storage, so that misses and existence checks for
+ * such keys can be answered without hitting the storage.
+ * Keys can't be removed from a Bloom filter, the removals are only accounted
+ * and the filter is rebuilt (by scanning the storage index) once too many
+ * stale or new keys push its false-positive rate above the target.
+ * While a rebuild is in progress the keys added are stored in both the
+ * current filter and the one being built, which replaces the current one
+ * once the scan is complete.
+ * Keys are added before being stored (so that a concurrent lookup can only
+ * see a false positive) and committed once stored (so that a rebuild which
+ * started in the meanwhile doesn't miss them).
+ * None of the calls takes a lock, a replaced filter is released by
+ * keyfilter_rebuild_end() once no call can be accessing it anymore.
+ */
+#ifndef __KEYFILTER_H__
+#define __KEYFILTER_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+typedef struct __keyfilter keyfilter_t;
+
+typedef struct {
+    uint64_t checks;          // lookups done on a ready filter
+    uint64_t negatives;       // lookups answered as definite misses
+    uint64_t false_positives; // lookups which passed the filter but missed the storage
+    uint64_t fp_rate_ppm;     // estimated false-positive rate (in parts per million)
+    uint64_t items;           // keys added to the current filter
+    uint64_t removed;         // keys removed since the current filter has been built
+    uint64_t rebuilds;        // filters built from the storage index
+} keyfilter_stats_t;
+
+/**
+ * @brief Create a new (empty and not ready) filter
+ * @param fp_rate The target false-positive rate
+ * @return A newly initialized filter
+ * @note The filter doesn't answer any lookup until it has been
+ *       built for the first time (see keyfilter_rebuild_begin())
+ */
+keyfilter_t *keyfilter_create(double fp_rate);
+
+/**
+ * @brief Release all the resources used by the filter
+ */
+void keyfilter_destroy(keyfilter_t *kf);
+
+/**
+ * @brief Add a key (which has been stored)
+ * @param hash The hash of the key (as returned by arc_hash_key())
+ */
+void keyfilter_add(keyfilter_t *kf, uint64_t hash);
+
+/**
+ * @brief Commit a key added with keyfilter_add() once it has been stored
+ * @param hash The hash of the key (as returned by arc_hash_key())
+ * @note A rebuild begun between the two calls might have scanned the storage
+ *       index before the key was there, the key is added to the filter being
+ *       built (or already built) so that it's never reported as missing
+ */
+void keyfilter_commit(keyfilter_t *kf, uint64_t hash);
+
+/**
+ * @brief Account a key which has been removed from the storage
+ */
+void keyfilter_remove(keyfilter_t *kf, uint64_t hash);
+
+/**
+ * @brief Check if a key might be in the storage
+ * @return 0 if the key is definitely not in the storage,
+ *         1 if it might be (or if the filter is not ready)
+ */
+int keyfilter_check(keyfilter_t *kf, uint64_t hash);
+
+/**
+ * @brief Account a lookup which passed the filter but missed the storage
+ */
+void keyfilter_false_positive(keyfilter_t *kf);
+
+/**
+ * @brief Start building a new filter
+ * @param capacity The number of keys the new filter is sized for
+ * @return 0 on success, -1 if a rebuild is already in progress
+ */
+int keyfilter_rebuild_begin(keyfilter_t *kf, size_t capacity);
+
+/**
+ * @brief Add a key found in the storage index to the filter being built
+ */
+void keyfilter_rebuild_add(keyfilter_t *kf, uint64_t hash);
+
+/**
+ * @brief Complete the rebuild
+ * @param success If true the new filter replaces the current one
+ *                (and the filter becomes ready), otherwise it's discarded
+ */
+void keyfilter_rebuild_end(keyfilter_t *kf, int success);
+
+/**
+ * @brief Returns true if the filter needs to be (re)built
+ */
+int keyfilter_needs_rebuild(keyfilter_t *kf);
+
+/**
+ * @brief Returns the counters of the filter
+ * @note The counters are updated using the atomic builtins
+ */
+keyfilter_stats_t *keyfilter_stats(keyfilter_t *kf);
+
+#endif /* __KEYFILTER_H__ */
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
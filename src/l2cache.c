@@ -0,0 +1,582 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include <atomic_defs.h>
+
+#include "shardcache_internal.h" // for MUTEX_* macros
+
+#include "arc_index.h"
+#include "l2cache.h"
+
+#define L2CACHE_MAGIC 0x6c326301
+
+// number of slots used to remember (by hash) when keys have been removed
+#define L2CACHE_TOMBSTONES 4096
+
+// number of prefix removals remembered to reject stale objects
+#define L2CACHE_PREFIX_TOMBSTONES 16
+
+#define L2CACHE_INDEX_SIZE_HINT 1024
+
+#pragma pack(push, 1)
+typedef struct {
+    uint32_t magic;
+    uint32_t klen;
+    uint32_t dlen;
+    uint32_t ts;
+    uint64_t seq;
+} l2cache_record_hdr_t;
+#pragma pack(pop)
+
+// a record in the log. It's referenced by the index until
+// the key is removed or a newer record is written for it
+typedef struct __l2cache_entry {
+    struct __l2cache_entry *next; // the next (newer) record in the log
+    uint64_t offset;
+    uint64_t seq;
+    uint64_t hash;
+    uint32_t size;                // the size of the record (header included)
+    uint32_t klen;
+    int indexed;
+    char key[];
+} l2cache_entry_t;
+
+// an object waiting to be written
+typedef struct __l2cache_job {
+    struct __l2cache_job *next;
+    uint64_t hash;
+    size_t klen;
+    size_t dlen;
+    int cancelled;
+    char buf[]; // the record as it's going to be written (header, key, data)
+} l2cache_job_t;
+
+typedef struct {
+    char *prefix;
+    size_t plen;
+    uint64_t version; // the version at which the prefix has been removed
+} l2cache_prefix_tombstone_t;
+
+#define L2CACHE_JOB_HDR(__j) ((l2cache_record_hdr_t *)(__j)->buf)
+#define L2CACHE_JOB_KEY(__j) ((__j)->buf + sizeof(l2cache_record_hdr_t))
+#define L2CACHE_JOB_DATA(__j) (L2CACHE_JOB_KEY(__j) + (__j)->klen)
+#define L2CACHE_JOB_SIZE(__j) (sizeof(l2cache_record_hdr_t) + (__j)->klen + (__j)->dlen)
+
+struct __l2cache {
+    int fd;
+    size_t size;
+    size_t max_object_size;
+
+    size_t write_rate;
+    size_t tokens;          // bytes which can still be admitted
+    struct timeval refill;  // last time the tokens have been refilled
+
+    uint64_t head;           // where the next record will be written
+    uint64_t seq;
+    l2cache_entry_t *oldest; // the records in the log (in the order they have been written)
+    l2cache_entry_t *newest;
+    arc_index_t *index;      // key -> l2cache_entry_t
+
+    l2cache_job_t *jobs;     // the objects waiting to be written
+    l2cache_job_t *last_job;
+    arc_index_t *pending;    // key -> l2cache_job_t (including the one being written)
+    l2cache_job_t *writing;  // the job being written
+
+    uint64_t version;
+    uint64_t removed[L2CACHE_TOMBSTONES]; // the version at which keys have been removed
+    l2cache_prefix_tombstone_t removed_prefixes[L2CACHE_PREFIX_TOMBSTONES];
+    int removed_prefixes_next;
+    uint64_t removed_before; // objects loaded before this version are never admitted
+                             // (set when a prefix tombstone is recycled)
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t writer_th;
+    int quit;
+
+    l2cache_stats_t stats;
+};
+
+static int
+l2cache_entry_match(void *value, const void *key, size_t klen, void *priv)
+{
+    l2cache_entry_t *entry = (l2cache_entry_t *)value;
+    return (entry->klen == klen && memcmp(entry->key, key, klen) == 0);
+}
+
+static int
+l2cache_job_match(void *value, const void *key, size_t klen, void *priv)
+{
+    l2cache_job_t *job = (l2cache_job_t *)value;
+    return (job->klen == klen && memcmp(L2CACHE_JOB_KEY(job), key, klen) == 0);
+}
+
+// NOTE: all the following static functions must be called with the lock held
+
+static inline int
+l2cache_is_stale(l2cache_t *l2, void *key, size_t klen, uint64_t hash, uint64_t version)
+{
+    if (l2->removed[hash % L2CACHE_TOMBSTONES] > version || l2->removed_before > version)
+        return 1;
+
+    int i;
+    for (i = 0; i < L2CACHE_PREFIX_TOMBSTONES; i++) {
+        l2cache_prefix_tombstone_t *tombstone = &l2->removed_prefixes[i];
+        if (tombstone->version > version && klen >= tombstone->plen &&
+            memcmp(key, tombstone->prefix, tombstone->plen) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+l2cache_unindex(l2cache_t *l2, l2cache_entry_t *entry)
+{
+    arc_index_delete_if_equals(l2->index, entry->key, entry->klen, entry->hash, entry);
+    entry->indexed = 0;
+    ATOMIC_DECREMENT(l2->stats.items);
+}
+
+static void
+l2cache_drop_oldest(l2cache_t *l2)
+{
+    l2cache_entry_t *entry = l2->oldest;
+    l2->oldest = entry->next;
+    if (!l2->oldest)
+        l2->newest = NULL;
+    if (entry->indexed)
+        l2cache_unindex(l2, entry);
+    free(entry);
+}
+
+// drop the records stored where the next 'size' bytes are going to be written
+static void
+l2cache_make_room(l2cache_t *l2, size_t size)
+{
+    // the records written before the current head belong to the current lap
+    // and are all newer than the ones stored after it
+    if (l2->head + size > l2->size) {
+        // not enough space before the end of the file,
+        // drop whatever is left of the previous lap and wrap around
+        while (l2->oldest && l2->oldest->offset >= l2->head)
+            l2cache_drop_oldest(l2);
+        l2->head = 0;
+    }
+
+    while (l2->oldest &&
+           l2->oldest->offset >= l2->head &&
+           l2->oldest->offset < l2->head + size)
+    {
+        l2cache_drop_oldest(l2);
+    }
+}
+
+static void
+l2cache_refill(l2cache_t *l2)
+{
+    struct timeval now, diff;
+    gettimeofday(&now, NULL);
+    timersub(&now, &l2->refill, &diff);
+    if (diff.tv_sec >= 1 || diff.tv_sec < 0) {
+        l2->tokens = l2->write_rate;
+        l2->refill = now;
+    } else {
+        size_t amount = ((uint64_t)l2->write_rate * diff.tv_usec) / 1000000;
+        if (amount) {
+            l2->tokens += amount;
+            if (l2->tokens > l2->write_rate)
+                l2->tokens = l2->write_rate;
+            l2->refill = now;
+        }
+    }
+}
+
+static void
+l2cache_write(l2cache_t *l2, l2cache_job_t *job)
+{
+    size_t size = L2CACHE_JOB_SIZE(job);
+
+    l2cache_make_room(l2, size);
+
+    l2cache_entry_t *entry = malloc(sizeof(l2cache_entry_t) + job->klen);
+    entry->next = NULL;
+    entry->offset = l2->head;
+    entry->seq = ++l2->seq;
+    entry->hash = job->hash;
+    entry->size = size;
+    entry->klen = job->klen;
+    entry->indexed = 0;
+    memcpy(entry->key, L2CACHE_JOB_KEY(job), job->klen);
+
+    // reserve the area by appending the entry to the log,
+    // so that the record can be written without holding the lock
+    if (l2->newest)
+        l2->newest->next = entry;
+    else
+        l2->oldest = entry;
+    l2->newest = entry;
+    l2->head += size;
+
+    L2CACHE_JOB_HDR(job)->seq = entry->seq;
+
+    MUTEX_UNLOCK(&l2->lock);
+    ssize_t wb = pwrite(l2->fd, job->buf, size, entry->offset);
+    MUTEX_LOCK(&l2->lock);
+
+    if (wb != (ssize_t)size) {
+        // the entry will stay in the log (not indexed) until overwritten
+        SHC_ERROR("Can't write to the l2 cache: %s", wb < 0 ? strerror(errno) : "short write");
+        return;
+    }
+
+    ATOMIC_INCREMENT(l2->stats.writes);
+    ATOMIC_INCREASE(l2->stats.written_bytes, size);
+
+    // the key has been removed while the record was being written
+    if (job->cancelled)
+        return;
+
+    l2cache_entry_t *prev = arc_index_get(l2->index, entry->key, entry->klen, entry->hash);
+    if (prev)
+        l2cache_unindex(l2, prev);
+
+    if (arc_index_set_if_not_exists(l2->index, entry->key, entry->klen, entry->hash, entry) == 0) {
+        entry->indexed = 1;
+        ATOMIC_INCREMENT(l2->stats.items);
+    }
+}
+
+static void *
+l2cache_writer(void *priv)
+{
+    l2cache_t *l2 = (l2cache_t *)priv;
+
+    MUTEX_LOCK(&l2->lock);
+    while (!l2->quit) {
+        l2cache_job_t *job = l2->jobs;
+        if (!job) {
+            pthread_cond_wait(&l2->cond, &l2->lock);
+            continue;
+        }
+
+        l2->jobs = job->next;
+        if (!l2->jobs)
+            l2->last_job = NULL;
+
+        // NOTE: cancelled jobs have been already removed from the pending index
+        if (!job->cancelled) {
+            l2->writing = job;
+            l2cache_write(l2, job);
+            l2->writing = NULL;
+            arc_index_delete_if_equals(l2->pending, L2CACHE_JOB_KEY(job), job->klen, job->hash, job);
+        }
+        free(job);
+    }
+    MUTEX_UNLOCK(&l2->lock);
+
+    return NULL;
+}
+
+l2cache_t *
+l2cache_create(char *path, size_t size, size_t write_rate)
+{
+    if (!size || !write_rate)
+        return NULL;
+
+    int fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0600);
+    if (fd < 0) {
+        SHC_ERROR("Can't open the l2 cache file %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        SHC_ERROR("Can't resize the l2 cache file %s: %s", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    l2cache_t *l2 = calloc(1, sizeof(l2cache_t));
+    l2->fd = fd;
+    l2->size = size;
+    l2->write_rate = write_rate;
+    l2->tokens = write_rate;
+    gettimeofday(&l2->refill, NULL);
+
+    // a single object shouldn't flush a big part of the log
+    // and must fit the write budget
+    l2->max_object_size = size / 8;
+    if (l2->max_object_size > write_rate)
+        l2->max_object_size = write_rate;
+
+    l2->index = arc_index_create(L2CACHE_INDEX_SIZE_HINT, l2cache_entry_match, NULL, NULL);
+    l2->pending = arc_index_create(L2CACHE_INDEX_SIZE_HINT, l2cache_job_match, NULL, NULL);
+
+    MUTEX_INIT(&l2->lock);
+    CONDITION_INIT(&l2->cond);
+
+    if (pthread_create(&l2->writer_th, NULL, l2cache_writer, l2) != 0) {
+        SHC_ERROR("Can't create the l2 cache writer thread: %s", strerror(errno));
+        arc_index_destroy(l2->index);
+        arc_index_destroy(l2->pending);
+        MUTEX_DESTROY(&l2->lock);
+        CONDITION_DESTROY(&l2->cond);
+        close(fd);
+        free(l2);
+        return NULL;
+    }
+
+    return l2;
+}
+
+void
+l2cache_destroy(l2cache_t *l2)
+{
+    MUTEX_LOCK(&l2->lock);
+    l2->quit = 1;
+    pthread_cond_signal(&l2->cond);
+    MUTEX_UNLOCK(&l2->lock);
+
+    pthread_join(l2->writer_th, NULL);
+
+    while (l2->jobs) {
+        l2cache_job_t *job = l2->jobs;
+        l2->jobs = job->next;
+        free(job);
+    }
+
+    while (l2->oldest)
+        l2cache_drop_oldest(l2);
+
+    arc_index_destroy(l2->index);
+    arc_index_destroy(l2->pending);
+
+    int i;
+    for (i = 0; i < L2CACHE_PREFIX_TOMBSTONES; i++)
+        free(l2->removed_prefixes[i].prefix);
+
+    MUTEX_DESTROY(&l2->lock);
+    CONDITION_DESTROY(&l2->cond);
+
+    close(l2->fd);
+    free(l2);
+}
+
+int
+l2cache_admit(l2cache_t *l2,
+              void *key,
+              size_t klen,
+              uint64_t hash,
+              void *data,
+              size_t dlen,
+              time_t ts,
+              uint64_t version)
+{
+    size_t size = sizeof(l2cache_record_hdr_t) + klen + dlen;
+    if (!dlen || size > l2->max_object_size) {
+        ATOMIC_INCREMENT(l2->stats.rejected);
+        return -1;
+    }
+
+    MUTEX_LOCK(&l2->lock);
+
+    // either the value might be stale or it's already stored
+    if (l2cache_is_stale(l2, key, klen, hash, version) ||
+        arc_index_get(l2->pending, key, klen, hash) ||
+        arc_index_get(l2->index, key, klen, hash))
+    {
+        MUTEX_UNLOCK(&l2->lock);
+        return 1;
+    }
+
+    l2cache_refill(l2);
+    if (size > l2->tokens) {
+        MUTEX_UNLOCK(&l2->lock);
+        ATOMIC_INCREMENT(l2->stats.rejected);
+        return -1;
+    }
+    l2->tokens -= size;
+
+    l2cache_job_t *job = malloc(sizeof(l2cache_job_t) + size);
+    job->next = NULL;
+    job->hash = hash;
+    job->klen = klen;
+    job->dlen = dlen;
+    job->cancelled = 0;
+
+    l2cache_record_hdr_t *hdr = L2CACHE_JOB_HDR(job);
+    hdr->magic = L2CACHE_MAGIC;
+    hdr->klen = klen;
+    hdr->dlen = dlen;
+    hdr->ts = ts;
+    hdr->seq = 0; // set by the writer
+    memcpy(L2CACHE_JOB_KEY(job), key, klen);
+    memcpy(L2CACHE_JOB_DATA(job), data, dlen);
+
+    arc_index_set_if_not_exists(l2->pending, L2CACHE_JOB_KEY(job), klen, hash, job);
+
+    if (l2->last_job)
+        l2->last_job->next = job;
+    else
+        l2->jobs = job;
+    l2->last_job = job;
+
+    pthread_cond_signal(&l2->cond);
+    MUTEX_UNLOCK(&l2->lock);
+
+    return 0;
+}
+
+int
+l2cache_get(l2cache_t *l2,
+            void *key,
+            size_t klen,
+            uint64_t hash,
+            void **data,
+            size_t *dlen,
+            time_t *ts)
+{
+    MUTEX_LOCK(&l2->lock);
+
+    // objects still waiting to be written are served from memory
+    l2cache_job_t *job = arc_index_get(l2->pending, key, klen, hash);
+    if (job) {
+        *data = malloc(job->dlen);
+        memcpy(*data, L2CACHE_JOB_DATA(job), job->dlen);
+        *dlen = job->dlen;
+        *ts = L2CACHE_JOB_HDR(job)->ts;
+        MUTEX_UNLOCK(&l2->lock);
+        ATOMIC_INCREMENT(l2->stats.hits);
+        return 0;
+    }
+
+    l2cache_entry_t *entry = arc_index_get(l2->index, key, klen, hash);
+    if (!entry) {
+        MUTEX_UNLOCK(&l2->lock);
+        ATOMIC_INCREMENT(l2->stats.misses);
+        return -1;
+    }
+
+    uint64_t offset = entry->offset;
+    uint64_t seq = entry->seq;
+    size_t size = entry->size;
+
+    MUTEX_UNLOCK(&l2->lock);
+
+    char *buf = malloc(size);
+    l2cache_record_hdr_t *hdr = (l2cache_record_hdr_t *)buf;
+    int found = 0;
+
+    if (pread(l2->fd, buf, size, offset) == (ssize_t)size &&
+        hdr->magic == L2CACHE_MAGIC &&
+        hdr->seq == seq &&
+        hdr->klen == klen &&
+        sizeof(l2cache_record_hdr_t) + hdr->klen + hdr->dlen == size &&
+        memcmp(buf + sizeof(l2cache_record_hdr_t), key, klen) == 0)
+    {
+        // the area is overwritten only after the record has been dropped
+        // from the index, so if it's still there we have read a valid copy
+        MUTEX_LOCK(&l2->lock);
+        entry = arc_index_get(l2->index, key, klen, hash);
+        found = (entry && entry->seq == seq);
+        MUTEX_UNLOCK(&l2->lock);
+    }
+
+    if (!found) {
+        free(buf);
+        ATOMIC_INCREMENT(l2->stats.misses);
+        return -1;
+    }
+
+    *dlen = hdr->dlen;
+    *ts = hdr->ts;
+    memmove(buf, buf + sizeof(l2cache_record_hdr_t) + klen, *dlen);
+    *data = buf;
+
+    ATOMIC_INCREMENT(l2->stats.hits);
+    return 0;
+}
+
+void
+l2cache_remove(l2cache_t *l2, void *key, size_t klen, uint64_t hash)
+{
+    MUTEX_LOCK(&l2->lock);
+
+    ATOMIC_INCREMENT(l2->version);
+    l2->removed[hash % L2CACHE_TOMBSTONES] = l2->version;
+
+    l2cache_job_t *job = arc_index_get(l2->pending, key, klen, hash);
+    if (job) {
+        arc_index_delete_if_equals(l2->pending, key, klen, hash, job);
+        job->cancelled = 1;
+    }
+
+    l2cache_entry_t *entry = arc_index_get(l2->index, key, klen, hash);
+    if (entry)
+        l2cache_unindex(l2, entry);
+
+    MUTEX_UNLOCK(&l2->lock);
+}
+
+static inline void
+l2cache_cancel_prefix(l2cache_t *l2, l2cache_job_t *job, void *prefix, size_t plen)
+{
+    if (!job->cancelled && job->klen >= plen && memcmp(L2CACHE_JOB_KEY(job), prefix, plen) == 0) {
+        arc_index_delete_if_equals(l2->pending, L2CACHE_JOB_KEY(job), job->klen, job->hash, job);
+        job->cancelled = 1;
+    }
+}
+
+void
+l2cache_remove_prefix(l2cache_t *l2, void *prefix, size_t plen)
+{
+    MUTEX_LOCK(&l2->lock);
+
+    ATOMIC_INCREMENT(l2->version);
+
+    // once recycled, a tombstone is accounted in removed_before
+    l2cache_prefix_tombstone_t *tombstone = &l2->removed_prefixes[l2->removed_prefixes_next];
+    if (tombstone->version > l2->removed_before)
+        l2->removed_before = tombstone->version;
+    free(tombstone->prefix);
+    tombstone->prefix = malloc(plen ? plen : 1);
+    memcpy(tombstone->prefix, prefix, plen);
+    tombstone->plen = plen;
+    tombstone->version = l2->version;
+    l2->removed_prefixes_next = (l2->removed_prefixes_next + 1) % L2CACHE_PREFIX_TOMBSTONES;
+
+    l2cache_job_t *job;
+    for (job = l2->jobs; job; job = job->next)
+        l2cache_cancel_prefix(l2, job, prefix, plen);
+    if (l2->writing)
+        l2cache_cancel_prefix(l2, l2->writing, prefix, plen);
+
+    l2cache_entry_t *entry;
+    for (entry = l2->oldest; entry; entry = entry->next) {
+        if (entry->indexed && entry->klen >= plen && memcmp(entry->key, prefix, plen) == 0)
+            l2cache_unindex(l2, entry);
+    }
+
+    MUTEX_UNLOCK(&l2->lock);
+}
+
+uint64_t
+l2cache_version(l2cache_t *l2)
+{
+    return ATOMIC_READ(l2->version);
+}
+
+l2cache_stats_t *
+l2cache_stats(l2cache_t *l2)
+{
+    return &l2->stats;
+}
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
@@ -0,0 +1,112 @@
+/**
+ * @file l2cache.h
+ * @brief File-backed second-level cache sitting behind the ARC
+ *
+ * Objects dropped from the ARC are queued and appended by a background
+ * writer thread to a circular log stored in a local file, while a compact
+ * in-memory index maps each key to its latest record. Once the write head
+ * reaches the end of the file it wraps around overwriting the oldest records.
+ * Writes are admitted only within a configurable budget of bytes per second
+ * so that the device is not worn out by objects churning through the ARC.
+ *
+ * @note The index is kept in memory only, so the content of the file
+ *       is discarded when the cache is created
+ */
+#ifndef __L2CACHE_H__
+#define __L2CACHE_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct __l2cache l2cache_t;
+
+typedef struct {
+    uint64_t hits;          // lookups served by the l2 cache
+    uint64_t misses;        // lookups which didn't find the key
+    uint64_t writes;        // records written to the file
+    uint64_t written_bytes; // bytes written to the file
+    uint64_t rejected;      // objects not admitted (too big or out of write budget)
+    uint64_t items;         // keys currently stored
+} l2cache_stats_t;
+
+/**
+ * @brief Create a new l2 cache
+ * @param path       The file where to store the records
+ *                   (created if it doesn't exist, truncated otherwise)
+ * @param size       The size of the file
+ * @param write_rate The maximum amount of bytes admitted per second
+ * @return A newly initialized l2 cache, NULL on errors
+ */
+l2cache_t *l2cache_create(char *path, size_t size, size_t write_rate);
+
+/**
+ * @brief Stop the writer thread and release all the resources
+ * @note The objects still waiting to be written are discarded
+ */
+void l2cache_destroy(l2cache_t *l2);
+
+/**
+ * @brief Queue an object to be written to the l2 cache
+ * @param hash The hash of the key (as returned by arc_hash_key())
+ * @param ts   The time at which the object has been loaded
+ * @param version The value returned by l2cache_version() before
+ *                the object has been loaded
+ * @return 0 if the object has been queued, 1 if it's already stored
+ *         (or the key has been removed after the object has been loaded),
+ *         -1 if the object has not been admitted
+ */
+int l2cache_admit(l2cache_t *l2,
+                  void *key,
+                  size_t klen,
+                  uint64_t hash,
+                  void *data,
+                  size_t dlen,
+                  time_t ts,
+                  uint64_t version);
+
+/**
+ * @brief Retrieve an object from the l2 cache
+ * @param data Where to store the pointer to the data
+ *             (which must be released by the caller using free())
+ * @param dlen Where to store the length of the data
+ * @param ts   Where to store the time at which the object has been loaded
+ * @return 0 if the object has been found, -1 otherwise
+ */
+int l2cache_get(l2cache_t *l2,
+                void *key,
+                size_t klen,
+                uint64_t hash,
+                void **data,
+                size_t *dlen,
+                time_t *ts);
+
+/**
+ * @brief Remove a key (and any pending write for it) from the l2 cache
+ */
+void l2cache_remove(l2cache_t *l2, void *key, size_t klen, uint64_t hash);
+
+/**
+ * @brief Remove all the keys starting with the given prefix
+ *        (and any pending write for them) from the l2 cache
+ * @note The whole log is visited
+ */
+void l2cache_remove_prefix(l2cache_t *l2, void *prefix, size_t plen);
+
+/**
+ * @brief Returns the current removal version
+ * @note Objects loaded before a removal of their key (detected by comparing
+ *       the version obtained before loading them) won't be admitted
+ */
+uint64_t l2cache_version(l2cache_t *l2);
+
+/**
+ * @brief Returns the counters of the l2 cache
+ * @note The counters are updated using the atomic builtins
+ */
+l2cache_stats_t *l2cache_stats(l2cache_t *l2);
+
+#endif /* __L2CACHE_H__ */
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
@@ -559,6 +559,32 @@ fetch_from_peer_helper(void *data,
     return ret;
 }
 
+void
+build_trace_record(shardcache_trace_t *trace, unsigned char *buf, shardcache_record_t *record)
+{
+    uint32_t high = htonl((uint32_t)(trace->id >> 32));
+    uint32_t low = htonl((uint32_t)trace->id);
+    memcpy(buf, &high, sizeof(uint32_t));
+    memcpy(buf + sizeof(uint32_t), &low, sizeof(uint32_t));
+    buf[2 * sizeof(uint32_t)] = trace->flags;
+    record->v = buf;
+    record->l = SHC_TRACE_RECORD_LEN;
+}
+
+int
+parse_trace_record(void *data, size_t len, shardcache_trace_t *trace)
+{
+    if (len != SHC_TRACE_RECORD_LEN)
+        return -1;
+
+    uint32_t high, low;
+    memcpy(&high, data, sizeof(uint32_t));
+    memcpy(&low, (char *)data + sizeof(uint32_t), sizeof(uint32_t));
+    trace->id = ((uint64_t)ntohl(high) << 32) | ntohl(low);
+    trace->flags = ((unsigned char *)data)[2 * sizeof(uint32_t)];
+    return trace->id ? 0 : -1;
+}
+
 int
 fetch_from_peer_async(char *peer,
                       char *auth,
@@ -567,6 +593,8 @@ fetch_from_peer_async(char *peer,
                       size_t klen,
                       size_t offset,
                       size_t len,
+                      uint32_t deadline,
+                      shardcache_trace_t *trace,
                       fetch_from_peer_async_cb cb,
                       void *priv,
                       int fd,
@@ -581,8 +609,10 @@ fetch_from_peer_async(char *peer,
 
     uint32_t offset_nbo = htonl(offset);
     uint32_t len_nbo = htonl(len);
+    uint32_t deadline_nbo = htonl(deadline);
+    unsigned char trace_buf[SHC_TRACE_RECORD_LEN];
     if (fd >= 0) {
-        shardcache_record_t record[3] = {
+        shardcache_record_t record[5] = {
             {
                 .v = key,
                 .l = klen
@@ -594,13 +624,29 @@ fetch_from_peer_async(char *peer,
             {
                 .v = &len_nbo,
                 .l = sizeof(uint32_t)
+            },
+            {
+                .v = &deadline_nbo,
+                .l = sizeof(uint32_t)
             }
         };
 
-        if (!offset && !len)
-            rc = write_message(fd, auth, sig_hdr, SHC_HDR_GET_ASYNC, &record[0], 1);
-        else
-            rc = write_message(fd, auth, sig_hdr, SHC_HDR_GET_OFFSET, record, 3);
+        // the trace context (if any) follows the deadline
+        // (which is then sent even if there is none)
+        int traced = (trace && trace->id);
+        if (traced)
+            build_trace_record(trace, trace_buf, &record[4]);
+
+        if (!offset && !len) {
+            // the deadline (if any) follows the key
+            if (deadline || traced)
+                record[1] = record[3];
+            if (traced)
+                record[2] = record[4];
+            rc = write_message(fd, auth, sig_hdr, SHC_HDR_GET_ASYNC, &record[0], traced ? 3 : deadline ? 2 : 1);
+        } else {
+            rc = write_message(fd, auth, sig_hdr, SHC_HDR_GET_OFFSET, record, traced ? 5 : deadline ? 4 : 3);
+        }
 
         if (rc == 0) {
             fetch_from_peer_helper_arg_t *arg = calloc(1, sizeof(fetch_from_peer_helper_arg_t));
@@ -756,9 +802,11 @@ read_message(int fd,
                 hdr != SHC_HDR_ADD &&
                 hdr != SHC_HDR_EXISTS &&
                 hdr != SHC_HDR_TOUCH &&
+                hdr != SHC_HDR_PREFETCH &&
                 hdr != SHC_HDR_MIGRATION_BEGIN &&
                 hdr != SHC_HDR_MIGRATION_ABORT &&
                 hdr != SHC_HDR_MIGRATION_END &&
+                hdr != SHC_HDR_MIGRATION_WARMUP &&
                 hdr != SHC_HDR_CHECK &&
                 hdr != SHC_HDR_STATS &&
                 hdr != SHC_HDR_GET_INDEX &&
@@ -1069,6 +1117,7 @@ _delete_from_peer_internal(char *peer,
                            unsigned char sig_hdr,
                            void *key,
                            size_t klen,
+                           shardcache_trace_t *trace,
                            int owner,
                            int fd,
                            int expect_response)
@@ -1090,11 +1139,17 @@ _delete_from_peer_internal(char *peer,
         else
             hdr = SHC_HDR_EVICT;
 
-        shardcache_record_t record = {
-            .v = key,
-            .l = klen
+        shardcache_record_t record[2] = {
+            {
+                .v = key,
+                .l = klen
+            }
         };
-        rc = write_message(fd, auth, sig_hdr, hdr, &record, 1);
+        unsigned char trace_buf[SHC_TRACE_RECORD_LEN];
+        int traced = (trace && trace->id);
+        if (traced)
+            build_trace_record(trace, trace_buf, &record[1]);
+        rc = write_message(fd, auth, sig_hdr, hdr, record, traced ? 2 : 1);
 
         // if we are not forwarding a delete command to the owner
         // of the key, but only an eviction request to a peer,
@@ -1134,10 +1189,11 @@ delete_from_peer(char *peer,
                  unsigned char sig,
                  void *key,
                  size_t klen,
+                 shardcache_trace_t *trace,
                  int fd,
                  int expect_response)
 {
-    return _delete_from_peer_internal(peer, auth, sig, key, klen, 1, fd, expect_response);
+    return _delete_from_peer_internal(peer, auth, sig, key, klen, trace, 1, fd, expect_response);
 }
 
 int
@@ -1146,10 +1202,11 @@ evict_from_peer(char *peer,
                 unsigned char sig,
                 void *key,
                 size_t klen,
+                shardcache_trace_t *trace,
                 int fd,
                 int expect_response)
 {
-    return _delete_from_peer_internal(peer, auth, sig, key, klen, 0, fd, expect_response);
+    return _delete_from_peer_internal(peer, auth, sig, key, klen, trace, 0, fd, expect_response);
 }
 
 
@@ -1163,6 +1220,7 @@ _send_to_peer_internal(char *peer,
                        void *value,
                        size_t vlen,
                        uint32_t expire,
+                       shardcache_trace_t *trace,
                        int add,
                        int fd,
                        int expect_response)
@@ -1175,7 +1233,7 @@ _send_to_peer_internal(char *peer,
 
     int rc = -1;
     if (fd >= 0) {
-        shardcache_record_t record[3] = {
+        shardcache_record_t record[4] = {
             {
                 .v = key,
                 .l = klen
@@ -1186,15 +1244,22 @@ _send_to_peer_internal(char *peer,
             }
         };
 
+        // the trace context (if any) follows the ttl
+        // (which is then sent even if there is none)
+        unsigned char trace_buf[SHC_TRACE_RECORD_LEN];
+        int traced = (trace && trace->id);
+        if (traced)
+            build_trace_record(trace, trace_buf, &record[3]);
+
         uint32_t expire_nbo = 0;
-        if (expire) {
+        if (expire || traced) {
             expire_nbo = htonl(expire);
             record[2].v = &expire_nbo;
             record[2].l = sizeof(expire);
         }
         rc = write_message(fd, auth, sig_hdr,
                                add ? SHC_HDR_ADD : SHC_HDR_SET,
-                               record, expire ? 3 : 2);
+                               record, traced ? 4 : expire ? 3 : 2);
         if (rc != 0) {
             if (should_close)
                 close(fd);
@@ -1255,11 +1320,12 @@ send_to_peer(char *peer,
              void *value,
              size_t vlen,
              uint32_t expire,
+             shardcache_trace_t *trace,
              int fd,
              int expect_response)
 {
     return _send_to_peer_internal(peer,
-            auth, sig, key, klen, value, vlen, expire, 0, fd, expect_response);
+            auth, sig, key, klen, value, vlen, expire, trace, 0, fd, expect_response);
 }
 
 int
@@ -1271,11 +1337,12 @@ add_to_peer(char *peer,
             void *value,
             size_t vlen,
             uint32_t expire,
+            shardcache_trace_t *trace,
             int fd,
             int expect_response)
 {
     return _send_to_peer_internal(peer, auth, sig, key, klen,
-                                  value, vlen, expire, 1, fd, expect_response);
+                                  value, vlen, expire, trace, 1, fd, expect_response);
 }
 
 int
@@ -1284,6 +1351,8 @@ fetch_from_peer(char *peer,
                 unsigned char sig_hdr,
                 void *key,
                 size_t len,
+                uint32_t deadline,
+                shardcache_trace_t *trace,
                 fbuf_t *out,
                 int fd)
 {
@@ -1294,12 +1363,24 @@ fetch_from_peer(char *peer,
     }
 
     if (fd >= 0) {
-        shardcache_record_t record = {
-            .v = key,
-            .l = len
+        uint32_t deadline_nbo = htonl(deadline);
+        shardcache_record_t record[3] = {
+            {
+                .v = key,
+                .l = len
+            },
+            {
+                .v = &deadline_nbo,
+                .l = sizeof(uint32_t)
+            }
         };
+        // the trace context (if any) follows the deadline
+        unsigned char trace_buf[SHC_TRACE_RECORD_LEN];
+        int traced = (trace && trace->id);
+        if (traced)
+            build_trace_record(trace, trace_buf, &record[2]);
         int rc = write_message(fd, auth, sig_hdr,
-                SHC_HDR_GET, &record, 1);
+                SHC_HDR_GET, record, traced ? 3 : deadline ? 2 : 1);
         if (rc == 0) {
             shardcache_hdr_t hdr = 0;
             int num_records = read_message(fd, auth, &out, 1, &hdr, 0);
@@ -1460,7 +1541,8 @@ touch_on_peer(char *peer,
               unsigned char sig_hdr,
               void *key,
               size_t klen,
-              int fd)
+              int fd,
+              int expect_response)
 {
     int should_close = 0;
     if (fd < 0) {
@@ -1477,10 +1559,9 @@ touch_on_peer(char *peer,
         };
         int rc = write_message(fd, auth, sig_hdr, hdr, &record, 1);
 
-        // if we are not forwarding a delete command to the owner
-        // of the key, but only an eviction request to a peer,
-        // we don't need to wait for the response
-        if (rc == 0) {
+        // if the caller is going to read the response asynchronously
+        // we don't need to wait for it here
+        if (rc == 0 && expect_response) {
             shardcache_hdr_t hdr = 0;
             fbuf_t resp = FBUF_STATIC_INITIALIZER;
             fbuf_t *respp = &resp;
@@ -1505,19 +1586,127 @@ touch_on_peer(char *peer,
         }
         if (should_close)
             close(fd);
-        return 0;
+        return rc;
     }
     return -1;
 }
 
+int
+prefetch_on_peer(char *peer,
+                 char *auth,
+                 unsigned char sig_hdr,
+                 void **keys,
+                 size_t *klens,
+                 int num_keys,
+                 int fd,
+                 int expect_response)
+{
+    int should_close = 0;
+    if (fd < 0) {
+        fd = connect_to_peer(peer, ATOMIC_READ(_tcp_timeout));
+        should_close = 1;
+    }
+
+    SHC_DEBUG2("Sending prefetch command (%d keys) to peer %s", num_keys, peer);
+    if (fd >= 0) {
+        // all the keys go in a single record (<KSIZE><KDATA>...)
+        fbuf_t keys_list = FBUF_STATIC_INITIALIZER;
+        int i;
+        for (i = 0; i < num_keys; i++) {
+            uint32_t ksize = htonl(klens[i]);
+            fbuf_add_binary(&keys_list, (char *)&ksize, sizeof(ksize));
+            fbuf_add_binary(&keys_list, keys[i], klens[i]);
+        }
+
+        shardcache_record_t record = {
+            .v = fbuf_data(&keys_list),
+            .l = fbuf_used(&keys_list)
+        };
+        int rc = write_message(fd, auth, sig_hdr, SHC_HDR_PREFETCH, &record, 1);
+        fbuf_destroy(&keys_list);
+
+        // if the caller is going to read the response asynchronously
+        // we don't need to wait for it here
+        if (rc == 0 && expect_response) {
+            shardcache_hdr_t hdr = 0;
+            fbuf_t resp = FBUF_STATIC_INITIALIZER;
+            fbuf_t *respp = &resp;
+            int num_records = read_message(fd, auth, &respp, 1, &hdr, 0);
+            rc = -1;
+            if (hdr == SHC_HDR_RESPONSE && num_records == 1) {
+                char *res = fbuf_data(&resp);
+                if (res && *res == SHC_RES_OK)
+                    rc = 0;
+            }
+            fbuf_destroy(&resp);
+        }
+        if (should_close)
+            close(fd);
+        return rc;
+    }
+    return -1;
+}
 
 int
-stats_from_peer(char *peer,
-                char *auth,
-                unsigned char sig_hdr,
-                char **out,
-                size_t *len,
-                int fd)
+invalidate_on_peer(char *peer,
+                   char *auth,
+                   unsigned char sig_hdr,
+                   void *prefix,
+                   size_t plen,
+                   int local,
+                   int fd,
+                   int expect_response)
+{
+    int should_close = 0;
+    if (fd < 0) {
+        fd = connect_to_peer(peer, ATOMIC_READ(_tcp_timeout));
+        should_close = 1;
+    }
+
+    SHC_DEBUG2("Sending invalidate command to peer %s", peer);
+    if (fd >= 0) {
+        unsigned char scope = local ? 1 : 0;
+        shardcache_record_t record[2] = {
+            {
+                .v = prefix,
+                .l = plen
+            },
+            {
+                .v = &scope,
+                .l = sizeof(scope)
+            }
+        };
+        int rc = write_message(fd, auth, sig_hdr, SHC_HDR_INVALIDATE, record, 2);
+
+        // the nodes broadcasting the command don't wait for the response
+        if (rc == 0 && expect_response) {
+            shardcache_hdr_t hdr = 0;
+            fbuf_t resp = FBUF_STATIC_INITIALIZER;
+            fbuf_t *respp = &resp;
+            int num_records = read_message(fd, auth, &respp, 1, &hdr, 0);
+            rc = -1;
+            if (hdr == SHC_HDR_RESPONSE && num_records == 1) {
+                char *res = fbuf_data(&resp);
+                if (res && *res == SHC_RES_OK)
+                    rc = 0;
+            }
+            fbuf_destroy(&resp);
+        }
+        if (should_close)
+            close(fd);
+        return rc;
+    }
+    return -1;
+}
+
+static int
+stats_section_from_peer(char *peer,
+                        char *auth,
+                        unsigned char sig_hdr,
+                        char *section,
+                        char **out,
+                        size_t *len,
+                        int fd)
 {
     int should_close = 0;
     if (fd < 0) {
@@ -1526,8 +1715,13 @@ stats_from_peer(char *peer,
     }
 
     if (fd >= 0) {
+        // the counters are returned if no section is requested
+        shardcache_record_t record = {
+            .v = section,
+            .l = section ? strlen(section) : 0
+        };
         int rc = write_message(fd, auth, sig_hdr,
-                SHC_HDR_STATS, NULL, 0);
+                SHC_HDR_STATS, &record, section ? 1 : 0);
         if (rc == 0) {
             fbuf_t resp = FBUF_STATIC_INITIALIZER;
             fbuf_t *respp = &resp;
@@ -1554,6 +1748,50 @@ stats_from_peer(char *peer,
     return -1;
 }
 
+int
+stats_from_peer(char *peer,
+                char *auth,
+                unsigned char sig_hdr,
+                char **out,
+                size_t *len,
+                int fd)
+{
+    return stats_section_from_peer(peer, auth, sig_hdr, NULL, out, len, fd);
+}
+
+int
+hotkeys_from_peer(char *peer,
+                  char *auth,
+                  unsigned char sig_hdr,
+                  char **out,
+                  size_t *len,
+                  int fd)
+{
+    return stats_section_from_peer(peer, auth, sig_hdr, "hotkeys", out, len, fd);
+}
+
+int
+slowlog_from_peer(char *peer,
+                  char *auth,
+                  unsigned char sig_hdr,
+                  char **out,
+                  size_t *len,
+                  int fd)
+{
+    return stats_section_from_peer(peer, auth, sig_hdr, "slowlog", out, len, fd);
+}
+
+int
+traces_from_peer(char *peer,
+                 char *auth,
+                 unsigned char sig_hdr,
+                 char **out,
+                 size_t *len,
+                 int fd)
+{
+    return stats_section_from_peer(peer, auth, sig_hdr, "traces", out, len, fd);
+}
+
 int
 check_peer(char *peer,
            char *auth,
@@ -1591,6 +1829,173 @@ check_peer(char *peer,
     return -1;
 }
 
+static void
+index_page_add_varint(fbuf_t *out, uint64_t v)
+{
+    unsigned char buf[10];
+    int n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    buf[n++] = v;
+    fbuf_add_binary(out, (char *)buf, n);
+}
+
+static int
+index_page_get_varint(char *data, size_t len, size_t *ofx, uint64_t *v)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    while (*ofx < len && shift < 64) {
+        unsigned char byte = (unsigned char)data[(*ofx)++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *v = value;
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+void
+build_index_page(shardcache_storage_index_item_t *items,
+                 size_t num_items,
+                 fbuf_t *out)
+{
+    void *prev = NULL;
+    size_t prev_len = 0;
+    size_t i;
+    for (i = 0; i < num_items; i++) {
+        char *key = items[i].key;
+        size_t klen = items[i].klen;
+        size_t prefix = 0;
+        size_t max_prefix = klen < prev_len ? klen : prev_len;
+        while (prefix < max_prefix && ((char *)prev)[prefix] == key[prefix])
+            prefix++;
+        index_page_add_varint(out, prefix);
+        index_page_add_varint(out, klen - prefix);
+        fbuf_add_binary(out, key + prefix, klen - prefix);
+        index_page_add_varint(out, items[i].vlen);
+        prev = key;
+        prev_len = klen;
+    }
+}
+
+int
+index_page_next(char *data,
+                size_t len,
+                size_t *ofx,
+                int legacy,
+                fbuf_t *key,
+                size_t *vlen)
+{
+    if (*ofx >= len)
+        return 0;
+
+    if (legacy) {
+        uint32_t nklen, nvlen;
+        if (*ofx + sizeof(nklen) > len)
+            return -1;
+        memcpy(&nklen, data + *ofx, sizeof(nklen));
+        uint32_t klen = ntohl(nklen);
+        if (klen == 0) // the index has ended
+            return 0;
+        if (*ofx + sizeof(nklen) + klen + sizeof(nvlen) > len)
+            return -1;
+        *ofx += sizeof(nklen);
+        fbuf_clear(key);
+        fbuf_add_binary(key, data + *ofx, klen);
+        *ofx += klen;
+        memcpy(&nvlen, data + *ofx, sizeof(nvlen));
+        *ofx += sizeof(nvlen);
+        *vlen = ntohl(nvlen);
+        return 1;
+    }
+
+    uint64_t prefix, suffix, value_len;
+    if (index_page_get_varint(data, len, ofx, &prefix) != 0 ||
+        index_page_get_varint(data, len, ofx, &suffix) != 0 ||
+        prefix > fbuf_used(key) || suffix > len - *ofx)
+    {
+        return -1;
+    }
+    fbuf_set_used(key, prefix);
+    fbuf_add_binary(key, data + *ofx, suffix);
+    *ofx += suffix;
+    if (index_page_get_varint(data, len, ofx, &value_len) != 0)
+        return -1;
+    *vlen = value_len;
+    return 1;
+}
+
+int
+index_page_from_peer(char *peer,
+                     char *auth,
+                     unsigned char sig_hdr,
+                     int fd,
+                     uint64_t *cursor,
+                     uint32_t page_size,
+                     uint64_t hash_min,
+                     uint64_t hash_max,
+                     fbuf_t *page)
+{
+    int should_close = 0;
+    if (fd < 0) {
+        fd = connect_to_peer(peer, ATOMIC_READ(_tcp_timeout));
+        should_close = 1;
+    }
+
+    if (fd < 0)
+        return -1;
+
+    uint32_t ncursor[2] = { htonl(*cursor >> 32), htonl(*cursor & 0xffffffff) };
+    uint32_t npage_size = htonl(page_size);
+    uint32_t nrange[4] = { htonl(hash_min >> 32), htonl(hash_min & 0xffffffff),
+                           htonl(hash_max >> 32), htonl(hash_max & 0xffffffff) };
+
+    shardcache_record_t records[3] = {
+        {
+            .v = ncursor,
+            .l = sizeof(ncursor)
+        },
+        {
+            .v = &npage_size,
+            .l = sizeof(npage_size)
+        },
+        {
+            .v = nrange,
+            .l = sizeof(nrange)
+        }
+    };
+
+    int rc = -1;
+    if (write_message(fd, auth, sig_hdr, SHC_HDR_GET_INDEX, records, 3) == 0) {
+        fbuf_t next = FBUF_STATIC_INITIALIZER;
+        fbuf_t *resps[2] = { page, &next };
+        shardcache_hdr_t hdr = 0;
+        int num_records = read_message(fd, auth, resps, 2, &hdr, 1);
+        if (hdr == SHC_HDR_INDEX_RESPONSE) {
+            if (num_records == 2 && fbuf_used(&next) == sizeof(ncursor)) {
+                memcpy(ncursor, fbuf_data(&next), sizeof(ncursor));
+                *cursor = ((uint64_t)ntohl(ncursor[0]) << 32) | ntohl(ncursor[1]);
+                rc = 0;
+            } else if (num_records == 1) {
+                // the peer doesn't know about paging and sent the whole index
+                *cursor = 0;
+                rc = 1;
+            }
+        }
+        fbuf_destroy(&next);
+    }
+
+    if (should_close)
+        close(fd);
+
+    return rc;
+}
+
 shardcache_storage_index_t *
 index_from_peer(char *peer,
                 char *auth,
@@ -1605,42 +2010,47 @@ index_from_peer(char *peer,
 
     shardcache_storage_index_t *index = calloc(1, sizeof(shardcache_storage_index_t));
     if (fd >= 0) {
-        int rc = write_message(fd, auth, sig_hdr, SHC_HDR_GET_INDEX, NULL, 0);
-        if (rc == 0) {
-            fbuf_t resp = FBUF_STATIC_INITIALIZER;
-            fbuf_t *respp = &resp;
-            shardcache_hdr_t hdr = 0;
-            int num_records = read_message(fd, auth, &respp, 1, &hdr, 1);
-            if (hdr == SHC_HDR_INDEX_RESPONSE && num_records == 1) {
-                char *data = fbuf_data(&resp);
-                int len = fbuf_used(&resp);
-                int ofx = 0;
-                while (ofx < len) {
-                    uint32_t *nklen = (uint32_t *)(data+ofx);
-                    uint32_t klen = ntohl(*nklen);
-                    if (klen == 0) {
-                        // the index has ended
-                        break;
-                    } else if (ofx + klen + 8 > len) {
-                        // TODO - Error messages (truncated?)
+        fbuf_t page = FBUF_STATIC_INITIALIZER;
+        fbuf_t key = FBUF_STATIC_INITIALIZER;
+        uint64_t cursor = 0;
+        size_t isize = 0;
+        do {
+            fbuf_clear(&page);
+            int rc = index_page_from_peer(peer, auth, sig_hdr, fd, &cursor,
+                                          SHARDCACHE_INDEX_PAGE_SIZE_MAX,
+                                          0, UINT64_MAX, &page);
+            if (rc == -1)
+                break;
+
+            size_t ofx = 0;
+            size_t vlen = 0;
+            fbuf_clear(&key);
+            while (index_page_next(fbuf_data(&page), fbuf_used(&page),
+                                   &ofx, rc, &key, &vlen) == 1)
+            {
+                if (index->size == isize) {
+                    // grow geometrically, the index can be huge
+                    isize = isize ? isize * 2 : SHARDCACHE_INDEX_PAGE_SIZE_DEFAULT;
+                    shardcache_storage_index_item_t *items =
+                        realloc(index->items, isize * sizeof(shardcache_storage_index_item_t));
+                    if (!items) {
+                        SHC_ERROR("Can't grow the index (%zu items)", isize);
+                        cursor = 0;
                         break;
                     }
-                    ofx += 4;
-                    void *key = malloc(klen);
-                    memcpy(key, data+ofx, klen);
-                    ofx += klen;
-                    uint32_t *nvlen = (uint32_t *)(data+ofx);
-                    uint32_t vlen = ntohl(*nvlen);
-                    ofx += 4;
-                    index->items = realloc(index->items, (index->size + 1) * sizeof(shardcache_storage_index_item_t));
-                    index->items[index->size].key = key;
-                    index->items[index->size].klen = klen;
-                    index->items[index->size].vlen = vlen;
-                    index->size++;
+                    index->items = items;
                 }
+                size_t klen = fbuf_used(&key);
+                shardcache_storage_index_item_t *item = &index->items[index->size++];
+                item->key = malloc(klen);
+                memcpy(item->key, fbuf_data(&key), klen);
+                item->klen = klen;
+                item->vlen = vlen;
             }
-            fbuf_destroy(&resp);
-        }
+        } while (cursor);
+        fbuf_destroy(&page);
+        fbuf_destroy(&key);
+
         if (should_close)
             close(fd);
     }
@@ -1696,6 +2106,57 @@ migrate_peer(char *peer,
     return -1;
 }
 
+int
+hot_set_from_peer(char *peer,
+                  char *auth,
+                  unsigned char sig_hdr,
+                  char *label,
+                  uint32_t max_items,
+                  fbuf_t *out,
+                  int fd)
+{
+    int should_close = 0;
+    if (fd < 0) {
+        fd = connect_to_peer(peer, ATOMIC_READ(_tcp_timeout));
+        should_close = 1;
+    }
+
+    SHC_DEBUG("Requesting the hot set to peer %s", peer);
+
+    if (fd >= 0) {
+        uint32_t max = htonl(max_items);
+        shardcache_record_t records[2] = {
+            {
+                .v = label,
+                .l = strlen(label)
+            },
+            {
+                .v = &max,
+                .l = sizeof(max)
+            }
+        };
+        int rc = write_message(fd, auth, sig_hdr, SHC_HDR_MIGRATION_WARMUP, records, 2);
+        if (rc == 0) {
+            shardcache_hdr_t hdr = 0;
+            fbuf_t *outp = out;
+            int num_records = read_message(fd, auth, &outp, 1, &hdr, 0);
+            // an error is reported as a single byte record
+            // (which can't be a valid hot set)
+            if (hdr == SHC_HDR_RESPONSE && num_records == 1 &&
+                !(fbuf_used(out) == 1 && (unsigned char)fbuf_data(out)[0] == SHC_RES_ERR))
+            {
+                if (should_close)
+                    close(fd);
+                return 0;
+            }
+            fbuf_clear(out);
+        }
+        if (should_close)
+            close(fd);
+    }
+    return -1;
+}
+
 int
 abort_migrate_peer(char *peer,
                    char *auth,
@@ -30,11 +30,14 @@ typedef enum {
     SHC_HDR_ADD              = 0x07,
     SHC_HDR_EXISTS           = 0x08,
     SHC_HDR_TOUCH            = 0x09,
+    SHC_HDR_PREFETCH         = 0x0A,
+    SHC_HDR_INVALIDATE       = 0x0B,
 
     // migration commands
     SHC_HDR_MIGRATION_ABORT  = 0x21,
     SHC_HDR_MIGRATION_BEGIN  = 0x22,
     SHC_HDR_MIGRATION_END    = 0x23,
+    SHC_HDR_MIGRATION_WARMUP = 0x24,
 
     // administrative commands
     SHC_HDR_CHECK            = 0x31,
@@ -76,6 +79,23 @@ typedef struct __shardcache_record_s {
 
 #define SHARDCACHE_RSEP 0x80
 
+// the (optional) trace context carried by the data commands,
+// encoded as: <trace id (8 bytes, network byte order)><flags>
+#define SHC_TRACE_RECORD_LEN 9
+#define SHC_TRACE_FLAG_SAMPLED 0x01 // the nodes record the spans of the request
+
+typedef struct {
+    uint64_t id;   // 0 if the request isn't traced
+    uint8_t flags; // SHC_TRACE_FLAG_*
+} shardcache_trace_t;
+
+// build the record holding a trace context
+// (buf must be able to hold SHC_TRACE_RECORD_LEN bytes)
+void build_trace_record(shardcache_trace_t *trace, unsigned char *buf, shardcache_record_t *record);
+
+// parse a trace record, returns 0 if it holds a trace context, -1 otherwise
+int parse_trace_record(void *data, size_t len, shardcache_trace_t *trace);
+
 // TODO - Document all exposed functions
 
 int global_tcp_timeout(int tcp_timeout);
@@ -104,12 +124,17 @@ int build_message(char *auth,
                   int num_records,
                   fbuf_t *out);
 
+// NOTE: the commands accepting a trace context send it along with the
+//       request when not NULL (and its id is not 0), the peer records
+//       its spans under the same id and propagates it further
+
 // delete a key from a peer
 int delete_from_peer(char *peer,
                      char *auth,
                      unsigned char sig_hdr,
                      void *key,
                      size_t klen,
+                     shardcache_trace_t *trace,
                      int fd,
                      int expect_response);
 
@@ -120,6 +145,7 @@ evict_from_peer(char *peer,
                 unsigned char sig,
                 void *key,
                 size_t klen,
+                shardcache_trace_t *trace,
                 int fd,
                 int expect_response);
 
@@ -133,6 +159,7 @@ int send_to_peer(char *peer,
                  void *value,
                  size_t vlen,
                  uint32_t expire,
+                 shardcache_trace_t *trace,
                  int fd,
                  int expect_response);
 
@@ -147,15 +174,20 @@ add_to_peer(char *peer,
             void *value,
             size_t vlen,
             uint32_t expire,
+            shardcache_trace_t *trace,
             int fd,
             int expect_response);
 
 // fetch the value for a given key from a peer
+// (the deadline is the number of milliseconds after which the peer
+//  can give up serving the request, 0 means no deadline)
 int fetch_from_peer(char *peer,
                     char *auth,
                     unsigned char sig_hdr,
                     void *key,
                     size_t len,
+                    uint32_t deadline,
+                    shardcache_trace_t *trace,
                     fbuf_t *out,
                     int fd);
 
@@ -186,7 +218,29 @@ touch_on_peer(char *peer,
               unsigned char sig_hdr,
               void *key,
               size_t klen,
-              int fd);
+              int fd,
+              int expect_response);
+
+// ask a peer to load multiple keys into its cache (without retrieving the values)
+int prefetch_on_peer(char *peer,
+                     char *auth,
+                     unsigned char sig_hdr,
+                     void **keys,
+                     size_t *klens,
+                     int num_keys,
+                     int fd,
+                     int expect_response);
+
+// invalidate all the keys starting with a prefix on a peer
+// (if 'local' is true the peer won't propagate the command to the other nodes)
+int invalidate_on_peer(char *peer,
+                       char *auth,
+                       unsigned char sig_hdr,
+                       void *prefix,
+                       size_t plen,
+                       int local,
+                       int fd,
+                       int expect_response);
 
 // retrieve all the stats counters from a peer
 int stats_from_peer(char *peer,
@@ -196,6 +250,33 @@ int stats_from_peer(char *peer,
                     size_t *len,
                     int fd);
 
+// retrieve the report of the heaviest keys from a peer
+// (the "hotkeys" section of the STATS command)
+int hotkeys_from_peer(char *peer,
+                      char *auth,
+                      unsigned char sig_hdr,
+                      char **out,
+                      size_t *len,
+                      int fd);
+
+// retrieve the most recent slow requests from a peer
+// (the "slowlog" section of the STATS command)
+int slowlog_from_peer(char *peer,
+                      char *auth,
+                      unsigned char sig_hdr,
+                      char **out,
+                      size_t *len,
+                      int fd);
+
+// retrieve the spans of the most recent sampled traces from a peer
+// (the "traces" section of the STATS command)
+int traces_from_peer(char *peer,
+                     char *auth,
+                     unsigned char sig_hdr,
+                     char **out,
+                     size_t *len,
+                     int fd);
+
 // check if a peer is alive (using the CHK command)
 int check_peer(char *peer,
                char *auth,
@@ -213,6 +294,18 @@ int migrate_peer(char *peer,
 // abort migration
 int abort_migrate_peer(char *peer, char *auth, unsigned char sig_hdr, int fd);
 
+// retrieve from a peer (at most max_items of) the most frequently used items
+// which are going to be owned by the node 'label' once the migration is over.
+// The items are stored in the 'out' buffer as <KSIZE><KDATA><VSIZE><VDATA>...
+// Returns 0 on success, -1 on errors (or if the peer is not migrating)
+int hot_set_from_peer(char *peer,
+                      char *auth,
+                      unsigned char sig_hdr,
+                      char *label,
+                      uint32_t max_items,
+                      fbuf_t *out,
+                      int fd);
+
 
 // connect to a given peer and return the opened filedescriptor
 int connect_to_peer(char *address_string, unsigned int timeout);
@@ -225,6 +318,48 @@ shardcache_storage_index_t *index_from_peer(char *peer,
                                             unsigned char sig_hdr,
                                             int fd);
 
+// default (and maximum) number of items returned in a single index page
+#define SHARDCACHE_INDEX_PAGE_SIZE_DEFAULT 1024
+#define SHARDCACHE_INDEX_PAGE_SIZE_MAX 65536
+
+// retrieve a single page of the index of keys stored in a given peer.
+// The cursor must be 0 to request the first page and it's updated
+// to point to the next page (0 if there are no more pages).
+// Only keys whose hash falls in the [hash_min, hash_max] range are returned.
+// The raw page is stored in the 'page' buffer and can be walked using
+// index_page_next().
+// Returns 0 if a compact page has been received, 1 if the peer doesn't
+// support paging and returned the full index in the legacy format
+// (in which case the cursor is set to 0), -1 on errors
+int index_page_from_peer(char *peer,
+                         char *auth,
+                         unsigned char sig_hdr,
+                         int fd,
+                         uint64_t *cursor,
+                         uint32_t page_size,
+                         uint64_t hash_min,
+                         uint64_t hash_max,
+                         fbuf_t *page);
+
+// encode the given items using the compact index format
+// (keys are delta-encoded against the previous key in the page)
+void build_index_page(shardcache_storage_index_item_t *items,
+                      size_t num_items,
+                      fbuf_t *out);
+
+// walk the items of an index page starting at *ofx.
+// The key is decoded into the 'key' buffer, which must be preserved
+// between the calls since the next key might share a prefix with it.
+// If 'legacy' is true the page is parsed using the legacy index format.
+// Returns 1 if an item has been decoded, 0 at the end of the page,
+// -1 if the page is malformed
+int index_page_next(char *data,
+                    size_t len,
+                    size_t *ofx,
+                    int legacy,
+                    fbuf_t *key,
+                    size_t *vlen);
+
 // idx = -1 , data == NULL, len = 0 when finished
 // idx = -2 , data == NULL, len = 0 if an error occurred
 typedef int (*async_read_callback_t)(void *data,
@@ -291,6 +426,8 @@ int fetch_from_peer_async(char *peer,
                           size_t klen,
                           size_t offset,
                           size_t len,
+                          uint32_t deadline,
+                          shardcache_trace_t *trace,
                           fetch_from_peer_async_cb cb,
                           void *priv,
                           int fd,
@@ -1,6 +1,8 @@
 #include <fbuf.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <netinet/in.h>
@@ -20,6 +22,7 @@
 #include "connections.h"
 #include "shardcache.h"
 #include "counters.h"
+#include "spsc_ring.h"
 
 #include "serving.h"
 
@@ -42,8 +45,42 @@ typedef struct {
     linked_list_t *prune;
     uint64_t numfds;
     uint64_t pruning;
+    // only used when the cache is partitioned (one worker per partition)
+    int index;
+    spsc_ring_t **inbox; // requests handed over by the other workers (one ring per producer)
+    int wakeup_fds[2];
+    int wakeup_pending;
+    uint64_t handoffs;
+    // only used by the control worker (one queue per priority lane)
+    linked_list_t **lanes;
+    // connections with a request waiting for its turn (deficit round-robin)
+    TAILQ_HEAD(, __shardcache_connection_context_s) backlog;
+    uint64_t turn;       // the current loop turn
+    uint64_t deferred;   // requests postponed to a later turn
+    uint64_t backlogged; // connections currently waiting for their turn
+    uint64_t look_ahead; // the average look-ahead of the connections (gauge)
+    uint64_t look_ahead_total;
+    uint64_t look_ahead_conns;
+    // busy polling
+    uint64_t activity;   // bumped every time the worker finds some work to do
+    uint64_t spin_usecs; // time spent polling without finding anything to do
+    uint64_t busy_usecs; // time spent (while busy polling) doing actual work
 } shardcache_worker_context_t;
 
+// Priority lanes. Requests not belonging to the data lane are handed over
+// to a reserved (control) worker, which doesn't own any connection and
+// serves the lanes in order of priority, so that replica consensus messages,
+// health checks and migration commands never queue behind the data requests
+typedef enum {
+    SHARDCACHE_LANE_DATA = 0,
+    SHARDCACHE_LANE_REPLICA,
+    SHARDCACHE_LANE_ADMIN,
+    SHARDCACHE_LANE_MIGRATION,
+    SHARDCACHE_NUM_LANES
+} shardcache_lane_t;
+
+#define SHARDCACHE_LANE_LABELS_ARRAY { "data", "replica", "admin", "migration" }
+
 struct __shardcache_serving_s {
     shardcache_t *cache;
     int sock;
@@ -53,13 +90,16 @@ struct __shardcache_serving_s {
     int num_workers;
     int next_worker_index;
     linked_list_t *workers;
+    shardcache_worker_context_t **partition_workers;
+    shardcache_worker_context_t *control_worker;
     uint64_t num_connections;
     uint64_t total_workers;
+    uint64_t lane_requests[SHARDCACHE_NUM_LANES]; // requests queued on the control lanes
 };
 
 typedef struct __shardcache_connection_context_s shardcache_connection_context_t;
 
-#define SHARDCACHE_REQUEST_RECORDS_MAX 4
+#define SHARDCACHE_REQUEST_RECORDS_MAX 5
 
 typedef struct __shardcache_request_s {
     fbuf_t records[SHARDCACHE_REQUEST_RECORDS_MAX];
@@ -79,6 +119,18 @@ typedef struct __shardcache_request_s {
     int copied;
     int done;
     fbuf_t fetch_accumulator;
+    uint64_t hash;
+    struct timeval deadline; // when the client gives up (all zeros if never)
+    shardcache_trace_t trace; // the trace the request belongs to (id 0 if none)
+    struct timeval created;
+    uint64_t mem; // the bytes accounted to the request (see SHARDCACHE_MEM_BUFFERS)
+
+    // the phases of the request (see shardcache_request_account_time())
+    struct timeval received;   // when the request started being received
+    struct timeval started;    // when a worker started processing it
+    struct timeval first_data; // when the first data of the value has been sent
+    struct timeval completed;  // when the last data of the value has been sent
+    shardcache_fetch_timing_t timing;
     TAILQ_ENTRY(__shardcache_request_s) next;
 } shardcache_request_t;
 
@@ -90,6 +142,8 @@ struct __shardcache_connection_context_s {
     int num_requests;
 
     fbuf_t records[SHARDCACHE_REQUEST_RECORDS_MAX];
+    uint64_t records_mem; // the bytes of the request being received (accounted
+                          // in SHARDCACHE_MEM_BUFFERS until the request is created)
 
     shardcache_serving_t *serv;
 
@@ -100,6 +154,26 @@ struct __shardcache_connection_context_s {
     shardcache_worker_context_t *worker;
     int closed;
     struct timeval in_prune_since;
+    uint64_t inflight; // requests handed over to other workers and not processed yet
+    struct timeval receiving; // when the request being read started arriving
+
+    // deficit round-robin state
+    int deficit;   // bytes of requests which can still be served in 'turn'
+    uint64_t turn; // the worker loop turn the deficit refers to
+    shardcache_request_t *deferred; // the request waiting for a later turn (if any)
+    struct timeval deferred_since;
+    TAILQ_ENTRY(__shardcache_connection_context_s) backlog_next;
+
+    // adaptive look-ahead (AIMD)
+    int look_ahead;                // pipelined requests which can be handled ahead
+    int look_ahead_credit;         // requests completed in time since the last increase
+    struct timeval look_ahead_cut; // when the look-ahead has been last decreased
+
+    // queueing stats (logged when the connection is released)
+    uint64_t served;
+    uint64_t deferrals;
+    uint64_t wait_usecs;
+    uint64_t max_wait_usecs;
 };
 #pragma pack(pop)
 
@@ -109,8 +183,12 @@ async_read_handler(void *data, size_t len, int idx, void *priv)
     shardcache_connection_context_t *ctx =
         (shardcache_connection_context_t *)priv;
 
-    if (idx >= 0 && idx < SHARDCACHE_REQUEST_RECORDS_MAX)
+    if (idx >= 0 && idx < SHARDCACHE_REQUEST_RECORDS_MAX) {
         fbuf_add_binary(&ctx->records[idx], data, len);
+        // a big record can take a while to be received
+        ctx->records_mem += len;
+        ATOMIC_INCREASE(ctx->serv->cache->mem[SHARDCACHE_MEM_BUFFERS], len);
+    }
 
     // idx == -1 means that reading finished
     // idx == -2 means error
@@ -142,9 +220,25 @@ shardcache_connection_context_create(shardcache_serving_t *serv, int fd)
     return ctx;
 }
 
+// the requests (and the data they hold) are accounted as they go,
+// the output is accounted until it's handed over to the iomux
+#define SHARDCACHE_REQUEST_MEM_ADD(__r, __n) \
+{ \
+    ATOMIC_INCREASE((__r)->mem, (__n)); \
+    ATOMIC_INCREASE((__r)->ctx->serv->cache->mem[SHARDCACHE_MEM_BUFFERS], (__n)); \
+}
+
+#define SHARDCACHE_REQUEST_MEM_SUB(__r, __n) \
+{ \
+    ATOMIC_DECREASE((__r)->mem, (__n)); \
+    ATOMIC_DECREASE((__r)->ctx->serv->cache->mem[SHARDCACHE_MEM_BUFFERS], (__n)); \
+}
+
 static void
 shardcache_request_destroy(shardcache_request_t *req)
 {
+    uint64_t mem = ATOMIC_READ(req->mem);
+    SHARDCACHE_REQUEST_MEM_SUB(req, mem);
     int i;
     for (i = 0; i < SHARDCACHE_REQUEST_RECORDS_MAX; i++) {
         fbuf_destroy(&req->records[i]);
@@ -157,6 +251,20 @@ shardcache_request_destroy(shardcache_request_t *req)
     free(req);
 }
 
+// take the connection out of the worker backlog (if there),
+// the deferred request will never be served
+static void
+shardcache_connection_unschedule(shardcache_connection_context_t *ctx)
+{
+    if (!ctx->deferred)
+        return;
+
+    TAILQ_REMOVE(&ctx->worker->backlog, ctx, backlog_next);
+    ATOMIC_DECREMENT(ctx->worker->backlogged);
+    ATOMIC_SET(ctx->deferred->done, 1);
+    ctx->deferred = NULL;
+}
+
 static void
 shardcache_connection_context_destroy(shardcache_connection_context_t *ctx)
 {
@@ -164,6 +272,20 @@ shardcache_connection_context_destroy(shardcache_connection_context_t *ctx)
     for (i = 0; i < SHARDCACHE_REQUEST_RECORDS_MAX; i++) {
         fbuf_destroy(&ctx->records[i]);
     }
+    ATOMIC_DECREASE(ctx->serv->cache->mem[SHARDCACHE_MEM_BUFFERS], ctx->records_mem);
+    shardcache_connection_unschedule(ctx);
+    if (ctx->look_ahead) {
+        shardcache_worker_context_t *wrk = ctx->worker;
+        ATOMIC_DECREASE(wrk->look_ahead_total, ctx->look_ahead);
+        uint64_t conns = ATOMIC_DECREMENT(wrk->look_ahead_conns);
+        ATOMIC_SET(wrk->look_ahead, conns ? ATOMIC_READ(wrk->look_ahead_total) / conns : 0);
+    }
+    if (ctx->deferrals) {
+        SHC_DEBUG("Connection %d served %"PRIu64" requests, %"PRIu64" deferred "
+                  "(wait avg: %"PRIu64"us, max: %"PRIu64"us)",
+                  ctx->fd, ctx->served, ctx->deferrals,
+                  ctx->wait_usecs / ctx->deferrals, ctx->max_wait_usecs);
+    }
     shardcache_request_t *req = TAILQ_FIRST(&ctx->requests);
     while(req) {
         TAILQ_REMOVE(&ctx->requests, req, next);
@@ -176,6 +298,22 @@ shardcache_connection_context_destroy(shardcache_connection_context_t *ctx)
     free(ctx);
 }
 
+// release the context of a closed connection, unless some of its requests
+// are still pending or referenced by the inbox of another worker, in which
+// case it's parked in the prune list until they are done
+static void
+shardcache_connection_context_release(shardcache_connection_context_t *ctx)
+{
+    if (TAILQ_FIRST(&ctx->requests) == NULL && !ATOMIC_READ(ctx->inflight)) {
+        shardcache_connection_context_destroy(ctx);
+        return;
+    }
+    ctx->closed = 1;
+    gettimeofday(&ctx->in_prune_since, NULL);
+    list_push_value(ctx->worker->prune, ctx);
+    ATOMIC_INCREMENT(ctx->worker->pruning);
+}
+
 static void send_data(shardcache_request_t *req, fbuf_t *data);
 
 #define WRITE_STATUS_MODE_SIMPLE  0x00
@@ -349,7 +487,17 @@ get_async_data_handler(void *key,
     shardcache_request_t *req =
         (shardcache_request_t *)priv;
 
+    if (!timerisset(&req->first_data))
+        gettimeofday(&req->first_data, NULL);
+
     if (req->skipped == 0 && req->copied == 0) {
+        if ((dlen || total_size) && shardcache_deadline_left(&req->deadline) == -1) {
+            // the data arrived too late, don't bother sending it
+            // (get requests are answered with an empty response)
+            ATOMIC_INCREMENT(req->ctx->serv->cache->cnt[SHARDCACHE_COUNTER_DROPPED_REQUESTS].value);
+            write_status(req, 0, WRITE_STATUS_MODE_SIMPLE);
+            return -1;
+        }
         if (send_async_data_response_preamble(req) != 0) {
             ATOMIC_INCREMENT(req->error);
             return -1;
@@ -368,6 +516,7 @@ get_async_data_handler(void *key,
             //ATOMIC_INCREMENT(req->error);
             //return -1;
         }
+        gettimeofday(&req->completed, NULL);
         if (send_async_data_response_epilogue(req) != 0) {
             ATOMIC_INCREMENT(req->error);
             return -1;
@@ -480,10 +629,16 @@ get_async_data_handler(void *key,
             send_data(req, &output);
             fbuf_destroy(&output);
         }
+        gettimeofday(&req->completed, NULL);
         if (send_async_data_response_epilogue(req) != 0) {
             ATOMIC_INCREMENT(req->error);
             return -1;
         }
+
+        shardcache_t *cache = req->ctx->serv->cache;
+        shardcache_hotkeys_track(cache, SHARDCACHE_HOTKEYS_BYTES, key, klen, req->hash, req->copied);
+        shardcache_hotkeys_track(cache, SHARDCACHE_HOTKEYS_VALUES, key, klen, req->hash, total_size);
+
         ATOMIC_INCREMENT(req->done);
     }
 
@@ -492,8 +647,7 @@ get_async_data_handler(void *key,
 
 static int
 get_async_data(shardcache_t *cache,
-               void *key,
-               size_t klen,
+               shardcache_key_t *key,
                shardcache_get_async_callback_t cb,
                shardcache_request_t *req)
 {
@@ -503,9 +657,9 @@ get_async_data(shardcache_t *cache,
     if (req->hdr == SHC_HDR_GET_OFFSET) {
         uint32_t offset = ntohl(*((uint32_t *)fbuf_data(&req->records[1])));
         uint32_t length = ntohl(*((uint32_t *)fbuf_data(&req->records[2])));
-        rc = shardcache_get_offset_async(cache, key, klen, offset, length, cb, req);
+        rc = shardcache_get_offset_async_key(cache, key, offset, length, cb, req);
     } else {
-        rc = shardcache_get_async(cache, key, klen, cb, req);
+        rc = shardcache_get_async_key(cache, key, cb, req);
     }
     if (rc != 0) {
         SHC_ERROR("shardcache_get_async returned error");
@@ -539,10 +693,21 @@ process_request(shardcache_request_t *req)
 
     shardcache_t *cache = req->ctx->serv->cache; //XXX
 
+    gettimeofday(&req->started, NULL);
+
+    // the commands forwarded to the peers on behalf of the request carry
+    // its trace context (a copy, the request can be released by the time
+    // the forwarding is done)
+    shardcache_trace_t trace = req->trace;
+    shardcache_request_trace = trace.id ? &trace : NULL;
+
     int rc = 0;
     void *key = fbuf_data(&req->records[0]);
     size_t klen = fbuf_used(&req->records[0]);
 
+    if (!req->hash && klen)
+        req->hash = arc_hash_key(key, klen);
+
     switch(req->hdr) {
         case SHC_HDR_GET:
         case SHC_HDR_GET_ASYNC:
@@ -562,7 +727,24 @@ process_request(shardcache_request_t *req)
                 }
             }
 
-            get_async_data(cache, key, klen, get_async_data_handler, req);
+            if (shardcache_deadline_left(&req->deadline) == -1) {
+                // the request expired while queued, the client already gave up
+                // (get requests are answered with an empty response)
+                ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_DROPPED_REQUESTS].value);
+                write_status(req, 0, WRITE_STATUS_MODE_SIMPLE);
+                break;
+            }
+
+            shardcache_hotkeys_track(cache, SHARDCACHE_HOTKEYS_REQUESTS, key, klen, req->hash, 1);
+
+            // the key is hashed once here and the hash carried through the lookups
+            shardcache_key_t k = { key, klen, req->hash, &req->deadline };
+            // the request can't be accessed once get_async_data() returns
+            // (it might be already completed), the fetch callbacks fill
+            // its timing as the lookup goes
+            shardcache_fetch_timing = &req->timing;
+            get_async_data(cache, &k, get_async_data_handler, req);
+            shardcache_fetch_timing = NULL;
             break;
         }
         case SHC_HDR_ADD:
@@ -589,8 +771,47 @@ process_request(shardcache_request_t *req)
         }
         case SHC_HDR_TOUCH:
         {
-            rc = shardcache_touch(cache, key, klen);
-            write_status(req, rc, WRITE_STATUS_MODE_SIMPLE);
+            shardcache_touch_async(cache, key, klen, shardcache_async_command_response, req);
+            break;
+        }
+        case SHC_HDR_PREFETCH:
+        {
+            // the record holds the list of keys (<KSIZE><KDATA>...)
+            char *data = fbuf_data(&req->records[0]);
+            size_t len = fbuf_used(&req->records[0]);
+            int num_keys = 0;
+            size_t ofx = 0;
+            while (ofx + sizeof(uint32_t) <= len) {
+                uint32_t ksize;
+                memcpy(&ksize, data + ofx, sizeof(uint32_t));
+                ofx += sizeof(uint32_t) + ntohl(ksize);
+                num_keys++;
+            }
+
+            if (ofx != len) {
+                SHC_WARNING("Bad record format for message PREFETCH");
+                write_status(req, -1, WRITE_STATUS_MODE_SIMPLE);
+                break;
+            }
+
+            void **keys = malloc(sizeof(void *) * (num_keys + 1));
+            size_t *klens = malloc(sizeof(size_t) * (num_keys + 1));
+            int i;
+            for (i = 0, ofx = 0; i < num_keys; i++) {
+                uint32_t ksize;
+                memcpy(&ksize, data + ofx, sizeof(uint32_t));
+                ofx += sizeof(uint32_t);
+                keys[i] = data + ofx;
+                klens[i] = ntohl(ksize);
+                ofx += klens[i];
+            }
+
+            // the values are loaded in background, just report
+            // if the keys have been accepted
+            rc = shardcache_prefetch(cache, keys, klens, num_keys);
+            write_status(req, rc >= 0 ? 0 : -1, WRITE_STATUS_MODE_SIMPLE);
+            free(keys);
+            free(klens);
             break;
         }
         case SHC_HDR_DELETE:
@@ -604,6 +825,15 @@ process_request(shardcache_request_t *req)
             write_status(req, 0, WRITE_STATUS_MODE_SIMPLE);
             break;
         }
+        case SHC_HDR_INVALIDATE:
+        {
+            // the nodes broadcasting the command flag it as local
+            // so that it's not propagated again
+            int local = (fbuf_used(&req->records[1]) == 1 && *fbuf_data(&req->records[1]));
+            rc = shardcache_invalidate_internal(cache, key, klen, !local);
+            write_status(req, rc >= 0 ? 0 : -1, WRITE_STATUS_MODE_SIMPLE);
+            break;
+        }
         case SHC_HDR_MIGRATION_BEGIN:
         {
             int num_shards = 0;
@@ -630,6 +860,39 @@ process_request(shardcache_request_t *req)
             write_status(req, 0, WRITE_STATUS_MODE_SIMPLE);
             break;
         }
+        case SHC_HDR_MIGRATION_WARMUP:
+        {
+            uint32_t max_items = 0;
+            if (fbuf_used(&req->records[1]) == sizeof(uint32_t)) {
+                memcpy(&max_items, fbuf_data(&req->records[1]), sizeof(uint32_t));
+                max_items = ntohl(max_items);
+            }
+
+            fbuf_t hot_set = FBUF_STATIC_INITIALIZER_PARAMS(FBUF_MAXLEN_NONE, 64, 1024, 512);
+            fbuf_t out = FBUF_STATIC_INITIALIZER_PARAMS(FBUF_MAXLEN_NONE, 64, 1024, 512);
+            rc = shardcache_get_hot_set(cache,
+                                        fbuf_data(&req->records[0]),
+                                        fbuf_used(&req->records[0]),
+                                        max_items,
+                                        &hot_set);
+            shardcache_record_t record = {
+                .v = fbuf_data(&hot_set),
+                .l = fbuf_used(&hot_set)
+            };
+            if (rc >= 0 && build_message((char *)cache->auth,
+                                         req->sig_hdr,
+                                         SHC_HDR_RESPONSE,
+                                         &record, 1, &out) == 0)
+            {
+                send_data(req, &out);
+                ATOMIC_INCREMENT(req->done);
+            } else {
+                write_status(req, -1, WRITE_STATUS_MODE_SIMPLE);
+            }
+            fbuf_destroy(&hot_set);
+            fbuf_destroy(&out);
+            break;
+        }
         case SHC_HDR_MIGRATION_ABORT:
         {
             rc = shardcache_migration_abort(cache);
@@ -656,6 +919,38 @@ process_request(shardcache_request_t *req)
         {
             fbuf_t buf = FBUF_STATIC_INITIALIZER_PARAMS(FBUF_MAXLEN_NONE, 64, 1024, 512);
 
+            // the (optional) record selects a section other than the counters
+            int hotkeys = (klen == 7 && memcmp(key, "hotkeys", 7) == 0);
+            int slowlog = (klen == 7 && memcmp(key, "slowlog", 7) == 0);
+            int traces = (klen == 6 && memcmp(key, "traces", 6) == 0);
+            if (hotkeys || slowlog || traces) {
+                if (hotkeys)
+                    shardcache_get_hotkeys(cache, &buf);
+                else if (slowlog)
+                    shardcache_get_slowlog(cache, &buf);
+                else
+                    shardcache_get_traces(cache, &buf);
+                fbuf_t out = FBUF_STATIC_INITIALIZER_PARAMS(FBUF_MAXLEN_NONE, 64, 1024, 512);
+                shardcache_record_t record = {
+                    .v = fbuf_data(&buf),
+                    .l = fbuf_used(&buf)
+                };
+                if (build_message((char *)cache->auth,
+                                  req->sig_hdr,
+                                  SHC_HDR_RESPONSE,
+                                  &record, 1, &out) == 0)
+                {
+                    send_data(req, &out);
+                    ATOMIC_INCREMENT(req->done);
+                } else {
+                    SHC_ERROR("Can't build the STATS (%.*s) response", (int)klen, (char *)key);
+                    write_status(req, -1, WRITE_STATUS_MODE_SIMPLE);
+                }
+                fbuf_destroy(&out);
+                fbuf_destroy(&buf);
+                break;
+            }
+
             shardcache_counter_t *counters = NULL;
             int i, num_nodes;
 
@@ -704,6 +999,66 @@ process_request(shardcache_request_t *req)
         {
             fbuf_t buf = FBUF_STATIC_INITIALIZER;
             fbuf_t out = FBUF_STATIC_INITIALIZER;
+
+            if (fbuf_used(&req->records[0]) == 2 * sizeof(uint32_t)) {
+                // paged request : <CURSOR>[<PAGE_SIZE>[<HASH_RANGE>]]
+                uint32_t *ncursor = (uint32_t *)fbuf_data(&req->records[0]);
+                uint64_t cursor = ((uint64_t)ntohl(ncursor[0]) << 32) | ntohl(ncursor[1]);
+                uint32_t page_size = SHARDCACHE_INDEX_PAGE_SIZE_DEFAULT;
+                uint64_t hash_min = 0;
+                uint64_t hash_max = UINT64_MAX;
+
+                if (fbuf_used(&req->records[1]) == sizeof(uint32_t)) {
+                    page_size = ntohl(*((uint32_t *)fbuf_data(&req->records[1])));
+                    if (page_size == 0)
+                        page_size = SHARDCACHE_INDEX_PAGE_SIZE_DEFAULT;
+                    else if (page_size > SHARDCACHE_INDEX_PAGE_SIZE_MAX)
+                        page_size = SHARDCACHE_INDEX_PAGE_SIZE_MAX;
+                }
+
+                if (fbuf_used(&req->records[2]) == 4 * sizeof(uint32_t)) {
+                    uint32_t *nrange = (uint32_t *)fbuf_data(&req->records[2]);
+                    hash_min = ((uint64_t)ntohl(nrange[0]) << 32) | ntohl(nrange[1]);
+                    hash_max = ((uint64_t)ntohl(nrange[2]) << 32) | ntohl(nrange[3]);
+                }
+
+                SHC_DEBUG("Fetching index page (cursor: %llu, size: %u)",
+                          (unsigned long long)cursor, page_size);
+
+                shardcache_storage_index_t *index =
+                    shardcache_get_index_page(cache, &cursor, page_size, hash_min, hash_max);
+                if (index) {
+                    build_index_page(index->items, index->size, &buf);
+                    shardcache_free_index(index);
+                }
+
+                uint32_t next[2] = { htonl(cursor >> 32), htonl(cursor & 0xffffffff) };
+                shardcache_record_t records[2] = {
+                    {
+                        .v = fbuf_data(&buf),
+                        .l = fbuf_used(&buf)
+                    },
+                    {
+                        .v = next,
+                        .l = sizeof(next)
+                    }
+                };
+                if (build_message((char *)req->ctx->serv->cache->auth,
+                                  req->sig_hdr,
+                                  SHC_HDR_INDEX_RESPONSE,
+                                  records, 2, &out) == 0)
+                {
+                    send_data(req, &out);
+                    ATOMIC_INCREMENT(req->done);
+                } else {
+                    write_status(req, -1, WRITE_STATUS_MODE_SIMPLE);
+                    SHC_ERROR("Can't build the index page response");
+                }
+                fbuf_destroy(&out);
+                fbuf_destroy(&buf);
+                break;
+            }
+
             SHC_DEBUG("Fetching index");
             shardcache_storage_index_t *index = shardcache_get_index(cache);
             SHC_DEBUG("Index got");
@@ -796,6 +1151,8 @@ process_request(shardcache_request_t *req)
             write_status(req, -1, WRITE_STATUS_MODE_SIMPLE);
             break;
     }
+
+    shardcache_request_trace = NULL;
 }
 
 
@@ -807,8 +1164,10 @@ shardcache_select_worker(shardcache_serving_t *serv)
     if (ATOMIC_READ(serv->leave))
         return NULL;
 
+    // the control worker (if any) is the last one in the list
+    // and doesn't handle connections
     shardcache_worker_context_t *wrk = list_pick_value(serv->workers,
-            __sync_fetch_and_add(&serv->next_worker_index, 1)%list_count(serv->workers));
+            __sync_fetch_and_add(&serv->next_worker_index, 1)%serv->num_workers);
 
     return wrk;
 }
@@ -821,6 +1180,11 @@ shardcache_request_create(shardcache_connection_context_t *ctx)
     req->sig_hdr = async_read_context_sig_hdr(ctx->reader_ctx);
     req->ctx = ctx;
     SPIN_INIT(&req->output_lock);
+    gettimeofday(&req->created, NULL);
+    // the requests already buffered when the previous one was
+    // created are accounted as received at creation time
+    req->received = timerisset(&ctx->receiving) ? ctx->receiving : req->created;
+    timerclear(&ctx->receiving);
 
     int i;
     for (i = 0; i < SHARDCACHE_REQUEST_RECORDS_MAX; i++) {
@@ -835,11 +1199,286 @@ shardcache_request_create(shardcache_connection_context_t *ctx)
     FBUF_STATIC_INITIALIZER_POINTER(&req->fetch_accumulator, FBUF_MAXLEN_NONE, 64, 1024, 512);
     FBUF_STATIC_INITIALIZER_POINTER(&req->output, FBUF_MAXLEN_NONE, 64, 1024, 512);
 
+    // the records received so far are now accounted to the request
+    ATOMIC_DECREASE(ctx->serv->cache->mem[SHARDCACHE_MEM_BUFFERS], ctx->records_mem);
+    ctx->records_mem = 0;
+
+    size_t mem = sizeof(shardcache_request_t);
+    for (i = 0; i < SHARDCACHE_REQUEST_RECORDS_MAX; i++)
+        mem += fbuf_used(&req->records[i]);
+    SHARDCACHE_REQUEST_MEM_ADD(req, mem);
+
+    // the (optional) deadline follows the other records of the get messages
+    // and is relative to the time the request has been received
+    int deadline_idx = (req->hdr == SHC_HDR_GET || req->hdr == SHC_HDR_GET_ASYNC)
+                     ? 1
+                     : (req->hdr == SHC_HDR_GET_OFFSET) ? 3 : -1;
+
+    if (deadline_idx > 0 && fbuf_used(&req->records[deadline_idx]) == sizeof(uint32_t)) {
+        uint32_t msecs;
+        memcpy(&msecs, fbuf_data(&req->records[deadline_idx]), sizeof(uint32_t));
+        msecs = ntohl(msecs);
+        if (msecs) {
+            struct timeval now, budget = { msecs / 1000, (msecs % 1000) * 1000 };
+            gettimeofday(&now, NULL);
+            timeradd(&now, &budget, &req->deadline);
+        }
+    }
+
+    // the (optional) trace context follows the deadline of the get
+    // messages, the ttl of the set messages and the key of the others
+    int trace_idx = -1;
+    switch(req->hdr) {
+        case SHC_HDR_GET:
+        case SHC_HDR_GET_ASYNC:
+            trace_idx = 2;
+            break;
+        case SHC_HDR_GET_OFFSET:
+            trace_idx = 4;
+            break;
+        case SHC_HDR_SET:
+        case SHC_HDR_ADD:
+            trace_idx = 3;
+            break;
+        case SHC_HDR_DELETE:
+        case SHC_HDR_EVICT:
+        case SHC_HDR_REPLICA_COMMAND:
+            trace_idx = 1;
+            break;
+        default:
+            break;
+    }
+
+    if (trace_idx > 0)
+        parse_trace_record(fbuf_data(&req->records[trace_idx]),
+                           fbuf_used(&req->records[trace_idx]),
+                           &req->trace);
+
     return req;
 }
 
 static int shardcache_output_handler(iomux_t *iomux, int fd, unsigned char **out, int *len, void *priv);
 
+#define SHARDCACHE_HANDOFF_RING_SIZE 1024
+
+static inline int
+shardcache_request_has_key(shardcache_hdr_t hdr)
+{
+    switch(hdr) {
+        case SHC_HDR_GET:
+        case SHC_HDR_GET_ASYNC:
+        case SHC_HDR_GET_OFFSET:
+        case SHC_HDR_SET:
+        case SHC_HDR_ADD:
+        case SHC_HDR_DELETE:
+        case SHC_HDR_EVICT:
+        case SHC_HDR_EXISTS:
+        case SHC_HDR_TOUCH:
+            return 1;
+        default:
+            break;
+    }
+    return 0;
+}
+
+static inline shardcache_lane_t
+shardcache_request_lane(shardcache_hdr_t hdr)
+{
+    switch(hdr) {
+        case SHC_HDR_REPLICA_COMMAND:
+        case SHC_HDR_REPLICA_RESPONSE:
+        case SHC_HDR_REPLICA_PING:
+        case SHC_HDR_REPLICA_ACK:
+            return SHARDCACHE_LANE_REPLICA;
+        case SHC_HDR_CHECK:
+        case SHC_HDR_STATS:
+            return SHARDCACHE_LANE_ADMIN;
+        case SHC_HDR_MIGRATION_BEGIN:
+        case SHC_HDR_MIGRATION_ABORT:
+        case SHC_HDR_MIGRATION_END:
+        case SHC_HDR_MIGRATION_WARMUP:
+            return SHARDCACHE_LANE_MIGRATION;
+        default:
+            break;
+    }
+    return SHARDCACHE_LANE_DATA;
+}
+
+static inline void
+shardcache_worker_wakeup(shardcache_worker_context_t *wrk)
+{
+    // only the first producer after the consumer drained the inbox
+    // needs to write on the wakeup socket
+    if (ATOMIC_CAS(wrk->wakeup_pending, 0, 1)) {
+        char c = 0;
+        if (write(wrk->wakeup_fds[1], &c, 1) != 1 && errno != EAGAIN)
+            SHC_WARNING("Can't wake up worker %d: %s", wrk->index, strerror(errno));
+    }
+}
+
+static void
+shardcache_worker_drain_inbox(shardcache_worker_context_t *wrk)
+{
+    // reset the flag before looking at the rings so that a request pushed
+    // while we are draining will trigger a new wakeup
+    ATOMIC_SET(wrk->wakeup_pending, 0);
+
+    int i;
+    if (!wrk->lanes) {
+        for (i = 0; i < wrk->serv->num_workers; i++) {
+            shardcache_request_t *req = spsc_ring_pop(wrk->inbox[i]);
+            while (req) {
+                wrk->activity++;
+                // the request can't be accessed once processed
+                shardcache_connection_context_t *ctx = req->ctx;
+                process_request(req);
+                ATOMIC_DECREMENT(ctx->inflight);
+                req = spsc_ring_pop(wrk->inbox[i]);
+            }
+        }
+        return;
+    }
+
+    // control worker: the rings are collected again before serving each
+    // request so that a request in a higher priority lane always
+    // overtakes the ones already queued in the lower priority lanes
+    for (;;) {
+        for (i = 0; i < wrk->serv->num_workers; i++) {
+            shardcache_request_t *req = spsc_ring_pop(wrk->inbox[i]);
+            while (req) {
+                shardcache_lane_t lane = shardcache_request_lane(req->hdr);
+                list_push_value(wrk->lanes[lane], req);
+                ATOMIC_INCREMENT(wrk->serv->lane_requests[lane]);
+                req = spsc_ring_pop(wrk->inbox[i]);
+            }
+        }
+
+        shardcache_request_t *req = NULL;
+        for (i = 0; i < SHARDCACHE_NUM_LANES && !req; i++)
+            req = list_shift_value(wrk->lanes[i]);
+
+        if (!req)
+            break;
+
+        wrk->activity++;
+        shardcache_connection_context_t *ctx = req->ctx;
+        process_request(req);
+        ATOMIC_DECREMENT(ctx->inflight);
+    }
+}
+
+static int
+shardcache_wakeup_handler(iomux_t *iomux, int fd, unsigned char *data, int len, void *priv)
+{
+    shardcache_worker_drain_inbox((shardcache_worker_context_t *)priv);
+    return len;
+}
+
+// if the cache is partitioned, requests for keys owned by a partition
+// other than the one of the worker handling the connection are handed over
+// to the owner worker. The response is still sent by the connection owner
+// (which polls req->done in the output handler).
+// The requests handed over are accounted as in-flight in their connection
+// context, which is not released until the other workers are done with them
+static inline void
+dispatch_request(shardcache_request_t *req)
+{
+    shardcache_serving_t *serv = req->ctx->serv;
+    shardcache_worker_context_t *wrk = req->ctx->worker;
+
+    shardcache_lane_t lane = shardcache_request_lane(req->hdr);
+    if (lane != SHARDCACHE_LANE_DATA && serv->control_worker) {
+        ATOMIC_INCREMENT(req->ctx->inflight);
+        if (spsc_ring_push(serv->control_worker->inbox[wrk->index], req) == 0) {
+            shardcache_worker_wakeup(serv->control_worker);
+            return;
+        }
+        ATOMIC_DECREMENT(req->ctx->inflight);
+        SHC_DEBUG2("Handoff ring to the control worker is full, serving locally");
+        process_request(req);
+        return;
+    }
+
+    if (serv->partition_workers && shardcache_request_has_key(req->hdr) &&
+        fbuf_used(&req->records[0]))
+    {
+        req->hash = arc_hash_key(fbuf_data(&req->records[0]), fbuf_used(&req->records[0]));
+        int target = shardcache_partition_index(serv->cache, req->hash);
+        if (target != wrk->index) {
+            shardcache_worker_context_t *owner = serv->partition_workers[target];
+            ATOMIC_INCREMENT(req->ctx->inflight);
+            if (spsc_ring_push(owner->inbox[wrk->index], req) == 0) {
+                ATOMIC_INCREMENT(wrk->handoffs);
+                shardcache_worker_wakeup(owner);
+                return;
+            }
+            ATOMIC_DECREMENT(req->ctx->inflight);
+            // the ring is full, the partition is thread-safe anyway
+            // so let's serve the request here instead of waiting
+            SHC_DEBUG2("Handoff ring to worker %d is full, serving locally", target);
+        }
+    }
+
+    process_request(req);
+}
+
+// the fixed cost accounted to each request on top of its size
+// (bounds the number of tiny requests served in a single turn)
+#define SHARDCACHE_REQUEST_COST_MIN 256
+
+static inline int
+shardcache_request_cost(shardcache_request_t *req)
+{
+    int cost = SHARDCACHE_REQUEST_COST_MIN;
+    int i;
+    for (i = 0; i < SHARDCACHE_REQUEST_RECORDS_MAX; i++)
+        cost += fbuf_used(&req->records[i]);
+    return cost;
+}
+
+// Deficit round-robin among the connections owned by a worker.
+// Each connection can have up to 'serving_quantum' bytes of requests
+// dispatched per loop turn, a request exceeding the deficit left waits
+// in the worker backlog (and no further input is parsed for its connection)
+// until enough quanta have been accumulated in the following turns.
+// This way a client pipelining lots of requests on a single connection
+// can't starve the other connections handled by the same worker
+static void
+schedule_request(shardcache_request_t *req)
+{
+    shardcache_connection_context_t *ctx = req->ctx;
+    shardcache_worker_context_t *wrk = ctx->worker;
+
+    int quantum = ATOMIC_READ(ctx->serv->cache->serving_quantum);
+    if (quantum <= 0) {
+        ctx->served++;
+        dispatch_request(req);
+        return;
+    }
+
+    if (ctx->turn != wrk->turn) {
+        // the connection wasn't backlogged, the leftover
+        // of its previous turns doesn't carry over
+        ctx->deficit = quantum;
+        ctx->turn = wrk->turn;
+    }
+
+    int cost = shardcache_request_cost(req);
+    if (cost <= ctx->deficit) {
+        ctx->deficit -= cost;
+        ctx->served++;
+        dispatch_request(req);
+        return;
+    }
+
+    ctx->deferred = req;
+    ctx->deferrals++;
+    gettimeofday(&ctx->deferred_since, NULL);
+    TAILQ_INSERT_TAIL(&wrk->backlog, ctx, backlog_next);
+    ATOMIC_INCREMENT(wrk->deferred);
+    ATOMIC_INCREMENT(wrk->backlogged);
+}
+
 static inline int
 shardcache_check_context_state(iomux_t *iomux,
                                int fd,
@@ -852,7 +1491,7 @@ shardcache_check_context_state(iomux_t *iomux,
         shardcache_request_t *req = shardcache_request_create(ctx);
         TAILQ_INSERT_TAIL(&ctx->requests, req, next);
         ctx->num_requests++;
-        process_request(req);
+        schedule_request(req);
         iomux_set_output_callback(iomux, fd, shardcache_output_handler);
     }
     else if (UNLIKELY(state == SHC_STATE_READING_ERR || state == SHC_STATE_AUTH_ERR))
@@ -870,6 +1509,149 @@ shardcache_check_context_state(iomux_t *iomux,
     return 0;
 }
 
+static void
+shardcache_connection_set_look_ahead(shardcache_connection_context_t *ctx, int look_ahead)
+{
+    shardcache_worker_context_t *wrk = ctx->worker;
+    if (ctx->look_ahead)
+        ATOMIC_DECREASE(wrk->look_ahead_total, ctx->look_ahead);
+    else
+        ATOMIC_INCREMENT(wrk->look_ahead_conns);
+    ctx->look_ahead = look_ahead;
+    ATOMIC_INCREASE(wrk->look_ahead_total, look_ahead);
+
+    uint64_t conns = ATOMIC_READ(wrk->look_ahead_conns);
+    if (conns)
+        ATOMIC_SET(wrk->look_ahead, ATOMIC_READ(wrk->look_ahead_total) / conns);
+}
+
+// AIMD adjustment of the look-ahead of a connection, driven by the time
+// its requests take to complete and by the backlog of the worker.
+// The look-ahead grows by one each time a window of requests completes
+// within the latency target and is halved (at most once per window)
+// when the target is missed or the worker can't keep up
+static void
+shardcache_connection_adapt_look_ahead(shardcache_connection_context_t *ctx,
+                                       shardcache_request_t *req)
+{
+    shardcache_t *cache = ctx->serv->cache;
+    int max = ATOMIC_READ(cache->serving_look_ahead);
+    int min = ATOMIC_READ(cache->serving_look_ahead_min);
+    if (min > max)
+        min = max;
+
+    int look_ahead = ctx->look_ahead;
+
+    struct timeval now, latency;
+    gettimeofday(&now, NULL);
+    timersub(&now, &req->created, &latency);
+    int target = ATOMIC_READ(cache->serving_latency_target);
+
+    if ((target > 0 && latency.tv_sec * 1000000 + latency.tv_usec > target) ||
+        ATOMIC_READ(ctx->worker->backlogged))
+    {
+        // only the requests received after the last decrease
+        // can tell if it was enough
+        if (timercmp(&req->created, &ctx->look_ahead_cut, >)) {
+            look_ahead /= 2;
+            ctx->look_ahead_cut = now;
+        }
+        ctx->look_ahead_credit = 0;
+    } else if (++ctx->look_ahead_credit >= look_ahead) {
+        look_ahead++;
+        ctx->look_ahead_credit = 0;
+    }
+
+    if (look_ahead < min)
+        look_ahead = min;
+    if (look_ahead > max)
+        look_ahead = max;
+    if (look_ahead < 1)
+        look_ahead = 1;
+
+    if (look_ahead != ctx->look_ahead)
+        shardcache_connection_set_look_ahead(ctx, look_ahead);
+}
+
+// the microseconds from 'from' to 'to' (0 if 'to' comes first)
+static inline uint64_t
+shardcache_elapsed_usecs(struct timeval *from, struct timeval *to)
+{
+    if (!timercmp(to, from, >))
+        return 0;
+    struct timeval diff;
+    timersub(to, from, &diff);
+    return diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+// break down the time taken by a completed request and account it
+// in the slow log if it went over the threshold, and as a span if it
+// belongs to a sampled trace.
+// The phases a request didn't go through take no time
+static void
+shardcache_request_account_time(shardcache_connection_context_t *ctx,
+                                shardcache_request_t *req)
+{
+    shardcache_t *cache = ctx->serv->cache;
+    int threshold = ATOMIC_READ(cache->slowlog_threshold);
+    // the requests which waited for a peer fetch forwarded on behalf of a
+    // sampled trace are recorded as spans linked to it
+    int sampled = (req->trace.id && (req->trace.flags & SHC_TRACE_FLAG_SAMPLED)) ||
+                  (req->timing.linked.id && (req->timing.linked.flags & SHC_TRACE_FLAG_SAMPLED));
+    if (!threshold && !sampled)
+        return;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    uint64_t total = shardcache_elapsed_usecs(&req->received, &now);
+    int slow = (threshold && total >= threshold);
+    if (!slow && !sampled)
+        return;
+
+    struct timeval *started = timerisset(&req->started) ? &req->started : &req->created;
+    // the commands which don't look up the cache are all execution
+    struct timeval *looked_up = timerisset(&req->timing.looked_up)
+                              ? &req->timing.looked_up
+                              : timerisset(&req->first_data) ? &req->first_data : &now;
+    // the values already in the cache are sent within the lookup
+    struct timeval *first_data = timerisset(&req->first_data) ? &req->first_data : looked_up;
+    struct timeval *lookup_end = timercmp(first_data, looked_up, <) ? first_data : looked_up;
+    struct timeval *completed = timerisset(&req->completed) ? &req->completed : first_data;
+    struct timeval *flush_start = timercmp(completed, looked_up, <) ? looked_up : completed;
+
+    slowlog_entry_t entry = {
+        .received = req->received,
+        .hdr = req->hdr,
+        .hash = req->hash,
+        .trace_id = req->trace.id,
+        .linked_trace_id = req->timing.linked.id,
+        .klen = fbuf_used(&req->records[0]),
+        .source = req->timing.source,
+        .total = total
+    };
+
+    if (entry.klen)
+        memcpy(entry.key, fbuf_data(&req->records[0]),
+               entry.klen < SLOWLOG_KEY_MAX ? entry.klen : SLOWLOG_KEY_MAX);
+    memcpy(entry.peer, req->timing.peer, sizeof(entry.peer));
+
+    uint64_t lookup = shardcache_elapsed_usecs(started, lookup_end);
+    entry.phases[SLOWLOG_PHASE_PARSE] = shardcache_elapsed_usecs(&req->received, &req->created);
+    entry.phases[SLOWLOG_PHASE_QUEUE] = shardcache_elapsed_usecs(&req->created, started);
+    entry.phases[SLOWLOG_PHASE_STORAGE] = req->timing.storage_usecs < lookup
+                                        ? req->timing.storage_usecs : lookup;
+    entry.phases[SLOWLOG_PHASE_LOOKUP] = lookup - entry.phases[SLOWLOG_PHASE_STORAGE];
+    entry.phases[SLOWLOG_PHASE_WAIT] = shardcache_elapsed_usecs(lookup_end, first_data);
+    entry.phases[SLOWLOG_PHASE_TRANSFER] = shardcache_elapsed_usecs(first_data, completed);
+    entry.phases[SLOWLOG_PHASE_FLUSH] = shardcache_elapsed_usecs(flush_start, &now);
+
+    if (sampled)
+        shardcache_trace_add(cache, &entry);
+
+    if (slow)
+        shardcache_slowlog_add(cache, &entry);
+}
 
 static int
 shardcache_output_handler(iomux_t *iomux, int fd, unsigned char **out, int *len, void *priv)
@@ -887,7 +1669,8 @@ shardcache_output_handler(iomux_t *iomux, int fd, unsigned char **out, int *len,
             // if there was an error while fetching a remote object
             if (!iomux_close(iomux, fd)) {
                 close(fd);
-                shardcache_connection_context_destroy(ctx);
+                shardcache_connection_unschedule(ctx);
+                shardcache_connection_context_release(ctx);
             }
             return IOMUX_OUTPUT_MODE_NONE;
         }
@@ -895,20 +1678,30 @@ shardcache_output_handler(iomux_t *iomux, int fd, unsigned char **out, int *len,
         int done = ATOMIC_READ(req->done);
 
         SPIN_LOCK(&req->output_lock);
-        if (fbuf_used(&req->output))
+        if (fbuf_used(&req->output)) {
             *len = fbuf_detach(&req->output, (char **)out, NULL);
+            SHARDCACHE_REQUEST_MEM_SUB(req, *len);
+        }
         SPIN_UNLOCK(&req->output_lock);
 
+        if (*len || done)
+            ctx->worker->activity++;
+
         if (done) {
             TAILQ_REMOVE(&ctx->requests, req, next);
             ctx->num_requests--;
+            shardcache_connection_adapt_look_ahead(ctx, req);
+            shardcache_request_account_time(ctx, req);
             shardcache_request_destroy(req);
             // if we have pending input data this is time
             // to process it and move to the next request
-            int state = async_read_context_update(ctx->reader_ctx);
-            if (shardcache_check_context_state(iomux, fd, ctx, state) != 0) {
-                iomux_close(iomux, fd);
-                *len = 0;
+            // (unless the connection is waiting for its turn)
+            if (!ctx->deferred) {
+                int state = async_read_context_update(ctx->reader_ctx);
+                if (shardcache_check_context_state(iomux, fd, ctx, state) != 0) {
+                    iomux_close(iomux, fd);
+                    *len = 0;
+                }
             }
         }
     } else {
@@ -922,6 +1715,7 @@ send_data(shardcache_request_t *req, fbuf_t *data)
 {
     SPIN_LOCK(&req->output_lock);
     fbuf_concat(&req->output, data);
+    SHARDCACHE_REQUEST_MEM_ADD(req, fbuf_used(data));
     SPIN_UNLOCK(&req->output_lock);
 }
 
@@ -939,14 +1733,25 @@ shardcache_input_handler(iomux_t *iomux,
 
 
     if (ctx) {
-        if (ctx->num_requests > ctx->serv->cache->serving_look_ahead) {
+        if (ctx->num_requests > ctx->look_ahead) {
             SHC_DEBUG2("Too many pipelined requests, waiting");
             return 0;
         }
 
+        if (ctx->deferred) {
+            SHC_DEBUG3("Connection %d is waiting for its turn", fd);
+            return 0;
+        }
+
+        if (!timerisset(&ctx->receiving))
+            gettimeofday(&ctx->receiving, NULL);
+
         async_read_context_state_t state =
             async_read_context_input_data(ctx->reader_ctx, data, len, &processed);
 
+        if (processed)
+            ctx->worker->activity++;
+
         // updating the context state might eventually push a new requeset
         // (if entirely dowloaded) to a worker
         if (shardcache_check_context_state(iomux, fd, ctx, state) != 0) {
@@ -966,14 +1771,8 @@ shardcache_eof_handler(iomux_t *iomux, int fd, void *priv)
     close(fd);
 
     if (ctx) {
-        if (TAILQ_FIRST(&ctx->requests) != NULL) {
-            ctx->closed = 1;
-            gettimeofday(&ctx->in_prune_since, NULL);
-            list_push_value(ctx->worker->prune, ctx);
-            ATOMIC_INCREMENT(ctx->worker->pruning);
-            return;
-        }
-        shardcache_connection_context_destroy(ctx);
+        shardcache_connection_unschedule(ctx);
+        shardcache_connection_context_release(ctx);
     }
 }
 
@@ -1002,15 +1801,117 @@ shardcache_connection_handler(iomux_t *iomux, int fd, void *priv)
 }
 
 
+// the number of turns a backlogged connection still has to wait
+// (besides the current one) before its deferred request can be served
+static inline int
+shardcache_backlog_turns(shardcache_connection_context_t *ctx, int quantum)
+{
+    int missing = shardcache_request_cost(ctx->deferred) - ctx->deficit - quantum;
+    return missing > 0 ? (missing + quantum - 1) / quantum : 0;
+}
+
+// a new loop turn: each backlogged connection earns a quantum and has its
+// deferred request dispatched if the deficit accumulated so far covers it
+static void
+shardcache_worker_serve_backlog(shardcache_worker_context_t *wrk)
+{
+    ATOMIC_INCREMENT(wrk->turn);
+
+    int quantum = ATOMIC_READ(wrk->serv->cache->serving_quantum);
+    uint64_t count = ATOMIC_READ(wrk->backlogged);
+    shardcache_connection_context_t *ctx;
+
+    // the turns in which no backlogged connection would be served are
+    // skipped (crediting their quanta to all the backlogged connections),
+    // the worker polls without blocking while the backlog isn't empty and
+    // would otherwise spin until a request bigger than the quantum is covered
+    if (quantum > 0 && count) {
+        int skip = INT_MAX;
+        TAILQ_FOREACH(ctx, &wrk->backlog, backlog_next) {
+            int turns = shardcache_backlog_turns(ctx, quantum);
+            if (turns < skip)
+                skip = turns;
+        }
+        if (skip > 0 && skip < INT_MAX) {
+            TAILQ_FOREACH(ctx, &wrk->backlog, backlog_next)
+                ctx->deficit += skip * quantum;
+        }
+    }
+
+    while (count--) {
+        ctx = TAILQ_FIRST(&wrk->backlog);
+        if (!ctx)
+            break;
+
+        TAILQ_REMOVE(&wrk->backlog, ctx, backlog_next);
+        shardcache_request_t *req = ctx->deferred;
+
+        ctx->deficit += quantum;
+        ctx->turn = wrk->turn;
+
+        int cost = shardcache_request_cost(req);
+        if (quantum > 0 && cost > ctx->deficit) {
+            // still not enough, back to the tail of the backlog
+            TAILQ_INSERT_TAIL(&wrk->backlog, ctx, backlog_next);
+            continue;
+        }
+
+        ctx->deficit -= cost;
+        ctx->deferred = NULL;
+        ATOMIC_DECREMENT(wrk->backlogged);
+
+        struct timeval now, diff;
+        gettimeofday(&now, NULL);
+        timersub(&now, &ctx->deferred_since, &diff);
+        uint64_t wait = (uint64_t)diff.tv_sec * 1000000 + diff.tv_usec;
+        ctx->wait_usecs += wait;
+        if (wait > ctx->max_wait_usecs)
+            ctx->max_wait_usecs = wait;
+
+        ctx->served++;
+        dispatch_request(req);
+
+        // resume parsing the input already received on this connection
+        int state = async_read_context_update(ctx->reader_ctx);
+        if (shardcache_check_context_state(wrk->iomux, ctx->fd, ctx, state) != 0)
+            iomux_close(wrk->iomux, ctx->fd);
+    }
+}
+
+// the spin budget (in microsecs) if the worker is busy polling, 0 otherwise
+static inline int
+shardcache_worker_busy_poll(shardcache_worker_context_t *wrk)
+{
+    shardcache_t *cache = wrk->serv->cache;
+    if (wrk->lanes || wrk->index >= ATOMIC_READ(cache->busy_poll_workers))
+        return 0;
+    int budget = ATOMIC_READ(cache->busy_poll);
+    return budget > 0 ? budget : 0;
+}
+
 static void *
 worker(void *priv)
 {
     shardcache_worker_context_t *wrkctx = (shardcache_worker_context_t *)priv;
     queue_t *jobs = wrkctx->jobs;
+    struct timeval last_activity = { 0, 0 };
 
     shardcache_thread_init(wrkctx->serv->cache);
 
     while (ATOMIC_READ(wrkctx->leave) == 0) {
+        // when busy polling the worker keeps polling its filedescriptors
+        // and queues without blocking until it doesn't find anything to do
+        // for longer than the spin budget, then it goes back to sleep
+        struct timeval loop_start, spun;
+        int busy_poll = shardcache_worker_busy_poll(wrkctx);
+        int spinning = 0;
+        uint64_t activity = wrkctx->activity;
+        if (busy_poll) {
+            gettimeofday(&loop_start, NULL);
+            timersub(&loop_start, &last_activity, &spun);
+            spinning = (spun.tv_sec == 0 && spun.tv_usec < busy_poll);
+        }
+
         shardcache_connection_context_t *ctx = queue_pop_left(jobs);
         while(ctx) {
             iomux_callbacks_t connection_callbacks = {
@@ -1023,6 +1924,19 @@ worker(void *priv)
             if (!iomux_add(wrkctx->iomux, ctx->fd, &connection_callbacks)) {
                 close(ctx->fd);
                 shardcache_connection_context_destroy(ctx);
+            } else {
+                wrkctx->activity++;
+#ifdef SO_BUSY_POLL
+                int busy_read = ATOMIC_READ(wrkctx->serv->cache->busy_poll_socket);
+                if (busy_poll && busy_read > 0 &&
+                    setsockopt(ctx->fd, SOL_SOCKET, SO_BUSY_POLL, &busy_read, sizeof(busy_read)) != 0)
+                {
+                    SHC_DEBUG("Can't set SO_BUSY_POLL on fd %d: %s", ctx->fd, strerror(errno));
+                }
+#endif
+                // new connections start from the maximum look-ahead
+                int look_ahead = ATOMIC_READ(wrkctx->serv->cache->serving_look_ahead);
+                shardcache_connection_set_look_ahead(ctx, look_ahead > 0 ? look_ahead : 1);
             }
             ctx = queue_pop_left(jobs);
         }
@@ -1030,27 +1944,38 @@ worker(void *priv)
 
         int timeout = ATOMIC_READ(wrkctx->serv->cache->iomux_run_timeout_low);
         struct timeval tv = { timeout/1e6, timeout%(int)1e6 };
+        // don't sit in the mux if there are connections waiting for their turn
+        if (spinning || !TAILQ_EMPTY(&wrkctx->backlog))
+            memset(&tv, 0, sizeof(tv));
         iomux_run(wrkctx->iomux, &tv);
 
+        if (wrkctx->inbox)
+            shardcache_worker_drain_inbox(wrkctx);
+
+        shardcache_worker_serve_backlog(wrkctx);
+
         int to_check = list_count(wrkctx->prune);
         while (to_check--) {
             shardcache_connection_context_t *to_prune = list_shift_value(wrkctx->prune);
             ATOMIC_DECREMENT(wrkctx->pruning);
             shardcache_request_t *req = TAILQ_FIRST(&to_prune->requests);
-            int done = 0;
-            if (req) {
-                if (ATOMIC_READ(req->done)) {
-                    // the request is served, we can destroy it
-                    TAILQ_REMOVE(&to_prune->requests, req, next);
-                    shardcache_request_destroy(req);
-                    done = (TAILQ_FIRST(&to_prune->requests) == NULL);
-                }
+            while (req && ATOMIC_READ(req->done)) {
+                // the request is served, we can destroy it
+                TAILQ_REMOVE(&to_prune->requests, req, next);
+                to_prune->num_requests--;
+                shardcache_request_destroy(req);
+                req = TAILQ_FIRST(&to_prune->requests);
             }
+            int done = (req == NULL);
             struct timeval quarantine = { 60, 0 };
             struct timeval now, diff;
             gettimeofday(&now, NULL);
             timersub(&now, &to_prune->in_prune_since, &diff);
-            if (done || timercmp(&diff, &quarantine, >)) {
+            // the requests still in the inbox of another worker (or being
+            // served by it) keep the context alive past the quarantine
+            if (!ATOMIC_READ(to_prune->inflight) &&
+                (done || timercmp(&diff, &quarantine, >)))
+            {
                 shardcache_connection_context_destroy(to_prune);
             } else {
                 list_push_value(wrkctx->prune, to_prune);
@@ -1058,7 +1983,26 @@ worker(void *priv)
             }
         }
 
-        ATOMIC_SET(wrkctx->numfds, iomux_num_fds(wrkctx->iomux));
+        // don't account the wakeup socket
+        ATOMIC_SET(wrkctx->numfds, iomux_num_fds(wrkctx->iomux) - (wrkctx->wakeup_fds[0] != -1 ? 1 : 0));
+
+        if (busy_poll) {
+            struct timeval now, elapsed;
+            gettimeofday(&now, NULL);
+            timersub(&now, &loop_start, &elapsed);
+            uint64_t usecs = elapsed.tv_sec * 1000000 + elapsed.tv_usec;
+            if (wrkctx->activity != activity) {
+                // (the time spent blocked in the mux isn't accounted)
+                if (spinning)
+                    ATOMIC_INCREASE(wrkctx->busy_usecs, usecs);
+                last_activity = now;
+                continue;
+            }
+            if (spinning) {
+                ATOMIC_INCREASE(wrkctx->spin_usecs, usecs);
+                continue;
+            }
+        }
 
         if (iomux_isempty(wrkctx->iomux)) {
             // we don't have any filedescriptor to handle in the mux,
@@ -1123,6 +2067,128 @@ serve_cache(void *priv)
     return NULL;
 }
 
+static shardcache_worker_context_t *
+shardcache_worker_create(shardcache_serving_t *serv, int index)
+{
+    shardcache_worker_context_t *wrk = calloc(1, sizeof(shardcache_worker_context_t));
+    wrk->serv = serv;
+    wrk->index = index;
+    wrk->wakeup_fds[0] = wrk->wakeup_fds[1] = -1;
+    wrk->jobs = queue_create();
+    queue_set_free_value_callback(wrk->jobs,
+            (queue_free_value_callback_t)shardcache_connection_context_destroy);
+    wrk->prune = list_create();
+    list_set_free_value_callback(wrk->prune, (free_value_callback_t)shardcache_connection_context_destroy);
+    TAILQ_INIT(&wrk->backlog);
+
+    MUTEX_INIT(&wrk->wakeup_lock);
+    CONDITION_INIT(&wrk->wakeup_cond);
+    wrk->iomux = iomux_create(1<<13, 0);
+    return wrk;
+}
+
+// create the wakeup socket and the rings used by the other workers
+// to hand requests over to this one (one ring per producer)
+static int
+shardcache_worker_inbox_create(shardcache_worker_context_t *wrk)
+{
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, wrk->wakeup_fds) != 0) {
+        SHC_ERROR("Can't create the wakeup socket for worker %d: %s",
+                  wrk->index, strerror(errno));
+        wrk->wakeup_fds[0] = wrk->wakeup_fds[1] = -1;
+        return -1;
+    }
+
+    fcntl(wrk->wakeup_fds[1], F_SETFL,
+          fcntl(wrk->wakeup_fds[1], F_GETFL) | O_NONBLOCK);
+    iomux_callbacks_t wakeup_callbacks = {
+        .mux_input = shardcache_wakeup_handler,
+        .priv = wrk
+    };
+    iomux_add(wrk->iomux, wrk->wakeup_fds[0], &wakeup_callbacks);
+
+    wrk->inbox = calloc(wrk->serv->num_workers, sizeof(spsc_ring_t *));
+    int n;
+    for (n = 0; n < wrk->serv->num_workers; n++)
+        wrk->inbox[n] = spsc_ring_create(SHARDCACHE_HANDOFF_RING_SIZE);
+
+    return 0;
+}
+
+static void
+shardcache_worker_destroy(shardcache_worker_context_t *wrk)
+{
+    int i;
+
+    queue_destroy(wrk->jobs);
+
+    MUTEX_DESTROY(&wrk->wakeup_lock);
+    CONDITION_DESTROY(&wrk->wakeup_cond);
+
+    shardcache_connection_context_t *ctx = list_shift_value(wrk->prune);
+    while (ctx) {
+        ATOMIC_DECREMENT(wrk->pruning);
+        shardcache_request_t *req = TAILQ_FIRST(&ctx->requests);
+        while (req) {
+            TAILQ_REMOVE(&ctx->requests, req, next);
+            ctx->num_requests--;
+            shardcache_request_destroy(req);
+            req = TAILQ_FIRST(&ctx->requests);
+        }
+        shardcache_connection_context_destroy(ctx);
+        ctx = list_shift_value(wrk->prune);
+    }
+
+    char label[64];
+    if (!wrk->lanes) {
+        snprintf(label, sizeof(label), "worker[%d].numfds", wrk->index);
+        shardcache_counter_remove(wrk->serv->cache->counters, label);
+        snprintf(label, sizeof(label), "worker[%d].pruning", wrk->index);
+        shardcache_counter_remove(wrk->serv->cache->counters, label);
+        snprintf(label, sizeof(label), "worker[%d].deferred", wrk->index);
+        shardcache_counter_remove(wrk->serv->cache->counters, label);
+        snprintf(label, sizeof(label), "worker[%d].backlogged", wrk->index);
+        shardcache_counter_remove(wrk->serv->cache->counters, label);
+        snprintf(label, sizeof(label), "worker[%d].turns", wrk->index);
+        shardcache_counter_remove(wrk->serv->cache->counters, label);
+        snprintf(label, sizeof(label), "worker[%d].look_ahead", wrk->index);
+        shardcache_counter_remove(wrk->serv->cache->counters, label);
+        snprintf(label, sizeof(label), "worker[%d].spin_usecs", wrk->index);
+        shardcache_counter_remove(wrk->serv->cache->counters, label);
+        snprintf(label, sizeof(label), "worker[%d].busy_usecs", wrk->index);
+        shardcache_counter_remove(wrk->serv->cache->counters, label);
+    }
+
+    if (wrk->inbox) {
+        if (!wrk->lanes) {
+            snprintf(label, sizeof(label), "worker[%d].handoffs", wrk->index);
+            shardcache_counter_remove(wrk->serv->cache->counters, label);
+        }
+        // pending requests are owned by the connection contexts
+        for (i = 0; i < wrk->serv->num_workers; i++)
+            spsc_ring_destroy(wrk->inbox[i]);
+        free(wrk->inbox);
+    }
+
+    if (wrk->lanes) {
+        for (i = 0; i < SHARDCACHE_NUM_LANES; i++)
+            list_destroy(wrk->lanes[i]);
+        free(wrk->lanes);
+    }
+
+    if (wrk->wakeup_fds[0] != -1) {
+        iomux_remove(wrk->iomux, wrk->wakeup_fds[0]);
+        close(wrk->wakeup_fds[0]);
+        close(wrk->wakeup_fds[1]);
+    }
+
+    iomux_destroy(wrk->iomux);
+
+    list_destroy(wrk->prune);
+
+    free(wrk);
+}
+
 shardcache_serving_t *start_serving(shardcache_t *cache, int num_workers)
 {
     shardcache_serving_t *s = calloc(1, sizeof(shardcache_serving_t));
@@ -1147,6 +2213,29 @@ shardcache_serving_t *start_serving(shardcache_t *cache, int num_workers)
 
     free(addr); // we don't need it anymore
 
+    int i;
+
+    // in partitioned mode each worker owns a partition of the keyspace
+    // and the requests are dispatched to it by the others, all the
+    // workers must be able to receive them before any is started
+    if (cache->num_partitions > 1 && num_workers == cache->num_partitions) {
+        s->partition_workers = calloc(num_workers, sizeof(shardcache_worker_context_t *));
+        for (i = 0; i < num_workers; i++) {
+            s->partition_workers[i] = shardcache_worker_create(s, i);
+            if (shardcache_worker_inbox_create(s->partition_workers[i]) != 0) {
+                SHC_ERROR("Can't set up the request dispatching to the "
+                          "worker of partition %d", i);
+                int n;
+                for (n = 0; n <= i; n++)
+                    shardcache_worker_destroy(s->partition_workers[n]);
+                free(s->partition_workers);
+                close(s->sock);
+                free(s);
+                return NULL;
+            }
+        }
+    }
+
     // create the workers' pool
     s->workers = list_create();
 
@@ -1155,30 +2244,62 @@ shardcache_serving_t *start_serving(shardcache_t *cache, int num_workers)
         shardcache_counter_add(cache->counters, "num_workers", &s->total_workers);
     }
 
-    int i;
     for (i = 0; i < ATOMIC_READ(num_workers); i++) {
-        shardcache_worker_context_t *wrk = calloc(1, sizeof(shardcache_worker_context_t));
-        wrk->serv = s;
-        wrk->jobs = queue_create();
-        queue_set_free_value_callback(wrk->jobs,
-                (queue_free_value_callback_t)shardcache_connection_context_destroy);
-        wrk->prune = list_create();
-        list_set_free_value_callback(wrk->prune, (free_value_callback_t)shardcache_connection_context_destroy);
+        shardcache_worker_context_t *wrk = s->partition_workers
+                                         ? s->partition_workers[i]
+                                         : shardcache_worker_create(s, i);
 
         char label[64];
         snprintf(label, sizeof(label), "worker[%d].numfds", i);
         shardcache_counter_add(cache->counters, label, &wrk->numfds);
         snprintf(label, sizeof(label), "worker[%d].pruning", i);
         shardcache_counter_add(cache->counters, label, &wrk->pruning);
+        snprintf(label, sizeof(label), "worker[%d].deferred", i);
+        shardcache_counter_add(cache->counters, label, &wrk->deferred);
+        snprintf(label, sizeof(label), "worker[%d].backlogged", i);
+        shardcache_counter_add(cache->counters, label, &wrk->backlogged);
+        snprintf(label, sizeof(label), "worker[%d].turns", i);
+        shardcache_counter_add(cache->counters, label, &wrk->turn);
+        snprintf(label, sizeof(label), "worker[%d].look_ahead", i);
+        shardcache_counter_add(cache->counters, label, &wrk->look_ahead);
+        snprintf(label, sizeof(label), "worker[%d].spin_usecs", i);
+        shardcache_counter_add(cache->counters, label, &wrk->spin_usecs);
+        snprintf(label, sizeof(label), "worker[%d].busy_usecs", i);
+        shardcache_counter_add(cache->counters, label, &wrk->busy_usecs);
+
+        if (s->partition_workers) {
+            snprintf(label, sizeof(label), "worker[%d].handoffs", i);
+            shardcache_counter_add(cache->counters, label, &wrk->handoffs);
+        }
 
-        MUTEX_INIT(&wrk->wakeup_lock);
-        CONDITION_INIT(&wrk->wakeup_cond);
-        wrk->iomux = iomux_create(1<<13, 0);
         pthread_create(&wrk->thread, NULL, worker, wrk);
         list_push_value(s->workers, wrk);
         ATOMIC_INCREMENT(s->total_workers);
     }
 
+    // the control worker, serving the requests in the control lanes
+    shardcache_worker_context_t *ctrl = shardcache_worker_create(s, num_workers);
+    if (shardcache_worker_inbox_create(ctrl) == 0) {
+        ctrl->lanes = calloc(SHARDCACHE_NUM_LANES, sizeof(linked_list_t *));
+        for (i = 0; i < SHARDCACHE_NUM_LANES; i++)
+            ctrl->lanes[i] = list_create();
+
+        const char *lane_labels[SHARDCACHE_NUM_LANES] = SHARDCACHE_LANE_LABELS_ARRAY;
+        for (i = SHARDCACHE_LANE_DATA + 1; i < SHARDCACHE_NUM_LANES; i++) {
+            char label[64];
+            snprintf(label, sizeof(label), "lane[%s].requests", lane_labels[i]);
+            shardcache_counter_add(cache->counters, label, &s->lane_requests[i]);
+        }
+
+        pthread_create(&ctrl->thread, NULL, worker, ctrl);
+        list_push_value(s->workers, ctrl);
+        s->control_worker = ctrl;
+    } else {
+        // control requests will be served by the workers owning the connections
+        SHC_WARNING("Priority lanes disabled");
+        shardcache_worker_destroy(ctrl);
+    }
+
     s->io_mux = iomux_create(0, 0);
 
     // and start a background thread to handle incoming connections
@@ -1195,49 +2316,26 @@ shardcache_serving_t *start_serving(shardcache_t *cache, int num_workers)
 static void
 clear_workers_list(linked_list_t *list)
 {
-    shardcache_worker_context_t *wrk = list_shift_value(list);
-
-    int cnt = 0;
-    while (wrk) {
+    // stop all the workers before releasing anything, a worker might
+    // still be serving requests handed over by the others
+    int i;
+    for (i = 0; i < list_count(list); i++) {
+        shardcache_worker_context_t *wrk = list_pick_value(list, i);
         ATOMIC_INCREMENT(wrk->leave);
 
         // wake up the worker if slacking
         CONDITION_SIGNAL(&wrk->wakeup_cond, &wrk->wakeup_lock);
+    }
 
+    for (i = 0; i < list_count(list); i++) {
+        shardcache_worker_context_t *wrk = list_pick_value(list, i);
         pthread_join(wrk->thread, NULL);
+    }
 
-        queue_destroy(wrk->jobs);
-
-        MUTEX_DESTROY(&wrk->wakeup_lock);
-        CONDITION_DESTROY(&wrk->wakeup_cond);
+    shardcache_worker_context_t *wrk = list_shift_value(list);
+    while (wrk) {
         SHC_DEBUG3("Worker thread %p exited", wrk);
-
-        shardcache_connection_context_t *ctx = list_shift_value(wrk->prune);
-        while (ctx) {
-            ATOMIC_DECREMENT(wrk->pruning);
-            shardcache_request_t *req = TAILQ_FIRST(&ctx->requests);
-            while (req) {
-                TAILQ_REMOVE(&ctx->requests, req, next);
-                ctx->num_requests--;
-                shardcache_request_destroy(req);
-                req = TAILQ_FIRST(&ctx->requests);
-            }
-            shardcache_connection_context_destroy(ctx);
-            ctx = list_shift_value(wrk->prune);
-        }
-
-        char label[64];
-        snprintf(label, sizeof(label), "worker[%d].numfds", cnt);
-        shardcache_counter_remove(wrk->serv->cache->counters, label);
-        snprintf(label, sizeof(label), "worker[%d].pruning", cnt);
-        shardcache_counter_remove(wrk->serv->cache->counters, label);
-        cnt++;
-
-        iomux_destroy(wrk->iomux);
-
-        list_destroy(wrk->prune);
-
-        free(wrk);
+        shardcache_worker_destroy(wrk);
         wrk = list_shift_value(list);
     }
 
@@ -1253,19 +2351,31 @@ stop_serving(shardcache_serving_t *s)
 
     // now the workers
     SHC_NOTICE("Collecting worker threads (might have to wait until i/o is finished)");
+    int lanes = (s->control_worker != NULL);
     clear_workers_list(s->workers);
+    s->control_worker = NULL;
     SHC_DEBUG2("All worker threads have been collected");
 
     // unregister our counters if we did at creation time
     if (s->cache->counters) {
         shardcache_counter_remove(s->cache->counters, "connections");
         shardcache_counter_remove(s->cache->counters, "num_workers");
+        if (lanes) {
+            const char *lane_labels[SHARDCACHE_NUM_LANES] = SHARDCACHE_LANE_LABELS_ARRAY;
+            int i;
+            for (i = SHARDCACHE_LANE_DATA + 1; i < SHARDCACHE_NUM_LANES; i++) {
+                char label[64];
+                snprintf(label, sizeof(label), "lane[%s].requests", lane_labels[i]);
+                shardcache_counter_remove(s->cache->counters, label);
+            }
+        }
     }
 
     pthread_join(s->io_thread, NULL);
 
     iomux_destroy(s->io_mux);
     list_destroy(s->workers);
+    free(s->partition_workers);
 
     free(s);
 }
@@ -26,54 +26,235 @@ const char *LIBSHARDCACHE_VERSION = "0.31";
 extern int shardcache_log_initialized;
 extern unsigned int shardcache_loglevel;
 
+__thread struct timeval *shardcache_fetch_deadline = NULL;
+__thread shardcache_fetch_timing_t *shardcache_fetch_timing = NULL;
+__thread shardcache_trace_t *shardcache_request_trace = NULL;
+
+// the number of points each node is placed on in the continuum
+#define SHARDCACHE_CONTINUUM_REPLICAS 200
+
+// the number of keys checked against libchash when a continuum is created
+#define SHARDCACHE_CONTINUUM_CHECK_KEYS 1024
+
+// the hash used by libchash to place the nodes and the keys on the continuum
+// (the leveldb bloom hash, see also the python client)
+static uint32_t
+shardcache_continuum_hash(const void *key, size_t len)
+{
+    const uint32_t seed = 0xbc9f1d34;
+    const uint32_t m = 0xc6a4a793;
+    const unsigned char *b = (const unsigned char *)key;
+    uint32_t h = seed ^ (uint32_t)(len * m);
+
+    while (len >= 4) {
+        h += b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+        h *= m;
+        h ^= h >> 16;
+        b += 4;
+        len -= 4;
+    }
+
+    switch (len) {
+        case 3:
+            h += b[2] << 16;
+            // fall through
+        case 2:
+            h += b[1] << 8;
+            // fall through
+        case 1:
+            h += b[0];
+            h *= m;
+            h ^= h >> 24;
+    }
+    return h;
+}
 
 static int
-shardcache_test_ownership_internal(shardcache_t *cache,
-                                   void *key,
-                                   size_t klen,
-                                   char *owner,
-                                   size_t *len,
-                                   int  migration)
+shardcache_continuum_point_cmp(const void *a, const void *b)
+{
+    const shardcache_continuum_point_t *pa = (const shardcache_continuum_point_t *)a;
+    const shardcache_continuum_point_t *pb = (const shardcache_continuum_point_t *)b;
+    if (pa->point != pb->point)
+        return pa->point < pb->point ? -1 : 1;
+    return pa->node - pb->node;
+}
+
+static int
+shardcache_continuum_chash_lookup(shardcache_continuum_t *continuum, void *key, size_t klen)
 {
     const char *node_name;
     size_t name_len = 0;
+    chash_lookup(continuum->chash, key, klen, &node_name, &name_len);
+    return shardcache_continuum_node_index(continuum, node_name, name_len);
+}
 
-    if (len && *len == 0)
-        return -1;
+// returns the index of the node owning the key
+static inline int
+shardcache_continuum_lookup(shardcache_continuum_t *continuum, void *key, size_t klen)
+{
+    if (continuum->num_nodes == 1)
+        return 0;
 
-    if (cache->num_shards == 1)
-        return 1;
+    if (!continuum->num_points)
+        return shardcache_continuum_chash_lookup(continuum, key, klen);
+
+    // the owner is the node of the first point past the key (wrapping around)
+    uint32_t point = shardcache_continuum_hash(key, klen);
+    int low = 0;
+    int high = continuum->num_points;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (continuum->points[mid].point > point)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    if (low >= continuum->num_points)
+        low = 0;
+    return continuum->points[low].node;
+}
 
-    SPIN_LOCK(&cache->migration_lock);
+// the continuum takes ownership of the nodes array
+static shardcache_continuum_t *
+shardcache_continuum_create(char *me, shardcache_node_t **nodes, int num_nodes)
+{
+    shardcache_continuum_t *continuum = calloc(1, sizeof(shardcache_continuum_t));
+    continuum->nodes = nodes;
+    continuum->num_nodes = num_nodes;
+    continuum->me = -1;
 
-    chash_t *continuum = NULL;
-    if (cache->migration && cache->migration_done) { 
-        shardcache_migration_end(cache);
-    } 
+    const char *names[num_nodes];
+    size_t lens[num_nodes];
+    int i, n;
+    for (i = 0; i < num_nodes; i++) {
+        names[i] = shardcache_node_get_label(nodes[i]);
+        lens[i] = strlen(names[i]);
+        if (strcmp(names[i], me) == 0)
+            continuum->me = i;
+    }
 
-    if (migration) {
-        if (cache->migration) {
-            continuum = cache->migration;
-        } else {
-            SPIN_UNLOCK(&cache->migration_lock);
-            return -1;
+    continuum->chash = chash_create(names, lens, num_nodes, SHARDCACHE_CONTINUUM_REPLICAS);
+
+    // place the nodes on the continuum as libchash does
+    continuum->num_points = num_nodes * SHARDCACHE_CONTINUUM_REPLICAS;
+    continuum->points = malloc(sizeof(shardcache_continuum_point_t) * continuum->num_points);
+    for (i = 0; i < num_nodes; i++) {
+        for (n = 0; n < SHARDCACHE_CONTINUUM_REPLICAS; n++) {
+            char name[lens[i] + 16];
+            int len = snprintf(name, sizeof(name), "%d%s", n, names[i]);
+            shardcache_continuum_point_t *p = &continuum->points[i * SHARDCACHE_CONTINUUM_REPLICAS + n];
+            p->point = shardcache_continuum_hash(name, len);
+            p->node = i;
+        }
+    }
+    qsort(continuum->points, continuum->num_points,
+          sizeof(shardcache_continuum_point_t), shardcache_continuum_point_cmp);
+
+    // the clients use libchash, a key must be resolved to the same node
+    for (i = 0; i < SHARDCACHE_CONTINUUM_CHECK_KEYS && num_nodes > 1; i++) {
+        char key[16];
+        int klen = snprintf(key, sizeof(key), "%d", i);
+        if (shardcache_continuum_lookup(continuum, key, klen) !=
+            shardcache_continuum_chash_lookup(continuum, key, klen))
+        {
+            SHC_WARNING("The continuum doesn't match the one built by libchash, "
+                        "the owners of the keys will be resolved through libchash");
+            free(continuum->points);
+            continuum->points = NULL;
+            continuum->num_points = 0;
+            break;
         }
-    } else {
-        continuum = cache->chash;
     }
 
-    chash_lookup(continuum, key, klen, &node_name, &name_len);
+    return continuum;
+}
+
+static void
+shardcache_continuum_destroy(shardcache_continuum_t *continuum)
+{
+    chash_free(continuum->chash);
+    shardcache_free_nodes(continuum->nodes, continuum->num_nodes);
+    free(continuum->points);
+    free(continuum);
+}
+
+// a continuum replaced by a migration (or discarded by an abort) might still
+// be in use by a lookup started right before the swap (or its nodes by who
+// looked up a key), so it's released only when the next continuum is retired
+// (or at destroy time). NOTE: must be called with the migration lock held
+static void
+shardcache_continuum_retire(shardcache_t *cache, shardcache_continuum_t *continuum)
+{
+    if (cache->retired_continuum)
+        shardcache_continuum_destroy(cache->retired_continuum);
+    cache->retired_continuum = continuum;
+}
+
+int
+shardcache_owner_lookup(shardcache_t *cache,
+                        void *key,
+                        size_t klen,
+                        int migration,
+                        shardcache_node_t **owner)
+{
+    // only one of the lookups noticing the completed migration ends it
+    if (UNLIKELY(ATOMIC_READ(cache->migration_done)) && ATOMIC_CAS(cache->migration_done, 1, 0))
+        shardcache_migration_end(cache);
+
+    shardcache_continuum_t *continuum = migration
+                                      ? ATOMIC_READ(cache->migration)
+                                      : ATOMIC_READ(cache->continuum);
+    if (!continuum)
+        return -1;
+
+    int index = shardcache_continuum_lookup(continuum, key, klen);
+
+    if (owner)
+        *owner = index >= 0 ? continuum->nodes[index] : NULL;
+
+    return (index >= 0 && index == continuum->me);
+}
+
+int
+shardcache_key_owner(shardcache_t *cache,
+                     void *key,
+                     size_t klen,
+                     shardcache_node_t **owner)
+{
+    int is_mine = shardcache_owner_lookup(cache, key, klen, 1, owner);
+    if (is_mine == -1)
+        is_mine = shardcache_owner_lookup(cache, key, klen, 0, owner);
+    return is_mine;
+}
+
+static int
+shardcache_test_ownership_internal(shardcache_t *cache,
+                                   void *key,
+                                   size_t klen,
+                                   char *owner,
+                                   size_t *len,
+                                   int  migration)
+{
+    if (len && *len == 0)
+        return -1;
+
+    shardcache_node_t *node = NULL;
+    int is_mine = shardcache_owner_lookup(cache, key, klen, migration, &node);
+    if (is_mine == -1)
+        return -1;
+
+    char *label = node ? shardcache_node_get_label(node) : "";
+    size_t name_len = strlen(label);
     if (owner) {
         if (len && name_len + 1 > *len)
             name_len = *len - 1;
-        memcpy(owner, node_name, name_len);
+        memcpy(owner, label, name_len);
         owner[name_len] = 0;
     }
     if (len)
         *len = name_len;
 
-    SPIN_UNLOCK(&cache->migration_lock);
-    return (strcmp(owner, cache->me) == 0);
+    return is_mine;
 }
 
 int
@@ -122,6 +303,57 @@ shardcache_release_connection_for_peer(shardcache_t *cache, char *peer, int fd)
     connections_pool_add(cache->connections_pool, peer, fd);
 }
 
+// the pipeline forwarding the writes to a peer (created on first use if
+// 'create' is true), NULL if pipelining is disabled.
+// The caller gets a reference and must release it with write_pipeline_release()
+static write_pipeline_t *
+shardcache_get_write_pipeline(shardcache_t *cache, char *peer, int create)
+{
+    int window = ATOMIC_READ(cache->write_pipeline_window);
+    if (window <= 0 && create)
+        return NULL;
+
+    write_pipeline_t *wp = NULL;
+    MUTEX_LOCK(&cache->write_pipelines_lock);
+    if (cache->write_pipelines) {
+        wp = ht_get(cache->write_pipelines, peer, strlen(peer), NULL);
+        if (!wp && create) {
+            wp = write_pipeline_create(peer,
+                                       (char *)cache->auth,
+                                       ATOMIC_READ(cache->tcp_timeout),
+                                       window,
+                                       ATOMIC_READ(cache->serving_look_ahead),
+                                       &cache->write_pipeline_stats);
+            if (wp)
+                ht_set(cache->write_pipelines, peer, strlen(peer), wp, 0);
+        }
+        if (wp)
+            write_pipeline_retain(wp);
+    }
+    MUTEX_UNLOCK(&cache->write_pipelines_lock);
+    return wp;
+}
+
+// the writes bypassing the pipelines (the sync ones and any write once
+// pipelining is disabled) let the writes already queued to the peer go
+// first, so that the writes to a key keep their order
+static void
+shardcache_drain_write_pipeline(shardcache_t *cache, char *peer)
+{
+    write_pipeline_t *wp = shardcache_get_write_pipeline(cache, peer, 0);
+    if (wp) {
+        write_pipeline_drain(wp);
+        write_pipeline_release(wp);
+    }
+}
+
+static int
+shardcache_write_pipeline_update_window(hashtable_t *table, void *value, size_t vlen, void *user)
+{
+    write_pipeline_set_window((write_pipeline_t *)value, *((int *)user));
+    return 1;
+}
+
 static void
 shardcache_do_nothing(int sig)
 {
@@ -129,17 +361,16 @@ shardcache_do_nothing(int sig)
 }
 
 typedef struct {
-    void *key;
-    size_t klen;
-} shardcache_key_t;
-
-typedef struct {
-    shardcache_t *cache;
+    shardcache_partition_t *part;
     shardcache_key_t item;
     int is_volatile;
 } expire_key_ctx_t;
 
-typedef shardcache_key_t shardcache_evictor_job_t;
+typedef struct {
+    void *key;
+    size_t klen;
+    int prefix; // invalidate all the keys starting with 'key' (instead of evicting it)
+} shardcache_evictor_job_t;
 
 static void
 destroy_evictor_job(shardcache_evictor_job_t *job)
@@ -149,12 +380,13 @@ destroy_evictor_job(shardcache_evictor_job_t *job)
 }
 
 static
-shardcache_evictor_job_t *create_evictor_job(void *key, size_t klen)
+shardcache_evictor_job_t *create_evictor_job(void *key, size_t klen, int prefix)
 {
     shardcache_evictor_job_t *job = malloc(sizeof(shardcache_evictor_job_t)); 
     job->key = malloc(klen);
     memcpy(job->key, key, klen);
     job->klen = klen; 
+    job->prefix = prefix;
     return job;
 }
 
@@ -169,15 +401,71 @@ evict_key(hashtable_t *table, void *value, size_t vlen, void *user)
     return -2;
 }
 
+// drop the copy of a key (if any) held by the l2 cache,
+// must be called whenever the cached value is removed or replaced
+static inline void
+shardcache_l2_remove(shardcache_t *cache, void *key, size_t klen, uint64_t hash)
+{
+    l2cache_t *l2 = ATOMIC_READ(cache->l2);
+    if (l2)
+        l2cache_remove(l2, key, klen, hash);
+}
+
+static inline uint64_t
+shardcache_arc_lists_size(size_t *lists_size[5])
+{
+    return ATOMIC_READ(*lists_size[0]) +
+           ATOMIC_READ(*lists_size[1]) +
+           ATOMIC_READ(*lists_size[2]) +
+           ATOMIC_READ(*lists_size[3]) +
+           ATOMIC_READ(*lists_size[4]);
+}
+
 static inline void
 shardcache_update_size_counters(shardcache_t *cache)
 {
+    uint64_t size = 0;
+    int i, n;
+    for (i = 0; i < cache->num_partitions; i++)
+        size += shardcache_arc_lists_size(cache->partitions[i].arc_lists_size);
+
+    for (n = 0; n < SHARDCACHE_NAMESPACES_MAX; n++) {
+        shardcache_namespace_t *ns = ATOMIC_READ(cache->namespaces[n]);
+        if (!ns)
+            break;
+        uint64_t ns_size = 0;
+        uint64_t ns_items = 0;
+        for (i = 0; i < cache->num_partitions; i++) {
+            ns_size += shardcache_arc_lists_size(ns->arc_lists_size[i]);
+            ns_items += arc_count(ns->arcs[i]);
+        }
+        ATOMIC_SET(ns->cnt[SHARDCACHE_COUNTER_CACHE_SIZE], ns_size);
+        ATOMIC_SET(ns->cnt[SHARDCACHE_COUNTER_CACHED_ITEMS], ns_items);
+        size += ns_size;
+    }
+
     ATOMIC_CAS(cache->cnt[SHARDCACHE_COUNTER_CACHE_SIZE].value,
                ATOMIC_READ(cache->cnt[SHARDCACHE_COUNTER_CACHE_SIZE].value),
-               ATOMIC_READ(*cache->arc_lists_size[0]) +
-               ATOMIC_READ(*cache->arc_lists_size[1]) +
-               ATOMIC_READ(*cache->arc_lists_size[2]) +
-               ATOMIC_READ(*cache->arc_lists_size[3]));
+               size);
+}
+
+size_t
+shardcache_cached_items(shardcache_t *cache)
+{
+    size_t count = 0;
+    int i;
+    for (i = 0; i < cache->num_partitions; i++)
+        count += arc_count(cache->partitions[i].arc);
+
+    int n;
+    for (n = 0; n < SHARDCACHE_NAMESPACES_MAX; n++) {
+        shardcache_namespace_t *ns = ATOMIC_READ(cache->namespaces[n]);
+        if (!ns)
+            break;
+        for (i = 0; i < cache->num_partitions; i++)
+            count += arc_count(ns->arcs[i]);
+    }
+    return count;
 }
 
 
@@ -203,15 +491,16 @@ evictor(void *priv)
             if (shardcache_loglevel >= LOG_DEBUG)
                 KEY2STR(job->key, job->klen, keystr, sizeof(keystr));
 
-            SHC_DEBUG2("Eviction job for key '%s' started", keystr);
+            SHC_DEBUG2("%s job for key '%s' started", job->prefix ? "Invalidation" : "Eviction", keystr);
 
             int i;
-            for (i = 0; i < cache->num_shards; i++) {
-                char *peer = shardcache_node_get_label(cache->shards[i]);
-                if (strcmp(peer, cache->me) != 0) {
+            shardcache_continuum_t *continuum = ATOMIC_READ(cache->continuum);
+            for (i = 0; i < continuum->num_nodes; i++) {
+                char *peer = shardcache_node_get_label(continuum->nodes[i]);
+                if (i != continuum->me) {
                     SHC_DEBUG3("Sending Eviction command to %s", peer);
-                    int rindex = random()%shardcache_node_num_addresses(cache->shards[i]);
-                    char *addr = shardcache_node_get_address_at_index(cache->shards[i], rindex);
+                    int rindex = random()%shardcache_node_num_addresses(continuum->nodes[i]);
+                    char *addr = shardcache_node_get_address_at_index(continuum->nodes[i], rindex);
                     int fd = connections_pool_get(connections, addr);
                     if (fd < 0)
                         break;
@@ -249,17 +538,20 @@ evictor(void *priv)
                         break;
                     }
 
-                    int rc = evict_from_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, job->key, job->klen, fd, 0);
+                    int rc = job->prefix
+                           ? invalidate_on_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, job->key, job->klen, 1, fd, 0)
+                           : evict_from_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, job->key, job->klen, NULL, fd, 0);
                     if (rc == 0) {
                         connections_pool_add(connections, addr, fd);
                     } else {
-                        SHC_WARNING("evict_from_peer return %d for peer %s", rc, peer);
+                        SHC_WARNING("%s return %d for peer %s",
+                                    job->prefix ? "invalidate_on_peer" : "evict_from_peer", rc, peer);
                         close(fd);
                     }
                 }
             }
 
-            SHC_DEBUG2("Eviction job for key '%s' completed", keystr);
+            SHC_DEBUG2("%s job for key '%s' completed", job->prefix ? "Invalidation" : "Eviction", keystr);
             destroy_evictor_job(job);
         }
 
@@ -295,28 +587,31 @@ static void
 shardcache_expire_key_cb(iomux_t *iomux, void *priv)
 {
     expire_key_ctx_t *ctx = (expire_key_ctx_t *)priv;
+    shardcache_partition_t *part = ctx->part;
     void *ptr = NULL;
     if (ctx->is_volatile) {
-        ht_delete(ctx->cache->volatile_timeouts, ctx->item.key, ctx->item.klen, &ptr, NULL);
+        ht_delete(part->volatile_timeouts, ctx->item.key, ctx->item.klen, &ptr, NULL);
         if (!ptr)
             return;
 
         free(ptr);
-        ht_delete(ctx->cache->volatile_storage, ctx->item.key, ctx->item.klen, &ptr, NULL);
+        ht_delete(part->volatile_storage, ctx->item.key, ctx->item.klen, &ptr, NULL);
         if (ptr) {
             volatile_object_t *prev = (volatile_object_t *)ptr;
-            ATOMIC_DECREASE(ctx->cache->cnt[SHARDCACHE_COUNTER_TABLE_SIZE].value,
+            ATOMIC_DECREASE(part->cache->cnt[SHARDCACHE_COUNTER_TABLE_SIZE].value,
                             prev->dlen);
             destroy_volatile(prev);
         }
     } else {
-        ht_delete(ctx->cache->cache_timeouts, ctx->item.key, ctx->item.klen, &ptr, NULL);
+        ht_delete(part->cache_timeouts, ctx->item.key, ctx->item.klen, &ptr, NULL);
         if (!ptr)
             return;
         free(ptr);
     }
-    ATOMIC_INCREMENT(ctx->cache->cnt[SHARDCACHE_COUNTER_EXPIRES].value);
-    arc_remove(ctx->cache->arc, (const void *)ctx->item.key, ctx->item.klen);
+    shardcache_namespace_t *ns = shardcache_namespace(part->cache, ctx->item.key, ctx->item.klen);
+    SHARDCACHE_NS_COUNTER_INCREMENT(part->cache, ns, SHARDCACHE_COUNTER_EXPIRES);
+    shardcache_l2_remove(part->cache, ctx->item.key, ctx->item.klen, ctx->item.hash);
+    arc_remove(shardcache_partition_arc(part, ns), (const void *)ctx->item.key, ctx->item.klen, ctx->item.hash);
 }
 
 typedef struct {
@@ -325,6 +620,7 @@ typedef struct {
 #define SHARDACHE_EXPIRE_UNSCHEDULE 2
     void *key;
     size_t klen;
+    uint64_t hash;
     time_t expire;
     int is_volatile;
 } shardcache_expire_job_t;
@@ -339,35 +635,37 @@ shardcache_expire_context_destroy(expire_key_ctx_t *ctx)
 void *
 shardcache_expire_keys(void *priv)
 {
-    shardcache_t *cache = (shardcache_t *)priv;
+    shardcache_partition_t *part = (shardcache_partition_t *)priv;
+    shardcache_t *cache = part->cache;
     while (!ATOMIC_READ(cache->quit))
     {
-        shardcache_expire_job_t *job = queue_pop_left(cache->expirer_queue);
+        shardcache_expire_job_t *job = queue_pop_left(part->expirer_queue);
         while (job) {
             if (job->cmd == SHARDACHE_EXPIRE_UNSCHEDULE) {
                 void *ptr = NULL;
-                hashtable_t *table = job->is_volatile ? cache->volatile_timeouts : cache->cache_timeouts;
+                hashtable_t *table = job->is_volatile ? part->volatile_timeouts : part->cache_timeouts;
 
                 ht_delete(table, job->key, job->klen, &ptr, NULL);
                 if (ptr) {
                     iomux_timeout_id_t *tid = (iomux_timeout_id_t *)ptr;
-                    iomux_unschedule(cache->expirer_mux, *tid);
+                    iomux_unschedule(part->expirer_mux, *tid);
                     free(tid);
                 } else {
                     // TODO - Error messages ?
                 }
                 free(job->key);
                 free(job);
-                job = queue_pop_left(cache->expirer_queue);
+                job = queue_pop_left(part->expirer_queue);
                 continue;
             }
 
             expire_key_ctx_t *ctx = calloc(1, sizeof(expire_key_ctx_t));
             ctx->item.key = job->key;
             ctx->item.klen = job->klen;
-            ctx->cache = cache;
+            ctx->item.hash = job->hash;
+            ctx->part = part;
             ctx->is_volatile = job->is_volatile;
-            hashtable_t *table = job->is_volatile ? cache->volatile_timeouts : cache->cache_timeouts;
+            hashtable_t *table = job->is_volatile ? part->volatile_timeouts : part->cache_timeouts;
             struct timeval timeout = { job->expire, (int)random()%(int)1e6 };
             iomux_timeout_id_t *tid_ptr = NULL;
             void *prev = NULL;
@@ -376,7 +674,7 @@ shardcache_expire_keys(void *priv)
 
             if (prev) {
                 tid_ptr = (iomux_timeout_id_t *)prev;
-                tid = iomux_reschedule(cache->expirer_mux,
+                tid = iomux_reschedule(part->expirer_mux,
                                        *tid_ptr,
                                        &timeout,
                                        shardcache_expire_key_cb,
@@ -384,7 +682,7 @@ shardcache_expire_keys(void *priv)
                                        (iomux_timeout_free_context_cb)shardcache_expire_context_destroy);
                 *tid_ptr = tid;
             } else {
-                tid = iomux_schedule(cache->expirer_mux,
+                tid = iomux_schedule(part->expirer_mux,
                                      &timeout, shardcache_expire_key_cb,
                                      ctx,
                                      (iomux_timeout_free_context_cb)shardcache_expire_context_destroy);
@@ -401,11 +699,11 @@ shardcache_expire_keys(void *priv)
             }
 
             free(job);
-            job = queue_pop_left(cache->expirer_queue);
+            job = queue_pop_left(part->expirer_queue);
         }
 
         struct timeval tv = { 1, 0 };
-        iomux_run(cache->expirer_mux, &tv);
+        iomux_run(part->expirer_mux, &tv);
         shardcache_update_size_counters(cache);
     }
     return NULL;
@@ -422,6 +720,8 @@ typedef struct {
     int index;
 } shardcache_run_async_arg_t;
 
+static void shardcache_prefetch_run(shardcache_t *cache);
+
 void *
 shardcache_run_async(void *priv)
 {
@@ -434,6 +734,7 @@ shardcache_run_async(void *priv)
         int timeout = ATOMIC_READ(cache->iomux_run_timeout_low);
         struct timeval tv = { timeout/1e6, timeout%(int)1e6 };
         iomux_run(async_mux, &tv);
+        shardcache_prefetch_run(cache);
         async_read_wrk_t *wrk = queue_pop_left(async_queue);
         while (wrk) {
             if (wrk->fd < 0 || !iomux_add(async_mux, wrk->fd, &wrk->cbs)) {
@@ -451,122 +752,630 @@ shardcache_run_async(void *priv)
     return NULL;
 }
 
-shardcache_t *
-shardcache_create(char *me,
-                  shardcache_node_t **nodes,
-                  int nnodes,
-                  shardcache_storage_t *st,
-                  char *secret,
-                  int num_workers,
-                  int num_async,
-                  size_t cache_size)
+static void
+shardcache_partition_counters(shardcache_t *cache, int add)
 {
+    static const char *names[5] = { "mru_size", "mfu_size", "mrug_size", "mfug_size", "large_size" };
     int i, n;
-    size_t shard_lens[nnodes];
-    char *shard_names[nnodes];
+    for (i = 0; i < cache->num_partitions; i++) {
+        shardcache_partition_t *part = &cache->partitions[i];
+        if (!part->arc)
+            continue;
+        for (n = 0; n < 5; n++) {
+            char label[64];
+            // keep the historical labels when the keyspace is not partitioned
+            if (cache->num_partitions > 1)
+                snprintf(label, sizeof(label), "partition[%d].%s", i, names[n]);
+            else
+                snprintf(label, sizeof(label), "%s", names[n]);
+            if (add)
+                shardcache_counter_add(cache->counters, label, part->arc_lists_size[n]);
+            else
+                shardcache_counter_remove(cache->counters, label);
+        }
+    }
+}
 
-    shardcache_t *cache = calloc(1, sizeof(shardcache_t));
+// the counters exported for each namespace
+static const int shardcache_namespace_counters_ids[] = {
+    SHARDCACHE_COUNTER_GETS,
+    SHARDCACHE_COUNTER_SETS,
+    SHARDCACHE_COUNTER_DELS,
+    SHARDCACHE_COUNTER_EXPIRES,
+    SHARDCACHE_COUNTER_CACHE_MISSES,
+    SHARDCACHE_COUNTER_FETCH_REMOTE,
+    SHARDCACHE_COUNTER_FETCH_LOCAL,
+    SHARDCACHE_COUNTER_CACHE_SIZE,
+    SHARDCACHE_COUNTER_CACHED_ITEMS
+};
 
-    cache->evict_on_delete = 1;
-    cache->use_persistent_connections = 1;
-    cache->tcp_timeout = SHARDCACHE_TCP_TIMEOUT_DEFAULT;
-    cache->expire_time = SHARDCACHE_EXPIRE_TIME_DEFAULT;
-    cache->serving_look_ahead = SHARDCACHE_SERVING_LOOK_AHEAD_DEFAULT;
-    cache->iomux_run_timeout_low = SHARDCACHE_IOMUX_RUN_TIMEOUT_LOW;
-    cache->iomux_run_timeout_high = SHARDCACHE_IOMUX_RUN_TIMEOUT_HIGH;
-    if (num_async > 0)
-        cache->num_async = num_async;
-    else if (num_async < 0)
-        cache->num_async = ((num_workers > 1 ? num_workers -1 : 1) / 10) + 1; // 1 async thread for every 10 workers
-    else
-        cache->num_async = SHARDCACHE_ASYNC_THREADS_NUM_DEFAULT;
+static void
+shardcache_namespace_counters(shardcache_t *cache, shardcache_namespace_t *ns, int add)
+{
+    int i;
+    for (i = 0; i < sizeof(shardcache_namespace_counters_ids) / sizeof(int); i++) {
+        int id = shardcache_namespace_counters_ids[i];
+        char label[256];
+        snprintf(label, sizeof(label), "ns[%s].%s", ns->prefix, cache->cnt[id].name);
+        if (add)
+            shardcache_counter_add(cache->counters, label, &ns->cnt[id]);
+        else
+            shardcache_counter_remove(cache->counters, label);
+    }
+}
 
-    SPIN_INIT(&cache->migration_lock);
+static void
+shardcache_namespace_destroy(shardcache_t *cache, shardcache_namespace_t *ns)
+{
+    int i;
+    for (i = 0; i < cache->num_partitions; i++) {
+        if (ns->arcs[i])
+            arc_destroy(ns->arcs[i]);
+    }
+    free(ns->arcs);
+    free(ns->arc_lists_size);
+    free(ns->prefix);
+    free(ns);
+}
 
-    if (st) {
-        if (st->version != SHARDCACHE_STORAGE_API_VERSION) {
-            SHC_ERROR("Storage module version mismatch: %u != %u", st->version, SHARDCACHE_STORAGE_API_VERSION);
-            shardcache_destroy(cache);
-            return NULL;
-        }
-        memcpy(&cache->storage, st, sizeof(cache->storage));
-        cache->use_persistent_storage = 1;
-    } else {
-        SHC_NOTICE("No storage callbacks provided,"
-                   "using only the internal volatile storage");
-        cache->use_persistent_storage = 0;
+static void
+shardcache_l2_counters(shardcache_t *cache, int add)
+{
+    l2cache_stats_t *stats = l2cache_stats(cache->l2);
+    struct {
+        const char *name;
+        uint64_t *value;
+    } counters[] = {
+        { "l2_hits",          &stats->hits          },
+        { "l2_misses",        &stats->misses        },
+        { "l2_writes",        &stats->writes        },
+        { "l2_written_bytes", &stats->written_bytes },
+        { "l2_rejected",      &stats->rejected      },
+        { "l2_items",         &stats->items         }
+    };
+    int i;
+    for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        if (add)
+            shardcache_counter_add(cache->counters, counters[i].name, counters[i].value);
+        else
+            shardcache_counter_remove(cache->counters, counters[i].name);
     }
+}
 
+static void
+shardcache_connections_pool_counters(shardcache_t *cache, int add)
+{
+    connections_pool_stats_t *stats = connections_pool_stats(cache->connections_pool);
+    struct {
+        const char *name;
+        uint64_t *value;
+    } counters[] = {
+        { "pool_probes",  &stats->probes  },
+        { "pool_dropped", &stats->dropped },
+        { "pool_warmed",  &stats->warmed  }
+    };
+    int i;
+    for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        if (add)
+            shardcache_counter_add(cache->counters, counters[i].name, counters[i].value);
+        else
+            shardcache_counter_remove(cache->counters, counters[i].name);
+    }
+}
 
-    cache->me = strdup(me);
+// keeps the pooled connections to the peers healthy and warm:
+// the idle ones are periodically probed (dropping the ones closed by the
+// peers) and refreshed before the expire time would idle them out,
+// new ones are established ahead of time up to the configured minimum
+static void *
+shardcache_pool_keeper(void *priv)
+{
+    shardcache_t *cache = (shardcache_t *)priv;
 
-    cache->ops.init    = arc_ops_init;
-    cache->ops.fetch   = arc_ops_fetch;
-    cache->ops.evict   = arc_ops_evict;
-    cache->ops.store   = arc_ops_store;
+    while (!ATOMIC_READ(cache->quit)) {
+        if (ATOMIC_READ(cache->use_persistent_connections)) {
+            // collect the addresses first, the connects can't
+            // happen while holding the migration lock
+            linked_list_t *peers = list_create();
+            list_set_free_value_callback(peers, free);
+            SPIN_LOCK(&cache->migration_lock);
+            int i;
+            shardcache_continuum_t *continuum = cache->continuum;
+            for (i = 0; i < continuum->num_nodes; i++) {
+                if (i == continuum->me)
+                    continue;
+                int n;
+                for (n = 0; n < shardcache_node_num_addresses(continuum->nodes[i]); n++)
+                    list_push_value(peers, strdup(shardcache_node_get_address_at_index(continuum->nodes[i], n)));
+            }
+            SPIN_UNLOCK(&cache->migration_lock);
 
-    cache->ops.priv = cache;
-    cache->shards = malloc(sizeof(shardcache_node_t *) * nnodes);
-    int me_found = 0;
-    int my_index = -1;
-    for (i = 0; i < nnodes; i++) {
-        shard_names[i] = shardcache_node_get_label(nodes[i]);
-        shard_lens[i] = strlen(shard_names[i]);
-        int num_replicas = shardcache_node_num_addresses(nodes[i]);
-        char *replicas[num_replicas];
-        shardcache_node_get_all_addresses(nodes[i], replicas, num_replicas);
-        cache->shards[i] = shardcache_node_create(shard_names[i], replicas, num_replicas);
-        char *label = shardcache_node_get_label(nodes[i]);
-        if (strcmp(label, me) == 0) {
-            me_found = 1;
-            for (n = 0; n < num_replicas; n++) {
-                char *address = shardcache_node_get_address_at_index(nodes[i], n);
-                int fd = open_socket(address, 0);
-                if (fd >= 0) {
-                    SHC_DEBUG("Using address %s", address);
-                    cache->addr = strdup(address);
-                    my_index = n;
-                    close(fd);
-                    break;
-                } else {
-                    SHC_DEBUG("Skipping address %s", address);
-                }
+            char *addr = list_shift_value(peers);
+            while (addr && !ATOMIC_READ(cache->quit)) {
+                connections_pool_refresh(cache->connections_pool, addr);
+                free(addr);
+                addr = list_shift_value(peers);
             }
+            free(addr);
+            list_destroy(peers);
         }
-    }
 
-    if (!cache->addr) {
-        if (me_found) {
-            SHC_ERROR("Can't bind any address configured for node %s", me);
-        } else {
-            SHC_ERROR("Can't find my address (%s) among the configured nodes", cache->me);
+        // refresh the connections well before they expire
+        int interval = connections_pool_expire_time(cache->connections_pool, -1) / 2;
+        if (interval < 100)
+            interval = 100;
+        while (interval > 0 && !ATOMIC_READ(cache->quit) &&
+               !ATOMIC_CAS(cache->pool_keeper_kick, 1, 0))
+        {
+            usleep(100000);
+            interval -= 100;
         }
-        shardcache_destroy(cache);
-        return NULL;
     }
+    return NULL;
+}
 
-    cache->num_shards = nnodes;
+static void
+shardcache_keyfilter_counters(shardcache_t *cache, int add)
+{
+    keyfilter_stats_t *stats = keyfilter_stats(cache->keyfilter);
+    struct {
+        const char *name;
+        uint64_t *value;
+    } counters[] = {
+        { "storage_filter_checks",          &stats->checks          },
+        { "storage_filter_negatives",       &stats->negatives       },
+        { "storage_filter_false_positives", &stats->false_positives },
+        { "storage_filter_fp_ppm",          &stats->fp_rate_ppm     },
+        { "storage_filter_items",           &stats->items           },
+        { "storage_filter_rebuilds",        &stats->rebuilds        }
+    };
+    int i;
+    for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        if (add)
+            shardcache_counter_add(cache->counters, counters[i].name, counters[i].value);
+        else
+            shardcache_counter_remove(cache->counters, counters[i].name);
+    }
+}
 
-    cache->chash = chash_create((const char **)shard_names, shard_lens, cache->num_shards, 200);
+// builds a new key filter by scanning the storage index a page at a time
+// (the keys stored while the scan is running are committed to the new filter
+// by shardcache_store())
+static void
+shardcache_keyfilter_build(shardcache_t *cache)
+{
+    size_t capacity = keyfilter_stats(cache->keyfilter)->items * 2;
+    if (cache->storage.count) {
+        size_t count = cache->storage.count(cache->storage.priv);
+        if (count * 2 > capacity)
+            capacity = count * 2;
+    }
 
-    // we need to tell the arc subsystem how big are the cached objects (well ... at least the container struct
-    // which is attached to each cached object to encapsulate its actual data and extra flags/members
-    cache->arc = arc_create(&cache->ops, cache_size, sizeof(cached_object_t), cache->arc_lists_size, cache->arc_mode);
-    cache->arc_size = cache_size;
+    if (keyfilter_rebuild_begin(cache->keyfilter, capacity) != 0)
+        return;
 
-    // check if there is already signal handler registered on SIGPIPE
-    struct sigaction sa;
-    if (sigaction(SIGPIPE, NULL, &sa) != 0) {
-        SHC_ERROR("Can't check signal handlers: %s", strerror(errno)); 
-        shardcache_destroy(cache);
-        return NULL;
-    }
+    SHC_DEBUG("Building the storage filter (capacity: %zu)", capacity);
+
+    uint64_t cursor = 0;
+    size_t scanned = 0;
+    do {
+        // without the index_page callback the full index is
+        // returned at once (and the cursor is left to 0)
+        shardcache_storage_index_t *index =
+            shardcache_get_index_page(cache, &cursor,
+                                      SHARDCACHE_STORAGE_FILTER_PAGE_SIZE,
+                                      0, UINT64_MAX);
+        if (!index)
+            break;
+        int i;
+        for (i = 0; i < index->size; i++)
+            keyfilter_rebuild_add(cache->keyfilter,
+                                  arc_hash_key(index->items[i].key, index->items[i].klen));
+        scanned += index->size;
+        shardcache_free_index(index);
+    } while (cursor && !ATOMIC_READ(cache->quit));
 
-    // if not we need to register one to handle writes/reads to disconnected sockets
-    if (sa.sa_handler == NULL)
-        signal(SIGPIPE, shardcache_do_nothing);
+    int success = !ATOMIC_READ(cache->quit);
+    keyfilter_rebuild_end(cache->keyfilter, success);
 
-    if (secret && *secret) {
+    if (success)
+        SHC_DEBUG("Storage filter built (%zu keys)", scanned);
+}
+
+// (re)builds the key filter whenever it's enabled and its
+// estimated false-positive rate drifted away from the target
+static void *
+shardcache_keyfilter_keeper(void *priv)
+{
+    shardcache_t *cache = (shardcache_t *)priv;
+
+    while (!ATOMIC_READ(cache->quit)) {
+        if (ATOMIC_READ(cache->storage_filter) && keyfilter_needs_rebuild(cache->keyfilter))
+            shardcache_keyfilter_build(cache);
+
+        int i;
+        for (i = 0; i < 10 && !ATOMIC_READ(cache->quit); i++)
+            usleep(100000);
+    }
+    return NULL;
+}
+
+static void
+shardcache_memory_counters(shardcache_t *cache, int add)
+{
+    const char *labels[SHARDCACHE_MEM_NUM] = SHARDCACHE_MEM_LABELS_ARRAY;
+    struct {
+        const char *name;
+        uint64_t *value;
+    } counters[SHARDCACHE_MEM_NUM + 3] = {
+        { "mem_total",      &cache->mem_total      },
+        { "mem_arc_target", &cache->mem_arc_target },
+        { "mem_rejected",   &cache->mem_rejected   }
+    };
+    int i;
+    for (i = 0; i < SHARDCACHE_MEM_NUM; i++) {
+        counters[i + 3].name = labels[i];
+        counters[i + 3].value = &cache->mem[i];
+    }
+    for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        if (add)
+            shardcache_counter_add(cache->counters, counters[i].name, counters[i].value);
+        else
+            shardcache_counter_remove(cache->counters, counters[i].name);
+    }
+}
+
+// refreshes the memory used by the subsystems which are not accounted
+// as they go (the size of the tables is estimated from their number of
+// items) and returns the total
+static uint64_t
+shardcache_memory_update(shardcache_t *cache)
+{
+    shardcache_update_size_counters(cache);
+    ATOMIC_SET(cache->mem[SHARDCACHE_MEM_CACHE],
+               ATOMIC_READ(cache->cnt[SHARDCACHE_COUNTER_CACHE_SIZE].value));
+
+    uint64_t volatile_size = ATOMIC_READ(cache->cnt[SHARDCACHE_COUNTER_TABLE_SIZE].value);
+    uint64_t timers_size = 0;
+    int i;
+    for (i = 0; i < cache->num_partitions; i++) {
+        shardcache_partition_t *part = &cache->partitions[i];
+        volatile_size += ht_count(part->volatile_storage) *
+                         (sizeof(volatile_object_t) + SHARDCACHE_MEM_HT_ENTRY_SIZE);
+        timers_size += (ht_count(part->cache_timeouts) + ht_count(part->volatile_timeouts)) *
+                       (sizeof(expire_key_ctx_t) + sizeof(iomux_timeout_id_t) +
+                        SHARDCACHE_MEM_HT_ENTRY_SIZE);
+        timers_size += queue_count(part->expirer_queue) * sizeof(shardcache_expire_job_t);
+    }
+    ATOMIC_SET(cache->mem[SHARDCACHE_MEM_VOLATILE], volatile_size);
+    ATOMIC_SET(cache->mem[SHARDCACHE_MEM_TIMERS], timers_size);
+
+    if (cache->evictor_jobs) {
+        ATOMIC_SET(cache->mem[SHARDCACHE_MEM_EVICTOR],
+                   ht_count(cache->evictor_jobs) *
+                   (sizeof(shardcache_evictor_job_t) + SHARDCACHE_MEM_HT_ENTRY_SIZE));
+    }
+
+    uint64_t total = 0;
+    for (i = 0; i < SHARDCACHE_MEM_NUM; i++)
+        total += ATOMIC_READ(cache->mem[i]);
+    ATOMIC_SET(cache->mem_total, total);
+    return total;
+}
+
+// the ratio the arcs are currently shrunk by (see shardcache_memory_governor())
+static double
+shardcache_memory_arc_ratio(shardcache_t *cache)
+{
+    uint64_t configured = ATOMIC_READ(cache->mem_arc_configured);
+    return configured ? (double)ATOMIC_READ(cache->mem_arc_target) / configured : 1.0;
+}
+
+// the large objects pools (see shardcache_large_object_pool()) are scaled
+// as the arcs, the namespaces get a pool in the same proportion to their
+// size as the one configured for the default arcs
+static void
+shardcache_large_object_pool_resize(shardcache_t *cache, shardcache_namespace_t *ns, double ratio)
+{
+    size_t threshold = ATOMIC_READ(cache->large_threshold);
+    size_t size = ATOMIC_READ(cache->large_size);
+    if (ns) {
+        size_t arc_size = ATOMIC_READ(cache->arc_size);
+        size = arc_size ? ((double)size / arc_size) * ns->size : 0;
+    }
+    int i;
+    for (i = 0; i < cache->num_partitions; i++) {
+        arc_t *arc = ns ? ns->arcs[i] : cache->partitions[i].arc;
+        arc_set_large_pool(arc, threshold, (size / cache->num_partitions) * ratio);
+    }
+}
+
+// shrinks (or grows back) all the arcs, including the namespace ones,
+// by the same ratio so that their total size matches the target
+static void
+shardcache_memory_resize_arcs(shardcache_t *cache, uint64_t target, uint64_t configured)
+{
+    double ratio = (double)target / configured;
+    int large = ATOMIC_READ(cache->large_threshold) > 0;
+    int i, n;
+    for (i = 0; i < cache->num_partitions; i++)
+        arc_set_size(cache->partitions[i].arc, (cache->arc_size / cache->num_partitions) * ratio);
+    if (large)
+        shardcache_large_object_pool_resize(cache, NULL, ratio);
+
+    for (n = 0; n < SHARDCACHE_NAMESPACES_MAX; n++) {
+        shardcache_namespace_t *ns = ATOMIC_READ(cache->namespaces[n]);
+        if (!ns)
+            break;
+        for (i = 0; i < cache->num_partitions; i++)
+            arc_set_size(ns->arcs[i], (ns->size / cache->num_partitions) * ratio);
+        if (large)
+            shardcache_large_object_pool_resize(cache, ns, ratio);
+    }
+}
+
+// keeps the memory used by the process within the configured limit:
+// the arcs get whatever the other subsystems leave below the high watermark
+// and new data is refused once the limit is reached
+static void *
+shardcache_memory_governor(void *priv)
+{
+    shardcache_t *cache = (shardcache_t *)priv;
+    uint64_t arc_target = cache->arc_size;
+    uint64_t arc_configured = cache->arc_size;
+
+    while (!ATOMIC_READ(cache->quit)) {
+        uint64_t total = shardcache_memory_update(cache);
+        uint64_t limit = (uint64_t)ATOMIC_READ(cache->memory_limit) << 20;
+
+        uint64_t configured = cache->arc_size;
+        int n;
+        for (n = 0; n < SHARDCACHE_NAMESPACES_MAX; n++) {
+            shardcache_namespace_t *ns = ATOMIC_READ(cache->namespaces[n]);
+            if (!ns)
+                break;
+            configured += ns->size;
+        }
+
+        uint64_t target = configured;
+        int pressure = 0;
+        if (limit) {
+            uint64_t high = limit / 100 * SHARDCACHE_MEM_HIGH_WATERMARK;
+            uint64_t others = total - ATOMIC_READ(cache->mem[SHARDCACHE_MEM_CACHE]);
+            uint64_t min = configured / 100 * SHARDCACHE_MEM_ARC_MIN;
+            target = high > others ? high - others : 0;
+            if (target < min)
+                target = min;
+            if (target > configured)
+                target = configured;
+
+            // stop refusing new data only once the usage
+            // went back below the low watermark
+            pressure = ATOMIC_READ(cache->mem_pressure)
+                     ? total > limit / 100 * SHARDCACHE_MEM_LOW_WATERMARK
+                     : total >= limit;
+        }
+
+        if (pressure != ATOMIC_READ(cache->mem_pressure)) {
+            if (pressure)
+                SHC_WARNING("Memory limit reached (%llu bytes in use), refusing new data",
+                            (unsigned long long)total);
+            else
+                SHC_NOTICE("Memory usage back to %llu bytes, accepting new data",
+                           (unsigned long long)total);
+            ATOMIC_SET(cache->mem_pressure, pressure);
+        }
+
+        // don't bother the arcs for small adjustments
+        // (unless a new namespace needs to be sized)
+        uint64_t delta = target > arc_target ? target - arc_target : arc_target - target;
+        if (delta > configured / 100 || configured != arc_configured) {
+            SHC_DEBUG("Resizing the arcs to %llu bytes (configured: %llu)",
+                      (unsigned long long)target, (unsigned long long)configured);
+            shardcache_memory_resize_arcs(cache, target, configured);
+            arc_target = target;
+            arc_configured = configured;
+            ATOMIC_SET(cache->mem_arc_target, target);
+            ATOMIC_SET(cache->mem_arc_configured, configured);
+        }
+
+        int i;
+        for (i = 0; i < SHARDCACHE_MEM_GOVERNOR_INTERVAL / 100 && !ATOMIC_READ(cache->quit); i++)
+            usleep(100000);
+    }
+    return NULL;
+}
+
+static void
+shardcache_write_pipeline_counters(shardcache_t *cache, int add)
+{
+    write_pipeline_stats_t *stats = &cache->write_pipeline_stats;
+    struct {
+        const char *name;
+        uint64_t *value;
+    } counters[] = {
+        { "forwarded_writes", &stats->writes    },
+        { "coalesced_writes", &stats->coalesced },
+        { "write_batches",    &stats->batches   },
+        { "write_errors",     &stats->errors    }
+    };
+    int i;
+    for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        if (add)
+            shardcache_counter_add(cache->counters, counters[i].name, counters[i].value);
+        else
+            shardcache_counter_remove(cache->counters, counters[i].name);
+    }
+}
+
+shardcache_t *
+shardcache_create(char *me,
+                  shardcache_node_t **nodes,
+                  int nnodes,
+                  shardcache_storage_t *st,
+                  char *secret,
+                  int num_workers,
+                  int num_async,
+                  size_t cache_size)
+{
+    return shardcache_create_partitioned(me, nodes, nnodes, st, secret,
+                                         num_workers, num_async, cache_size, 1);
+}
+
+shardcache_t *
+shardcache_create_partitioned(char *me,
+                              shardcache_node_t **nodes,
+                              int nnodes,
+                              shardcache_storage_t *st,
+                              char *secret,
+                              int num_workers,
+                              int num_async,
+                              size_t cache_size,
+                              int num_partitions)
+{
+    int i, n;
+
+    shardcache_t *cache = calloc(1, sizeof(shardcache_t));
+
+    if (num_partitions < 1)
+        num_partitions = 1;
+
+    if (num_partitions > 1 && num_workers != num_partitions) {
+        SHC_NOTICE("Using %d serving workers (one per partition) instead of %d",
+                   num_partitions, num_workers);
+        num_workers = num_partitions;
+    }
+
+    cache->num_partitions = num_partitions;
+    cache->partitions = calloc(num_partitions, sizeof(shardcache_partition_t));
+
+    cache->evict_on_delete = 1;
+    cache->use_persistent_connections = 1;
+    cache->tcp_timeout = SHARDCACHE_TCP_TIMEOUT_DEFAULT;
+    cache->expire_time = SHARDCACHE_EXPIRE_TIME_DEFAULT;
+    cache->serving_look_ahead = SHARDCACHE_SERVING_LOOK_AHEAD_DEFAULT;
+    cache->serving_look_ahead_min = SHARDCACHE_SERVING_LOOK_AHEAD_MIN_DEFAULT;
+    cache->serving_latency_target = SHARDCACHE_SERVING_LATENCY_TARGET_DEFAULT;
+    cache->serving_quantum = SHARDCACHE_SERVING_QUANTUM_DEFAULT;
+    cache->busy_poll = SHARDCACHE_BUSY_POLL_DEFAULT;
+    cache->prefetch_max_inflight = SHARDCACHE_PREFETCH_MAX_INFLIGHT_DEFAULT;
+    cache->warmup_max_items = SHARDCACHE_WARMUP_MAX_ITEMS_DEFAULT;
+    cache->warmup_rate = SHARDCACHE_WARMUP_RATE_DEFAULT;
+    cache->warmup_invalidated = ht_create(128, 0, NULL);
+    cache->warmup_invalidated_prefixes = ht_create(16, 0, NULL);
+    cache->write_pipeline_window = SHARDCACHE_WRITE_PIPELINE_WINDOW_DEFAULT;
+    cache->prefetch_queue = queue_create();
+    queue_set_free_value_callback(cache->prefetch_queue, free);
+    cache->iomux_run_timeout_low = SHARDCACHE_IOMUX_RUN_TIMEOUT_LOW;
+    cache->iomux_run_timeout_high = SHARDCACHE_IOMUX_RUN_TIMEOUT_HIGH;
+    if (num_async > 0)
+        cache->num_async = num_async;
+    else if (num_async < 0)
+        cache->num_async = ((num_workers > 1 ? num_workers -1 : 1) / 10) + 1; // 1 async thread for every 10 workers
+    else
+        cache->num_async = SHARDCACHE_ASYNC_THREADS_NUM_DEFAULT;
+
+    SPIN_INIT(&cache->migration_lock);
+    MUTEX_INIT(&cache->write_pipelines_lock);
+
+    if (st) {
+        if (st->version != SHARDCACHE_STORAGE_API_VERSION) {
+            SHC_ERROR("Storage module version mismatch: %u != %u", st->version, SHARDCACHE_STORAGE_API_VERSION);
+            shardcache_destroy(cache);
+            return NULL;
+        }
+        memcpy(&cache->storage, st, sizeof(cache->storage));
+        cache->use_persistent_storage = 1;
+    } else {
+        SHC_NOTICE("No storage callbacks provided,"
+                   "using only the internal volatile storage");
+        cache->use_persistent_storage = 0;
+    }
+
+
+    cache->me = strdup(me);
+
+    shardcache_node_t **shards = malloc(sizeof(shardcache_node_t *) * nnodes);
+    int me_found = 0;
+    int my_index = -1;
+    for (i = 0; i < nnodes; i++) {
+        char *label = shardcache_node_get_label(nodes[i]);
+        int num_replicas = shardcache_node_num_addresses(nodes[i]);
+        char *replicas[num_replicas];
+        shardcache_node_get_all_addresses(nodes[i], replicas, num_replicas);
+        shards[i] = shardcache_node_create(label, replicas, num_replicas);
+        if (strcmp(label, me) == 0) {
+            me_found = 1;
+            for (n = 0; n < num_replicas; n++) {
+                char *address = shardcache_node_get_address_at_index(nodes[i], n);
+                int fd = open_socket(address, 0);
+                if (fd >= 0) {
+                    SHC_DEBUG("Using address %s", address);
+                    cache->addr = strdup(address);
+                    my_index = n;
+                    close(fd);
+                    break;
+                } else {
+                    SHC_DEBUG("Skipping address %s", address);
+                }
+            }
+        }
+    }
+
+    if (!cache->addr) {
+        if (me_found) {
+            SHC_ERROR("Can't bind any address configured for node %s", me);
+        } else {
+            SHC_ERROR("Can't find my address (%s) among the configured nodes", cache->me);
+        }
+        shardcache_free_nodes(shards, nnodes);
+        shardcache_destroy(cache);
+        return NULL;
+    }
+
+    cache->continuum = shardcache_continuum_create(cache->me, shards, nnodes);
+
+    for (i = 0; i < cache->num_partitions; i++) {
+        shardcache_partition_t *part = &cache->partitions[i];
+        part->index = i;
+        part->cache = cache;
+
+        part->ops.init    = arc_ops_init;
+        part->ops.fetch   = arc_ops_fetch;
+        part->ops.evict   = arc_ops_evict;
+        part->ops.store   = arc_ops_store;
+        part->ops.demote  = arc_ops_demote;
+        part->ops.priv    = part;
+
+        // we need to tell the arc subsystem how big are the cached objects (well ... at least the container struct
+        // which is attached to each cached object to encapsulate its actual data and extra flags/members
+        part->arc = arc_create(&part->ops,
+                               cache_size / cache->num_partitions,
+                               sizeof(cached_object_t),
+                               part->arc_lists_size,
+                               cache->arc_mode,
+                               SHARDCACHE_ARC_RECLAIM_MODE);
+        if (!part->arc) {
+            SHC_ERROR("Can't create the arc for partition %d", i);
+            shardcache_destroy(cache);
+            return NULL;
+        }
+    }
+    cache->arc_size = cache_size;
+
+    // check if there is already signal handler registered on SIGPIPE
+    struct sigaction sa;
+    if (sigaction(SIGPIPE, NULL, &sa) != 0) {
+        SHC_ERROR("Can't check signal handlers: %s", strerror(errno)); 
+        shardcache_destroy(cache);
+        return NULL;
+    }
+
+    // if not we need to register one to handle writes/reads to disconnected sockets
+    if (sa.sa_handler == NULL)
+        signal(SIGPIPE, shardcache_do_nothing);
+
+    if (secret && *secret) {
         cache->auth = calloc(1, 16);
         strncpy((char *)cache->auth, secret, 16);
     } 
@@ -585,10 +1394,19 @@ shardcache_create(char *me,
         shardcache_counter_add(cache->counters, cache->cnt[i].name, &cache->cnt[i].value); 
     }
 
-    shardcache_counter_add(cache->counters, "mru_size", cache->arc_lists_size[0]);
-    shardcache_counter_add(cache->counters, "mfu_size", cache->arc_lists_size[1]);
-    shardcache_counter_add(cache->counters, "mrug_size", cache->arc_lists_size[2]);
-    shardcache_counter_add(cache->counters, "mfug_size", cache->arc_lists_size[3]);
+    shardcache_write_pipeline_counters(cache, 1);
+    shardcache_partition_counters(cache, 1);
+
+    cache->hotkeys_sample_rate = SHARDCACHE_HOTKEYS_SAMPLE_RATE_DEFAULT;
+    for (i = 0; i < SHARDCACHE_HOTKEYS_NUM; i++) {
+        cache->hotkeys[i] = topk_create(SHARDCACHE_HOTKEYS_CAPACITY,
+                                        i == SHARDCACHE_HOTKEYS_VALUES ? TOPK_MODE_MAX : TOPK_MODE_SUM,
+                                        i == SHARDCACHE_HOTKEYS_VALUES ? 0 : SHARDCACHE_HOTKEYS_HALF_LIFE);
+    }
+
+    cache->slowlog_threshold = SHARDCACHE_SLOWLOG_THRESHOLD_DEFAULT;
+    cache->slowlog = slowlog_create(SHARDCACHE_SLOWLOG_SIZE);
+    cache->traces = slowlog_create(SHARDCACHE_TRACES_SIZE);
 
     if (ATOMIC_READ(cache->evict_on_delete)) {
         MUTEX_INIT(&cache->evictor_lock);
@@ -601,12 +1419,38 @@ shardcache_create(char *me,
     gettimeofday(&tv, NULL);
     srandom((unsigned)tv.tv_usec);
 
-    cache->volatile_storage = ht_create(1<<16, 1<<20, (ht_free_item_callback_t)destroy_volatile);
+    for (i = 0; i < cache->num_partitions; i++) {
+        cache->partitions[i].volatile_storage =
+            ht_create(1<<16, 1<<20, (ht_free_item_callback_t)destroy_volatile);
+    }
 
     cache->connections_pool = connections_pool_create(cache->tcp_timeout,
                                                       SHARDCACHE_CONNECTION_EXPIRE_DEFAULT,
                                                       (num_workers/2)+ 1);
 
+    cache->write_pipelines = ht_create(128, 65535, (ht_free_item_callback_t)write_pipeline_release);
+
+    shardcache_connections_pool_counters(cache, 1);
+    if (pthread_create(&cache->pool_keeper_th, NULL, shardcache_pool_keeper, cache) != 0) {
+        SHC_ERROR("Can't create the connections keeper thread: %s", strerror(errno));
+        shardcache_destroy(cache);
+        return NULL;
+    }
+
+    // the filter needs to scan the index of the keys owned by this node,
+    // a global storage is shared (and can be modified) by all the nodes
+    if (cache->use_persistent_storage && !cache->storage.global &&
+        (cache->storage.index_page || (cache->storage.index && cache->storage.count)))
+    {
+        cache->keyfilter = keyfilter_create(SHARDCACHE_STORAGE_FILTER_FP_RATE);
+        shardcache_keyfilter_counters(cache, 1);
+        if (pthread_create(&cache->keyfilter_th, NULL, shardcache_keyfilter_keeper, cache) != 0) {
+            SHC_ERROR("Can't create the storage filter thread: %s", strerror(errno));
+            shardcache_destroy(cache);
+            return NULL;
+        }
+    }
+
     global_tcp_timeout(ATOMIC_READ(cache->tcp_timeout));
 
     cache->async_context = calloc(1, sizeof(shardcache_async_io_context_t) * cache->num_async);
@@ -634,11 +1478,23 @@ shardcache_create(char *me,
         return NULL;
     }
 
-    cache->cache_timeouts = ht_create(1<<16, 1<<20, (ht_free_item_callback_t)free);
-    cache->volatile_timeouts = ht_create(1<<16, 1<<20, (ht_free_item_callback_t)free);
-    cache->expirer_mux = iomux_create(0, 1);
-    cache->expirer_queue = queue_create();
-    pthread_create(&cache->expirer_th, NULL, shardcache_expire_keys, cache);
+    for (i = 0; i < cache->num_partitions; i++) {
+        shardcache_partition_t *part = &cache->partitions[i];
+        part->cache_timeouts = ht_create(1<<16, 1<<20, (ht_free_item_callback_t)free);
+        part->volatile_timeouts = ht_create(1<<16, 1<<20, (ht_free_item_callback_t)free);
+        part->expirer_mux = iomux_create(0, 1);
+        part->expirer_queue = queue_create();
+        pthread_create(&part->expirer_th, NULL, shardcache_expire_keys, part);
+    }
+
+    // needs the expiration tables
+    cache->mem_arc_target = cache->arc_size;
+    shardcache_memory_counters(cache, 1);
+    if (pthread_create(&cache->governor_th, NULL, shardcache_memory_governor, cache) != 0) {
+        SHC_ERROR("Can't create the memory governor thread: %s", strerror(errno));
+        shardcache_destroy(cache);
+        return NULL;
+    }
 
     if (!shardcache_log_initialized)
         shardcache_log_init("libshardcache", LOG_WARNING);
@@ -647,7 +1503,7 @@ shardcache_create(char *me,
     // NOTE: this needs to happen after the cache has been fully initialized
     for (i = 0; i < nnodes; i++) {
         if (shardcache_node_num_addresses(nodes[i]) > 1 && my_index >= 0)
-            cache->replica = shardcache_replica_create(cache, cache->shards[i], my_index, NULL);
+            cache->replica = shardcache_replica_create(cache, cache->continuum->nodes[i], my_index, NULL);
     }
     return cache;
 }
@@ -660,6 +1516,11 @@ shardcache_destroy(shardcache_t *cache)
     ATOMIC_INCREMENT(cache->quit);
 
     ATOMIC_INCREMENT(cache->async_quit);
+
+    // the warm-up threads are detached, wait for them to notice we are leaving
+    while (ATOMIC_READ(cache->warmup_running))
+        usleep(10000);
+
     if (cache->async_context) { 
         for (i = 0; i < cache->num_async; i ++) {
             if (cache->async_context[i].mux) {
@@ -671,6 +1532,18 @@ shardcache_destroy(shardcache_t *cache)
         }
     }
 
+    // flush (or fail) the writes still queued on the pipelines while the
+    // requests they have to be notified to are still around. A pipeline
+    // still referenced by a worker is released by it once the write is
+    // pushed (and the writes queued after this point go straight to the peers)
+    if (cache->write_pipelines) {
+        MUTEX_LOCK(&cache->write_pipelines_lock);
+        hashtable_t *write_pipelines = cache->write_pipelines;
+        cache->write_pipelines = NULL;
+        MUTEX_UNLOCK(&cache->write_pipelines_lock);
+        ht_destroy(write_pipelines);
+    }
+
     if (cache->serv)
         stop_serving(cache->serv);
 
@@ -696,6 +1569,14 @@ shardcache_destroy(shardcache_t *cache)
         free(cache->async_context);
     }
 
+    if (cache->prefetch_queue)
+        queue_destroy(cache->prefetch_queue);
+
+    if (cache->warmup_invalidated)
+        ht_destroy(cache->warmup_invalidated);
+    if (cache->warmup_invalidated_prefixes)
+        ht_destroy(cache->warmup_invalidated_prefixes);
+
     if (ATOMIC_READ(cache->evict_on_delete) && cache->evictor_jobs)
     {
         SHC_DEBUG2("Stopping evictor thread");
@@ -715,10 +1596,30 @@ shardcache_destroy(shardcache_t *cache)
     SPIN_UNLOCK(&cache->migration_lock);
     SPIN_DESTROY(&cache->migration_lock);
 
-    if (cache->expirer_th) {
-        SHC_DEBUG2("Stopping expirer thread");
-        pthread_join(cache->expirer_th, NULL);
-        SHC_DEBUG2("Expirer thread stopped");
+    for (i = 0; i < cache->num_partitions; i++) {
+        if (cache->partitions[i].expirer_th) {
+            SHC_DEBUG2("Stopping expirer thread (partition %d)", i);
+            pthread_join(cache->partitions[i].expirer_th, NULL);
+            SHC_DEBUG2("Expirer thread stopped");
+        }
+    }
+
+    if (cache->pool_keeper_th) {
+        SHC_DEBUG2("Stopping the connections keeper thread");
+        pthread_join(cache->pool_keeper_th, NULL);
+        SHC_DEBUG2("Connections keeper thread stopped");
+    }
+
+    if (cache->governor_th) {
+        SHC_DEBUG2("Stopping the memory governor thread");
+        pthread_join(cache->governor_th, NULL);
+        SHC_DEBUG2("Memory governor thread stopped");
+    }
+
+    if (cache->keyfilter_th) {
+        SHC_DEBUG2("Stopping the storage filter thread");
+        pthread_join(cache->keyfilter_th, NULL);
+        SHC_DEBUG2("Storage filter thread stopped");
     }
 
     if (cache->replica)
@@ -728,43 +1629,71 @@ shardcache_destroy(shardcache_t *cache)
         for (i = 0; i < SHARDCACHE_NUM_COUNTERS; i ++) {
             shardcache_counter_remove(cache->counters, cache->cnt[i].name);
         }
-        shardcache_counter_remove(cache->counters, "mru_size");
-        shardcache_counter_remove(cache->counters, "mfu_size");
-        shardcache_counter_remove(cache->counters, "mrug_size");
-        shardcache_counter_remove(cache->counters, "mfug_size");
+        shardcache_write_pipeline_counters(cache, 0);
+        if (cache->connections_pool)
+            shardcache_connections_pool_counters(cache, 0);
+        if (cache->keyfilter)
+            shardcache_keyfilter_counters(cache, 0);
+        if (cache->governor_th)
+            shardcache_memory_counters(cache, 0);
+        shardcache_partition_counters(cache, 0);
+        if (cache->l2)
+            shardcache_l2_counters(cache, 0);
+        for (i = 0; i < SHARDCACHE_NAMESPACES_MAX && cache->namespaces[i]; i++)
+            shardcache_namespace_counters(cache, cache->namespaces[i], 0);
         shardcache_release_counters(cache->counters);
     }
 
-    if (cache->volatile_storage)
-        ht_destroy(cache->volatile_storage);
-
     if (cache->auth)
         free((void *)cache->auth);
 
-    if (cache->arc)
-        arc_destroy(cache->arc);
+    if (cache->continuum)
+        shardcache_continuum_destroy(cache->continuum);
 
-    if (cache->chash)
-        chash_free(cache->chash);
+    // a migration still in progress is simply discarded
+    if (cache->migration)
+        shardcache_continuum_destroy(cache->migration);
 
-    if (cache->expirer_mux)
-        iomux_destroy(cache->expirer_mux);
+    if (cache->retired_continuum)
+        shardcache_continuum_destroy(cache->retired_continuum);
 
-    if (cache->expirer_queue) {
-        shardcache_expire_job_t *job = queue_pop_left(cache->expirer_queue);
-        while(job) {
-            free(job->key);
-            free(job);
-            job = queue_pop_left(cache->expirer_queue);
+    // the namespaces arcs use the partitions ops, release them first
+    for (i = 0; i < SHARDCACHE_NAMESPACES_MAX && cache->namespaces[i]; i++)
+        shardcache_namespace_destroy(cache, cache->namespaces[i]);
+
+    for (i = 0; i < cache->num_partitions; i++) {
+        shardcache_partition_t *part = &cache->partitions[i];
+
+        if (part->volatile_storage)
+            ht_destroy(part->volatile_storage);
+
+        if (part->arc)
+            arc_destroy(part->arc);
+
+        if (part->expirer_mux)
+            iomux_destroy(part->expirer_mux);
+
+        if (part->expirer_queue) {
+            shardcache_expire_job_t *job = queue_pop_left(part->expirer_queue);
+            while(job) {
+                free(job->key);
+                free(job);
+                job = queue_pop_left(part->expirer_queue);
+            }
+            queue_destroy(part->expirer_queue);
         }
-        queue_destroy(cache->expirer_queue);
-    }
 
-    if (cache->cache_timeouts)
-        ht_destroy(cache->cache_timeouts);
+        if (part->cache_timeouts)
+            ht_destroy(part->cache_timeouts);
+
+        if (part->volatile_timeouts)
+            ht_destroy(part->volatile_timeouts);
+    }
+    free(cache->partitions);
 
-    if (cache->volatile_timeouts)
-        ht_destroy(cache->volatile_timeouts);
+    // the arcs are gone, nothing can be demoted anymore
+    if (cache->l2)
+        l2cache_destroy(cache->l2);
 
     if (cache->me)
         free(cache->me);
@@ -772,12 +1701,25 @@ shardcache_destroy(shardcache_t *cache)
     if (cache->addr)
         free(cache->addr);
 
-    if (cache->shards)
-        shardcache_free_nodes(cache->shards, cache->num_shards);
-
     if (cache->connections_pool)
         connections_pool_destroy(cache->connections_pool);
 
+    if (cache->keyfilter)
+        keyfilter_destroy(cache->keyfilter);
+
+    for (i = 0; i < SHARDCACHE_HOTKEYS_NUM; i++) {
+        if (cache->hotkeys[i])
+            topk_destroy(cache->hotkeys[i]);
+    }
+
+    if (cache->slowlog)
+        slowlog_destroy(cache->slowlog);
+
+    if (cache->traces)
+        slowlog_destroy(cache->traces);
+
+    MUTEX_DESTROY(&cache->write_pipelines_lock);
+
     free(cache);
     SHC_DEBUG("Shardcache node stopped");
 }
@@ -789,6 +1731,7 @@ typedef struct {
     size_t len;
     size_t sent;
     shardcache_t *cache;
+    arc_t *arc;
     arc_resource_t res;
     shardcache_get_async_callback_t cb;
     void *priv;
@@ -805,7 +1748,7 @@ shardcache_get_async_helper(void *key,
 {
     shardcache_get_async_helper_arg_t *arg = (shardcache_get_async_helper_arg_t *)priv;
 
-    arc_t *arc = arg->cache->arc;
+    arc_t *arc = arg->arc;
 
     if (ATOMIC_READ(arg->cache->async_quit)) {
         arc_release_resource(arc, arg->res);
@@ -814,23 +1757,19 @@ shardcache_get_async_helper(void *key,
     }
 
 
-    int rc = -1;
-    if ((arg->dlen + dlen) > arg->offset) {
-        if (arg->dlen < arg->offset) {
-            int diff = arg->offset - arg->dlen;
-            rc = arg->cb(key, klen, data + diff, dlen - diff, total_size, timestamp, arg->priv);
-            arg->sent += (dlen - diff);
-        } else {
-            if (arg->len && (arg->sent + dlen) > arg->len) {
-                int diff = arg->len - arg->sent;
-                rc = arg->cb(key, klen, data, diff, total_size, timestamp, arg->priv);
-                arg->sent += diff;
-            } else {
-                rc = arg->cb(key, klen, data, dlen, total_size, timestamp, arg->priv);
-                arg->sent += dlen;
-            }
+    int rc = 0;
+    if (dlen) {
+        // the chunk starts at arg->dlen in the object, only the part
+        // falling in the requested range (if any) is handed over
+        size_t start = arg->offset > arg->dlen ? arg->offset - arg->dlen : 0;
+        size_t end = dlen;
+        if (arg->len && end > start + (arg->len - arg->sent))
+            end = start + (arg->len - arg->sent);
+        if (start < end) {
+            rc = arg->cb(key, klen, data + start, end - start, total_size, timestamp, arg->priv);
+            arg->sent += end - start;
         }
-    } else if (!dlen) {
+    } else if (total_size) {
         rc = arg->cb(key, klen, NULL, 0, total_size, timestamp, arg->priv);
     }
 
@@ -867,17 +1806,38 @@ shardcache_get_offset_async(shardcache_t *cache,
         return -1;
     }
 
+    shardcache_key_t k = SHARDCACHE_KEY(key, klen);
+    return shardcache_get_offset_async_key(cache, &k, offset, length, cb, priv);
+}
+
+int
+shardcache_get_offset_async_key(shardcache_t *cache,
+                                shardcache_key_t *k,
+                                size_t offset,
+                                size_t length,
+                                shardcache_get_async_callback_t cb,
+                                void *priv)
+{
+    void *key = k->key;
+    size_t klen = k->klen;
+    shardcache_namespace_t *ns = shardcache_namespace(cache, key, klen);
+    arc_t *arc = shardcache_arc(cache, ns, k->hash);
+
     if (offset == 0)
-        ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_GETS].value);
+        SHARDCACHE_NS_COUNTER_INCREMENT(cache, ns, SHARDCACHE_COUNTER_GETS);
 
     void *obj_ptr = NULL;
-    arc_resource_t res = arc_lookup(cache->arc, (const void *)key, klen, &obj_ptr, 1);
+    shardcache_fetch_deadline = k->deadline;
+    arc_resource_t res = arc_lookup(arc, (const void *)key, klen, k->hash, &obj_ptr, 1);
+    shardcache_fetch_deadline = NULL;
+    if (shardcache_fetch_timing)
+        gettimeofday(&shardcache_fetch_timing->looked_up, NULL);
     if (!res) {
         return -1;
     }
 
     if (!obj_ptr) {
-        arc_release_resource(cache->arc, res);
+        arc_release_resource(arc, res);
         return -1;
     }
 
@@ -886,10 +1846,10 @@ shardcache_get_offset_async(shardcache_t *cache,
     if (COBJ_CHECK_FLAGS(obj, COBJ_FLAG_EVICTED)) {
         // if marked for eviction we don't want to return this object
         MUTEX_UNLOCK(&obj->lock);
-        arc_release_resource(cache->arc, res);
+        arc_release_resource(arc, res);
         // but we will try to fetch it again
         SHC_DEBUG("The retreived object has been already evicted, try fetching it again (offset)");
-        return shardcache_get_async(cache, key, klen, cb, priv);
+        return shardcache_get_async_key(cache, k, cb, priv);
     } else if (COBJ_CHECK_FLAGS(obj, COBJ_FLAG_COMPLETE)) {
         size_t dlen = obj->dlen;
         void *data = NULL;
@@ -899,7 +1859,7 @@ shardcache_get_offset_async(shardcache_t *cache,
             } else {
                 cb(key, klen, NULL, 0, 0, &obj->ts, priv);
                 MUTEX_UNLOCK(&obj->lock);
-                arc_release_resource(cache->arc, res);
+                arc_release_resource(arc, res);
                 free(data);
                 return 0;
             }
@@ -913,24 +1873,25 @@ shardcache_get_offset_async(shardcache_t *cache,
 
         time_t obj_expiration = (COBJ_CHECK_FLAGS(obj, COBJ_FLAG_DROP) || COBJ_CHECK_FLAGS(obj, COBJ_FLAG_EVICT))
                               ? 0
-                              : obj->ts.tv_sec + cache->expire_time;
+                              : obj->ts.tv_sec + SHARDCACHE_NS_OPTION(cache, ns, expire_time);
 
         if (UNLIKELY(cache->lazy_expiration && obj_expiration &&
-            cache->expire_time > 0 && obj_expiration < time(NULL)))
+            SHARDCACHE_NS_OPTION(cache, ns, expire_time) > 0 && obj_expiration < time(NULL)))
         {
             MUTEX_UNLOCK(&obj->lock);
-            arc_drop_resource(cache->arc, res);
+            arc_drop_resource(arc, res);
             free(data);
             ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_EXPIRES].value);
-            return shardcache_get_offset_async(cache, key, klen, offset, length, cb, priv);
+            return shardcache_get_offset_async_key(cache, k, offset, length, cb, priv);
         } else {
             cb(key, klen, data, dlen, dlen, &obj->ts, priv);
             MUTEX_UNLOCK(&obj->lock);
-            arc_release_resource(cache->arc, res);
+            arc_release_resource(arc, res);
             free(data);
             return 0;
         }
     } else {
+        size_t sent = 0;
         if (obj->dlen) {
             // check if we have enough so far
             if (obj->dlen > offset) {
@@ -948,23 +1909,48 @@ shardcache_get_offset_async(shardcache_t *cache,
                 cb(key, klen, data, dlen, 0, NULL, priv);
                 if (data)
                     free(data);
+                sent = dlen;
             }
         }
 
+        // the listener picks up from the data received so far,
+        // handing over only what's left of the requested range
         shardcache_get_async_helper_arg_t *arg = calloc(1, sizeof(shardcache_get_async_helper_arg_t));
+        arg->dlen = obj->dlen;
+        arg->offset = offset;
+        arg->len = length;
+        arg->sent = sent;
         arg->cb = cb;
         arg->priv = priv;
         arg->cache = cache;
-        arg->res = res;
+        arg->arc = arc;
+        // the listener can be called (and release the resource)
+        // by a different thread
+        arg->res = arc_retain_resource(arc, res);
 
         shardcache_get_listener_t *listener = malloc(sizeof(shardcache_get_listener_t));
         listener->cb = shardcache_get_async_helper;
         listener->priv = arg;
         list_push_value(obj->listeners, listener);
+        // a peer fetch still in flight is retried on behalf of
+        // the listeners outliving the deadline it was sent with
+        shardcache_deadline_extend(&obj->deadline, k->deadline);
+
+        if (shardcache_fetch_timing) {
+            shardcache_fetch_timing->source |= SLOWLOG_SOURCE_WAITED;
+            // the peer fetch carries only the trace of the request which
+            // triggered it, the span of this one gets linked to that trace
+            if (obj->trace_id && (!shardcache_request_trace ||
+                                  shardcache_request_trace->id != obj->trace_id))
+            {
+                shardcache_fetch_timing->linked.id = obj->trace_id;
+                shardcache_fetch_timing->linked.flags = obj->trace_flags;
+            }
+        }
         MUTEX_UNLOCK(&obj->lock);
     }
 
-    arc_release_resource(cache->arc, res);
+    arc_release_resource(arc, res);
     return 0;
 }
 
@@ -981,11 +1967,14 @@ size_t shardcache_get_offset(shardcache_t *cache,
     if (!key)
         return 0;
 
+    shardcache_namespace_t *ns = shardcache_namespace(cache, key, klen);
     if (offset == 0)
-        ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_GETS].value);
+        SHARDCACHE_NS_COUNTER_INCREMENT(cache, ns, SHARDCACHE_COUNTER_GETS);
 
+    uint64_t hash = arc_hash_key(key, klen);
+    arc_t *arc = shardcache_arc(cache, ns, hash);
     void *obj_ptr = NULL;
-    arc_resource_t res = arc_lookup(cache->arc, (const void *)key, klen, &obj_ptr, 0);
+    arc_resource_t res = arc_lookup(arc, (const void *)key, klen, hash, &obj_ptr, 0);
     if (!res)
         return 0;
 
@@ -1007,7 +1996,7 @@ size_t shardcache_get_offset(shardcache_t *cache,
         vlen = obj->dlen;
         MUTEX_UNLOCK(&obj->lock);
     }
-    arc_release_resource(cache->arc, res);
+    arc_release_resource(arc, res);
     return (offset < vlen + copied) ? (vlen - offset - copied) : 0;
 }
 
@@ -1021,7 +2010,22 @@ shardcache_get_async(shardcache_t *cache,
     if (!key)
         return -1;
 
-    ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_GETS].value);
+    shardcache_key_t k = SHARDCACHE_KEY(key, klen);
+    return shardcache_get_async_key(cache, &k, cb, priv);
+}
+
+int
+shardcache_get_async_key(shardcache_t *cache,
+                         shardcache_key_t *k,
+                         shardcache_get_async_callback_t cb,
+                         void *priv)
+{
+    void *key = k->key;
+    size_t klen = k->klen;
+    shardcache_namespace_t *ns = shardcache_namespace(cache, key, klen);
+    arc_t *arc = shardcache_arc(cache, ns, k->hash);
+
+    SHARDCACHE_NS_COUNTER_INCREMENT(cache, ns, SHARDCACHE_COUNTER_GETS);
 
     if (UNLIKELY(shardcache_loglevel > LOG_DEBUG+3)) {
         char keystr[1024];
@@ -1030,12 +2034,16 @@ shardcache_get_async(shardcache_t *cache,
     }
 
     void *obj_ptr = NULL;
-    arc_resource_t res = arc_lookup(cache->arc, (const void *)key, klen, &obj_ptr, 1);
+    shardcache_fetch_deadline = k->deadline;
+    arc_resource_t res = arc_lookup(arc, (const void *)key, klen, k->hash, &obj_ptr, 1);
+    shardcache_fetch_deadline = NULL;
+    if (shardcache_fetch_timing)
+        gettimeofday(&shardcache_fetch_timing->looked_up, NULL);
     if (!res)
         return -1;
 
     if (!obj_ptr) {
-        arc_release_resource(cache->arc, res);
+        arc_release_resource(arc, res);
         return -1;
     }
 
@@ -1047,7 +2055,7 @@ shardcache_get_async(shardcache_t *cache,
         // if marked for eviction we don't want to return this object
         // but we will try to fetch it again
         MUTEX_UNLOCK(&obj->lock);
-        arc_release_resource(cache->arc, res);
+        arc_release_resource(arc, res);
 
         if (retry_timeout > 1<<11) {
             SHC_DEBUG("The retreived object has been already evicted, try fetching it again");
@@ -1059,12 +2067,16 @@ shardcache_get_async(shardcache_t *cache,
         retry_timeout <<= 1;
 
         obj_ptr = NULL;
-        res = arc_lookup(cache->arc, (const void *)key, klen, &obj_ptr, 1);
+        shardcache_fetch_deadline = k->deadline;
+        res = arc_lookup(arc, (const void *)key, klen, k->hash, &obj_ptr, 1);
+        shardcache_fetch_deadline = NULL;
+        if (shardcache_fetch_timing)
+            gettimeofday(&shardcache_fetch_timing->looked_up, NULL);
         if (!res)
             return -1;
 
         if (!obj_ptr) {
-            arc_release_resource(cache->arc, res);
+            arc_release_resource(arc, res);
             return -1;
         }
 
@@ -1075,19 +2087,19 @@ shardcache_get_async(shardcache_t *cache,
     if (COBJ_CHECK_FLAGS(obj, COBJ_FLAG_COMPLETE)) {
         time_t obj_expiration = (COBJ_CHECK_FLAGS(obj, COBJ_FLAG_DROP) || COBJ_CHECK_FLAGS(obj, COBJ_FLAG_EVICT))
                               ? 0
-                              : obj->ts.tv_sec + cache->expire_time;
+                              : obj->ts.tv_sec + SHARDCACHE_NS_OPTION(cache, ns, expire_time);
         if (UNLIKELY(cache->lazy_expiration && obj_expiration &&
-                     cache->expire_time > 0 && obj_expiration < time(NULL)))
+                     SHARDCACHE_NS_OPTION(cache, ns, expire_time) > 0 && obj_expiration < time(NULL)))
         {
             MUTEX_UNLOCK(&obj->lock);
-            arc_drop_resource(cache->arc, res);
+            arc_drop_resource(arc, res);
             ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_EXPIRES].value);
-            return shardcache_get_async(cache, key, klen, cb, priv);
+            return shardcache_get_async_key(cache, k, cb, priv);
 
         } else {
             cb(key, klen, obj->data, obj->dlen, obj->dlen, &obj->ts, priv);
             MUTEX_UNLOCK(&obj->lock);
-            arc_release_resource(cache->arc, res);
+            arc_release_resource(arc, res);
         }
     } else {
         if (obj->dlen) // let's send what we have so far
@@ -1097,13 +2109,32 @@ shardcache_get_async(shardcache_t *cache,
         arg->cb = cb;
         arg->priv = priv;
         arg->cache = cache;
-        arg->res = res;
+        arg->arc = arc;
+        // the listener can be called (and release the resource)
+        // by a different thread
+        arg->res = arc_retain_resource(arc, res);
 
         shardcache_get_listener_t *listener = malloc(sizeof(shardcache_get_listener_t));
         listener->cb = shardcache_get_async_helper;
         listener->priv = arg;
         list_push_value(obj->listeners, listener);
+        // a peer fetch still in flight is retried on behalf of
+        // the listeners outliving the deadline it was sent with
+        shardcache_deadline_extend(&obj->deadline, k->deadline);
+
+        if (shardcache_fetch_timing) {
+            shardcache_fetch_timing->source |= SLOWLOG_SOURCE_WAITED;
+            // the peer fetch carries only the trace of the request which
+            // triggered it, the span of this one gets linked to that trace
+            if (obj->trace_id && (!shardcache_request_trace ||
+                                  shardcache_request_trace->id != obj->trace_id))
+            {
+                shardcache_fetch_timing->linked.id = obj->trace_id;
+                shardcache_fetch_timing->linked.flags = obj->trace_flags;
+            }
+        }
         MUTEX_UNLOCK(&obj->lock);
+        arc_release_resource(arc, res);
     }
 
     return 0;
@@ -1246,10 +2277,28 @@ shardcache_head(shardcache_t *cache,
     return remainder + rlen;
 }
 
-typedef struct {
-    void *key;
-    size_t klen;
-    shardcache_async_response_callback_t cb;
+int
+shardcache_head_async(shardcache_t *cache,
+                      void *key,
+                      size_t klen,
+                      size_t hlen,
+                      shardcache_get_async_callback_t cb,
+                      void *priv)
+{
+    // an empty head would be notified as dlen == 0 and total_size == 0,
+    // which the callbacks take as an error
+    if (!key || !hlen)
+        return -1;
+
+    ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_HEADS].value);
+
+    return shardcache_get_offset_async(cache, key, klen, 0, hlen, cb, priv);
+}
+
+typedef struct {
+    void *key;
+    size_t klen;
+    shardcache_async_response_callback_t cb;
     void *priv;
     int done;
     char *addr;
@@ -1315,6 +2364,40 @@ static int shardcache_async_command_helper(void *data,
     return 0;
 }
 
+// queue an asynchronous read of the response to a command already sent
+// to a peer on 'fd'. The callback will be called (and the connection
+// released) by one of the async i/o threads
+static int
+shardcache_read_response_async(shardcache_t *cache,
+                               char *addr,
+                               int fd,
+                               shardcache_hdr_t hdr,
+                               void *key,
+                               size_t klen,
+                               shardcache_async_response_callback_t cb,
+                               void *priv)
+{
+    shardcache_async_command_helper_arg_t *arg = calloc(1, sizeof(shardcache_async_command_helper_arg_t));
+    arg->key = malloc(klen);
+    memcpy(arg->key, key, klen);
+    arg->klen = klen;
+    arg->cb = cb;
+    arg->priv = priv;
+    arg->cache = cache;
+    arg->addr = addr;
+    arg->fd = fd;
+    arg->hdr = hdr;
+    async_read_wrk_t *wrk = NULL;
+    int rc = read_message_async(fd, (char *)cache->auth, shardcache_async_command_helper, arg, &wrk);
+    if (rc == 0 && wrk) {
+        shardcache_queue_async_read_wrk(cache, wrk);
+        return 0;
+    }
+    free(arg->key);
+    free(arg);
+    return -1;
+}
+
 int
 shardcache_exists_async(shardcache_t *cache,
                         void *key,
@@ -1326,22 +2409,23 @@ shardcache_exists_async(shardcache_t *cache,
         return -1;
 
     // if we are not the owner try propagating the command to the responsible peer
-    char node_name[1024];
-    size_t node_len = sizeof(node_name);
-    memset(node_name, 0, node_len);
-
-    int is_mine = shardcache_test_migration_ownership(cache, key, klen, node_name, &node_len);
-    if (is_mine == -1)
-        is_mine = shardcache_test_ownership(cache, key, klen, node_name, &node_len);
+    shardcache_node_t *owner = NULL;
+    int is_mine = shardcache_key_owner(cache, key, klen, &owner);
 
     int rc = -1;
 
     if (is_mine == 1)
     {
+        uint64_t hash = arc_hash_key(key, klen);
+        shardcache_partition_t *part = shardcache_partition(cache, hash);
         // TODO - clean this bunch of nested conditions
-        if (!ht_exists(cache->volatile_storage, key, klen)) {
+        if (!ht_exists(part->volatile_storage, key, klen)) {
             if (cache->use_persistent_storage && cache->storage.exist) {
-                if (!cache->storage.exist(key, klen, cache->storage.priv)) {
+                if (!shardcache_storage_maybe_has(cache, hash)) {
+                    rc = 0;
+                } else if (!cache->storage.exist(key, klen, cache->storage.priv)) {
+                    if (cache->keyfilter)
+                        keyfilter_false_positive(cache->keyfilter);
                     rc = 0;
                 } else {
                     rc = 1;
@@ -1357,9 +2441,9 @@ shardcache_exists_async(shardcache_t *cache,
             cb(key, klen, rc, priv);
 
     } else {
-        shardcache_node_t *peer = shardcache_node_select(cache, (char *)node_name); 
+        shardcache_node_t *peer = owner;
         if (!peer) {
-            SHC_ERROR("Can't find address for node %s", peer);
+            SHC_ERROR("Can't find the node owning the key %.*s", (int)klen, (char *)key);
             if (cb)
                 cb(key, klen, -1, priv);
             return -1;
@@ -1368,23 +2452,12 @@ shardcache_exists_async(shardcache_t *cache,
         int fd = shardcache_get_connection_for_peer(cache, addr);
         if (cb) {
             rc = exists_on_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, fd, 0);
-            if (rc == 0) {
-                shardcache_async_command_helper_arg_t *arg = calloc(1, sizeof(shardcache_async_command_helper_arg_t));
-                arg->key = malloc(klen);
-                memcpy(arg->key, key, klen);
-                arg->klen = klen;
-                arg->cb = cb;
-                arg->priv = priv;
-                arg->cache = cache;
-                arg->addr = addr;
-                arg->fd = fd;
-                arg->hdr = SHC_HDR_EXISTS;
-                async_read_wrk_t *wrk = NULL;
-                rc = read_message_async(fd, (char *)cache->auth, shardcache_async_command_helper, arg, &wrk);
-                if (rc == 0 && wrk) {
-                    shardcache_queue_async_read_wrk(cache, wrk);
-                }
-            } else {
+            if (rc == 0)
+                rc = shardcache_read_response_async(cache, addr, fd, SHC_HDR_EXISTS, key, klen, cb, priv);
+
+            if (rc != 0) {
+                if (fd >= 0)
+                    close(fd);
                 cb(key, klen, -1, priv);
             }
         } else {
@@ -1404,58 +2477,225 @@ shardcache_exists(shardcache_t *cache, void *key, size_t klen)
 }
 
 int
-shardcache_touch(shardcache_t *cache, void *key, size_t klen)
+shardcache_touch_async(shardcache_t *cache,
+                       void *key,
+                       size_t klen,
+                       shardcache_async_response_callback_t cb,
+                       void *priv)
 {
-    if (!key || !klen)
+    if (!key || !klen) {
+        if (cb)
+            cb(key, klen, -1, priv);
         return -1;
+    }
 
     // if we are not the owner try propagating the command to the responsible peer
-    char node_name[1024];
-    size_t node_len = sizeof(node_name);
-    memset(node_name, 0, node_len);
+    shardcache_node_t *owner = NULL;
+    int is_mine = shardcache_key_owner(cache, key, klen, &owner);
 
-    int is_mine = shardcache_test_migration_ownership(cache, key, klen, node_name, &node_len);
-    if (is_mine == -1)
-        is_mine = shardcache_test_ownership(cache, key, klen, node_name, &node_len);
+    int rc = -1;
 
     if (is_mine == 1)
     {
+        uint64_t hash = arc_hash_key(key, klen);
+        arc_t *arc = shardcache_arc(cache, shardcache_namespace(cache, key, klen), hash);
         void *obj_ptr = NULL;
-        arc_resource_t res = arc_lookup(cache->arc, (const void *)key, klen, &obj_ptr, 0);
+        arc_resource_t res = arc_lookup(arc, (const void *)key, klen, hash, &obj_ptr, 0);
         if (res) {
             cached_object_t *obj = (cached_object_t *)obj_ptr;
-            MUTEX_LOCK(&obj->lock);
-            gettimeofday(&obj->ts, NULL);
-            MUTEX_UNLOCK(&obj->lock);
-            arc_release_resource(cache->arc, res);
-            return obj ? 0 : -1;
+            if (obj) {
+                MUTEX_LOCK(&obj->lock);
+                gettimeofday(&obj->ts, NULL);
+                MUTEX_UNLOCK(&obj->lock);
+                rc = 0;
+            }
+            arc_release_resource(arc, res);
         }
+        if (cb)
+            cb(key, klen, rc, priv);
     } else {
-        shardcache_node_t *peer = shardcache_node_select(cache, node_name);
+        shardcache_node_t *peer = owner;
         if (!peer) {
-            SHC_ERROR("Can't find address for node %s", peer);
+            SHC_ERROR("Can't find the node owning the key %.*s", (int)klen, (char *)key);
+            if (cb)
+                cb(key, klen, -1, priv);
             return -1;
         }
         char *addr = shardcache_node_get_address(peer);
         int fd = shardcache_get_connection_for_peer(cache, addr);
-        int rc = touch_on_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, fd);
-        shardcache_release_connection_for_peer(cache, addr, fd);
-        return rc;
+        if (cb) {
+            rc = touch_on_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, fd, 0);
+            if (rc == 0)
+                rc = shardcache_read_response_async(cache, addr, fd, SHC_HDR_TOUCH, key, klen, cb, priv);
+
+            if (rc != 0) {
+                if (fd >= 0)
+                    close(fd);
+                cb(key, klen, -1, priv);
+            }
+        } else {
+            rc = touch_on_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, fd, 1);
+            shardcache_release_connection_for_peer(cache, addr, fd);
+        }
     }
 
+    return rc;
+}
+
+int
+shardcache_touch(shardcache_t *cache, void *key, size_t klen)
+{
+    return shardcache_touch_async(cache, key, klen, NULL, NULL);
+}
+
+typedef struct {
+    shardcache_t *cache;
+    arc_t *arc;
+    arc_resource_t res;
+} shardcache_prefetch_arg_t;
+
+static int
+shardcache_prefetch_listener(void *key,
+                             size_t klen,
+                             void *data,
+                             size_t dlen,
+                             size_t total_size,
+                             struct timeval *timestamp,
+                             void *priv)
+{
+    shardcache_prefetch_arg_t *arg = (shardcache_prefetch_arg_t *)priv;
+
+    // we are only interested in knowing when the fetch is over
+    // (either because complete or because of an error)
+    if (dlen && !total_size && !timestamp)
+        return 0;
+
+    // NOTE: the next prefetch will be started by the async i/o threads,
+    //       the object lock is held while the listeners are notified
+    ATOMIC_DECREMENT(arg->cache->cnt[SHARDCACHE_COUNTER_PREFETCH_INFLIGHT].value);
+    arc_release_resource(arg->arc, arg->res);
+    free(arg);
     return -1;
 }
 
+// returns 1 if the fetch is still in progress once the lookup returns
+static int
+shardcache_prefetch_key(shardcache_t *cache, shardcache_key_t *k)
+{
+    arc_t *arc = shardcache_arc(cache, shardcache_namespace(cache, k->key, k->klen), k->hash);
+    void *obj_ptr = NULL;
+    arc_resource_t res = arc_lookup(arc, (const void *)k->key, k->klen, k->hash, &obj_ptr, 1);
+    if (!res)
+        return -1;
+
+    int rc = 0;
+    cached_object_t *obj = (cached_object_t *)obj_ptr;
+    if (obj) {
+        MUTEX_LOCK(&obj->lock);
+        if (!COBJ_CHECK_FLAGS(obj, COBJ_FLAG_COMPLETE) && obj->listeners) {
+            // the key has been explicitly requested, don't apply the
+            // sampling which usually keeps only a few of the remote items
+            COBJ_UNSET_FLAG(obj, COBJ_FLAG_DROP);
+
+            shardcache_prefetch_arg_t *arg = malloc(sizeof(shardcache_prefetch_arg_t));
+            arg->cache = cache;
+            arg->arc = arc;
+            arg->res = arc_retain_resource(arc, res);
+
+            shardcache_get_listener_t *listener = malloc(sizeof(shardcache_get_listener_t));
+            listener->cb = shardcache_prefetch_listener;
+            listener->priv = arg;
+            list_push_value(obj->listeners, listener);
+            rc = 1;
+        }
+        MUTEX_UNLOCK(&obj->lock);
+    }
+    arc_release_resource(arc, res);
+    return rc;
+}
+
+// called by the async i/o threads to start the queued prefetches
+// as long as there are free slots
 static void
-shardcache_commence_eviction(shardcache_t *cache, void *key, size_t klen)
+shardcache_prefetch_run(shardcache_t *cache)
+{
+    uint64_t *inflight = &cache->cnt[SHARDCACHE_COUNTER_PREFETCH_INFLIGHT].value;
+    for (;;) {
+        if (ATOMIC_INCREASE(*inflight, 1) > ATOMIC_READ(cache->prefetch_max_inflight)) {
+            ATOMIC_DECREMENT(*inflight);
+            break;
+        }
+
+        shardcache_key_t *k = queue_pop_left(cache->prefetch_queue);
+        if (!k) {
+            ATOMIC_DECREMENT(*inflight);
+            break;
+        }
+
+        ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_PREFETCHES].value);
+
+        // if the fetch is still in progress the slot
+        // will be released by shardcache_prefetch_listener()
+        if (shardcache_prefetch_key(cache, k) != 1)
+            ATOMIC_DECREMENT(*inflight);
+
+        free(k);
+    }
+}
+
+int
+shardcache_prefetch(shardcache_t *cache, void **keys, size_t *klens, int num_keys)
 {
-    shardcache_evictor_job_t *job = create_evictor_job(key, klen);
+    if (!keys || !klens || num_keys < 0)
+        return -1;
+
+    int queued = 0;
+    int i;
+    for (i = 0; i < num_keys; i++) {
+        if (!keys[i] || !klens[i])
+            continue;
+
+        if (queue_count(cache->prefetch_queue) >= SHARDCACHE_PREFETCH_QUEUE_MAX ||
+            ATOMIC_READ(cache->mem_pressure))
+        {
+            ATOMIC_INCREASE(cache->cnt[SHARDCACHE_COUNTER_PREFETCH_DROPS].value, num_keys - i);
+            break;
+        }
+
+        // the key is stored right after the descriptor
+        shardcache_key_t *k = malloc(sizeof(shardcache_key_t) + klens[i]);
+        k->key = (char *)k + sizeof(shardcache_key_t);
+        k->klen = klens[i];
+        memcpy(k->key, keys[i], klens[i]);
+        k->hash = arc_hash_key(k->key, k->klen);
+
+        if (queue_push_right(cache->prefetch_queue, k) != 0) {
+            ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_PREFETCH_DROPS].value);
+            free(k);
+            continue;
+        }
+        queued++;
+    }
+
+    return queued;
+}
+
+static void
+shardcache_queue_evictor_job(shardcache_t *cache, void *key, size_t klen, int prefix)
+{
+    shardcache_evictor_job_t *job = create_evictor_job(key, klen, prefix);
 
     char keystr[1024];
     KEY2STR(key, klen, keystr, sizeof(keystr));
-    SHC_DEBUG2("Adding evictor job for key %s", keystr);
+    SHC_DEBUG2("Adding evictor job for %s %s", prefix ? "prefix" : "key", keystr);
 
-    int rc = ht_set_if_not_exists(cache->evictor_jobs, key, klen, job, sizeof(shardcache_evictor_job_t));
+    // jobs are indexed by their type followed by the key, so that evicting
+    // a key and invalidating the same prefix don't collapse into one job
+    char *job_id = malloc(klen + 1);
+    job_id[0] = prefix ? 1 : 0;
+    memcpy(job_id + 1, key, klen);
+    int rc = ht_set_if_not_exists(cache->evictor_jobs, job_id, klen + 1, job, sizeof(shardcache_evictor_job_t));
+    free(job_id);
 
     if (rc != 0) {
         destroy_evictor_job(job);
@@ -1467,6 +2707,12 @@ shardcache_commence_eviction(shardcache_t *cache, void *key, size_t klen)
     MUTEX_UNLOCK(&cache->evictor_lock);
 }
 
+static inline void
+shardcache_commence_eviction(shardcache_t *cache, void *key, size_t klen)
+{
+    shardcache_queue_evictor_job(cache, key, klen, 0);
+}
+
 static inline int
 shardcache_queue_expiration_job(shardcache_t *cache, void *key, size_t klen, int expire, int is_volatile, int cmd)
 {
@@ -1476,10 +2722,12 @@ shardcache_queue_expiration_job(shardcache_t *cache, void *key, size_t klen, int
     job->key = malloc(klen);
     job->klen = klen;
     memcpy(job->key, key, klen);
+    job->hash = arc_hash_key(key, klen);
     job->expire = expire;
     job->is_volatile = is_volatile;
 
-    int rc = queue_push_right(cache->expirer_queue, job);
+    shardcache_partition_t *part = shardcache_partition(cache, job->hash);
+    int rc = queue_push_right(part->expirer_queue, job);
     if (rc != 0) {
         free(job->key);
         free(job);
@@ -1515,14 +2763,16 @@ shardcache_store(shardcache_t *cache,
                  int replica)
 
 {
+    uint64_t hash = arc_hash_key(key, klen);
+    shardcache_partition_t *part = shardcache_partition(cache, hash);
     void *prev_ptr = NULL;
     if (inx) {
-        if (ht_exists(cache->volatile_storage, key, klen) == 1)
+        if (ht_exists(part->volatile_storage, key, klen) == 1)
             return 1;
     } else {
         // remove this key from the volatile storage (if present)
         // it's going to be eventually persistent now (depending on the storage type)
-        ht_delete(cache->volatile_storage, key, klen, prev_ptr, NULL);
+        ht_delete(part->volatile_storage, key, klen, prev_ptr, NULL);
     }
 
     if (prev_ptr) {
@@ -1531,18 +2781,31 @@ shardcache_store(shardcache_t *cache,
         destroy_volatile(prev);
     }
 
-    if (inx && cache->storage.exist &&
-            cache->storage.exist(key, klen, cache->storage.priv) == 1)
-    {
-        return 1;
+    if (inx && cache->storage.exist && shardcache_storage_maybe_has(cache, hash)) {
+        if (cache->storage.exist(key, klen, cache->storage.priv) == 1)
+            return 1;
+        if (cache->keyfilter)
+            keyfilter_false_positive(cache->keyfilter);
     }
 
+    // add the key to the filter before storing it, a lookup running
+    // in the meanwhile can only see a false positive this way
+    if (cache->keyfilter)
+        keyfilter_add(cache->keyfilter, hash);
+
     int rc = cache->storage.store(key, klen, value, vlen, cache->storage.priv);
 
-    if (cache->cache_on_set)
-        arc_load(cache->arc, (const void *)key, klen, value, vlen);
+    if (cache->keyfilter)
+        keyfilter_commit(cache->keyfilter, hash);
+
+    shardcache_l2_remove(cache, key, klen, hash);
+
+    shardcache_namespace_t *ns = shardcache_namespace(cache, key, klen);
+    arc_t *arc = shardcache_partition_arc(part, ns);
+    if (SHARDCACHE_NS_OPTION(cache, ns, cache_on_set))
+        arc_load(arc, (const void *)key, klen, hash, value, vlen);
     else
-        arc_remove(cache->arc, (const void *)key, klen);
+        arc_remove(arc, (const void *)key, klen, hash);
 
     if (!replica)
         shardcache_commence_eviction(cache, key, klen);
@@ -1550,6 +2813,15 @@ shardcache_store(shardcache_t *cache,
     return rc;
 }
 
+// the hot items received for a key changed while the warm-up is running
+// are stale, they must not be loaded (see shardcache_warmup_load())
+static inline void
+shardcache_warmup_invalidate(shardcache_t *cache, void *key, size_t klen)
+{
+    if (UNLIKELY(ATOMIC_READ(cache->warmup_running)))
+        ht_set(cache->warmup_invalidated, key, klen, NULL, 0);
+}
+
 int
 shardcache_set_internal(shardcache_t *cache,
                         void *key,
@@ -1573,32 +2845,46 @@ shardcache_set_internal(shardcache_t *cache,
 
     char keystr[1024];
     KEY2STR(key, klen, keystr, sizeof(keystr));
-    ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_SETS].value);
+    shardcache_namespace_t *ns = shardcache_namespace(cache, key, klen);
+    SHARDCACHE_NS_COUNTER_INCREMENT(cache, ns, SHARDCACHE_COUNTER_SETS);
 
-    char node_name[1024];
-    size_t node_len = sizeof(node_name);
-    memset(node_name, 0, node_len);
-    
     // first check if we are the owner for this key
-    int is_mine = shardcache_test_migration_ownership(cache, key, klen, node_name, &node_len);
-    if (is_mine == -1)
-        is_mine = shardcache_test_ownership(cache, key, klen, node_name, &node_len);
+    shardcache_node_t *owner = NULL;
+    int is_mine = shardcache_key_owner(cache, key, klen, &owner);
 
     if (is_mine == 1)
     {
+        shardcache_warmup_invalidate(cache, key, klen);
+
         SHC_DEBUG2("Storing value %s (%d) for key %s",
                    shardcache_hex_escape(value, vlen, DEBUG_DUMP_MAXSIZE, 0),
                    (int)vlen, keystr);
 
         if (!cache->use_persistent_storage || expire)
         {
+            uint64_t hash = arc_hash_key(key, klen);
+            shardcache_partition_t *part = shardcache_partition(cache, hash);
             volatile_object_t *prev = NULL;
+
+            // once the memory limit has been reached only
+            // the existing volatile items can be updated
+            if (ATOMIC_READ(cache->mem_pressure) && !ht_exists(part->volatile_storage, key, klen)) {
+                SHC_DEBUG("Memory limit reached, refusing the new volatile key %s", keystr);
+                ATOMIC_INCREMENT(cache->mem_rejected);
+                if (cb)
+                    cb(key, klen, -1, priv);
+                return -1;
+            }
+
             // ensure removing this key from the persistent storage (if present)
             // since it's now going to be a volatile item
-            if (cache->use_persistent_storage && cache->storage.remove)
+            if (cache->use_persistent_storage && cache->storage.remove) {
                 cache->storage.remove(key, klen, cache->storage.priv);
+                if (cache->keyfilter)
+                    keyfilter_remove(cache->keyfilter, hash);
+            }
 
-            if (inx && ht_exists(cache->volatile_storage, key, klen)) {
+            if (inx && ht_exists(part->volatile_storage, key, klen)) {
                 SHC_DEBUG("A volatile value already exists for key %s", keystr);
                 if (cb)
                     cb(key, klen, 1, priv);
@@ -1618,10 +2904,10 @@ shardcache_set_internal(shardcache_t *cache,
 
             void *prev_ptr = NULL;
             if (inx) {
-                rc = ht_set(cache->volatile_storage, key, klen,
+                rc = ht_set(part->volatile_storage, key, klen,
                              obj, sizeof(volatile_object_t));
             } else {
-                rc = ht_get_and_set(cache->volatile_storage, key, klen,
+                rc = ht_get_and_set(part->volatile_storage, key, klen,
                                      obj, sizeof(volatile_object_t),
                                      &prev_ptr, NULL);
             }
@@ -1636,10 +2922,12 @@ shardcache_set_internal(shardcache_t *cache,
                                     prev->dlen - vlen);
                 }
                 destroy_volatile(prev); 
-                if (cache->cache_on_set)
-                    arc_load(cache->arc, (const void *)key, klen, value, vlen);
+                shardcache_l2_remove(cache, key, klen, hash);
+                arc_t *arc = shardcache_partition_arc(part, ns);
+                if (SHARDCACHE_NS_OPTION(cache, ns, cache_on_set))
+                    arc_load(arc, (const void *)key, klen, hash, value, vlen);
                 else
-                    arc_remove(cache->arc, (const void *)key, klen);
+                    arc_remove(arc, (const void *)key, klen, hash);
 
                 if (!replica)
                     shardcache_commence_eviction(cache, key, klen);
@@ -1656,15 +2944,11 @@ shardcache_set_internal(shardcache_t *cache,
             rc = shardcache_store(cache, key, klen, value, vlen, inx, replica);
         }
     }
-    else if (node_len)
+    else
     {
-        SHC_DEBUG2("Forwarding set command %s => %s (%d) to %s",
-                keystr, shardcache_hex_escape(value, vlen, DEBUG_DUMP_MAXSIZE, 0),
-                (int)vlen, node_name);
-
-        shardcache_node_t *peer = shardcache_node_select(cache, (char *)node_name);
+        shardcache_node_t *peer = owner;
         if (!peer) {
-            SHC_ERROR("Can't find address for node %s", peer);
+            SHC_ERROR("Can't find the node owning key %s", keystr);
             if (cache->use_persistent_storage && cache->storage.global)
                 rc = shardcache_store(cache, key, klen, value, vlen, inx, replica);
             
@@ -1673,13 +2957,31 @@ shardcache_set_internal(shardcache_t *cache,
 
             return rc;
         }
+        SHC_DEBUG2("Forwarding set command %s => %s (%d) to %s",
+                keystr, shardcache_hex_escape(value, vlen, DEBUG_DUMP_MAXSIZE, 0),
+                (int)vlen, shardcache_node_get_label(peer));
+
         char *addr = shardcache_node_get_address(peer);
 
-        int fd = shardcache_get_connection_for_peer(cache, addr);
+        // the async writes are batched (and coalesced) on a pipeline towards
+        // the owner, unless the global storage needs to take over on failures
+        write_pipeline_t *wp = NULL;
+        if (cb && !(cache->use_persistent_storage && cache->storage.global))
+            wp = shardcache_get_write_pipeline(cache, addr, 1);
+        if (!wp)
+            shardcache_drain_write_pipeline(cache, addr);
 
-        if (inx) {
+        int fd = wp ? -1 : shardcache_get_connection_for_peer(cache, addr);
+
+        if (wp) {
+            rc = write_pipeline_push(wp, inx ? SHC_HDR_ADD : SHC_HDR_SET,
+                                     key, klen, value, vlen, expire, cb, priv);
+            write_pipeline_release(wp);
+            if (rc == 0)
+                async = 1;
+        } else if (inx) {
             if (cb) {
-                rc = add_to_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, value, vlen, expire, fd, 0);
+                rc = add_to_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, value, vlen, expire, shardcache_request_trace, fd, 0);
                 if (rc == 0) {
                     shardcache_async_command_helper_arg_t *arg = calloc(1, sizeof(shardcache_async_command_helper_arg_t));
                     arg->key = malloc(klen);
@@ -1705,7 +3007,7 @@ shardcache_set_internal(shardcache_t *cache,
                         rc = shardcache_store(cache, key, klen, value, vlen, inx, replica);
                 }
             } else {
-                rc = add_to_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, value, vlen, expire, fd, 1);
+                rc = add_to_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, value, vlen, expire, shardcache_request_trace, fd, 1);
                 if (rc == 0) {
                     shardcache_release_connection_for_peer(cache, addr, fd);
                 } else {
@@ -1715,7 +3017,7 @@ shardcache_set_internal(shardcache_t *cache,
                 }
             }
         } else if (cb) {
-            rc = send_to_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, value, vlen, expire, fd, 0);
+            rc = send_to_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, value, vlen, expire, shardcache_request_trace, fd, 0);
             if (rc == 0) {
                 shardcache_async_command_helper_arg_t *arg = calloc(1, sizeof(shardcache_async_command_helper_arg_t));
                 arg->key = malloc(klen);
@@ -1740,7 +3042,7 @@ shardcache_set_internal(shardcache_t *cache,
                 rc = shardcache_store(cache, key, klen, value, vlen, inx, replica);
             }
         } else {
-            rc = send_to_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, value, vlen, expire, fd, 1);
+            rc = send_to_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, value, vlen, expire, shardcache_request_trace, fd, 1);
             if (rc == 0) {
                 shardcache_release_connection_for_peer(cache, addr, fd);
             } else {
@@ -1751,10 +3053,13 @@ shardcache_set_internal(shardcache_t *cache,
         }
 
         if (rc == 0) {
-            if (cache->cache_on_set)
-                arc_load(cache->arc, (const void *)key, klen, value, vlen);
+            uint64_t hash = arc_hash_key(key, klen);
+            arc_t *arc = shardcache_arc(cache, ns, hash);
+            shardcache_l2_remove(cache, key, klen, hash);
+            if (SHARDCACHE_NS_OPTION(cache, ns, cache_on_set))
+                arc_load(arc, (const void *)key, klen, hash, value, vlen);
             else
-                arc_remove(cache->arc, (const void *)key, klen);
+                arc_remove(arc, (const void *)key, klen, hash);
         }
 
     }
@@ -1875,26 +3180,28 @@ shardcache_del_internal(shardcache_t *cache,
         return rc;
     }
 
-    ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_DELS].value);
+    shardcache_namespace_t *ns = shardcache_namespace(cache, key, klen);
+    SHARDCACHE_NS_COUNTER_INCREMENT(cache, ns, SHARDCACHE_COUNTER_DELS);
 
     // if we are not the owner try propagating the command to the responsible peer
-    char node_name[1024];
-    size_t node_len = sizeof(node_name);
-    memset(node_name, 0, node_len);
-
-    int is_mine = shardcache_test_migration_ownership(cache, key, klen, node_name, &node_len);
-    if (is_mine == -1)
-        is_mine = shardcache_test_ownership(cache, key, klen, node_name, &node_len);
+    shardcache_node_t *owner = NULL;
+    int is_mine = shardcache_key_owner(cache, key, klen, &owner);
 
     if (is_mine == 1)
     {
+        shardcache_warmup_invalidate(cache, key, klen);
+
+        uint64_t hash = arc_hash_key(key, klen);
+        shardcache_partition_t *part = shardcache_partition(cache, hash);
         void *prev_ptr;
-        rc = ht_delete(cache->volatile_storage, key, klen, &prev_ptr, NULL);
+        rc = ht_delete(part->volatile_storage, key, klen, &prev_ptr, NULL);
 
         if (rc != 0) {
             if (cache->use_persistent_storage) {
                 if (cache->storage.remove) {
                     rc = cache->storage.remove(key, klen, cache->storage.priv);
+                    if (rc == 0 && cache->keyfilter)
+                        keyfilter_remove(cache->keyfilter, hash);
                 } else {
                     // if there is a readonly persistent storage
                     // we want to return a 'success' return code,
@@ -1914,7 +3221,8 @@ shardcache_del_internal(shardcache_t *cache,
 
         if (ATOMIC_READ(cache->evict_on_delete))
         {
-            arc_remove(cache->arc, (const void *)key, klen);
+            shardcache_l2_remove(cache, key, klen, hash);
+            arc_remove(shardcache_partition_arc(part, ns), (const void *)key, klen, hash);
 
             if (!replica)
                 shardcache_commence_eviction(cache, key, klen);
@@ -1924,18 +3232,26 @@ shardcache_del_internal(shardcache_t *cache,
             cb(key, klen, rc, priv);
 
     } else if (!replica) {
-        shardcache_node_t *peer = shardcache_node_select(cache, (char *)node_name);
+        shardcache_node_t *peer = owner;
         if (!peer) {
-            SHC_ERROR("Can't find address for node %s", peer);
+            SHC_ERROR("Can't find the node owning the key %.*s", (int)klen, (char *)key);
             if (cb)
                 cb(key, klen, -1, priv);
             return -1;
         }
         char *addr = shardcache_node_get_address(peer);
-        int fd = shardcache_get_connection_for_peer(cache, addr);
+        write_pipeline_t *wp = cb ? shardcache_get_write_pipeline(cache, addr, 1) : NULL;
+        if (!wp)
+            shardcache_drain_write_pipeline(cache, addr);
+        int fd = wp ? -1 : shardcache_get_connection_for_peer(cache, addr);
         int rc = -1;
-        if (cb) {
-            rc = delete_from_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, fd, 0);
+        if (wp) {
+            rc = write_pipeline_push(wp, SHC_HDR_DELETE, key, klen, NULL, 0, 0, cb, priv);
+            write_pipeline_release(wp);
+            if (rc != 0)
+                cb(key, klen, -1, priv);
+        } else if (cb) {
+            rc = delete_from_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, shardcache_request_trace, fd, 0);
             if (rc == 0) {
                 shardcache_async_command_helper_arg_t *arg = calloc(1, sizeof(shardcache_async_command_helper_arg_t));
                 arg->key = malloc(klen);
@@ -1960,7 +3276,7 @@ shardcache_del_internal(shardcache_t *cache,
                 cb(key, klen, -1, priv);
             }
         } else {
-            rc = delete_from_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, fd, 1);
+            rc = delete_from_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, shardcache_request_trace, fd, 1);
             if (rc == 0)
                 shardcache_release_connection_for_peer(cache, addr, fd);
             else
@@ -2012,23 +3328,104 @@ shardcache_evict(shardcache_t *cache, void *key, size_t klen)
     if (cache->replica)
         return shardcache_replica_dispatch(cache->replica, SHARDCACHE_REPLICA_OP_EVICT, key, klen, NULL, 0, 0);
 
-    arc_remove(cache->arc, (const void *)key, klen);
+    shardcache_warmup_invalidate(cache, key, klen);
+
+    uint64_t hash = arc_hash_key(key, klen);
+    shardcache_l2_remove(cache, key, klen, hash);
+    arc_remove(shardcache_arc(cache, shardcache_namespace(cache, key, klen), hash), (const void *)key, klen, hash);
 
     return 0;
 }
 
+typedef struct {
+    shardcache_t *cache;
+    void *prefix;
+    size_t plen;
+    int count;
+} shardcache_invalidate_arg_t;
+
+static int
+shardcache_invalidate_volatile(hashtable_t *table, void *key, size_t klen, void *value, size_t vlen, void *user)
+{
+    shardcache_invalidate_arg_t *arg = (shardcache_invalidate_arg_t *)user;
+    if (klen < arg->plen || memcmp(key, arg->prefix, arg->plen) != 0)
+        return 1;
+
+    volatile_object_t *v = (volatile_object_t *)value;
+    ATOMIC_DECREASE(arg->cache->cnt[SHARDCACHE_COUNTER_TABLE_SIZE].value, v->dlen);
+    shardcache_unschedule_expiration(arg->cache, key, klen, 1);
+    arg->count++;
+
+    // remove the item (released by the free callback of the table)
+    return -1;
+}
+
+int
+shardcache_invalidate_internal(shardcache_t *cache, void *prefix, size_t plen, int broadcast)
+{
+    if (!prefix || !plen)
+        return -1;
+
+    char keystr[1024];
+    KEY2STR(prefix, plen, keystr, sizeof(keystr));
+    SHC_DEBUG("Invalidating prefix %s", keystr);
+
+    shardcache_invalidate_arg_t arg = {
+        .cache = cache,
+        .prefix = prefix,
+        .plen = plen,
+        .count = 0
+    };
+
+    // recorded before removing anything, a hot item loaded past
+    // this point is checked again (see shardcache_warmup_load())
+    if (UNLIKELY(ATOMIC_READ(cache->warmup_running)))
+        ht_set(cache->warmup_invalidated_prefixes, prefix, plen, NULL, 0);
+
+    l2cache_t *l2 = ATOMIC_READ(cache->l2);
+    if (l2)
+        l2cache_remove_prefix(l2, prefix, plen);
+
+    int i, n;
+    for (i = 0; i < cache->num_partitions; i++) {
+        shardcache_partition_t *part = &cache->partitions[i];
+        ht_foreach_pair(part->volatile_storage, shardcache_invalidate_volatile, &arg);
+        arg.count += arc_remove_prefix(part->arc, prefix, plen);
+        for (n = 0; n < SHARDCACHE_NAMESPACES_MAX; n++) {
+            shardcache_namespace_t *ns = ATOMIC_READ(cache->namespaces[n]);
+            if (!ns)
+                break;
+            arg.count += arc_remove_prefix(ns->arcs[i], prefix, plen);
+        }
+    }
+
+    ATOMIC_INCREASE(cache->cnt[SHARDCACHE_COUNTER_INVALIDATED_ITEMS].value, arg.count);
+    ATOMIC_SET(cache->cnt[SHARDCACHE_COUNTER_CACHED_ITEMS].value, shardcache_cached_items(cache));
+
+    if (broadcast && cache->evictor_jobs)
+        shardcache_queue_evictor_job(cache, prefix, plen, 1);
+
+    return arg.count;
+}
+
+int
+shardcache_invalidate(shardcache_t *cache, void *prefix, size_t plen)
+{
+    return shardcache_invalidate_internal(cache, prefix, plen, 1);
+}
+
 shardcache_node_t **
 shardcache_get_nodes(shardcache_t *cache, int *num_nodes)
 {
     int i;
     int num = 0;
     SPIN_LOCK(&cache->migration_lock);
-    num = cache->num_shards;
+    num = cache->continuum->num_nodes;
     if (num_nodes)
         *num_nodes = num;
     shardcache_node_t **list = malloc(sizeof(shardcache_node_t *) * num);
     for (i = 0; i < num; i++) {
-        shardcache_node_t *orig = cache->shards[i];
+        shardcache_node_t *orig = cache->continuum->nodes[i];
         char *label = shardcache_node_get_label(orig);
         int num_replicas = shardcache_node_num_addresses(orig);
         char *addresses[num_replicas];
@@ -2085,6 +3482,78 @@ shardcache_get_index(shardcache_t *cache)
     return index;
 }
 
+static size_t
+shardcache_index_filter(shardcache_storage_index_item_t *items,
+                        size_t count,
+                        uint64_t hash_min,
+                        uint64_t hash_max)
+{
+    if (hash_min == 0 && hash_max == UINT64_MAX)
+        return count;
+
+    size_t i, kept = 0;
+    for (i = 0; i < count; i++) {
+        uint64_t hash = arc_hash_key(items[i].key, items[i].klen);
+        if (hash < hash_min || hash > hash_max) {
+            free(items[i].key);
+            continue;
+        }
+        if (kept != i)
+            items[kept] = items[i];
+        kept++;
+    }
+    return kept;
+}
+
+shardcache_storage_index_t *
+shardcache_get_index_page(shardcache_t *cache,
+                          uint64_t *cursor,
+                          size_t max_items,
+                          uint64_t hash_min,
+                          uint64_t hash_max)
+{
+    if (!cache->use_persistent_storage || !max_items) {
+        *cursor = 0;
+        return NULL;
+    }
+
+    if (!cache->storage.index_page) {
+        // the storage can only return the full index, faking pages on
+        // top of it would fetch it again for each page: it's returned
+        // as a single page (the last one)
+        shardcache_storage_index_t *full = NULL;
+        if (*cursor == 0)
+            full = shardcache_get_index(cache);
+        if (!full) {
+            full = calloc(1, sizeof(shardcache_storage_index_t));
+        } else {
+            full->size = shardcache_index_filter(full->items, full->size,
+                                                 hash_min, hash_max);
+        }
+        *cursor = 0;
+        return full;
+    }
+
+    shardcache_storage_index_t *index = calloc(1, sizeof(shardcache_storage_index_t));
+    index->items = calloc(sizeof(shardcache_storage_index_item_t), max_items);
+
+    // if the hash range filters out most of the keys keep fetching
+    // pages from the storage, but don't let a single request scan
+    // the whole index
+    int rounds = 0;
+    do {
+        size_t count = cache->storage.index_page(&index->items[index->size],
+                                                 max_items - index->size,
+                                                 cursor,
+                                                 cache->storage.priv);
+        index->size += shardcache_index_filter(&index->items[index->size],
+                                               count, hash_min, hash_max);
+    } while (*cursor && index->size < max_items &&
+             ++rounds < SHARDCACHE_INDEX_PAGE_ROUNDS_MAX);
+
+    return index;
+}
+
 void
 shardcache_free_index(shardcache_storage_index_t *index)
 {
@@ -2105,10 +3574,7 @@ expire_migrated(hashtable_t *table, void *key, size_t klen, void *value, size_t
     shardcache_t *cache = (shardcache_t *)user;
     volatile_object_t *v = (volatile_object_t *)value;
 
-    char node_name[1024];
-    size_t node_len = sizeof(node_name);
-    memset(node_name, 0, node_len);
-    int is_mine = shardcache_test_migration_ownership(cache, key, klen, node_name, &node_len);
+    int is_mine = shardcache_owner_lookup(cache, key, klen, 1, NULL);
     if (is_mine == -1) {
         SHC_WARNING("expire_migrated running while no migration continuum present ... aborting");
         return 0;
@@ -2154,16 +3620,13 @@ migrate(void *priv)
             size_t klen = index->items[i].klen;
             void *key = index->items[i].key;
 
-            char node_name[1024];
-            size_t node_len = sizeof(node_name);
-            memset(node_name, 0, node_len);
-
             char keystr[1024];
             KEY2STR(key, klen, keystr, sizeof(keystr));
 
             SHC_DEBUG("Migrator processign key %s", keystr);
 
-            int is_mine = shardcache_test_migration_ownership(cache, key, klen, node_name, &node_len);
+            shardcache_node_t *owner = NULL;
+            int is_mine = shardcache_owner_lookup(cache, key, klen, 1, &owner);
 
             int rc = 0;
             
@@ -2186,23 +3649,24 @@ migrate(void *priv)
                     }
                 }
                 if (value) {
-                    shardcache_node_t *peer = shardcache_node_select(cache, (char *)node_name);
+                    shardcache_node_t *peer = owner;
                     if (peer) {
+                        char *label = shardcache_node_get_label(peer);
                         char *addr = shardcache_node_get_address(peer);
-                        SHC_DEBUG("Migrator copying %s to peer %s (%s)", keystr, node_name, addr);
+                        SHC_DEBUG("Migrator copying %s to peer %s (%s)", keystr, label, addr);
                         int fd = shardcache_get_connection_for_peer(cache, addr);
-                        rc = send_to_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, value, vlen, 0, fd, 1);
+                        rc = send_to_peer(addr, (char *)cache->auth, SHC_HDR_SIGNATURE_SIP, key, klen, value, vlen, 0, NULL, fd, 1);
                         if (rc == 0) {
                             shardcache_release_connection_for_peer(cache, addr, fd);
                             ATOMIC_INCREMENT(migrated_items);
                             list_push_value(to_delete, &index->items[i]);
                         } else {
                             close(fd);
-                            SHC_WARNING("Errors copying %s to peer %s (%s)", keystr, node_name, addr);
+                            SHC_WARNING("Errors copying %s to peer %s (%s)", keystr, label, addr);
                             ATOMIC_INCREMENT(errors);
                         }
                     } else {
-                        SHC_ERROR("Can't find address for peer %s (me : %s)", node_name, cache->me);
+                        SHC_ERROR("Can't find the peer owning %s (me : %s)", keystr, cache->me);
                         ATOMIC_INCREMENT(errors);
                     }
                 }
@@ -2220,8 +3684,11 @@ migrate(void *priv)
             SHC_INFO("Migration completed, now removing not-owned  items");
         shardcache_storage_index_item_t *item = list_shift_value(to_delete);
         while (item) {
-            if (cache->storage.remove)
+            if (cache->storage.remove) {
                 cache->storage.remove(item->key, item->klen, cache->storage.priv);
+                if (cache->keyfilter)
+                    keyfilter_remove(cache->keyfilter, arc_hash_key(item->key, item->klen));
+            }
 
             char ikeystr[1024];
             KEY2STR(item->key, item->klen, ikeystr, sizeof(ikeystr));
@@ -2231,7 +3698,9 @@ migrate(void *priv)
         }
 
         // and now let's expire all the volatile keys that don't belong to us anymore
-        ht_foreach_pair(cache->volatile_storage, expire_migrated, cache);
+        int n;
+        for (n = 0; n < cache->num_partitions; n++)
+            ht_foreach_pair(cache->partitions[n].volatile_storage, expire_migrated, cache);
         //ATOMIC_SET(cache->next_expire, 0);
     }
 
@@ -2252,6 +3721,449 @@ migrate(void *priv)
     return NULL;
 }
 
+typedef struct {
+    shardcache_t *cache;
+    shardcache_node_t *new_owner; // the requester in the migration continuum
+    shardcache_node_t *old_owner; // the requester in the current continuum (if any)
+    int max_items;
+    int count;
+    fbuf_t *out;
+} shardcache_hot_set_arg_t;
+
+static int
+shardcache_hot_set_collect(const void *key, size_t klen, uint64_t hash, arc_resource_t res, void *priv)
+{
+    shardcache_hot_set_arg_t *arg = (shardcache_hot_set_arg_t *)priv;
+    shardcache_t *cache = arg->cache;
+
+    if (arg->count >= arg->max_items || fbuf_used(arg->out) >= SHARDCACHE_WARMUP_MAX_BYTES)
+        return -1;
+
+    // only the keys moving to the requester are interesting
+    shardcache_node_t *owner = NULL;
+    if (shardcache_owner_lookup(cache, (void *)key, klen, 1, &owner) == -1)
+        return -1;
+    if (owner != arg->new_owner)
+        return 0;
+    shardcache_owner_lookup(cache, (void *)key, klen, 0, &owner);
+    if (owner == arg->old_owner)
+        return 0;
+
+    cached_object_t *obj = (cached_object_t *)arc_get_resource_ptr(res);
+    MUTEX_LOCK(&obj->lock);
+    if (COBJ_CHECK_FLAGS(obj, COBJ_FLAG_COMPLETE) && obj->data && obj->dlen &&
+        !COBJ_CHECK_FLAGS(obj, COBJ_FLAG_DROP|COBJ_FLAG_EVICT|COBJ_FLAG_EVICTED))
+    {
+        uint32_t ksize = htonl(klen);
+        uint32_t vsize = htonl(obj->dlen);
+        fbuf_add_binary(arg->out, (char *)&ksize, sizeof(ksize));
+        fbuf_add_binary(arg->out, (char *)key, klen);
+        fbuf_add_binary(arg->out, (char *)&vsize, sizeof(vsize));
+        fbuf_add_binary(arg->out, obj->data, obj->dlen);
+        arg->count++;
+    }
+    MUTEX_UNLOCK(&obj->lock);
+    return 0;
+}
+
+int
+shardcache_get_hot_set(shardcache_t *cache,
+                       char *label,
+                       size_t label_len,
+                       int max_items,
+                       fbuf_t *out)
+{
+    shardcache_hot_set_arg_t arg = {
+        .cache = cache,
+        .max_items = max_items,
+        .out = out
+    };
+
+    shardcache_continuum_t *migration = ATOMIC_READ(cache->migration);
+    if (!migration)
+        return -1;
+    shardcache_continuum_t *continuum = ATOMIC_READ(cache->continuum);
+    int index = shardcache_continuum_node_index(migration, label, label_len);
+    if (index >= 0)
+        arg.new_owner = migration->nodes[index];
+    index = shardcache_continuum_node_index(continuum, label, label_len);
+    if (index >= 0)
+        arg.old_owner = continuum->nodes[index];
+
+    if (!arg.new_owner)
+        return -1;
+
+    // the hottest items of each partition are visited first
+    int i, n;
+    for (i = 0; i < cache->num_partitions && arg.count < max_items; i++)
+        arc_foreach_mfu(cache->partitions[i].arc, max_items, shardcache_hot_set_collect, &arg);
+
+    // then the ones of the namespaces
+    for (n = 0; n < SHARDCACHE_NAMESPACES_MAX && arg.count < max_items; n++) {
+        shardcache_namespace_t *ns = ATOMIC_READ(cache->namespaces[n]);
+        if (!ns)
+            break;
+        for (i = 0; i < cache->num_partitions && arg.count < max_items; i++)
+            arc_foreach_mfu(ns->arcs[i], max_items, shardcache_hot_set_collect, &arg);
+    }
+
+    return arg.count;
+}
+
+void
+shardcache_hotkeys_track(shardcache_t *cache,
+                         int tracker,
+                         void *key,
+                         size_t klen,
+                         uint64_t hash,
+                         uint64_t weight)
+{
+    static __thread uint32_t ticks[SHARDCACHE_HOTKEYS_NUM];
+
+    int rate = ATOMIC_READ(cache->hotkeys_sample_rate);
+    if (!rate)
+        return;
+
+    // the largest values are rare enough to be all checked
+    // (most of them are discarded by the tracker without locking)
+    if (tracker != SHARDCACHE_HOTKEYS_VALUES) {
+        if (++ticks[tracker] % rate)
+            return;
+        weight *= rate;
+    }
+
+    topk_add(cache->hotkeys[tracker], key, klen, hash, weight);
+}
+
+// the keys are binary, the bytes which are not printable
+// (and the separators) are escaped as \xNN
+static void
+shardcache_escape_key(fbuf_t *out, char *key, size_t klen)
+{
+    int i;
+    for (i = 0; i < klen; i++) {
+        unsigned char c = key[i];
+        if (c < 0x20 || c > 0x7e || c == ';' || c == '\\')
+            fbuf_printf(out, "\\x%02x", c);
+        else
+            fbuf_add_binary(out, (char *)&c, 1);
+    }
+}
+
+void
+shardcache_get_hotkeys(shardcache_t *cache, fbuf_t *out)
+{
+    const char *labels[SHARDCACHE_HOTKEYS_NUM] = SHARDCACHE_HOTKEYS_LABELS_ARRAY;
+    topk_item_t *items = malloc(sizeof(topk_item_t) * SHARDCACHE_HOTKEYS_REPORT);
+
+    fbuf_printf(out, "sample_rate;%d\r\n", ATOMIC_READ(cache->hotkeys_sample_rate));
+
+    // <tracker>.<rank>;<key>;<count>;<error>
+    int i, n;
+    for (i = 0; i < SHARDCACHE_HOTKEYS_NUM; i++) {
+        int count = topk_get(cache->hotkeys[i], items, SHARDCACHE_HOTKEYS_REPORT);
+        for (n = 0; n < count; n++) {
+            fbuf_printf(out, "%s.%d;", labels[i], n + 1);
+            shardcache_escape_key(out, items[n].key,
+                                      items[n].klen < TOPK_KEY_MAX ? items[n].klen : TOPK_KEY_MAX);
+            if (items[n].klen > TOPK_KEY_MAX)
+                fbuf_add(out, "...");
+            fbuf_printf(out, ";%llu;%llu\r\n",
+                        (unsigned long long)items[n].count,
+                        (unsigned long long)items[n].error);
+        }
+    }
+
+    free(items);
+}
+
+// the hdr and the source of the value as they appear in the slow log
+static void
+shardcache_slowlog_describe(slowlog_entry_t *entry, char *cmd, size_t cmdlen, char *source, size_t srclen)
+{
+    snprintf(cmd, cmdlen, "0x%02x", entry->hdr);
+    snprintf(source, srclen, "%s%s%s%s",
+             entry->source ? "" : "cache",
+             (entry->source & SLOWLOG_SOURCE_STORAGE) ? "storage" : "",
+             (entry->source & SLOWLOG_SOURCE_PEER)
+             ? ((entry->source & SLOWLOG_SOURCE_STORAGE) ? "+peer" : "peer") : "",
+             (entry->source & SLOWLOG_SOURCE_WAITED)
+             ? ((entry->source & (SLOWLOG_SOURCE_STORAGE|SLOWLOG_SOURCE_PEER)) ? "+waited" : "waited") : "");
+}
+
+void
+shardcache_slowlog_add(shardcache_t *cache, slowlog_entry_t *entry)
+{
+    slowlog_add(cache->slowlog, entry);
+
+    // the log gets only a sample of the slow requests
+    time_t now = time(NULL);
+    time_t last = ATOMIC_READ(cache->slowlog_last_logged);
+    if (now == last || !ATOMIC_CAS(cache->slowlog_last_logged, last, now))
+        return;
+
+    const char *labels[SLOWLOG_NUM_PHASES] = SLOWLOG_PHASE_LABELS_ARRAY;
+    fbuf_t phases = FBUF_STATIC_INITIALIZER;
+    fbuf_t key = FBUF_STATIC_INITIALIZER;
+    int i;
+    for (i = 0; i < SLOWLOG_NUM_PHASES; i++)
+        fbuf_printf(&phases, " %s=%llu", labels[i], (unsigned long long)entry->phases[i]);
+    shardcache_escape_key(&key, entry->key,
+                          entry->klen < SLOWLOG_KEY_MAX ? entry->klen : SLOWLOG_KEY_MAX);
+
+    char cmd[8], source[32], trace[64] = "";
+    shardcache_slowlog_describe(entry, cmd, sizeof(cmd), source, sizeof(source));
+    if (entry->trace_id || entry->linked_trace_id) {
+        int n = 0;
+        if (entry->trace_id)
+            n = snprintf(trace, sizeof(trace), ", trace: %016llx", (unsigned long long)entry->trace_id);
+        if (entry->linked_trace_id)
+            snprintf(trace + n, sizeof(trace) - n, ", link: %016llx", (unsigned long long)entry->linked_trace_id);
+    }
+    SHC_NOTICE("Slow request %s for key %s%s (hash: %016llx, source: %s%s%s%s): %llu usecs,%s",
+               cmd, fbuf_used(&key) ? fbuf_data(&key) : "",
+               entry->klen > SLOWLOG_KEY_MAX ? "..." : "",
+               (unsigned long long)entry->hash, source,
+               entry->peer[0] ? ", peer: " : "", entry->peer, trace,
+               (unsigned long long)entry->total, fbuf_data(&phases));
+
+    fbuf_destroy(&phases);
+    fbuf_destroy(&key);
+}
+
+// the entries of a ring, one per line, the most recent first
+static void
+shardcache_slowlog_write(slowlog_t *log, int size, fbuf_t *out)
+{
+    const char *labels[SLOWLOG_NUM_PHASES] = SLOWLOG_PHASE_LABELS_ARRAY;
+    slowlog_entry_t *entries = malloc(sizeof(slowlog_entry_t) * size);
+
+    // # received;cmd;hash;trace;link;key;source;peer;total;<phases>
+    fbuf_add(out, "# received;cmd;hash;trace;link;key;source;peer;total");
+    int i, n;
+    for (i = 0; i < SLOWLOG_NUM_PHASES; i++)
+        fbuf_printf(out, ";%s", labels[i]);
+    fbuf_add(out, " (usecs)\r\n");
+
+    int count = slowlog_get(log, entries, size);
+    for (n = 0; n < count; n++) {
+        slowlog_entry_t *entry = &entries[n];
+        char cmd[8], source[32];
+        shardcache_slowlog_describe(entry, cmd, sizeof(cmd), source, sizeof(source));
+        fbuf_printf(out, "%ld.%06ld;%s;%016llx;",
+                    (long)entry->received.tv_sec, (long)entry->received.tv_usec,
+                    cmd, (unsigned long long)entry->hash);
+        if (entry->trace_id)
+            fbuf_printf(out, "%016llx;", (unsigned long long)entry->trace_id);
+        else
+            fbuf_add(out, "-;");
+        if (entry->linked_trace_id)
+            fbuf_printf(out, "%016llx;", (unsigned long long)entry->linked_trace_id);
+        else
+            fbuf_add(out, "-;");
+        shardcache_escape_key(out, entry->key,
+                              entry->klen < SLOWLOG_KEY_MAX ? entry->klen : SLOWLOG_KEY_MAX);
+        if (entry->klen > SLOWLOG_KEY_MAX)
+            fbuf_add(out, "...");
+        fbuf_printf(out, ";%s;%s;%llu", source, entry->peer[0] ? entry->peer : "-",
+                    (unsigned long long)entry->total);
+        for (i = 0; i < SLOWLOG_NUM_PHASES; i++)
+            fbuf_printf(out, ";%llu", (unsigned long long)entry->phases[i]);
+        fbuf_add(out, "\r\n");
+    }
+
+    free(entries);
+}
+
+void
+shardcache_get_slowlog(shardcache_t *cache, fbuf_t *out)
+{
+    fbuf_printf(out, "threshold;%d\r\n", ATOMIC_READ(cache->slowlog_threshold));
+    fbuf_printf(out, "slow_requests;%llu\r\n", (unsigned long long)slowlog_count(cache->slowlog));
+    shardcache_slowlog_write(cache->slowlog, SHARDCACHE_SLOWLOG_SIZE, out);
+}
+
+void
+shardcache_trace_add(shardcache_t *cache, slowlog_entry_t *entry)
+{
+    slowlog_add(cache->traces, entry);
+}
+
+void
+shardcache_get_traces(shardcache_t *cache, fbuf_t *out)
+{
+    fbuf_printf(out, "traced_requests;%llu\r\n", (unsigned long long)slowlog_count(cache->traces));
+    shardcache_slowlog_write(cache->traces, SHARDCACHE_TRACES_SIZE, out);
+}
+
+typedef struct {
+    void *key;
+    size_t klen;
+    int match;
+} shardcache_warmup_prefix_arg_t;
+
+static int
+shardcache_warmup_prefix_match(hashtable_t *table, void *prefix, size_t plen, void *value, size_t vlen, void *user)
+{
+    shardcache_warmup_prefix_arg_t *arg = (shardcache_warmup_prefix_arg_t *)user;
+    if (plen <= arg->klen && memcmp(arg->key, prefix, plen) == 0) {
+        arg->match = 1;
+        return 0;
+    }
+    return 1;
+}
+
+// check if the key has been written, deleted, evicted or invalidated
+// (by prefix) since the warm-up started
+static int
+shardcache_warmup_invalidated(shardcache_t *cache, void *key, size_t klen)
+{
+    if (ht_exists(cache->warmup_invalidated, key, klen))
+        return 1;
+
+    if (!ht_count(cache->warmup_invalidated_prefixes))
+        return 0;
+
+    shardcache_warmup_prefix_arg_t arg = {
+        .key = key,
+        .klen = klen,
+        .match = 0
+    };
+    ht_foreach_pair(cache->warmup_invalidated_prefixes, shardcache_warmup_prefix_match, &arg);
+    return arg.match;
+}
+
+// load the items of a hot set (as returned by hot_set_from_peer())
+static void
+shardcache_warmup_load(shardcache_t *cache, fbuf_t *hot_set, struct timeval *start, uint64_t *loaded)
+{
+    char *data = fbuf_data(hot_set);
+    size_t len = fbuf_used(hot_set);
+    size_t ofx = 0;
+
+    while (ofx + sizeof(uint32_t) <= len && !ATOMIC_READ(cache->quit)) {
+        uint32_t ksize, vsize;
+        memcpy(&ksize, data + ofx, sizeof(uint32_t));
+        ksize = ntohl(ksize);
+        ofx += sizeof(uint32_t);
+        if (ofx + ksize + sizeof(uint32_t) > len)
+            break;
+        char *key = data + ofx;
+        ofx += ksize;
+        memcpy(&vsize, data + ofx, sizeof(uint32_t));
+        vsize = ntohl(vsize);
+        ofx += sizeof(uint32_t);
+        if (ofx + vsize > len)
+            break;
+        char *value = data + ofx;
+        ofx += vsize;
+
+        int is_mine = shardcache_owner_lookup(cache, key, ksize, 1, NULL);
+        if (is_mine == -1) // the migration is over (or has been aborted)
+            break;
+        if (!is_mine)
+            continue;
+
+        // the key has been written, deleted, evicted or invalidated
+        // since the peer collected its hot set
+        if (shardcache_warmup_invalidated(cache, key, ksize))
+            continue;
+
+        uint64_t hash = arc_hash_key(key, ksize);
+        arc_t *arc = shardcache_arc(cache, shardcache_namespace(cache, key, ksize), hash);
+        if (arc_load(arc, key, ksize, hash, value, vsize) >= 0) {
+            // the change might have got in while loading, it's either
+            // recorded by now or it's going to replace what we loaded
+            if (shardcache_warmup_invalidated(cache, key, ksize))
+                arc_remove(arc, key, ksize, hash);
+            else
+                ATOMIC_INCREMENT(cache->cnt[SHARDCACHE_COUNTER_WARMUP_LOADED].value);
+        }
+        (*loaded)++;
+
+        // don't go faster than warmup_rate items per second
+        int rate = ATOMIC_READ(cache->warmup_rate);
+        if (rate > 0) {
+            struct timeval now, diff;
+            gettimeofday(&now, NULL);
+            timersub(&now, start, &diff);
+            uint64_t elapsed = diff.tv_sec * 1000000 + diff.tv_usec;
+            uint64_t expected = (*loaded * 1000000) / rate;
+            if (expected > elapsed)
+                usleep(expected - elapsed);
+        }
+    }
+}
+
+static void *
+shardcache_warmup(void *priv)
+{
+    shardcache_t *cache = (shardcache_t *)priv;
+
+    // snapshot the peers (the nodes in the current continuum)
+    SPIN_LOCK(&cache->migration_lock);
+    int num_peers = 0;
+    shardcache_continuum_t *continuum = cache->continuum;
+    char **peers = malloc(sizeof(char *) * (continuum->num_nodes + 1));
+    int i;
+    for (i = 0; i < continuum->num_nodes; i++) {
+        if (i != continuum->me)
+            peers[num_peers++] = strdup(shardcache_node_get_address(continuum->nodes[i]));
+    }
+    SPIN_UNLOCK(&cache->migration_lock);
+
+    shardcache_thread_init(cache);
+
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    uint64_t loaded = 0;
+
+    for (i = 0; i < num_peers && !ATOMIC_READ(cache->quit); i++) {
+        fbuf_t hot_set = FBUF_STATIC_INITIALIZER_PARAMS(FBUF_MAXLEN_NONE, 64, 1024, 512);
+        // the peer might have not received the migration command yet
+        int retries = 3;
+        int rc = -1;
+        while (rc != 0 && retries-- && !ATOMIC_READ(cache->quit)) {
+            int fd = shardcache_get_connection_for_peer(cache, peers[i]);
+            rc = hot_set_from_peer(peers[i],
+                                   (char *)cache->auth,
+                                   SHC_HDR_SIGNATURE_SIP,
+                                   cache->me,
+                                   ATOMIC_READ(cache->warmup_max_items),
+                                   &hot_set,
+                                   fd);
+            if (rc == 0) {
+                shardcache_release_connection_for_peer(cache, peers[i], fd);
+            } else {
+                if (fd >= 0)
+                    close(fd);
+                sleep(1);
+            }
+        }
+
+        if (rc == 0) {
+            SHC_DEBUG("Loading the hot set received from peer %s (%d bytes)",
+                      peers[i], fbuf_used(&hot_set));
+            shardcache_warmup_load(cache, &hot_set, &start, &loaded);
+        } else {
+            SHC_WARNING("Can't get the hot set from peer %s", peers[i]);
+        }
+        fbuf_destroy(&hot_set);
+        free(peers[i]);
+    }
+
+    // release the remaining peers if we are leaving early
+    for (; i < num_peers; i++)
+        free(peers[i]);
+    free(peers);
+
+    SHC_NOTICE("Warm-up completed (%llu items received)", (unsigned long long)loaded);
+
+    shardcache_thread_end(cache);
+    ATOMIC_DECREMENT(cache->warmup_running);
+    return NULL;
+}
+
 static int
 shardcache_check_migration_continuum(shardcache_t *cache,
                                      shardcache_node_t **nodes,
@@ -2261,7 +4173,7 @@ shardcache_check_migration_continuum(shardcache_t *cache,
     int ignore = 0;
     int i,n;
 
-    if (num_nodes == cache->num_shards) {
+    if (num_nodes == cache->continuum->num_nodes) {
         // let's assume the lists are the same, if not
         // ignore will be set again to 0
         ignore = 1;
@@ -2269,7 +4181,7 @@ shardcache_check_migration_continuum(shardcache_t *cache,
             int found = 0;
             for (n = 0; n < num_nodes; n++) {
                 char *label1 = shardcache_node_get_label(nodes[i]);
-                char *label2 = shardcache_node_get_label(cache->shards[n]);
+                char *label2 = shardcache_node_get_label(cache->continuum->nodes[n]);
                 if (*label1 == *label2 && strcmp(label1, label2) == 0) {
                     found = 1;
                     break;
@@ -2291,40 +4203,36 @@ shardcache_set_migration_continuum(shardcache_t *cache,
                                    shardcache_node_t **nodes,
                                    int num_nodes)
 {
-    size_t shard_lens[num_nodes];
-    char *shard_names[num_nodes];
+    // the continuum is built before taking the lock, the lookups
+    // don't wait for it (they don't take the lock at all anyway)
+    shardcache_node_t **shards = malloc(sizeof(shardcache_node_t *) * num_nodes);
+    int i;
+    for (i = 0; i < num_nodes; i++) {
+        shardcache_node_t *node = nodes[i];
+        int num_replicas = shardcache_node_num_addresses(node);
+        char *addresses[num_replicas];
+        shardcache_node_get_all_addresses(node, addresses, num_replicas);
+        shards[i] = shardcache_node_create(shardcache_node_get_label(node), addresses, num_replicas);
+    }
+    shardcache_continuum_t *migration = shardcache_continuum_create(cache->me, shards, num_nodes);
 
     SPIN_LOCK(&cache->migration_lock);
 
     if (cache->migration) {
         // already in a migration, ignore this command
         SPIN_UNLOCK(&cache->migration_lock);
+        shardcache_continuum_destroy(migration);
         return -1;
     }
 
     if (shardcache_check_migration_continuum(cache, nodes, num_nodes) != 0) {
         SPIN_UNLOCK(&cache->migration_lock);
+        shardcache_continuum_destroy(migration);
         return -1;
     }
 
     cache->migration_done = 0;
-    cache->migration_shards = malloc(sizeof(shardcache_node_t *) * num_nodes);
-    cache->num_migration_shards = num_nodes;
-    int i;
-    for (i = 0; i < cache->num_migration_shards; i++) {
-        shardcache_node_t *node = nodes[i];
-        shard_names[i] = shardcache_node_get_label(node);
-        int num_replicas = shardcache_node_num_addresses(node);
-        char *addresses[num_replicas];
-        shardcache_node_get_all_addresses(node, addresses, num_replicas);
-        cache->migration_shards[i] = shardcache_node_create(shard_names[i], addresses, num_replicas);
-        shard_lens[i] = strlen(shard_names[i]);
-    }
-
-    cache->migration = chash_create((const char **)shard_names,
-                                    shard_lens,
-                                    num_nodes,
-                                    200);
+    ATOMIC_SET(cache->migration, migration);
 
     SPIN_UNLOCK(&cache->migration_lock);
     return 0;
@@ -2347,6 +4255,23 @@ shardcache_migration_begin_internal(shardcache_t *cache,
 
     pthread_create(&cache->migrate_th, NULL, migrate, cache);
 
+    // warm up the cache with the hot items we are going to own
+    // (the thread is detached, shardcache_destroy() waits for it)
+    if (ATOMIC_READ(cache->warmup_max_items) > 0) {
+        pthread_t warmup_th;
+        // the keys changed during a previous warm-up don't matter anymore
+        if (ATOMIC_INCREMENT(cache->warmup_running) == 1) {
+            ht_clear(cache->warmup_invalidated);
+            ht_clear(cache->warmup_invalidated_prefixes);
+        }
+        if (pthread_create(&warmup_th, NULL, shardcache_warmup, cache) == 0) {
+            pthread_detach(warmup_th);
+        } else {
+            SHC_ERROR("Can't create the warm-up thread: %s", strerror(errno));
+            ATOMIC_DECREMENT(cache->warmup_running);
+        }
+    }
+
     if (forward) {
         fbuf_t mgb_message = FBUF_STATIC_INITIALIZER;
 
@@ -2360,8 +4285,9 @@ shardcache_migration_begin_internal(shardcache_t *cache,
             fbuf_printf(&mgb_message, "%s:%s", label, addr);
         }
 
-        for (i = 0; i < cache->num_shards; i++) {
-            if (strcmp(shardcache_node_get_label(cache->shards[i]), cache->me) != 0) {
+        shardcache_continuum_t *continuum = cache->continuum;
+        for (i = 0; i < continuum->num_nodes; i++) {
+            if (i != continuum->me) {
                 int num_replicas = shardcache_node_num_addresses(nodes[i]);
                 char *label = shardcache_node_get_label(nodes[i]);
                 int rindex = random()%num_replicas;
@@ -2403,15 +4329,11 @@ shardcache_migration_abort_internal(shardcache_t *cache)
     int ret = -1;
     SPIN_LOCK(&cache->migration_lock);
     if (cache->migration) {
-        chash_free(cache->migration);
-        free(cache->migration_shards);
+        shardcache_continuum_retire(cache, cache->migration);
+        ATOMIC_SET(cache->migration, NULL);
         SHC_NOTICE("Migration aborted");
         ret = 0;
     }
-    cache->migration = NULL;
-    cache->migration_shards = NULL;
-    cache->num_migration_shards = 0;
-
     SPIN_UNLOCK(&cache->migration_lock);
     pthread_join(cache->migrate_th, NULL);
     return ret;
@@ -2431,14 +4353,10 @@ shardcache_migration_end_internal(shardcache_t *cache)
     int ret = -1;
     SPIN_LOCK(&cache->migration_lock);
     if (cache->migration) {
-        chash_free(cache->chash);
-        shardcache_free_nodes(cache->shards, cache->num_shards);
-        cache->chash = cache->migration;
-        cache->shards = cache->migration_shards;
-        cache->num_shards = cache->num_migration_shards;
-        cache->migration = NULL;
-        cache->migration_shards = NULL;
-        cache->num_migration_shards = 0;
+        // the lookups switch to the new continuum as soon as it's published
+        shardcache_continuum_retire(cache, cache->continuum);
+        ATOMIC_SET(cache->continuum, cache->migration);
+        ATOMIC_SET(cache->migration, NULL);
         SHC_NOTICE("Migration ended");
         ret = 0;
     }
@@ -2477,6 +4395,16 @@ shardcache_conn_expire_time(shardcache_t *cache, int new_value)
     return connections_pool_expire_time(cache->connections_pool, new_value);
 }
 
+int
+shardcache_conn_min_warm(shardcache_t *cache, int new_value)
+{
+    int old_value = connections_pool_min_warm(cache->connections_pool, new_value);
+    // let the keeper establish the new connections right away
+    if (new_value > old_value)
+        ATOMIC_SET(cache->pool_keeper_kick, 1);
+    return old_value;
+}
+
 static inline int
 shardcache_get_set_option(int *option, int new_value)
 {
@@ -2546,6 +4474,226 @@ shardcache_serving_look_ahead(shardcache_t *cache, int new_value)
     return shardcache_get_set_option(&cache->serving_look_ahead, new_value);
 }
 
+int
+shardcache_serving_look_ahead_min(shardcache_t *cache, int new_value)
+{
+    return shardcache_get_set_option(&cache->serving_look_ahead_min, new_value);
+}
+
+int
+shardcache_serving_latency_target(shardcache_t *cache, int new_value)
+{
+    return shardcache_get_set_option(&cache->serving_latency_target, new_value);
+}
+
+int
+shardcache_serving_quantum(shardcache_t *cache, int new_value)
+{
+    return shardcache_get_set_option(&cache->serving_quantum, new_value);
+}
+
+int
+shardcache_busy_poll(shardcache_t *cache, int new_value)
+{
+    if (new_value == 0)
+        new_value = SHARDCACHE_BUSY_POLL_DEFAULT;
+    return shardcache_get_set_option(&cache->busy_poll, new_value);
+}
+
+int
+shardcache_busy_poll_workers(shardcache_t *cache, int new_value)
+{
+    return shardcache_get_set_option(&cache->busy_poll_workers, new_value);
+}
+
+int
+shardcache_busy_poll_socket(shardcache_t *cache, int new_value)
+{
+    return shardcache_get_set_option(&cache->busy_poll_socket, new_value);
+}
+
+int
+shardcache_prefetch_max_inflight(shardcache_t *cache, int new_value)
+{
+    if (new_value == 0)
+        new_value = SHARDCACHE_PREFETCH_MAX_INFLIGHT_DEFAULT;
+    return shardcache_get_set_option(&cache->prefetch_max_inflight, new_value);
+}
+
+int
+shardcache_warmup_max_items(shardcache_t *cache, int new_value)
+{
+    return shardcache_get_set_option(&cache->warmup_max_items, new_value);
+}
+
+int
+shardcache_warmup_rate(shardcache_t *cache, int new_value)
+{
+    if (new_value == 0)
+        new_value = SHARDCACHE_WARMUP_RATE_DEFAULT;
+    return shardcache_get_set_option(&cache->warmup_rate, new_value);
+}
+
+int
+shardcache_write_pipeline_window(shardcache_t *cache, int new_value)
+{
+    int old_value = shardcache_get_set_option(&cache->write_pipeline_window, new_value);
+    if (new_value > 0) {
+        MUTEX_LOCK(&cache->write_pipelines_lock);
+        if (cache->write_pipelines)
+            ht_foreach_value(cache->write_pipelines, shardcache_write_pipeline_update_window, &new_value);
+        MUTEX_UNLOCK(&cache->write_pipelines_lock);
+    }
+    return old_value;
+}
+
+int
+shardcache_hotkeys_sample_rate(shardcache_t *cache, int new_value)
+{
+    return shardcache_get_set_option(&cache->hotkeys_sample_rate, new_value);
+}
+
+int
+shardcache_slowlog_threshold(shardcache_t *cache, int new_value)
+{
+    return shardcache_get_set_option(&cache->slowlog_threshold, new_value);
+}
+
+int
+shardcache_memory_limit(shardcache_t *cache, int new_value)
+{
+    // the governor applies the new limit within its next round
+    return shardcache_get_set_option(&cache->memory_limit, new_value);
+}
+
+int
+shardcache_storage_filter(shardcache_t *cache, int new_value)
+{
+    if (!cache->keyfilter)
+        return -1;
+    // the keeper builds the filter (if needed) within a second
+    return shardcache_get_set_option(&cache->storage_filter, new_value);
+}
+
+int
+shardcache_l2_enable(shardcache_t *cache, char *path, size_t size, size_t write_rate)
+{
+    if (ATOMIC_READ(cache->l2))
+        return -1;
+
+    l2cache_t *l2 = l2cache_create(path, size, write_rate ? write_rate : SHARDCACHE_L2_WRITE_RATE_DEFAULT);
+    if (!l2)
+        return -1;
+
+    if (!ATOMIC_CAS(cache->l2, NULL, l2)) {
+        l2cache_destroy(l2);
+        return -1;
+    }
+
+    shardcache_l2_counters(cache, 1);
+    return 0;
+}
+
+int
+shardcache_namespace_add(shardcache_t *cache,
+                         char *prefix,
+                         size_t size,
+                         int expire_time,
+                         int cache_on_set,
+                         int force_caching)
+{
+    if (!prefix || !*prefix || !size)
+        return -1;
+
+    shardcache_namespace_t *ns = calloc(1, sizeof(shardcache_namespace_t));
+    ns->prefix = strdup(prefix);
+    ns->plen = strlen(prefix);
+    ns->size = size;
+    ns->expire_time = expire_time;
+    ns->cache_on_set = cache_on_set;
+    ns->force_caching = force_caching;
+    ns->arcs = calloc(cache->num_partitions, sizeof(arc_t *));
+    ns->arc_lists_size = calloc(cache->num_partitions, sizeof(*ns->arc_lists_size));
+
+    int i;
+    for (i = 0; i < cache->num_partitions; i++) {
+        shardcache_partition_t *part = &cache->partitions[i];
+        ns->arcs[i] = arc_create(&part->ops,
+                                 size / cache->num_partitions,
+                                 sizeof(cached_object_t),
+                                 ns->arc_lists_size[i],
+                                 cache->arc_mode,
+                                 SHARDCACHE_ARC_RECLAIM_MODE);
+        if (!ns->arcs[i]) {
+            shardcache_namespace_destroy(cache, ns);
+            return -1;
+        }
+    }
+
+    // publish the namespace in the first free slot,
+    // unless the same prefix has already been defined
+    for (i = 0; i < SHARDCACHE_NAMESPACES_MAX; i++) {
+        if (ATOMIC_CAS(cache->namespaces[i], NULL, ns))
+            break;
+        shardcache_namespace_t *other = ATOMIC_READ(cache->namespaces[i]);
+        if (other->plen == ns->plen && memcmp(other->prefix, ns->prefix, ns->plen) == 0) {
+            SHC_ERROR("Namespace %s already defined", prefix);
+            shardcache_namespace_destroy(cache, ns);
+            return -1;
+        }
+    }
+
+    if (i == SHARDCACHE_NAMESPACES_MAX) {
+        SHC_ERROR("Can't define namespace %s, too many namespaces", prefix);
+        shardcache_namespace_destroy(cache, ns);
+        return -1;
+    }
+
+    // applied once published, so a concurrent shardcache_large_object_pool()
+    // can't be missed
+    if (ATOMIC_READ(cache->large_threshold))
+        shardcache_large_object_pool_resize(cache, ns, shardcache_memory_arc_ratio(cache));
+
+    // the objects already cached under the prefix (by the default arcs or by
+    // a namespace with a shorter prefix) can't be reached anymore, drop them
+    // instead of leaving them around until evicted
+    int p, n, removed = 0;
+    for (p = 0; p < cache->num_partitions; p++) {
+        removed += arc_remove_prefix(cache->partitions[p].arc, ns->prefix, ns->plen);
+        for (n = 0; n < SHARDCACHE_NAMESPACES_MAX; n++) {
+            shardcache_namespace_t *other = ATOMIC_READ(cache->namespaces[n]);
+            if (!other)
+                break;
+            if (other->plen < ns->plen && memcmp(other->prefix, ns->prefix, other->plen) == 0)
+                removed += arc_remove_prefix(other->arcs[p], ns->prefix, ns->plen);
+        }
+    }
+    if (removed)
+        SHC_DEBUG("Dropped %d objects cached under the new namespace %s", removed, prefix);
+
+    shardcache_namespace_counters(cache, ns, 1);
+    return 0;
+}
+
+void
+shardcache_large_object_pool(shardcache_t *cache, size_t threshold, size_t size)
+{
+    ATOMIC_SET(cache->large_threshold, threshold);
+    ATOMIC_SET(cache->large_size, size);
+
+    // each partition gets its share of the pool, as for the arc
+    double ratio = shardcache_memory_arc_ratio(cache);
+    shardcache_large_object_pool_resize(cache, NULL, ratio);
+
+    int i;
+    for (i = 0; i < SHARDCACHE_NAMESPACES_MAX; i++) {
+        shardcache_namespace_t *ns = ATOMIC_READ(cache->namespaces[i]);
+        if (!ns)
+            break;
+        shardcache_large_object_pool_resize(cache, ns, ratio);
+    }
+}
+
 int
 shardcache_lazy_expiration(shardcache_t *cache, int new_value)
 {
@@ -32,8 +32,29 @@ typedef struct __shardcache_s shardcache_t;
 #define SHARDCACHE_CONNECTION_EXPIRE_DEFAULT  5000   // (in millisecs)
 #define SHARDCACHE_SERVING_LOOK_AHEAD_DEFAULT 64     // number of queued/pipelined
                                                      // requests to handle ahead
+#define SHARDCACHE_SERVING_LOOK_AHEAD_MIN_DEFAULT 4   // lower bound of the adaptive look-ahead
+#define SHARDCACHE_SERVING_LATENCY_TARGET_DEFAULT 10000 // (in microsecs) completion time above
+                                                     // which the look-ahead is decreased
+#define SHARDCACHE_SERVING_QUANTUM_DEFAULT    16384  // bytes of requests served per connection
+                                                     // in each worker loop turn
+#define SHARDCACHE_BUSY_POLL_DEFAULT          50     // (in microsecs) time spent polling
+                                                     // before sleeping when busy polling
 #define SHARDCACHE_ASYNC_THREADS_NUM_DEFAULT  1      // number of async i/o threads used
                                                      // for inter-node communication
+#define SHARDCACHE_PREFETCH_MAX_INFLIGHT_DEFAULT 32  // number of prefetches which can
+                                                     // be fetching at the same time
+#define SHARDCACHE_PREFETCH_QUEUE_MAX         65536  // number of keys waiting to be prefetched
+#define SHARDCACHE_WARMUP_MAX_ITEMS_DEFAULT   10000  // number of hot items requested to each
+                                                     // peer when a migration begins
+#define SHARDCACHE_WARMUP_RATE_DEFAULT        5000   // number of hot items loaded per second
+#define SHARDCACHE_WARMUP_MAX_BYTES           (1<<26) // max size of the hot set sent by a peer
+#define SHARDCACHE_L2_WRITE_RATE_DEFAULT      (8<<20) // bytes written to the l2 cache per second
+#define SHARDCACHE_WRITE_PIPELINE_WINDOW_DEFAULT 200 // (in microsecs) time the writes forwarded
+                                                     // to the owners wait to be batched
+#define SHARDCACHE_HOTKEYS_SAMPLE_RATE_DEFAULT 16    // 1 every N requests is tracked
+                                                     // to report the heaviest keys
+#define SHARDCACHE_SLOWLOG_THRESHOLD_DEFAULT  100000 // (in microsecs) time after which a request
+                                                     // is accounted in the slow log
 extern const char *LIBSHARDCACHE_VERSION;
 
 /*
@@ -103,6 +124,36 @@ shardcache_t *shardcache_create(char *me,
                         int num_async,
                         size_t cache_size);
 
+/**
+ * @brief Create a new shardcache instance splitting the local keyspace
+ *        in per-core partitions
+ *
+ *        Each partition has its own cache, volatile storage, expirer and
+ *        serving worker (event loop). Connections are still spread among
+ *        all the workers and requests for keys owned by another partition
+ *        are handed over to the worker owning it through lock-free rings.
+ *
+ * @param num_partitions  The number of partitions (fixed for the whole life
+ *                        of the instance). The number of serving workers will
+ *                        match the number of partitions and each partition gets
+ *                        cache_size/num_partitions bytes of cache.\n
+ *                        If 1, this is equivalent to shardcache_create()
+ *
+ * @note All the other parameters are the same as shardcache_create()
+ * @note The creation fails (returning NULL) if the workers can't be set up
+ *       to hand the requests over to each other
+ * @see shardcache_create()
+ */
+shardcache_t *shardcache_create_partitioned(char *me, 
+                                            shardcache_node_t **nodes,
+                                            int num_nodes,
+                                            shardcache_storage_t *storage,
+                                            char *secret,
+                                            int num_workers,
+                                            int num_async,
+                                            size_t cache_size,
+                                            int num_partitions);
+
 
 
 typedef enum {
@@ -178,6 +229,24 @@ int shardcache_tcp_timeout(shardcache_t *cache, int new_value);
  */
 int shardcache_conn_expire_time(shardcache_t *cache, int new_value);
 
+/*
+ * @brief Allows to change the minimum number of idle connections kept
+ *        ready in the connection pool for each peer
+ * @param cache       A valid pointer to a shardcache_t structure
+ * @param new_value   The number of warm connections per peer
+ *                    (capped to the maximum number of spare connections).\n
+ *                    If 0 no connection will be established ahead of time;\n
+ *                    If -1 is provided as new_value, no change will be applied
+ *                    but the actual value will still be returned
+ *                    (effectively querying the actual status).
+ * @return the previous value for the min_warm setting
+ * @note A background thread establishes the missing connections and
+ *       periodically probes the idle ones with a NOOP (dropping the ones
+ *       closed by the peers), which also keeps them from expiring
+ * @note defaults to 0
+ */
+int shardcache_conn_min_warm(shardcache_t *cache, int new_value);
+
 /*
  * @brief Allows to change the timeout passed to iomux_run()
  *               by the serving workers and the async reader
@@ -221,15 +290,319 @@ int shardcache_iomux_run_timeout_high(shardcache_t *cache, int new_value);
 int shardcache_expire_time(shardcache_t *cache, int new_value);
 
 /*
- * @brief Allows to change the number of queued/pipelined requests to handle ahead
- *        while still serving the response to the first request
+ * @brief Allows to change the maximum number of queued/pipelined requests to handle
+ *        ahead while still serving the response to the first request
  * @param cache A valid pointer to a shardcache_t structure
- * @param new_value The amount of requests to look ahead
+ * @param new_value The maximum amount of requests to look ahead
  * @return the previous value for the look_ahead setting
+ * @note The look-ahead of each connection is adjusted (AIMD) between
+ *       the value set with shardcache_serving_look_ahead_min() and this one
  * @note defaults to SHARDCACHE_SERVING_LOOK_AHEAD_DEFAULT
  */
 int shardcache_serving_look_ahead(shardcache_t *cache, int new_value);
 
+/*
+ * @brief Allows to change the minimum number of queued/pipelined requests
+ *        handled ahead for each connection
+ * @param cache A valid pointer to a shardcache_t structure
+ * @param new_value The minimum amount of requests to look ahead\n
+ *                  If equal to (or greater than) the maximum look-ahead,
+ *                  the look-ahead won't be adjusted;\n
+ *                  If -1 is provided as new_value, no change will be applied
+ *                  but the actual value will still be returned
+ *                  (effectively querying the actual status).
+ * @return the previous value for the look_ahead_min setting
+ * @note The look-ahead of a connection grows by one each time a window of
+ *       requests completes within the latency target and is halved when the
+ *       target is missed or the worker handling the connection is backlogged
+ * @note defaults to SHARDCACHE_SERVING_LOOK_AHEAD_MIN_DEFAULT
+ */
+int shardcache_serving_look_ahead_min(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to change the completion time above which the look-ahead
+ *        of a connection is decreased
+ * @param cache A valid pointer to a shardcache_t structure
+ * @param new_value The latency target (in microseconds)\n
+ *                  If 0 only the backlog of the workers will be considered;\n
+ *                  If -1 is provided as new_value, no change will be applied
+ *                  but the actual value will still be returned
+ *                  (effectively querying the actual status).
+ * @return the previous value for the latency_target setting
+ * @note defaults to SHARDCACHE_SERVING_LATENCY_TARGET_DEFAULT
+ */
+int shardcache_serving_latency_target(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to change the amount of requests served for each connection
+ *        in a single loop turn of the worker handling it
+ * @param cache A valid pointer to a shardcache_t structure
+ * @param new_value The quantum (in bytes) earned by each connection at every
+ *                  turn, each request costs its size plus a fixed overhead\n
+ *                  If 0 the requests will be served as soon as they are read;\n
+ *                  If -1 is provided as new_value, no change will be applied
+ *                  but the actual value will still be returned
+ *                  (effectively querying the actual status).
+ * @return the previous value for the serving_quantum setting
+ * @note The connections handled by the same worker are served using
+ *       deficit round-robin, so that a client pipelining lots of requests
+ *       on a single connection can't starve the other ones
+ * @note defaults to SHARDCACHE_SERVING_QUANTUM_DEFAULT
+ */
+int shardcache_serving_quantum(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to change the number of serving workers which busy poll
+ *        their connections instead of sleeping when there is nothing to do
+ * @param cache A valid pointer to a shardcache_t structure
+ * @param new_value The number of busy polling workers (the first ones)\n
+ *                  If 0 none of the workers will busy poll;\n
+ *                  If -1 is provided as new_value, no change will be applied
+ *                  but the actual value will still be returned
+ *                  (effectively querying the actual status).
+ * @return the previous value for the busy_poll_workers setting
+ * @note A busy polling worker keeps polling its connections and its queues
+ *       without blocking until it doesn't find anything to do for longer
+ *       than the spin budget (see shardcache_busy_poll()), trading cpu time
+ *       for lower wake-up latencies.
+ *       The time spent spinning and the time spent doing actual work are
+ *       exported in the worker[N].spin_usecs and worker[N].busy_usecs counters
+ * @note defaults to 0
+ */
+int shardcache_busy_poll_workers(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to change the time a busy polling worker keeps spinning
+ *        without finding anything to do before going back to sleep
+ * @param cache A valid pointer to a shardcache_t structure
+ * @param new_value The spin budget (in microseconds)\n
+ *                  If 0 the default value will be restored;\n
+ *                  If -1 is provided as new_value, no change will be applied
+ *                  but the actual value will still be returned
+ *                  (effectively querying the actual status).
+ * @return the previous value for the busy_poll setting
+ * @note defaults to SHARDCACHE_BUSY_POLL_DEFAULT
+ */
+int shardcache_busy_poll(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to set the SO_BUSY_POLL socket option on the connections
+ *        handled by the busy polling workers
+ * @param cache A valid pointer to a shardcache_t structure
+ * @param new_value The value (in microseconds) for SO_BUSY_POLL\n
+ *                  If 0 the socket option won't be set;\n
+ *                  If -1 is provided as new_value, no change will be applied
+ *                  but the actual value will still be returned
+ *                  (effectively querying the actual status).
+ * @return the previous value for the busy_poll_socket setting
+ * @note Only applies to the connections accepted after the change and
+ *       is ignored on systems not supporting SO_BUSY_POLL
+ * @note defaults to 0
+ */
+int shardcache_busy_poll_socket(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to change the maximum number of prefetches which can be
+ *        fetching their value at the same time
+ * @param cache A valid pointer to a shardcache_t structure
+ * @param new_value The maximum number of concurrent prefetches\n
+ *                  If 0 the default value will be restored;\n
+ *                  If -1 is provided as new_value, no change will be applied
+ *                  but the actual value will still be returned
+ *                  (effectively querying the actual status).
+ * @return the previous value for the prefetch_max_inflight setting
+ * @note defaults to SHARDCACHE_PREFETCH_MAX_INFLIGHT_DEFAULT
+ */
+int shardcache_prefetch_max_inflight(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to change the number of hot items requested to each peer
+ *        when a migration begins (join-time warm-up)
+ * @param cache A valid pointer to a shardcache_t structure
+ * @param new_value The maximum number of items to request to each peer\n
+ *                  If 0 the warm-up will be disabled;\n
+ *                  If -1 is provided as new_value, no change will be applied
+ *                  but the actual value will still be returned
+ *                  (effectively querying the actual status).
+ * @return the previous value for the warmup_max_items setting
+ * @note When a migration begins each node asks its peers for the most
+ *       frequently used items which are going to be owned by it under
+ *       the new continuum and loads them into its cache
+ * @note defaults to SHARDCACHE_WARMUP_MAX_ITEMS_DEFAULT
+ */
+int shardcache_warmup_max_items(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to change the rate at which the hot items received
+ *        from the peers are loaded into the cache during the warm-up
+ * @param cache A valid pointer to a shardcache_t structure
+ * @param new_value The number of items to load per second\n
+ *                  If 0 the default value will be restored;\n
+ *                  If -1 is provided as new_value, no change will be applied
+ *                  but the actual value will still be returned
+ *                  (effectively querying the actual status).
+ * @return the previous value for the warmup_rate setting
+ * @note defaults to SHARDCACHE_WARMUP_RATE_DEFAULT
+ */
+int shardcache_warmup_rate(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to change the time the asynchronous writes (set/add/delete)
+ *        forwarded to the owners are held back to be sent in batches
+ * @param cache A valid pointer to a shardcache_t structure
+ * @param new_value The time to wait (in microseconds) before flushing the
+ *                  writes queued for a peer\n
+ *                  If 0 the writes will be forwarded one by one;\n
+ *                  If -1 is provided as new_value, no change will be applied
+ *                  but the actual value will still be returned
+ *                  (effectively querying the actual status).
+ * @return the previous value for the write_pipeline_window setting
+ * @note The writes queued for a peer are sent over a single connection
+ *       and the ones for a key which is still waiting to be sent are
+ *       coalesced (the last one wins and all the callers are notified
+ *       with its result)
+ * @note The synchronous writes are sent directly to the owner, but only
+ *       once the writes already queued for it have been acknowledged,
+ *       so that the writes to a key are applied in order
+ * @note defaults to SHARDCACHE_WRITE_PIPELINE_WINDOW_DEFAULT
+ */
+int shardcache_write_pipeline_window(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to change the sampling of the requests tracked to find
+ *        the heaviest keys (the ones most requested, with the most bytes
+ *        served or fetched from their owners the most, and the largest values)
+ * @param cache       A valid pointer to a shardcache_t structure
+ * @param new_value   The number of requests (and fetches) for each one tracked\n
+ *                    If 0 the tracking is disabled;\n
+ *                    If -1 is provided as new_value, no change will be applied
+ *                    but the actual value will still be returned
+ *                    (effectively querying the actual status).
+ * @return the previous value for the hotkeys_sample_rate setting
+ * @note The heaviest keys are reported by the STATS command when the
+ *       "hotkeys" section is requested (see shardcache_client_hotkeys())
+ * @note defaults to SHARDCACHE_HOTKEYS_SAMPLE_RATE_DEFAULT
+ */
+int shardcache_hotkeys_sample_rate(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to change the time after which a request is considered slow
+ * @param cache       A valid pointer to a shardcache_t structure
+ * @param new_value   The threshold (in microseconds)\n
+ *                    If 0 the slow log is disabled;\n
+ *                    If -1 is provided as new_value, no change will be applied
+ *                    but the actual value will still be returned
+ *                    (effectively querying the actual status).
+ * @return the previous value for the slowlog_threshold setting
+ * @note The most recent slow get requests are kept in memory with the time
+ *       spent in each phase (parsing, queueing, lookup, storage, waiting for
+ *       the value, transfer and flushing) and reported by the STATS command
+ *       when the "slowlog" section is requested (see shardcache_client_slowlog()).\n
+ *       At most one slow request per second is also logged
+ * @note defaults to SHARDCACHE_SLOWLOG_THRESHOLD_DEFAULT
+ */
+int shardcache_slowlog_threshold(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to set the memory limit the process is kept within
+ * @param cache       A valid pointer to a shardcache_t structure
+ * @param new_value   The limit (in megabytes)\n
+ *                    If 0 the memory usage is only accounted;\n
+ *                    If -1 is provided as new_value, no change will be applied
+ *                    but the actual value will still be returned
+ *                    (effectively querying the actual status).
+ * @return the previous value for the memory_limit setting
+ * @note The memory used by the cache, the volatile items, the scheduled
+ *       expirations, the requests being served and the eviction jobs is
+ *       exported in the stats (mem_* counters).\n
+ *       Once the usage goes over the 90% of the limit the cache is shrunk,
+ *       once it reaches the limit new volatile items, prefetches and the
+ *       caching of remote items are refused until it's back below the 80%
+ * @note defaults to 0
+ */
+int shardcache_memory_limit(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Allows to use a filter of the keys in the persistent storage
+ *        to answer the lookups (and the existence checks) for keys
+ *        which are not there without hitting the storage
+ * @param cache       A valid pointer to a shardcache_t structure
+ * @param new_value   1 if the storage filter is desired, 0 otherwise.\n
+ *                    If -1 is provided as new_value, no change will be applied
+ *                    but the actual value will still be returned
+ *                    (effectively querying the actual status).
+ * @return the previous value for the storage_filter setting,
+ *         -1 if the filter is not available
+ * @note The filter is built (in background) by scanning the storage index
+ *       and rebuilt once its false-positive rate drifts above the target,
+ *       it's not available if the storage can't be indexed or if it's global
+ * @note The storage must be modified only through shardcache,
+ *       keys added to it behind its back would be reported as missing
+ * @note defaults to 0
+ */
+int shardcache_storage_filter(shardcache_t *cache, int new_value);
+
+/*
+ * @brief Enable the second-level cache, stored in a local file
+ * @param cache      A valid pointer to a shardcache_t structure
+ * @param path       The path of the file backing the l2 cache
+ *                   (created if it doesn't exist, truncated otherwise)
+ * @param size       The size of the file (in bytes)
+ * @param write_rate The maximum amount of bytes written to the file per second\n
+ *                   If 0 SHARDCACHE_L2_WRITE_RATE_DEFAULT will be used
+ * @return 0 on success, -1 on errors (or if the l2 cache was already enabled)
+ * @note Objects dropped from the cache to make room for new ones are written
+ *       to the l2 cache (as long as the write budget allows it) and cache
+ *       misses are served from there, if possible, before hitting the
+ *       storage or the peers
+ * @note The l2 cache can't be disabled once enabled
+ */
+int shardcache_l2_enable(shardcache_t *cache, char *path, size_t size, size_t write_rate);
+
+/*
+ * @brief Define a namespace, grouping all the keys starting with a prefix
+ * @param cache         A valid pointer to a shardcache_t structure
+ * @param prefix        The prefix of the keys belonging to the namespace
+ *                      (if more namespaces match a key the longest prefix wins)
+ * @param size          The size of the cache dedicated to the namespace (in bytes),
+ *                      in addition to the size of the cache provided to shardcache_create()
+ * @param expire_time   The expire time (in seconds) for the cached keys of the namespace
+ *                      (0 means no expiration), see shardcache_expire_time()
+ * @param cache_on_set  Same as shardcache_cache_on_set() but only for the namespace
+ * @param force_caching Same as shardcache_force_caching() but only for the namespace
+ * @return 0 on success, -1 on errors (or if a namespace with the same prefix exists)
+ * @note The keys in a namespace don't compete for the cache with the other keys,
+ *       so a scan over one namespace can't evict the hot keys of another one.
+ *       The serving workers and the connections are still shared.
+ * @note The counters of each namespace are exported as ns[<prefix>].<counter>
+ * @note Namespaces can't be removed once defined. The keys belonging to a
+ *       namespace defined at runtime which were already cached are dropped
+ *       (and fetched again into the namespace when accessed)
+ */
+int shardcache_namespace_add(shardcache_t *cache,
+                             char *prefix,
+                             size_t size,
+                             int expire_time,
+                             int cache_on_set,
+                             int force_caching);
+
+/*
+ * @brief Keep the large objects in a separate pool
+ * @param cache     A valid pointer to a shardcache_t structure
+ * @param threshold The size (in bytes) above which an object is considered large\n
+ *                  If 0 the pool is disabled and all the objects go through the arc
+ * @param size      The size of the pool (in bytes), in addition to the size
+ *                  of the cache provided to shardcache_create()
+ * @note The namespaces (see shardcache_namespace_add()), including the ones
+ *       added later, get their own pool in the same proportion to their size
+ * @note Large objects are evicted (in LRU order) only to make room for other
+ *       large objects, so a burst of big values can't flush the small hot
+ *       keys out of the cache. The size of the pool is exposed by the
+ *       large_size counter.
+ * @note Disabled by default
+ */
+void shardcache_large_object_pool(shardcache_t *cache, size_t threshold, size_t size);
+
 /*
  * @brief Allows to enable/disable the 'lazy_expiration' mode
  * @param cache       A valid pointer to a shardcache_t structure
@@ -409,6 +782,25 @@ shardcache_get_offset_async(shardcache_t *cache,
                             shardcache_get_async_callback_t cb,
                             void *priv);
 
+/**
+ * @brief Asynchronous version of shardcache_head()
+ * @param cache   A valid pointer to a shardcache_t structure
+ * @param key     A valid pointer to the key
+ * @param klen    The length of the key
+ * @param hlen    The maximum amount of data to retrieve (must be greater than 0)
+ * @param cb      The shardcache_get_async_callback_t which will be called
+ *                for each chunk of data retrieved
+ * @param priv    A pointer which will be passed to the
+ *                shardcache_get_async_callback_t when called
+ * @return 0 on success, -1 otherwise
+ */
+int shardcache_head_async(shardcache_t *cache,
+                          void *key,
+                          size_t klen,
+                          size_t hlen,
+                          shardcache_get_async_callback_t cb,
+                          void *priv);
+
 /**
  * @brief Callback expected by all the _async() routines returning an integer result
  *        (basically all apart shardcache_get_async() shardcache_offset_async())
@@ -450,6 +842,43 @@ int shardcache_touch(shardcache_t *cache,
                      void *key,
                      size_t klen);
 
+/**
+ * @brief Asynchronous version of shardcache_touch()
+ * @param cache   A valid pointer to a shardcache_t structure
+ * @param key     A valid pointer to the key
+ * @param klen    The length of the key
+ * @param cb      The shardcache_async_response_callback_t which will be
+ *                called once the response is completely retrieved
+ * @param priv    A pointer which will be passed to the
+ *                shardcache_async_response_callback_t when called
+ * @return 0 if the command has been successfully issued, -1 otherwise
+ * @note If the key is owned by a peer, the response will be read and
+ *       the callback called by one of the async i/o threads
+ */
+int shardcache_touch_async(shardcache_t *cache,
+                           void *key,
+                           size_t klen,
+                           shardcache_async_response_callback_t cb,
+                           void *priv);
+
+/**
+ * @brief Load multiple keys into the cache without retrieving their values
+ * @param cache    A valid pointer to a shardcache_t structure
+ * @param keys     An array of pointers to the keys
+ * @param klens    An array holding the lengths of the keys
+ * @param num_keys The number of keys in the arrays
+ * @return The number of keys queued for prefetching, -1 in case of errors
+ * @note The keys are copied and the function returns immediately,
+ *       the values are fetched in background by the async i/o threads
+ *       (at most shardcache_prefetch_max_inflight() at the same time).
+ *       Keys not fitting in the prefetch queue are discarded
+ * @note Prefetched items owned by a peer are always kept in the cache
+ */
+int shardcache_prefetch(shardcache_t *cache,
+                        void **keys,
+                        size_t *klens,
+                        int num_keys);
+
 /**
  * @brief Set the value for a key
  * @param cache   A valid pointer to a shardcache_t structure
@@ -594,6 +1023,23 @@ int shardcache_del_async(shardcache_t *cache,
  */
 int shardcache_evict(shardcache_t *cache, void *key, size_t klen);
 
+/**
+ * @brief Invalidate all the keys starting with a prefix
+ *
+ * The keys are removed from the cache (including the l2 cache) and from
+ * the volatile storage of this node in a single pass, then the command is
+ * broadcast once to all the other nodes which do the same locally
+ *
+ * @note the values will not be removed from the underlying storage
+ * @note the command is broadcast by the evictor thread, so it's applied
+ *       only locally if evict_on_delete was disabled at creation time
+ * @param cache A valid pointer to a shardcache_t structure
+ * @param prefix A valid pointer to the prefix
+ * @param plen   The length of the prefix (must be greater than 0)
+ * @return The number of items removed on this node, -1 on errors
+ */
+int shardcache_invalidate(shardcache_t *cache, void *prefix, size_t plen);
+
 /**
  * @brief Get the node owning a specific key
  * @param cache A valid pointer to a shardcache_t structure
@@ -622,6 +1068,31 @@ int shardcache_test_ownership(shardcache_t *cache,
  */
 shardcache_storage_index_t *shardcache_get_index(shardcache_t *cache);
 
+/**
+ * @brief Get a page of the index of keys managed by the specific shardcache instance
+ * @param cache     A valid pointer to a shardcache_t structure
+ * @param cursor    A pointer to the position in the index, 0 to get the first page.
+ *                  It will be updated to point to the next page (0 if there are no more)
+ * @param max_items The maximum number of items to return
+ * @param hash_min  The lower bound of the range of key hashes to include
+ * @param hash_max  The upper bound of the range of key hashes to include
+ * @return A pointer to a shardcache_storage_index_t structure holding 
+ *         the page (which might be empty even if there are more pages)
+ *         or NULL if there is no persistent storage
+ * @note The hash of a key is the one returned by arc_hash_key().
+ *       To get the whole index use 0 and UINT64_MAX as the hash range
+ * @note If the storage doesn't implement the index_page callback the full index
+ *       is returned as a single page (regardless of max_items) and the cursor
+ *       is set to 0
+ * @note The caller MUST release the returned pointer once done with it
+ *       by using the shardcache_free_index() function
+ */
+shardcache_storage_index_t *shardcache_get_index_page(shardcache_t *cache,
+                                                      uint64_t *cursor,
+                                                      size_t max_items,
+                                                      uint64_t hash_min,
+                                                      uint64_t hash_max);
+
 /**
  * @brief Release all resources used by the index provided as argument
  * @param index A pointer to a valid shardcache_storage_index_t structure
@@ -33,9 +33,14 @@ struct shardcache_client_s {
     int pipeline_max;
     int errno;
     int multi_command_max_wait;
+    int request_deadline;
+    shardcache_trace_t trace;
     char errstr[1024];
 };
 
+// the trace context sent along with the requests (if any)
+#define CLIENT_TRACE(__c) ((__c)->trace.id ? &(__c)->trace : NULL)
+
 int
 shardcache_client_tcp_timeout(shardcache_client_t *c, int new_value)
 {
@@ -72,6 +77,24 @@ shardcache_client_pipeline_max(shardcache_client_t *c, int new_value)
     return old_value;
 }
 
+int
+shardcache_client_request_deadline(shardcache_client_t *c, int new_value)
+{
+    int old_value = c->request_deadline;
+    if (new_value >= 0)
+        c->request_deadline = new_value;
+    return old_value;
+}
+
+uint64_t
+shardcache_client_trace(shardcache_client_t *c, uint64_t trace_id, int sampled)
+{
+    uint64_t old_value = c->trace.id;
+    c->trace.id = trace_id;
+    c->trace.flags = sampled ? SHC_TRACE_FLAG_SAMPLED : 0;
+    return old_value;
+}
+
 shardcache_client_t *
 shardcache_client_create(shardcache_node_t **nodes, int num_nodes, char *auth)
 {
@@ -173,7 +196,7 @@ shardcache_client_get(shardcache_client_t *c, void *key, size_t klen, void **dat
     }
 
     fbuf_t value = FBUF_STATIC_INITIALIZER;
-    int rc = fetch_from_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, key, klen, &value, fd);
+    int rc = fetch_from_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, key, klen, c->request_deadline, CLIENT_TRACE(c), &value, fd);
     if (rc == 0) {
         size_t size = fbuf_used(&value);
         if (data)
@@ -262,7 +285,7 @@ shardcache_client_touch(shardcache_client_t *c, void *key, size_t klen)
         snprintf(c->errstr, sizeof(c->errstr), "Can't connect to '%s'", node);
         return -1;
     }
-    int rc = touch_on_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, key, klen, fd);
+    int rc = touch_on_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, key, klen, fd, 1);
     if (rc == -1) {
         close(fd);
         c->errno = SHARDCACHE_CLIENT_ERROR_NODE;
@@ -276,6 +299,63 @@ shardcache_client_touch(shardcache_client_t *c, void *key, size_t klen)
     return rc;
 }
 
+int
+shardcache_client_prefetch(shardcache_client_t *c, void **keys, size_t *klens, int num_keys)
+{
+    void **node_keys = malloc(sizeof(void *) * (num_keys + 1));
+    size_t *node_klens = malloc(sizeof(size_t) * (num_keys + 1));
+    char **owners = malloc(sizeof(char *) * (num_keys + 1));
+    int rc = 0;
+    int i, n;
+
+    for (i = 0; i < num_keys; i++)
+        owners[i] = select_node(c, keys[i], klens[i], NULL);
+
+    // send a single command to each node with all the keys it owns
+    for (n = 0; n < c->num_shards; n++) {
+        char *addr = shardcache_node_get_address(c->shards[n]);
+        int count = 0;
+        for (i = 0; i < num_keys; i++) {
+            if (owners[i] && strcmp(owners[i], addr) == 0) {
+                node_keys[count] = keys[i];
+                node_klens[count] = klens[i];
+                count++;
+            }
+        }
+        if (!count)
+            continue;
+
+        int fd = connections_pool_get(c->connections, addr);
+        if (fd < 0) {
+            c->errno = SHARDCACHE_CLIENT_ERROR_NETWORK;
+            snprintf(c->errstr, sizeof(c->errstr), "Can't connect to '%s'", addr);
+            rc = -1;
+            continue;
+        }
+
+        if (prefetch_on_peer(addr, (char *)c->auth, SHC_HDR_SIGNATURE_SIP,
+                             node_keys, node_klens, count, fd, 1) != 0)
+        {
+            close(fd);
+            c->errno = SHARDCACHE_CLIENT_ERROR_NODE;
+            snprintf(c->errstr, sizeof(c->errstr), "Can't prefetch keys on node '%s'", addr);
+            rc = -1;
+        } else {
+            connections_pool_add(c->connections, addr, fd);
+        }
+    }
+
+    if (rc == 0) {
+        c->errno = SHARDCACHE_CLIENT_OK;
+        c->errstr[0] = 0;
+    }
+
+    free(node_keys);
+    free(node_klens);
+    free(owners);
+    return rc;
+}
+
 static inline int
 shardcache_client_set_internal(shardcache_client_t *c, void *key, size_t klen, void *data, size_t dlen, uint32_t expire, int inx)
 {
@@ -289,9 +369,9 @@ shardcache_client_set_internal(shardcache_client_t *c, void *key, size_t klen, v
 
     int rc = -1;
     if (inx)
-        rc = add_to_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, key, klen, data, dlen, expire, fd, 1);
+        rc = add_to_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, key, klen, data, dlen, expire, CLIENT_TRACE(c), fd, 1);
     else
-        rc = send_to_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, key, klen, data, dlen, expire, fd, 1);
+        rc = send_to_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, key, klen, data, dlen, expire, CLIENT_TRACE(c), fd, 1);
 
     if (rc == -1) {
         close(fd);
@@ -327,7 +407,7 @@ shardcache_client_del(shardcache_client_t *c, void *key, size_t klen)
         snprintf(c->errstr, sizeof(c->errstr), "Can't connect to '%s'", node);
         return -1;
     }
-    int rc = delete_from_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, key, klen, fd, 1);
+    int rc = delete_from_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, key, klen, CLIENT_TRACE(c), fd, 1);
     if (rc != 0) {
         close(fd);
         c->errno = SHARDCACHE_CLIENT_ERROR_NODE;
@@ -351,7 +431,7 @@ shardcache_client_evict(shardcache_client_t *c, void *key, size_t klen)
         return -1;
     }
 
-    int rc = evict_from_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, key, klen, fd, 1);
+    int rc = evict_from_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, key, klen, CLIENT_TRACE(c), fd, 1);
     if (rc != 0) {
         close(fd);
         c->errno = SHARDCACHE_CLIENT_ERROR_NODE;
@@ -387,6 +467,31 @@ shardcache_get_node(shardcache_client_t *c, char *node_name)
     return node;
 }
 
+int
+shardcache_client_invalidate(shardcache_client_t *c, void *prefix, size_t plen)
+{
+    // any node will do, the command is broadcast to the others by the receiver
+    int fd = -1;
+    char *node = select_node(c, prefix, plen, &fd);
+    if (fd < 0) {
+        c->errno = SHARDCACHE_CLIENT_ERROR_NETWORK;
+        snprintf(c->errstr, sizeof(c->errstr), "Can't connect to '%s'", node);
+        return -1;
+    }
+
+    int rc = invalidate_on_peer(node, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, prefix, plen, 0, fd, 1);
+    if (rc != 0) {
+        close(fd);
+        c->errno = SHARDCACHE_CLIENT_ERROR_NODE;
+        snprintf(c->errstr, sizeof(c->errstr), "Can't invalidate prefix on node '%s'", node);
+    } else {
+        connections_pool_add(c->connections, node, fd);
+        c->errno = SHARDCACHE_CLIENT_OK;
+        c->errstr[0] = 0;
+    }
+    return rc;
+}
+
 int
 shardcache_client_stats(shardcache_client_t *c, char *node_name, char **buf, size_t *len)
 {
@@ -418,6 +523,68 @@ shardcache_client_stats(shardcache_client_t *c, char *node_name, char **buf, siz
     return rc;
 }
 
+// the sections of the STATS command other than the counters
+typedef int (*shardcache_client_section_from_peer_t)(char *peer,
+                                                     char *auth,
+                                                     unsigned char sig_hdr,
+                                                     char **out,
+                                                     size_t *len,
+                                                     int fd);
+
+static int
+shardcache_client_stats_section(shardcache_client_t *c,
+                                char *node_name,
+                                shardcache_client_section_from_peer_t section_from_peer,
+                                char *description,
+                                char **buf,
+                                size_t *len)
+{
+
+    shardcache_node_t *node = shardcache_get_node(c, node_name);
+    if (!node)
+        return -1;
+
+    char *addr = shardcache_node_get_address(node);
+    int fd = connections_pool_get(c->connections, addr);
+    if (fd < 0) {
+        c->errno = SHARDCACHE_CLIENT_ERROR_NETWORK;
+        snprintf(c->errstr, sizeof(c->errstr), "Can't connect to '%s'", addr);
+        return -1;
+    }
+
+    int rc = section_from_peer(addr, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, buf, len, fd);
+    if (rc != 0) {
+        close(fd);
+        c->errno = SHARDCACHE_CLIENT_ERROR_NODE;
+        snprintf(c->errstr, sizeof(c->errstr),
+                "Can't get the %s from node '%s'", description, shardcache_node_get_label(node));
+    } else {
+        connections_pool_add(c->connections, addr, fd);
+        c->errno = SHARDCACHE_CLIENT_OK;
+        c->errstr[0] = 0;
+    }
+
+    return rc;
+}
+
+int
+shardcache_client_hotkeys(shardcache_client_t *c, char *node_name, char **buf, size_t *len)
+{
+    return shardcache_client_stats_section(c, node_name, hotkeys_from_peer, "hot keys", buf, len);
+}
+
+int
+shardcache_client_slowlog(shardcache_client_t *c, char *node_name, char **buf, size_t *len)
+{
+    return shardcache_client_stats_section(c, node_name, slowlog_from_peer, "slow requests", buf, len);
+}
+
+int
+shardcache_client_traces(shardcache_client_t *c, char *node_name, char **buf, size_t *len)
+{
+    return shardcache_client_stats_section(c, node_name, traces_from_peer, "traces", buf, len);
+}
+
 int
 shardcache_client_check(shardcache_client_t *c, char *node_name) {
     shardcache_node_t *node = shardcache_get_node(c, node_name);
@@ -499,6 +666,131 @@ shardcache_client_index(shardcache_client_t *c, char *node_name)
     return index;
 }
 
+struct shardcache_client_index_iterator_s {
+    shardcache_client_t *client;
+    char *label;
+    char *addr;
+    uint64_t cursor;
+    uint32_t page_size;
+    uint64_t hash_min;
+    uint64_t hash_max;
+    fbuf_t page;
+    fbuf_t key;
+    size_t ofx;
+    int legacy;
+    int last_page;
+};
+
+shardcache_client_index_iterator_t *
+shardcache_client_index_iterator_create(shardcache_client_t *c,
+                                        char *node_name,
+                                        uint32_t page_size,
+                                        uint64_t hash_min,
+                                        uint64_t hash_max)
+{
+    shardcache_node_t *node = shardcache_get_node(c, node_name);
+    if (!node) {
+        c->errno = SHARDCACHE_CLIENT_ERROR_ARGS;
+        snprintf(c->errstr, sizeof(c->errstr), "Unknown node '%s'", node_name);
+        return NULL;
+    }
+
+    shardcache_client_index_iterator_t *it = calloc(1, sizeof(shardcache_client_index_iterator_t));
+    it->client = c;
+    it->label = strdup(shardcache_node_get_label(node));
+    it->addr = strdup(shardcache_node_get_address(node));
+    it->page_size = page_size ? page_size : SHARDCACHE_INDEX_PAGE_SIZE_DEFAULT;
+    it->hash_min = hash_min;
+    it->hash_max = hash_max;
+    // there is no page yet, the first call to next() will fetch it
+    return it;
+}
+
+static int
+shardcache_client_index_iterator_fetch(shardcache_client_index_iterator_t *it)
+{
+    shardcache_client_t *c = it->client;
+
+    int fd = connections_pool_get(c->connections, it->addr);
+    if (fd < 0) {
+        c->errno = SHARDCACHE_CLIENT_ERROR_NETWORK;
+        snprintf(c->errstr, sizeof(c->errstr), "Can't connect to '%s'", it->addr);
+        return -1;
+    }
+
+    fbuf_clear(&it->page);
+    fbuf_clear(&it->key);
+    it->ofx = 0;
+
+    int rc = index_page_from_peer(it->addr, (char *)c->auth, SHC_HDR_SIGNATURE_SIP, fd,
+                                  &it->cursor, it->page_size, it->hash_min, it->hash_max,
+                                  &it->page);
+    if (rc == -1) {
+        close(fd);
+        c->errno = SHARDCACHE_CLIENT_ERROR_NODE;
+        snprintf(c->errstr, sizeof(c->errstr),
+                "Can't get index page from node '%s'", it->label);
+        return -1;
+    }
+
+    connections_pool_add(c->connections, it->addr, fd);
+    it->legacy = rc;
+    it->last_page = (it->cursor == 0);
+    return 0;
+}
+
+int
+shardcache_client_index_iterator_next(shardcache_client_index_iterator_t *it,
+                                      void **key,
+                                      size_t *klen,
+                                      size_t *vlen)
+{
+    shardcache_client_t *c = it->client;
+    size_t value_len = 0;
+
+    for (;;) {
+        int rc = index_page_next(fbuf_data(&it->page), fbuf_used(&it->page),
+                                 &it->ofx, it->legacy, &it->key, &value_len);
+        if (rc == 1) {
+            if (key)
+                *key = fbuf_data(&it->key);
+            if (klen)
+                *klen = fbuf_used(&it->key);
+            if (vlen)
+                *vlen = value_len;
+            c->errno = SHARDCACHE_CLIENT_OK;
+            c->errstr[0] = 0;
+            return 1;
+        } else if (rc == -1) {
+            c->errno = SHARDCACHE_CLIENT_ERROR_PROTOCOL;
+            snprintf(c->errstr, sizeof(c->errstr),
+                    "Malformed index page from node '%s'", it->label);
+            return -1;
+        }
+
+        // the current page is over (pages can also be empty
+        // if the hash range filtered out all the scanned keys)
+        if (it->last_page) {
+            c->errno = SHARDCACHE_CLIENT_OK;
+            c->errstr[0] = 0;
+            return 0;
+        }
+
+        if (shardcache_client_index_iterator_fetch(it) != 0)
+            return -1;
+    }
+}
+
+void
+shardcache_client_index_iterator_destroy(shardcache_client_index_iterator_t *it)
+{
+    fbuf_destroy(&it->page);
+    fbuf_destroy(&it->key);
+    free(it->label);
+    free(it->addr);
+    free(it);
+}
+
 int
 shardcache_client_migration_begin(shardcache_client_t *c, shardcache_node_t **nodes, int num_nodes)
 {
@@ -640,6 +932,8 @@ shardcache_client_get_async(shardcache_client_t *c,
                                  klen,
                                  0,
                                  0,
+                                 c->request_deadline,
+                                 CLIENT_TRACE(c),
                                  shardcache_client_get_async_data_helper,
                                  arg,
                                  fd,
@@ -94,6 +94,35 @@ int shardcache_client_use_random_node(shardcache_client_t *c, int new_value);
  */
 int shardcache_client_pipeline_max(shardcache_client_t *c, int new_value);
 
+/**
+ * @brief Get and/or set the deadline (in milliseconds) sent along with the
+ *        get requests.
+ * @note  Once the deadline expires the nodes stop working on the request
+ *        (which will receive an empty response), so it should be set to
+ *        the time after which the caller is going to give up anyway.
+ *        A value of 0 (the default) indicates no deadline
+ * @param c         A valid pointer to a shardcache_client_t structure
+ * @param new_value If greater or equal to 0 the new value will be set.
+ *                  Otherwise the old value will be queried but no new value
+ *                  will be set
+ * @return The previously configured deadline
+ *         (still valid if no new value has been provided)
+ */
+int shardcache_client_request_deadline(shardcache_client_t *c, int new_value);
+
+/**
+ * @brief Set the trace id sent along with the requests
+ * @note  The nodes propagate the trace id to the peers they forward the
+ *        requests to (fetches from the owners and forwarded writes), so that
+ *        the work done across the nodes on behalf of a request can be tied
+ *        back to it (see shardcache_client_traces())
+ * @param c         A valid pointer to a shardcache_client_t structure
+ * @param trace_id  The trace id (0, the default, disables the tracing)
+ * @param sampled   If not 0 the nodes record the spans of the traced requests
+ * @return The previously configured trace id
+ */
+uint64_t shardcache_client_trace(shardcache_client_t *c, uint64_t trace_id, int sampled);
+
 /**
  * @brief Get the value for a key
  * @param c       A valid pointer to a shardcache_client_t structure
@@ -195,6 +224,20 @@ int shardcache_client_exists(shardcache_client_t *c, void *key, size_t klen);
  */
 int shardcache_client_touch(shardcache_client_t *c, void *key, size_t klen);
 
+/**
+ * @brief Ask the nodes responsible for the given keys to load them into
+ *        their cache (without retrieving the values).
+ *        One PREFETCH command is sent to each of the involved nodes
+ * @param c        A valid pointer to a shardcache_client_t structure
+ * @param keys     An array of pointers to the keys
+ * @param klens    An array holding the lengths of the keys
+ * @param num_keys The number of keys in the arrays
+ * @return 0 if all the nodes accepted the keys, -1 in case of errors
+ * @note The values are fetched in background by the nodes, this function
+ *       doesn't wait for them to be loaded
+ */
+int shardcache_client_prefetch(shardcache_client_t *c, void **keys, size_t *klens, int num_keys);
+
 
 /**
  * @brief Set the value for a key if it doesn't exist already
@@ -252,6 +295,20 @@ int shardcache_client_del(shardcache_client_t *c, void *key, size_t klen);
  */
 int shardcache_client_evict(shardcache_client_t *c, void *key, size_t klen);
 
+/**
+ * @brief Invalidate (remove from the cache and the volatile storage)
+ *        all the keys starting with a prefix, on all the nodes
+ * @param c      A valid pointer to a shardcache_client_t structure
+ * @param prefix A valid pointer to the prefix
+ * @param plen   The length of the prefix
+ * @return 0 on success, -1 otherwise and the internal errno is set
+ * @note The command is sent to a single node which broadcasts it to the others
+ * @note On success the internal errno will be set to SHARDCACHE_CLIENT_OK
+ * @see shardcache_client_errno()
+ * @see shardcache_client_errstr()
+ */
+int shardcache_client_invalidate(shardcache_client_t *c, void *prefix, size_t plen);
+
 /**
  * @brief Get the stats from a shardcache node
  * @param c     A valid pointer to a shardcache_client_t structure
@@ -268,6 +325,71 @@ int shardcache_client_evict(shardcache_client_t *c, void *key, size_t klen);
  */
 int shardcache_client_stats(shardcache_client_t *c, char *node_name, char **buf, size_t *len);
 
+/**
+ * @brief Get the report of the heaviest keys from a shardcache node
+ * @param c     A valid pointer to a shardcache_client_t structure
+ * @param node_name  The name of the node we want to get the report from
+ * @param buf   A reference to the pointer which will be set to point to the memory
+ *              holding the retrieved report
+ * @param len If not NULL, the size of memory pointed by *buf is stored in *len
+ * @return 0 on success, -1 otherwise and the internal errno is set
+ * @note The report holds a line for each of the most requested keys, the keys
+ *       with the most bytes served, the keys most fetched from their owners
+ *       and the largest values, in the form: tracker.rank;key;count;error\n
+ *       The non-printable bytes of the keys are escaped as \\xNN
+ * @note The caller is responsible of releasing the memory eventually pointed by *buf
+ *       by using free()
+ * @note On success the internal errno will be set to SHARDCACHE_CLIENT_OK
+ * @see shardcache_client_errno()
+ * @see shardcache_client_errstr()
+ */
+int shardcache_client_hotkeys(shardcache_client_t *c, char *node_name, char **buf, size_t *len);
+
+/**
+ * @brief Get the most recent slow requests from a shardcache node
+ * @param c     A valid pointer to a shardcache_client_t structure
+ * @param node_name  The name of the node we want to get the slow requests from
+ * @param buf   A reference to the pointer which will be set to point to the memory
+ *              holding the retrieved report
+ * @param len If not NULL, the size of memory pointed by *buf is stored in *len
+ * @return 0 on success, -1 otherwise and the internal errno is set
+ * @note The report holds a line for each of the requests which took longer
+ *       than the threshold (see shardcache_slowlog_threshold()), the most
+ *       recent first, in the form:
+ *       received;cmd;hash;trace;link;key;source;peer;total;parse;queue;lookup;storage;wait;transfer;flush\n
+ *       where the times are in microseconds, the trace is the trace id the
+ *       request carried (if any), the link is the trace id the peer fetch
+ *       the request waited for has been forwarded with (if it was started
+ *       by another request) and the non-printable bytes of the keys
+ *       are escaped as \\xNN
+ * @note The caller is responsible of releasing the memory eventually pointed by *buf
+ *       by using free()
+ * @note On success the internal errno will be set to SHARDCACHE_CLIENT_OK
+ * @see shardcache_client_errno()
+ * @see shardcache_client_errstr()
+ */
+int shardcache_client_slowlog(shardcache_client_t *c, char *node_name, char **buf, size_t *len);
+
+/**
+ * @brief Get the spans of the most recent sampled traces from a shardcache node
+ * @param c     A valid pointer to a shardcache_client_t structure
+ * @param node_name  The name of the node we want to get the spans from
+ * @param buf   A reference to the pointer which will be set to point to the memory
+ *              holding the retrieved report
+ * @param len If not NULL, the size of memory pointed by *buf is stored in *len
+ * @return 0 on success, -1 otherwise and the internal errno is set
+ * @note The report holds a line for each of the requests served by the node
+ *       on behalf of a sampled trace (see shardcache_client_trace()), in the
+ *       same form as the slow requests (see shardcache_client_slowlog()).
+ *       The spans of a trace can be merged across the nodes by the trace id
+ * @note The caller is responsible of releasing the memory eventually pointed by *buf
+ *       by using free()
+ * @note On success the internal errno will be set to SHARDCACHE_CLIENT_OK
+ * @see shardcache_client_errno()
+ * @see shardcache_client_errstr()
+ */
+int shardcache_client_traces(shardcache_client_t *c, char *node_name, char **buf, size_t *len);
+
 /**
  * @brief Check the status of a shardcache node
  * @param c     A valid pointer to a shardcache_client_t structure
@@ -316,6 +438,52 @@ int shardcache_client_migration_abort(shardcache_client_t *c);
  */
 shardcache_storage_index_t *shardcache_client_index(shardcache_client_t *c, char *node_name);
 
+typedef struct shardcache_client_index_iterator_s shardcache_client_index_iterator_t;
+
+/**
+ * @brief Create an iterator walking the index of a shardcache node
+ *        one page at a time
+ * @param c          A valid pointer to a shardcache_client_t structure
+ * @param node_name  The name of the node we want to get the index from
+ * @param page_size  The number of items to request in each page
+ *                   (0 to use the default page size)
+ * @param hash_min   The lower bound of the range of key hashes to include
+ * @param hash_max   The upper bound of the range of key hashes to include
+ * @return A pointer to a newly initialized iterator, NULL if the node is unknown
+ * @note Use 0 and UINT64_MAX as hash range to walk the whole index.
+ *       Splitting the range allows to walk the index in parallel
+ * @note The caller must use shardcache_client_index_iterator_destroy()
+ *       to release the resources used by the iterator
+ */
+shardcache_client_index_iterator_t *
+shardcache_client_index_iterator_create(shardcache_client_t *c,
+                                        char *node_name,
+                                        uint32_t page_size,
+                                        uint64_t hash_min,
+                                        uint64_t hash_max);
+
+/**
+ * @brief Get the next item from the index, fetching a new page from the
+ *        node if necessary
+ * @param it    A valid pointer to a shardcache_client_index_iterator_t structure
+ * @param key   If provided, will be set to point to the key
+ * @param klen  If provided, the length of the key will be stored at this location
+ * @param vlen  If provided, the length of the value will be stored at this location
+ * @return 1 if an item has been returned, 0 if there are no more items,
+ *         -1 in case of errors (and the internal errno of the client is set)
+ * @note The key is owned by the iterator and is valid only until the next call
+ */
+int shardcache_client_index_iterator_next(shardcache_client_index_iterator_t *it,
+                                          void **key,
+                                          size_t *klen,
+                                          size_t *vlen);
+
+/**
+ * @brief Release all the resources used by the index iterator
+ * @param it    A valid pointer to a shardcache_client_index_iterator_t structure
+ */
+void shardcache_client_index_iterator_destroy(shardcache_client_index_iterator_t *it);
+
 /**
  * @brief Return the error code for the last operation performed by the shardcache client
  * @param c     A valid pointer to a shardcache_client_t structure
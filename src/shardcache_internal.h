@@ -20,9 +20,75 @@
 #include "counters.h"
 #include "shardcache.h"
 #include "shardcache_replica.h"
+#include "l2cache.h"
+#include "write_pipeline.h"
+#include "keyfilter.h"
+#include "topk.h"
+#include "slowlog.h"
 
 #define DEBUG_DUMP_MAXSIZE 128
 
+// the reclamation mode used for the ARC objects,
+// build with ARC_RECLAIM=epoch to use epoch-based reclamation
+#ifdef SHARDCACHE_ARC_RECLAIM_EPOCH
+#define SHARDCACHE_ARC_RECLAIM_MODE ARC_RECLAIM_EPOCH
+#else
+#define SHARDCACHE_ARC_RECLAIM_MODE ARC_RECLAIM_REFCNT
+#endif
+
+// the maximum number of pages fetched from the storage to fill
+// a single (hash-range filtered) index page
+#define SHARDCACHE_INDEX_PAGE_ROUNDS_MAX 16
+
+// the target false-positive rate of the storage filter and the
+// number of keys fetched at once when scanning the index to build it
+#define SHARDCACHE_STORAGE_FILTER_FP_RATE 0.01
+#define SHARDCACHE_STORAGE_FILTER_PAGE_SIZE 1024
+
+// the memory accounting, bytes used by each subsystem
+#define SHARDCACHE_MEM_LABELS_ARRAY \
+        { "mem_cache", "mem_volatile", "mem_timers", "mem_buffers", "mem_evictor" }
+
+#define SHARDCACHE_MEM_CACHE    0 // the arcs (as estimated by the arcs themselves)
+#define SHARDCACHE_MEM_VOLATILE 1 // the volatile items
+#define SHARDCACHE_MEM_TIMERS   2 // the scheduled expirations
+#define SHARDCACHE_MEM_BUFFERS  3 // the requests being served (and their buffers)
+#define SHARDCACHE_MEM_EVICTOR  4 // the queued eviction jobs
+#define SHARDCACHE_MEM_NUM      5
+
+// the estimated overhead of an entry in the (libhl) hashtables
+#define SHARDCACHE_MEM_HT_ENTRY_SIZE 64
+
+// the governor starts shrinking the arcs once the memory in use
+// goes over the high watermark and refuses new data above the limit
+#define SHARDCACHE_MEM_HIGH_WATERMARK 90 // percent of the limit
+#define SHARDCACHE_MEM_LOW_WATERMARK  80 // percent of the limit
+#define SHARDCACHE_MEM_ARC_MIN        10 // percent of the configured cache size
+#define SHARDCACHE_MEM_GOVERNOR_INTERVAL 500 // milliseconds
+
+// the trackers of the heaviest keys (see shardcache_get_hotkeys())
+#define SHARDCACHE_HOTKEYS_LABELS_ARRAY \
+        { "requests", "bytes_served", "remote_fetches", "big_values" }
+
+#define SHARDCACHE_HOTKEYS_REQUESTS 0 // the get requests served
+#define SHARDCACHE_HOTKEYS_BYTES    1 // the bytes of the values served
+#define SHARDCACHE_HOTKEYS_FETCHES  2 // the values fetched from their owners
+#define SHARDCACHE_HOTKEYS_VALUES   3 // the largest values served
+#define SHARDCACHE_HOTKEYS_NUM      4
+
+#define SHARDCACHE_HOTKEYS_CAPACITY  64 // keys tracked by each tracker
+#define SHARDCACHE_HOTKEYS_REPORT    16 // keys reported for each tracker
+#define SHARDCACHE_HOTKEYS_HALF_LIFE 60 // seconds
+
+// the slow requests kept in memory (see shardcache_get_slowlog())
+#define SHARDCACHE_SLOWLOG_SIZE 128
+
+// the spans of the sampled traces kept in memory (see shardcache_get_traces())
+#define SHARDCACHE_TRACES_SIZE 1024
+
+// the maximum number of namespaces which can be defined
+#define SHARDCACHE_NAMESPACES_MAX 32
+
 #define KEY2STR(__k, __l, __o, __ol) \
 { \
     size_t __s = (__l < __ol) ? __l : __ol; \
@@ -113,6 +179,28 @@
 
 typedef struct chash_t chash_t;
 
+typedef struct {
+    uint32_t point;
+    int node;
+} shardcache_continuum_point_t;
+
+/* A set of nodes and the continuum the keys are distributed on.
+ * The points of the continuum are mapped to the indices of the nodes when
+ * the continuum is created, so resolving the owner of a key takes a binary
+ * search and no string comparisons.
+ * The continuums are published through atomic pointers and looked up without
+ * locks, one replaced by a migration (or discarded by an abort) is released
+ * at the following swap (see shardcache_continuum_retire()) */
+typedef struct {
+    shardcache_node_t **nodes;
+    int num_nodes;
+    int me;         // the index of this node in the nodes array (-1 if not part of it)
+    chash_t *chash; // the libchash continuum, used only if the points
+                    // couldn't be mapped (num_points is 0 then)
+    shardcache_continuum_point_t *points;
+    int num_points;
+} shardcache_continuum_t;
+
 typedef struct {
     pthread_t io_th; // the thread taking care of spooling the asynchronous
                      // i/o operations
@@ -120,6 +208,32 @@ typedef struct {
                      // operations
     queue_t *queue;
 } shardcache_async_io_context_t;
+
+/* A slice of the keyspace handled by this node.
+ * Each partition owns its own cache, volatile storage and expirer so that,
+ * when the serving workers are bound to the partitions, the data structures
+ * of a partition are only touched by the worker owning it */
+typedef struct {
+    int index;        // the index of this partition in the partitions array
+    shardcache_t *cache;
+
+    arc_t *arc;       // the arc instance caching the keys in this partition
+    arc_ops_t ops;    // the arc operations callbacks (priv points back to the partition)
+    size_t *arc_lists_size[5];
+
+    hashtable_t *volatile_storage; // an hashtable used as volatile storage
+
+    hashtable_t *cache_timeouts; // hashtable holding the timeout_id of the expiration timers
+                                 // for cached objects
+    hashtable_t *volatile_timeouts; // hashtable holding the timeout_id for the expiration timers
+                                    // for volatile items
+
+    iomux_t *expirer_mux; // iomux used to handle the expiration timers
+    pthread_t expirer_th; // the thread taking care of propagating expiration commands
+    queue_t *expirer_queue; // the queue holding shedule/unschedule expiration jobs
+} shardcache_partition_t;
+
+typedef struct __shardcache_namespace_s shardcache_namespace_t;
  
 struct __shardcache_s {
     char *me;   // a copy of the label for this node
@@ -128,32 +242,32 @@ struct __shardcache_s {
 
     shardcache_replica_t *replica;
 
-    shardcache_node_t **shards; // a copy of the shards array provided
-                               // at construction time
+    shardcache_continuum_t *continuum; // the nodes provided at construction time
+                                       // (or set by the last migration)
+    shardcache_continuum_t *retired_continuum; // the continuum replaced by the last migration
+                                               // (see shardcache_continuum_retire())
 
-    int num_shards;   // the number of shards in the array
+    shardcache_partition_t *partitions; // the partitions of the keyspace
+    int num_partitions; // the number of partitions (fixed at creation time)
 
-    arc_t *arc;       // the internal arc instance
-    arc_ops_t ops;    // the structure holding the arc operations callbacks
-    size_t arc_size;  // the actual size of the arc cache
+    size_t arc_size;  // the actual size of the arc cache (the sum of all the partitions)
                       // NOTE: arc_size is updated using the atomic builtins,
                       // don't access it directly but use ATOMIC_READ() instead
                       // (see deps/libhl/src/atomic_defs.h)
-    size_t *arc_lists_size[4];
+
+    size_t large_threshold; // the large objects pool settings, applied to the
+    size_t large_size;      // namespaces arcs as well (see shardcache_large_object_pool())
 
     // lock used internally during the migration procedures
-    // and when selecting the node owner for a key
+    // (the owners of the keys are looked up without taking it)
 #ifdef __MACH__
     OSSpinLock migration_lock;
 #else
     pthread_spinlock_t migration_lock;
 #endif
 
-    chash_t *chash;   // the internal chash instance
-
-    chash_t *migration;                  // the migration continuum
-    shardcache_node_t **migration_shards; // the new shards array after the migration
-    int num_migration_shards;            // the new number of shards in the migration_shards array
+    shardcache_continuum_t *migration;   // the migration continuum
+                                         // (NULL if no migration is in progress)
     int migration_done;                  // boolean value indicating that the migration is complete
                                          // (to be accessed using ATOMIC_READ())
 
@@ -162,17 +276,6 @@ struct __shardcache_s {
 
     shardcache_storage_t storage;  // the structure holding the callbacks for the persistent storage 
 
-    hashtable_t *volatile_storage; // an hashtable used as volatile storage
-
-    hashtable_t *cache_timeouts; // hashtable holding the timeout_id of the expiration timers
-                                 // for cached objects
-    hashtable_t *volatile_timeouts; // hashtable holding the timeout_id for the expiration timers
-                                    // for volatile items
-
-    iomux_t *expirer_mux; // iomux used to handle the expiration timers
-    pthread_t expirer_th; // the thread taking care of propagating expiration commands
-    queue_t *expirer_queue; // the queue holding shedule/unschedule expiration jobs
-
     int arc_mode; // the arc mode to use **TODO - DOCUMENT**
 
     int cache_on_set; // cache the value on set commands (instead of waiting for a get
@@ -201,8 +304,44 @@ struct __shardcache_s {
                                 // by both the async reader and the serving workers
 
 
-    int serving_look_ahead;     // amount of pipelined requests to handle in parallel
+    int serving_look_ahead;     // max amount of pipelined requests to handle in parallel
                                 // while the current is being served
+    int serving_look_ahead_min; // the look-ahead of each connection is adjusted
+                                // between this and serving_look_ahead
+    int serving_latency_target; // completion time (in microsecs) above which the
+                                // look-ahead of a connection is decreased
+    int serving_quantum;        // bytes of requests served per connection in each
+                                // worker loop turn (deficit round-robin, 0 disables it)
+    int busy_poll;              // time (in microsecs) the busy polling workers keep
+                                // polling without finding anything to do before sleeping
+    int busy_poll_workers;      // number of workers busy polling (0 disables it)
+    int busy_poll_socket;       // SO_BUSY_POLL value set on the connections handled
+                                // by the busy polling workers (0 to leave it unset)
+
+    queue_t *prefetch_queue;    // keys waiting to be prefetched by the async i/o threads
+    int prefetch_max_inflight;  // max number of prefetches fetching at the same time
+
+    int warmup_max_items;       // max number of hot items to request to each peer
+                                // when a migration begins (0 disables the warm-up)
+    int warmup_rate;            // max number of hot items loaded per second
+    int warmup_running;         // number of (detached) warm-up threads still running
+    hashtable_t *warmup_invalidated; // the keys written, deleted or evicted while
+                                     // a warm-up is running (their hot items are stale)
+    hashtable_t *warmup_invalidated_prefixes; // the prefixes invalidated while
+                                              // a warm-up is running
+
+    l2cache_t *l2;              // the second-level cache (NULL if not enabled)
+
+    int write_pipeline_window;  // time (in microsecs) the writes forwarded to the owners
+                                // are held back to be batched/coalesced (0 disables it)
+    hashtable_t *write_pipelines;  // peer address -> write_pipeline_t
+    pthread_mutex_t write_pipelines_lock;
+    write_pipeline_stats_t write_pipeline_stats; // shared by all the pipelines
+
+    shardcache_namespace_t *namespaces[SHARDCACHE_NAMESPACES_MAX];
+                                // the namespaces defined so far
+                                // (slots are filled in order and never released
+                                //  until destruction, read them using ATOMIC_READ())
 
     shardcache_serving_t *serv; // the serving-subsystem instance
 
@@ -213,6 +352,38 @@ struct __shardcache_s {
 
     pthread_t evictor_th; // the evictor thread
 
+    pthread_t pool_keeper_th; // the thread probing/warming the pooled connections
+    int pool_keeper_kick;     // set to have the keeper run before its next round
+
+    keyfilter_t *keyfilter;   // the filter of the keys in the persistent storage
+                              // (NULL if the storage can't be indexed)
+    int storage_filter;       // boolean flag indicating if the filter is used
+                              // to answer the lookups for missing keys
+    pthread_t keyfilter_th;   // the thread (re)building the filter
+
+    int memory_limit;           // the memory (in megabytes) the governor keeps
+                                // the process within (0 disables the governor)
+    uint64_t mem[SHARDCACHE_MEM_NUM]; // the bytes in use by each subsystem
+                                      // (accessed using the atomic builtins)
+    uint64_t mem_total;         // the sum of all the subsystems
+    uint64_t mem_arc_target;    // the size the arcs are currently shrunk to
+    uint64_t mem_arc_configured; // the configured size mem_arc_target refers to
+                                 // (0 until the arcs are resized the first time)
+    uint64_t mem_rejected;      // new data refused because of the memory limit
+    int mem_pressure;           // set while new data is being refused
+    pthread_t governor_th;      // the memory governor thread
+
+    topk_t *hotkeys[SHARDCACHE_HOTKEYS_NUM]; // the trackers of the heaviest keys
+    int hotkeys_sample_rate;    // 1 every 'hotkeys_sample_rate' events is tracked
+                                // (0 disables the tracking)
+
+    slowlog_t *slowlog;         // the most recent slow requests
+    int slowlog_threshold;      // the microseconds after which a request is slow
+                                // (0 disables the slow log)
+    time_t slowlog_last_logged; // when a slow request has been last logged
+
+    slowlog_t *traces;          // the spans of the most recent sampled traces
+
     pthread_cond_t evictor_cond;  // condition variable used by the evictor thread
                                   // when waiting for new jobs (instead of actively
                                   // polling on the linked list used as queue)
@@ -225,7 +396,9 @@ struct __shardcache_s {
 #define SHARDCACHE_COUNTER_LABELS_ARRAY  \
         { "gets", "sets", "dels", "heads", "evicts", "expires", \
           "cache_misses", "fetch_remote", "fetch_local", "not_found", \
-          "volatile_table_size", "cache_size", "cached_items", "errors" }
+          "volatile_table_size", "cache_size", "cached_items", "errors", \
+          "prefetches", "prefetch_inflight", "prefetch_drops", "warmup_loaded", \
+          "invalidated_items", "dropped_requests" }
 
 #define SHARDCACHE_COUNTER_GETS             0
 #define SHARDCACHE_COUNTER_SETS             1
@@ -241,7 +414,13 @@ struct __shardcache_s {
 #define SHARDCACHE_COUNTER_CACHE_SIZE       11
 #define SHARDCACHE_COUNTER_CACHED_ITEMS     12
 #define SHARDCACHE_COUNTER_ERRORS           13
-#define SHARDCACHE_NUM_COUNTERS             14
+#define SHARDCACHE_COUNTER_PREFETCHES       14
+#define SHARDCACHE_COUNTER_PREFETCH_INFLIGHT 15
+#define SHARDCACHE_COUNTER_PREFETCH_DROPS   16
+#define SHARDCACHE_COUNTER_WARMUP_LOADED    17
+#define SHARDCACHE_COUNTER_INVALIDATED_ITEMS 18
+#define SHARDCACHE_COUNTER_DROPPED_REQUESTS 19
+#define SHARDCACHE_NUM_COUNTERS             20
     struct {
         const char *name; // the exported label of the counter
         uint64_t value;   // the actual value (accessed using the atomic builtins)
@@ -262,15 +441,212 @@ struct __shardcache_s {
     int quit;
 };
 
+/* A namespace, selected by a prefix of the keys.
+ * The keys in a namespace are cached in dedicated arc instances (one per
+ * partition) so that they don't compete for the cache with the other keys,
+ * and the expiration/caching settings apply to them in place of the global ones */
+struct __shardcache_namespace_s {
+    char *prefix;     // the prefix selecting the keys in this namespace
+    size_t plen;      // the length of the prefix
+
+    size_t size;      // the size of the cache for this namespace
+                      // (split among the partitions)
+    arc_t **arcs;     // the arc instances (one per partition, sharing the partition ops)
+    size_t *(*arc_lists_size)[5];
+
+    int expire_time;   // same as the homonymous settings in shardcache_t
+    int cache_on_set;  // but only applying to the keys in this namespace
+    int force_caching;
+
+    uint64_t cnt[SHARDCACHE_NUM_COUNTERS]; // the namespace counters (same indexes as
+                                           // the global ones, only some are exported)
+};
+
 typedef struct {
     void *data;
     size_t dlen;
     uint32_t expire;
 } volatile_object_t;
 
+/* Key descriptor. The hash is computed once, when the key enters the cache
+ * (either through the public API or while parsing a request), and is then
+ * carried through all the lookups done for that key */
+typedef struct {
+    void *key;
+    size_t klen;
+    uint64_t hash;
+    struct timeval *deadline; // when the requester will give up (NULL if never)
+} shardcache_key_t;
+
+#define SHARDCACHE_KEY(__k, __l) { (__k), (__l), arc_hash_key((__k), (__l)), NULL }
+
+/* The deadline of the lookup being done by the current thread (if any),
+ * the fetch callbacks invoked by the arc within the lookup use it to skip
+ * the work for requests which already expired and to propagate the
+ * remaining budget to the peers */
+extern __thread struct timeval *shardcache_fetch_deadline;
+
+/* Where the time of the lookup being done by the current thread (if any)
+ * went, filled by the fetch callbacks for the slow log */
+typedef struct {
+    int source;             // SLOWLOG_SOURCE_* flags
+    uint64_t storage_usecs; // the time spent in the storage fetch callback
+    struct timeval looked_up; // when the arc lookup returned
+    char peer[64];          // the owner the value has been fetched from (if any)
+    shardcache_trace_t linked; // the trace the fetch the lookup waited for has been
+                               // forwarded with, if not its own (id 0 if none)
+} shardcache_fetch_timing_t;
+
+extern __thread shardcache_fetch_timing_t *shardcache_fetch_timing;
+
+/* The trace context of the request being served by the current thread
+ * (if any), the commands forwarded to the peers on its behalf carry it */
+extern __thread shardcache_trace_t *shardcache_request_trace;
+
+/* The milliseconds left before a deadline.
+ * Returns 0 if there is no deadline, -1 if it already expired */
+static inline int
+shardcache_deadline_left(struct timeval *deadline)
+{
+    if (!deadline || (!deadline->tv_sec && !deadline->tv_usec))
+        return 0;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (timercmp(&now, deadline, >=))
+        return -1;
+    struct timeval left;
+    timersub(deadline, &now, &left);
+    int msecs = left.tv_sec * 1000 + left.tv_usec / 1000;
+    return msecs > 0 ? msecs : 1;
+}
+
+/* Extend a deadline to cover another one (an unset deadline means none) */
+static inline void
+shardcache_deadline_extend(struct timeval *deadline, struct timeval *other)
+{
+    if (!timerisset(deadline))
+        return;
+    if (!other || !timerisset(other))
+        timerclear(deadline);
+    else if (timercmp(other, deadline, >))
+        *deadline = *other;
+}
+
+/* The partition owning a key.
+ * The top bits of the hash are used since the lower ones
+ * are the ones addressing the key in the arc index */
+static inline int
+shardcache_partition_index(shardcache_t *cache, uint64_t hash)
+{
+    return cache->num_partitions > 1 ? (int)((hash >> 48) % cache->num_partitions) : 0;
+}
+
+static inline shardcache_partition_t *
+shardcache_partition(shardcache_t *cache, uint64_t hash)
+{
+    return &cache->partitions[shardcache_partition_index(cache, hash)];
+}
+
+/* The namespace of a key (the one with the longest matching prefix),
+ * NULL if the key doesn't belong to any namespace */
+static inline shardcache_namespace_t *
+shardcache_namespace(shardcache_t *cache, const void *key, size_t klen)
+{
+    shardcache_namespace_t *match = NULL;
+    int i;
+    for (i = 0; i < SHARDCACHE_NAMESPACES_MAX; i++) {
+        shardcache_namespace_t *ns = ATOMIC_READ(cache->namespaces[i]);
+        if (!ns)
+            break;
+        if (klen >= ns->plen && (!match || ns->plen > match->plen) &&
+            memcmp(key, ns->prefix, ns->plen) == 0)
+        {
+            match = ns;
+        }
+    }
+    return match;
+}
+
+/* The arc instance of a partition caching the keys of the given namespace
+ * (NULL for the keys outside of any namespace) */
+static inline arc_t *
+shardcache_partition_arc(shardcache_partition_t *part, shardcache_namespace_t *ns)
+{
+    return ns ? ns->arcs[part->index] : part->arc;
+}
+
+static inline arc_t *
+shardcache_arc(shardcache_t *cache, shardcache_namespace_t *ns, uint64_t hash)
+{
+    return shardcache_partition_arc(shardcache_partition(cache, hash), ns);
+}
+
+/* Returns false if the key is definitely not in the persistent storage
+ * (according to the key filter), true if it might be */
+static inline int
+shardcache_storage_maybe_has(shardcache_t *cache, uint64_t hash)
+{
+    return (!cache->keyfilter ||
+            !ATOMIC_READ(cache->storage_filter) ||
+            keyfilter_check(cache->keyfilter, hash));
+}
+
+// the value of a setting for the keys in a namespace (or the global one)
+#define SHARDCACHE_NS_OPTION(__c, __ns, __o) ((__ns) ? (__ns)->__o : (__c)->__o)
+
+// increment both the global counter and the namespace one (if any)
+#define SHARDCACHE_NS_COUNTER_INCREMENT(__c, __ns, __n) \
+{ \
+    ATOMIC_INCREMENT((__c)->cnt[__n].value); \
+    if (__ns) \
+        ATOMIC_INCREMENT((__ns)->cnt[__n]); \
+}
+
+// invalidate a prefix on this node and, if 'broadcast' is true,
+// on all the other nodes (through the evictor)
+int shardcache_invalidate_internal(shardcache_t *cache, void *prefix, size_t plen, int broadcast);
+
+int shardcache_get_async_key(shardcache_t *cache,
+                             shardcache_key_t *key,
+                             shardcache_get_async_callback_t cb,
+                             void *priv);
+
+int shardcache_get_offset_async_key(shardcache_t *cache,
+                                    shardcache_key_t *key,
+                                    size_t offset,
+                                    size_t length,
+                                    shardcache_get_async_callback_t cb,
+                                    void *priv);
+
 int shardcache_test_migration_ownership(shardcache_t *cache,
         void *key, size_t klen, char *owner, size_t *len);
 
+/* Look up the node owning a key (without taking any lock).
+ * If migration is true the key is looked up in the migration continuum,
+ * otherwise in the current one. The node stored in *owner stays valid
+ * even if the migration ends (or is aborted) in the meanwhile, until
+ * the following swap releases the continuum it belongs to.
+ * Returns 1 if the key is owned by this node, 0 if owned by a peer and -1
+ * if there is no migration in progress (when migration is true) */
+int shardcache_owner_lookup(shardcache_t *cache,
+                            void *key,
+                            size_t klen,
+                            int migration,
+                            shardcache_node_t **owner);
+
+/* Look up the node owning a key first in the migration continuum
+ * (if a migration is in progress) and then in the current one */
+int shardcache_key_owner(shardcache_t *cache,
+                         void *key,
+                         size_t klen,
+                         shardcache_node_t **owner);
+
+/* Returns the index of the node with the given label in the continuum
+ * (-1 if not found) */
+int shardcache_continuum_node_index(shardcache_continuum_t *continuum,
+                                    const char *label,
+                                    size_t label_len);
+
 int shardcache_get_connection_for_peer(shardcache_t *cache, char *peer);
 
 void shardcache_release_connection_for_peer(shardcache_t *cache, char *peer, int fd);
@@ -300,5 +676,42 @@ int shardcache_unschedule_expiration(shardcache_t *cache, void *key, size_t klen
 
 void shardcache_queue_async_read_wrk(shardcache_t *cache, async_read_wrk_t *wrk);
 
+// the number of objects cached in all the partitions
+size_t shardcache_cached_items(shardcache_t *cache);
+
+// collect (at most max_items of) the most frequently used objects which are
+// moving to the node 'label' under the migration continuum.
+// Returns the number of collected items, -1 if there is no migration in progress
+int shardcache_get_hot_set(shardcache_t *cache,
+                           char *label,
+                           size_t label_len,
+                           int max_items,
+                           fbuf_t *out);
+
+// account a key in one of the trackers of the heaviest keys
+// (SHARDCACHE_HOTKEYS_*), the events are sampled
+void shardcache_hotkeys_track(shardcache_t *cache,
+                              int tracker,
+                              void *key,
+                              size_t klen,
+                              uint64_t hash,
+                              uint64_t weight);
+
+// write the report of the heaviest keys (as served by the STATS command)
+void shardcache_get_hotkeys(shardcache_t *cache, fbuf_t *out);
+
+// account a request which took longer than the slow log threshold
+// (the entry is logged at most once per second)
+void shardcache_slowlog_add(shardcache_t *cache, slowlog_entry_t *entry);
+
+// write the report of the slow requests (as served by the STATS command)
+void shardcache_get_slowlog(shardcache_t *cache, fbuf_t *out);
+
+// record the span of a request belonging to a sampled trace
+void shardcache_trace_add(shardcache_t *cache, slowlog_entry_t *entry);
+
+// write the spans of the sampled traces (as served by the STATS command)
+void shardcache_get_traces(shardcache_t *cache, fbuf_t *out);
+
 // vim: tabstop=4 shiftwidth=4 expandtab:
 /* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
@@ -11,6 +11,7 @@
 
 struct __shardcache_node_s {
     char *label;
+    size_t label_len;
     char **address;
     int num_replicas;
     char *string;
@@ -66,6 +67,7 @@ shardcache_node_create_from_string(char *str)
 
     shardcache_node_t *node = malloc(sizeof(shardcache_node_t));
     node->label = strdup(label);
+    node->label_len = strlen(label);
     node->address = addrlist;
     node->string = strdup(str);
     node->num_replicas = num_addresses;
@@ -80,6 +82,7 @@ shardcache_node_create(char *label, char **addresses, int num_addresses)
     int i;
     shardcache_node_t *node = calloc(1, sizeof(shardcache_node_t));
     node->label = strdup(label);
+    node->label_len = strlen(label);
     node->num_replicas = num_addresses;
     node->address = calloc(num_addresses, sizeof(char *));
     int slen = strlen(node->label) + 3;
@@ -104,6 +107,7 @@ shardcache_node_copy(shardcache_node_t *node)
 
     shardcache_node_t *copy = malloc(sizeof(shardcache_node_t));
     copy->label = strdup(node->label);
+    copy->label_len = node->label_len;
     copy->address = malloc(sizeof(char *) * node->num_replicas);
     for (i = 0; i < node->num_replicas; i++)
         copy->address[i] = strdup(node->address[i]);
@@ -146,26 +150,32 @@ shardcache_node_t *
 shardcache_node_select(shardcache_t *cache, char *label)
 {
     shardcache_node_t *node = NULL;
-    int i;
-    for (i = 0; i < cache->num_shards; i++ ){
-        if (strcmp(cache->shards[i]->label, label) == 0) {
-            node = cache->shards[i];
-            break;
-        }
-    }
+    size_t label_len = strlen(label);
     SPIN_LOCK(&cache->migration_lock);
-    if (cache->migration && !node) {
-        for (i = 0; i < cache->num_migration_shards; i++) {
-            if (strcmp(cache->migration_shards[i]->label, label) == 0) {
-                node = cache->migration_shards[i];
-                break;
-            }
-        }
+    int i = shardcache_continuum_node_index(cache->continuum, label, label_len);
+    if (i >= 0) {
+        node = cache->continuum->nodes[i];
+    } else if (cache->migration) {
+        i = shardcache_continuum_node_index(cache->migration, label, label_len);
+        if (i >= 0)
+            node = cache->migration->nodes[i];
     }
     SPIN_UNLOCK(&cache->migration_lock);
     return node;
 }
 
+int
+shardcache_continuum_node_index(shardcache_continuum_t *continuum, const char *label, size_t label_len)
+{
+    int i;
+    for (i = 0; i < continuum->num_nodes; i++) {
+        shardcache_node_t *node = continuum->nodes[i];
+        if (node->label_len == label_len && memcmp(node->label, label, label_len) == 0)
+            return i;
+    }
+    return -1;
+}
+
 int
 shardcache_node_num_addresses(shardcache_node_t *node)
 {
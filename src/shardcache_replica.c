@@ -330,11 +330,18 @@ kepaxos_send(char **recipients,
         connection->ctx = async_read_context_create((char *)replica->shc->auth,
                                                     kepaxos_connection_append_input_data,
                                                     connection);
-        shardcache_record_t record = {
-            .v = cmd,
-            .l = cmd_len
+        shardcache_record_t record[2] = {
+            {
+                .v = cmd,
+                .l = cmd_len
+            }
         };
-        int rc = build_message((char *)replica->shc->auth, 0, SHC_HDR_REPLICA_COMMAND, &record, 1, &connection->output);
+        // the commands run on behalf of a traced request carry its trace context
+        unsigned char trace_buf[SHC_TRACE_RECORD_LEN];
+        if (shardcache_request_trace)
+            build_trace_record(shardcache_request_trace, trace_buf, &record[1]);
+        int rc = build_message((char *)replica->shc->auth, 0, SHC_HDR_REPLICA_COMMAND,
+                               record, shardcache_request_trace ? 2 : 1, &connection->output);
         if (rc == 0) {
 
             iomux_callbacks_t callbacks = {
@@ -526,7 +533,7 @@ shardcache_replica_recover(void *priv)
         fbuf_t data = FBUF_STATIC_INITIALIZER;
         // TODO - use fetch_from_peer_async() so that the download
         //        can be stopped earlier if the recovery is aborted
-        rc = fetch_from_peer(item->peer, (char *)replica->shc->auth, 0, item->key, item->klen, &data, fd);
+        rc = fetch_from_peer(item->peer, (char *)replica->shc->auth, 0, item->key, item->klen, 0, NULL, &data, fd);
         if (rc == 0) {
             void *check = NULL;
             rc = ht_delete(replica->recovery, item->key, item->klen, &check, NULL);
@@ -180,6 +180,29 @@ typedef size_t (*shardcache_count_items_callback_t)(void *priv);
 typedef size_t (*shardcache_get_index_callback_t)
     (shardcache_storage_index_item_t *index, size_t isize, void *priv);
 
+/**
+ * @brief Callback to fetch a page of the index of stored keys.
+ *
+ *        Allows shardcache to walk the index without materializing it
+ *        all at once (which is what the index callback requires).
+ *
+ * @param index  An array of shardcache_storage_index_item_t structures
+ *               to hold the page
+ * @param isize  The number of slots in the provided index array
+ * @param cursor A pointer to an opaque position in the index.
+ *               It's 0 when the first page is requested and the callback
+ *               must update it to point to the next page, or set it
+ *               to 0 if there are no more items
+ * @param priv   The priv pointer owned by the storage
+ *
+ * @return The number of items stored in the index array
+ * @note The keys stored in the index array will be released by the caller
+ * @note The page might contain less than isize items even if the cursor
+ *       is not 0 (the caller will just ask for the next page)
+ */
+typedef size_t (*shardcache_get_index_page_callback_t)
+    (shardcache_storage_index_item_t *index, size_t isize, uint64_t *cursor, void *priv);
+
 /**
  * @brief Callback used to notify the underlying storage about the creation of a new worker thread
  *
@@ -283,6 +306,14 @@ struct __shardcache_storage_s {
      */
     void                                   *priv;
 
+    /**
+     * @brief Optional callback which returns the index in pages
+     * @note If not set, paged index requests will be answered with the full
+     *       index (as returned by the index callback) in a single page
+     * @note check shardcache_get_index_page() documentation for more details
+     */
+    shardcache_get_index_page_callback_t   index_page;
+
     // the members of this structure are used internally by libshardcache to store the symbols
     // extrated from the loadable storage plugins.
     // The storage itself should never try accessing/modifying them
@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <atomic_defs.h>
+
+#include "slowlog.h"
+
+struct __slowlog {
+    pthread_mutex_t lock;
+    slowlog_entry_t *entries;
+    int size;
+    uint64_t added; // the next entry is written at (added % size)
+};
+
+slowlog_t *
+slowlog_create(int size)
+{
+    slowlog_t *log = calloc(1, sizeof(slowlog_t));
+    pthread_mutex_init(&log->lock, NULL);
+    log->size = size > 0 ? size : 1;
+    log->entries = calloc(log->size, sizeof(slowlog_entry_t));
+    return log;
+}
+
+void
+slowlog_destroy(slowlog_t *log)
+{
+    pthread_mutex_destroy(&log->lock);
+    free(log->entries);
+    free(log);
+}
+
+void
+slowlog_add(slowlog_t *log, slowlog_entry_t *entry)
+{
+    pthread_mutex_lock(&log->lock);
+    memcpy(&log->entries[log->added % log->size], entry, sizeof(slowlog_entry_t));
+    ATOMIC_INCREMENT(log->added);
+    pthread_mutex_unlock(&log->lock);
+}
+
+int
+slowlog_get(slowlog_t *log, slowlog_entry_t *entries, int max)
+{
+    pthread_mutex_lock(&log->lock);
+    int count = log->added < log->size ? log->added : log->size;
+    if (count > max)
+        count = max;
+    int i;
+    for (i = 0; i < count; i++)
+        entries[i] = log->entries[(log->added - 1 - i) % log->size];
+    pthread_mutex_unlock(&log->lock);
+    return count;
+}
+
+uint64_t
+slowlog_count(slowlog_t *log)
+{
+    return ATOMIC_READ(log->added);
+}
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
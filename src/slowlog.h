@@ -0,0 +1,90 @@
+/**
+ * @file slowlog.h
+ * @brief In-memory ring of the slowest requests
+ *
+ * Each entry holds the breakdown of the time spent by a request in the
+ * different phases of its processing, the oldest entries are overwritten
+ * once the ring is full.
+ */
+#ifndef __SLOWLOG_H__
+#define __SLOWLOG_H__
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdint.h>
+
+// the (leading) bytes of the keys kept in the entries
+#define SLOWLOG_KEY_MAX 64
+
+typedef enum {
+    SLOWLOG_PHASE_PARSE = 0, // receiving the request
+    SLOWLOG_PHASE_QUEUE,     // waiting for a worker to process it
+    SLOWLOG_PHASE_LOOKUP,    // looking up the cache (including the local fetches)
+                             // or executing the command
+    SLOWLOG_PHASE_STORAGE,   // fetching from the storage (part of the lookup)
+    SLOWLOG_PHASE_WAIT,      // waiting for the value to be fetched (by a peer
+                             // or by another request for the same key)
+    SLOWLOG_PHASE_TRANSFER,  // receiving the value
+    SLOWLOG_PHASE_FLUSH,     // waiting for the response to be handed to the socket
+    SLOWLOG_NUM_PHASES
+} slowlog_phase_t;
+
+#define SLOWLOG_PHASE_LABELS_ARRAY \
+        { "parse", "queue", "lookup", "storage", "wait", "transfer", "flush" }
+
+// where the value came from
+#define SLOWLOG_SOURCE_STORAGE 0x01 // the value has been fetched from the storage
+#define SLOWLOG_SOURCE_PEER    0x02 // the value has been fetched from its owner
+#define SLOWLOG_SOURCE_WAITED  0x04 // the value wasn't complete at lookup time
+
+typedef struct {
+    struct timeval received;  // when the request started being received
+    unsigned char hdr;        // the command
+    uint64_t hash;            // the hash of the key
+    uint64_t trace_id;        // the trace the request belongs to (0 if none)
+    uint64_t linked_trace_id; // the trace of the peer fetch the request waited
+                              // for, if not its own (0 if none)
+    char key[SLOWLOG_KEY_MAX];
+    size_t klen;              // the actual length of the key
+    char peer[64];            // the owner the value has been fetched from (if any)
+    int source;               // SLOWLOG_SOURCE_* flags
+    uint64_t total;           // the time (in microseconds) taken by the request
+    uint64_t phases[SLOWLOG_NUM_PHASES]; // the time (in microseconds) spent in each phase
+} slowlog_entry_t;
+
+typedef struct __slowlog slowlog_t;
+
+/**
+ * @brief Create a new ring
+ * @param size The number of entries kept
+ * @return A newly initialized ring
+ */
+slowlog_t *slowlog_create(int size);
+
+/**
+ * @brief Release all the resources used by the ring
+ */
+void slowlog_destroy(slowlog_t *log);
+
+/**
+ * @brief Add (a copy of) an entry, replacing the oldest one if the ring is full
+ */
+void slowlog_add(slowlog_t *log, slowlog_entry_t *entry);
+
+/**
+ * @brief Get the entries, the most recent first
+ * @param entries A buffer able to hold up to 'max' entries
+ * @param max     The maximum number of entries to return
+ * @return The number of entries copied to the buffer
+ */
+int slowlog_get(slowlog_t *log, slowlog_entry_t *entries, int max);
+
+/**
+ * @brief Returns the number of entries added since the ring has been created
+ */
+uint64_t slowlog_count(slowlog_t *log);
+
+#endif /* __SLOWLOG_H__ */
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
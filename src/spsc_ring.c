@@ -0,0 +1,92 @@
+#include <stdlib.h>
+
+#include "spsc_ring.h"
+
+#define SPSC_RING_CACHELINE 64
+
+#define LOAD_ACQUIRE(__p) __atomic_load_n(&(__p), __ATOMIC_ACQUIRE)
+#define LOAD_RELAXED(__p) __atomic_load_n(&(__p), __ATOMIC_RELAXED)
+#define STORE_RELEASE(__p, __v) __atomic_store_n(&(__p), (__v), __ATOMIC_RELEASE)
+
+struct __spsc_ring {
+    // producer side
+    size_t head;
+    size_t cached_tail; // the last tail seen by the producer
+    char pad1[SPSC_RING_CACHELINE - 2 * sizeof(size_t)];
+
+    // consumer side
+    size_t tail;
+    size_t cached_head; // the last head seen by the consumer
+    char pad2[SPSC_RING_CACHELINE - 2 * sizeof(size_t)];
+
+    size_t mask;
+    void **slots;
+};
+
+spsc_ring_t *
+spsc_ring_create(size_t size)
+{
+    size_t slots = 2;
+    while (slots < size)
+        slots <<= 1;
+
+    spsc_ring_t *ring = NULL;
+    if (posix_memalign((void **)&ring, SPSC_RING_CACHELINE, sizeof(spsc_ring_t)) != 0)
+        return NULL;
+
+    ring->head = ring->cached_tail = 0;
+    ring->tail = ring->cached_head = 0;
+    ring->mask = slots - 1;
+    ring->slots = calloc(slots, sizeof(void *));
+    if (!ring->slots) {
+        free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+void
+spsc_ring_destroy(spsc_ring_t *ring)
+{
+    free(ring->slots);
+    free(ring);
+}
+
+int
+spsc_ring_push(spsc_ring_t *ring, void *value)
+{
+    size_t head = ring->head;
+    if (head - ring->cached_tail > ring->mask) {
+        // looks full, refresh our copy of the consumer index
+        ring->cached_tail = LOAD_ACQUIRE(ring->tail);
+        if (head - ring->cached_tail > ring->mask)
+            return -1;
+    }
+    ring->slots[head & ring->mask] = value;
+    STORE_RELEASE(ring->head, head + 1);
+    return 0;
+}
+
+void *
+spsc_ring_pop(spsc_ring_t *ring)
+{
+    size_t tail = ring->tail;
+    if (tail == ring->cached_head) {
+        // looks empty, refresh our copy of the producer index
+        ring->cached_head = LOAD_ACQUIRE(ring->head);
+        if (tail == ring->cached_head)
+            return NULL;
+    }
+    void *value = ring->slots[tail & ring->mask];
+    STORE_RELEASE(ring->tail, tail + 1);
+    return value;
+}
+
+size_t
+spsc_ring_count(spsc_ring_t *ring)
+{
+    return LOAD_RELAXED(ring->head) - LOAD_RELAXED(ring->tail);
+}
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
@@ -0,0 +1,52 @@
+/**
+ * @file spsc_ring.h
+ * @brief Bounded lock-free single-producer/single-consumer ring
+ *
+ * Used to hand requests over between the serving workers when the keyspace
+ * is split in per-core partitions. Exactly one thread may push and exactly
+ * one (possibly different) thread may pop, no locks are taken on either side
+ * and the producer and consumer indexes live on separate cache lines.
+ */
+#ifndef __SPSC_RING_H__
+#define __SPSC_RING_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+typedef struct __spsc_ring spsc_ring_t;
+
+/**
+ * @brief Create a new ring
+ * @param size The number of slots (rounded up to the next power of 2)
+ * @return A newly initialized ring
+ */
+spsc_ring_t *spsc_ring_create(size_t size);
+
+/**
+ * @brief Release all the resources used by the ring
+ * @note The values still in the ring are not touched
+ */
+void spsc_ring_destroy(spsc_ring_t *ring);
+
+/**
+ * @brief Push a value (producer side)
+ * @return 0 on success, -1 if the ring is full
+ */
+int spsc_ring_push(spsc_ring_t *ring, void *value);
+
+/**
+ * @brief Pop a value (consumer side)
+ * @return The oldest value in the ring, NULL if empty
+ */
+void *spsc_ring_pop(spsc_ring_t *ring);
+
+/**
+ * @brief Returns the number of values in the ring
+ * @note The result is only an estimate if called while the ring is in use
+ */
+size_t spsc_ring_count(spsc_ring_t *ring);
+
+#endif /* __SPSC_RING_H__ */
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <atomic_defs.h>
+
+#include "topk.h"
+
+typedef struct {
+    uint64_t hash;
+    topk_item_t item;
+} topk_entry_t;
+
+struct __topk {
+    pthread_mutex_t lock;
+    topk_mode_t mode;
+    int half_life;
+    time_t last_decay;
+    int capacity;
+    int used;
+    uint64_t floor; // the lowest count once all the entries are used
+    topk_entry_t *entries;
+};
+
+topk_t *
+topk_create(int capacity, topk_mode_t mode, int half_life)
+{
+    topk_t *tk = calloc(1, sizeof(topk_t));
+    pthread_mutex_init(&tk->lock, NULL);
+    tk->capacity = capacity > 0 ? capacity : 1;
+    tk->mode = mode;
+    tk->half_life = half_life;
+    tk->last_decay = time(NULL);
+    tk->entries = calloc(tk->capacity, sizeof(topk_entry_t));
+    return tk;
+}
+
+void
+topk_destroy(topk_t *tk)
+{
+    pthread_mutex_destroy(&tk->lock);
+    free(tk->entries);
+    free(tk);
+}
+
+static inline int
+topk_entry_match(topk_entry_t *entry, void *key, size_t klen, uint64_t hash)
+{
+    return (entry->hash == hash && entry->item.klen == klen &&
+            memcmp(entry->item.key, key, klen < TOPK_KEY_MAX ? klen : TOPK_KEY_MAX) == 0);
+}
+
+static inline void
+topk_entry_set(topk_entry_t *entry, void *key, size_t klen, uint64_t hash)
+{
+    entry->hash = hash;
+    entry->item.klen = klen;
+    memcpy(entry->item.key, key, klen < TOPK_KEY_MAX ? klen : TOPK_KEY_MAX);
+}
+
+static int
+topk_min(topk_t *tk)
+{
+    int i, min = 0;
+    for (i = 1; i < tk->used; i++) {
+        if (tk->entries[i].item.count < tk->entries[min].item.count)
+            min = i;
+    }
+    return min;
+}
+
+static void
+topk_decay(topk_t *tk)
+{
+    time_t now = time(NULL);
+    if (now - tk->last_decay < tk->half_life)
+        return;
+
+    int i;
+    for (i = 0; i < tk->used; i++) {
+        tk->entries[i].item.count >>= 1;
+        tk->entries[i].item.error >>= 1;
+    }
+    tk->last_decay = now;
+}
+
+void
+topk_add(topk_t *tk, void *key, size_t klen, uint64_t hash, uint64_t weight)
+{
+    // in max mode most of the weights can be discarded without locking
+    if (tk->mode == TOPK_MODE_MAX && weight <= ATOMIC_READ(tk->floor))
+        return;
+
+    pthread_mutex_lock(&tk->lock);
+
+    if (tk->half_life)
+        topk_decay(tk);
+
+    topk_entry_t *entry = NULL;
+    int i;
+    for (i = 0; i < tk->used; i++) {
+        if (topk_entry_match(&tk->entries[i], key, klen, hash)) {
+            entry = &tk->entries[i];
+            break;
+        }
+    }
+
+    if (entry) {
+        if (tk->mode == TOPK_MODE_SUM)
+            entry->item.count += weight;
+        else if (weight > entry->item.count)
+            entry->item.count = weight;
+    } else if (tk->used < tk->capacity) {
+        entry = &tk->entries[tk->used++];
+        topk_entry_set(entry, key, klen, hash);
+        entry->item.count = weight;
+        entry->item.error = 0;
+    } else {
+        entry = &tk->entries[topk_min(tk)];
+        if (tk->mode == TOPK_MODE_SUM) {
+            // the new key might have been seen as many times
+            // as the one it replaces
+            entry->item.error = entry->item.count;
+            entry->item.count += weight;
+            topk_entry_set(entry, key, klen, hash);
+        } else if (weight > entry->item.count) {
+            entry->item.count = weight;
+            topk_entry_set(entry, key, klen, hash);
+        }
+    }
+
+    if (tk->mode == TOPK_MODE_MAX && tk->used == tk->capacity)
+        ATOMIC_SET(tk->floor, tk->entries[topk_min(tk)].item.count);
+
+    pthread_mutex_unlock(&tk->lock);
+}
+
+static int
+topk_item_cmp(const void *a, const void *b)
+{
+    const topk_item_t *ia = (const topk_item_t *)a;
+    const topk_item_t *ib = (const topk_item_t *)b;
+    return (ia->count < ib->count) - (ia->count > ib->count);
+}
+
+int
+topk_get(topk_t *tk, topk_item_t *items, int max)
+{
+    pthread_mutex_lock(&tk->lock);
+    int i, count = tk->used;
+    topk_item_t *all = malloc(sizeof(topk_item_t) * (count ? count : 1));
+    for (i = 0; i < count; i++)
+        all[i] = tk->entries[i].item;
+    pthread_mutex_unlock(&tk->lock);
+
+    qsort(all, count, sizeof(topk_item_t), topk_item_cmp);
+
+    if (count > max)
+        count = max;
+    memcpy(items, all, sizeof(topk_item_t) * count);
+    free(all);
+    return count;
+}
+
+void
+topk_clear(topk_t *tk)
+{
+    pthread_mutex_lock(&tk->lock);
+    tk->used = 0;
+    ATOMIC_SET(tk->floor, 0);
+    tk->last_decay = time(NULL);
+    pthread_mutex_unlock(&tk->lock);
+}
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
@@ -0,0 +1,74 @@
+/**
+ * @file topk.h
+ * @brief Bounded tracker of the heaviest keys in a stream
+ *
+ * In sum mode the tracker implements the space-saving algorithm: a fixed
+ * number of counters, when a key which is not tracked shows up it takes
+ * over the counter with the lowest count (inheriting it as its error).
+ * The counts are halved every half-life so that the tracker follows the
+ * recent traffic.
+ * In max mode the tracker keeps the keys with the greatest weights
+ * (e.g. the largest values) seen so far.
+ */
+#ifndef __TOPK_H__
+#define __TOPK_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+// the (leading) bytes of the keys kept by the tracker
+#define TOPK_KEY_MAX 256
+
+typedef struct __topk topk_t;
+
+typedef enum {
+    TOPK_MODE_SUM = 0, // the weights of a key are summed
+    TOPK_MODE_MAX      // only the greatest weight of a key is kept
+} topk_mode_t;
+
+typedef struct {
+    char key[TOPK_KEY_MAX];
+    size_t klen;    // the actual length of the key (might exceed TOPK_KEY_MAX)
+    uint64_t count; // the (estimated) count
+    uint64_t error; // the maximum overestimation of the count (sum mode only)
+} topk_item_t;
+
+/**
+ * @brief Create a new tracker
+ * @param capacity  The number of keys tracked
+ * @param mode      The tracking mode
+ * @param half_life The time (in seconds) after which the counts
+ *                  are halved (0 to never decay them)
+ * @return A newly initialized tracker
+ */
+topk_t *topk_create(int capacity, topk_mode_t mode, int half_life);
+
+/**
+ * @brief Release all the resources used by the tracker
+ */
+void topk_destroy(topk_t *tk);
+
+/**
+ * @brief Account a key
+ * @param hash   The hash of the key (as returned by arc_hash_key())
+ * @param weight The weight to add (sum mode) or to compare (max mode)
+ */
+void topk_add(topk_t *tk, void *key, size_t klen, uint64_t hash, uint64_t weight);
+
+/**
+ * @brief Get the tracked keys, sorted by count (the greatest first)
+ * @param items A buffer able to hold up to 'max' items
+ * @param max   The maximum number of items to return
+ * @return The number of items copied to the buffer
+ */
+int topk_get(topk_t *tk, topk_item_t *items, int max);
+
+/**
+ * @brief Forget all the tracked keys
+ */
+void topk_clear(topk_t *tk);
+
+#endif /* __TOPK_H__ */
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
@@ -0,0 +1,429 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <hashtable.h>
+#include <fbuf.h>
+
+#include <atomic_defs.h>
+
+#include "shardcache_internal.h" // for MUTEX_* macros
+
+#include "messaging.h"
+#include "write_pipeline.h"
+
+// a writer waiting for a (possibly coalesced) write to be acknowledged
+typedef struct __write_pipeline_listener {
+    struct __write_pipeline_listener *next;
+    write_pipeline_callback_t cb;
+    void *priv;
+} write_pipeline_listener_t;
+
+typedef struct __write_pipeline_entry {
+    struct __write_pipeline_entry *next;
+    unsigned char hdr;
+    void *key;
+    size_t klen;
+    void *value;
+    size_t vlen;
+    uint32_t expire;
+    write_pipeline_listener_t *listeners;
+    write_pipeline_listener_t *last_listener;
+} write_pipeline_entry_t;
+
+struct __write_pipeline {
+    char *peer;
+    char *auth;
+    int tcp_timeout;
+    int window;
+    int batch_max;
+    int fd; // the persistent connection to the peer (-1 if not connected)
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_cond_t drained_cond;
+
+    write_pipeline_entry_t *head; // the writes waiting to be flushed
+    write_pipeline_entry_t *tail;
+    hashtable_t *pending;         // key -> the queued write which can be coalesced
+    struct timeval oldest;        // when the oldest queued write has been pushed
+    uint64_t queued;              // the writes queued so far (not counting the coalesced ones)
+    uint64_t acked;               // the writes acknowledged so far
+    int draining;                 // the writers waiting for the queue to be drained
+
+    int refcnt;
+    int quit;
+    write_pipeline_stats_t *stats;
+};
+
+static void
+write_pipeline_entry_destroy(write_pipeline_entry_t *entry)
+{
+    write_pipeline_listener_t *listener = entry->listeners;
+    while (listener) {
+        write_pipeline_listener_t *next = listener->next;
+        free(listener);
+        listener = next;
+    }
+    free(entry->key);
+    free(entry->value);
+    free(entry);
+}
+
+static void
+write_pipeline_entry_notify(write_pipeline_entry_t *entry, int rc)
+{
+    write_pipeline_listener_t *listener = entry->listeners;
+    while (listener) {
+        if (listener->cb)
+            listener->cb(entry->key, entry->klen, rc, listener->priv);
+        listener = listener->next;
+    }
+}
+
+static int
+write_pipeline_read_response(write_pipeline_t *wp)
+{
+    shardcache_hdr_t hdr = 0;
+    fbuf_t resp = FBUF_STATIC_INITIALIZER;
+    fbuf_t *respp = &resp;
+    int rc = -2; // connection error
+    int num_records = read_message(wp->fd, wp->auth, &respp, 1, &hdr, 0);
+    if (hdr == SHC_HDR_RESPONSE && num_records == 1) {
+        char *res = fbuf_data(&resp);
+        rc = -1;
+        if (res && fbuf_used(&resp) == 1) {
+            if (*res == SHC_RES_OK)
+                rc = 0;
+            else if (*res == SHC_RES_EXISTS)
+                rc = 1;
+        }
+    }
+    fbuf_destroy(&resp);
+    return rc;
+}
+
+// send a batch of writes and acknowledge them in order.
+// Called by the pipeline thread without holding the lock
+static void
+write_pipeline_flush(write_pipeline_t *wp, write_pipeline_entry_t *batch)
+{
+    fbuf_t out = FBUF_STATIC_INITIALIZER;
+    int rc = -1;
+
+    if (wp->fd < 0)
+        wp->fd = connect_to_peer(wp->peer, wp->tcp_timeout);
+
+    if (wp->fd >= 0) {
+        rc = 0;
+        write_pipeline_entry_t *entry = batch;
+        while (entry && rc == 0) {
+            uint32_t expire_nbo = htonl(entry->expire);
+            shardcache_record_t records[3] = {
+                { .v = entry->key,   .l = entry->klen },
+                { .v = entry->value, .l = entry->vlen },
+                { .v = &expire_nbo,  .l = sizeof(uint32_t) }
+            };
+            int num_records = (entry->hdr == SHC_HDR_DELETE) ? 1 : (entry->expire ? 3 : 2);
+            rc = build_message(wp->auth, SHC_HDR_SIGNATURE_SIP, entry->hdr, records, num_records, &out);
+            entry = entry->next;
+        }
+
+        if (rc == 0) {
+            fcntl(wp->fd, F_SETFL, fcntl(wp->fd, F_GETFL, 0) & ~O_NONBLOCK);
+            while (fbuf_used(&out) > 0) {
+                int wb = fbuf_write(&out, wp->fd, 0);
+                if (wb == 0 || (wb == -1 && errno != EINTR && errno != EAGAIN)) {
+                    SHC_WARNING("Can't send the pipelined writes to %s: %s",
+                                wp->peer, strerror(errno));
+                    rc = -1;
+                    break;
+                }
+            }
+        }
+    }
+    fbuf_destroy(&out);
+
+    ATOMIC_INCREMENT(wp->stats->batches);
+
+    // the responses arrive in the same order the commands have been sent
+    while (batch) {
+        write_pipeline_entry_t *entry = batch;
+        batch = entry->next;
+
+        int res = -1;
+        if (rc == 0) {
+            res = write_pipeline_read_response(wp);
+            if (res == -2) {
+                // the connection is broken, the remaining writes fail as well
+                SHC_WARNING("Can't read the pipelined responses from %s", wp->peer);
+                rc = -1;
+                res = -1;
+            }
+        }
+        if (rc != 0)
+            ATOMIC_INCREMENT(wp->stats->errors);
+
+        write_pipeline_entry_notify(entry, res);
+        write_pipeline_entry_destroy(entry);
+    }
+
+    if (rc != 0 && wp->fd >= 0) {
+        close(wp->fd);
+        wp->fd = -1;
+    }
+}
+
+static void *
+write_pipeline_run(void *priv)
+{
+    write_pipeline_t *wp = (write_pipeline_t *)priv;
+
+    MUTEX_LOCK(&wp->lock);
+    while (!wp->quit) {
+        if (!wp->head) {
+            pthread_cond_wait(&wp->cond, &wp->lock);
+            continue;
+        }
+
+        // give the writers some time to fill the batch
+        // (unless someone is waiting for the queue to be drained)
+        struct timeval now, deadline;
+        struct timeval window = { wp->window / 1000000, wp->window % 1000000 };
+        timeradd(&wp->oldest, &window, &deadline);
+        gettimeofday(&now, NULL);
+        if (!wp->draining && timercmp(&now, &deadline, <)) {
+            struct timespec abstime = { deadline.tv_sec, deadline.tv_usec * 1000 };
+            pthread_cond_timedwait(&wp->cond, &wp->lock, &abstime);
+            continue;
+        }
+
+        // detach the batch, the writes in it can't be coalesced anymore
+        write_pipeline_entry_t *batch = wp->head;
+        write_pipeline_entry_t *last = NULL;
+        int count = 0;
+        while (wp->head && count < wp->batch_max) {
+            last = wp->head;
+            if (ht_get(wp->pending, last->key, last->klen, NULL) == last)
+                ht_delete(wp->pending, last->key, last->klen, NULL, NULL);
+            wp->head = last->next;
+            count++;
+        }
+        last->next = NULL;
+        if (!wp->head)
+            wp->tail = NULL;
+        else
+            gettimeofday(&wp->oldest, NULL);
+
+        MUTEX_UNLOCK(&wp->lock);
+        write_pipeline_flush(wp, batch);
+        MUTEX_LOCK(&wp->lock);
+
+        wp->acked += count;
+        pthread_cond_broadcast(&wp->drained_cond);
+    }
+    MUTEX_UNLOCK(&wp->lock);
+
+    return NULL;
+}
+
+write_pipeline_t *
+write_pipeline_create(char *peer,
+                      char *auth,
+                      int tcp_timeout,
+                      int window,
+                      int batch_max,
+                      write_pipeline_stats_t *stats)
+{
+    write_pipeline_t *wp = calloc(1, sizeof(write_pipeline_t));
+    wp->peer = strdup(peer);
+    wp->auth = auth;
+    wp->tcp_timeout = tcp_timeout;
+    wp->window = window;
+    wp->batch_max = batch_max > 0 ? batch_max : 1;
+    wp->fd = -1;
+    wp->stats = stats;
+    wp->pending = ht_create(128, 65535, NULL);
+    wp->refcnt = 1;
+
+    MUTEX_INIT(&wp->lock);
+    CONDITION_INIT(&wp->cond);
+    CONDITION_INIT(&wp->drained_cond);
+
+    if (pthread_create(&wp->thread, NULL, write_pipeline_run, wp) != 0) {
+        SHC_ERROR("Can't create the write pipeline thread for %s: %s", peer, strerror(errno));
+        ht_destroy(wp->pending);
+        MUTEX_DESTROY(&wp->lock);
+        CONDITION_DESTROY(&wp->cond);
+        CONDITION_DESTROY(&wp->drained_cond);
+        free(wp->peer);
+        free(wp);
+        return NULL;
+    }
+
+    return wp;
+}
+
+static void
+write_pipeline_destroy(write_pipeline_t *wp)
+{
+    MUTEX_LOCK(&wp->lock);
+    wp->quit = 1;
+    pthread_cond_signal(&wp->cond);
+    MUTEX_UNLOCK(&wp->lock);
+
+    pthread_join(wp->thread, NULL);
+
+    while (wp->head) {
+        write_pipeline_entry_t *entry = wp->head;
+        wp->head = entry->next;
+        write_pipeline_entry_notify(entry, -1);
+        write_pipeline_entry_destroy(entry);
+    }
+
+    if (wp->fd >= 0)
+        close(wp->fd);
+
+    ht_destroy(wp->pending);
+    MUTEX_DESTROY(&wp->lock);
+    CONDITION_DESTROY(&wp->cond);
+    CONDITION_DESTROY(&wp->drained_cond);
+    free(wp->peer);
+    free(wp);
+}
+
+void
+write_pipeline_retain(write_pipeline_t *wp)
+{
+    ATOMIC_INCREMENT(wp->refcnt);
+}
+
+void
+write_pipeline_release(write_pipeline_t *wp)
+{
+    if (ATOMIC_DECREMENT(wp->refcnt) == 0)
+        write_pipeline_destroy(wp);
+}
+
+void
+write_pipeline_drain(write_pipeline_t *wp)
+{
+    MUTEX_LOCK(&wp->lock);
+    uint64_t target = wp->queued;
+    if (wp->acked < target) {
+        wp->draining++;
+        pthread_cond_signal(&wp->cond);
+        while (wp->acked < target && !wp->quit)
+            pthread_cond_wait(&wp->drained_cond, &wp->lock);
+        wp->draining--;
+    }
+    MUTEX_UNLOCK(&wp->lock);
+}
+
+void
+write_pipeline_set_window(write_pipeline_t *wp, int window)
+{
+    MUTEX_LOCK(&wp->lock);
+    wp->window = window;
+    pthread_cond_signal(&wp->cond);
+    MUTEX_UNLOCK(&wp->lock);
+}
+
+int
+write_pipeline_push(write_pipeline_t *wp,
+                    unsigned char hdr,
+                    void *key,
+                    size_t klen,
+                    void *value,
+                    size_t vlen,
+                    uint32_t expire,
+                    write_pipeline_callback_t cb,
+                    void *priv)
+{
+    if (hdr != SHC_HDR_SET && hdr != SHC_HDR_ADD && hdr != SHC_HDR_DELETE)
+        return -1;
+
+    if (hdr == SHC_HDR_DELETE) {
+        value = NULL;
+        vlen = 0;
+        expire = 0;
+    }
+
+    write_pipeline_listener_t *listener = malloc(sizeof(write_pipeline_listener_t));
+    listener->next = NULL;
+    listener->cb = cb;
+    listener->priv = priv;
+
+    void *value_copy = NULL;
+    if (vlen) {
+        value_copy = malloc(vlen);
+        memcpy(value_copy, value, vlen);
+    }
+
+    MUTEX_LOCK(&wp->lock);
+
+    if (wp->quit) {
+        MUTEX_UNLOCK(&wp->lock);
+        free(listener);
+        free(value_copy);
+        return -1;
+    }
+
+    ATOMIC_INCREMENT(wp->stats->writes);
+
+    write_pipeline_entry_t *entry = ht_get(wp->pending, key, klen, NULL);
+    if (entry && hdr != SHC_HDR_ADD) {
+        // overwrite the queued write, its position in the queue
+        // doesn't matter since there are no other writes for the
+        // same key queued after it
+        free(entry->value);
+        entry->hdr = hdr;
+        entry->value = value_copy;
+        entry->vlen = vlen;
+        entry->expire = expire;
+        entry->last_listener->next = listener;
+        entry->last_listener = listener;
+        ATOMIC_INCREMENT(wp->stats->coalesced);
+        MUTEX_UNLOCK(&wp->lock);
+        return 0;
+    }
+
+    entry = calloc(1, sizeof(write_pipeline_entry_t));
+    entry->hdr = hdr;
+    entry->key = malloc(klen);
+    memcpy(entry->key, key, klen);
+    entry->klen = klen;
+    entry->value = value_copy;
+    entry->vlen = vlen;
+    entry->expire = expire;
+    entry->listeners = entry->last_listener = listener;
+
+    // an ADD depends on the outcome of the writes queued before it,
+    // so the writes queued after it can't be coalesced with those
+    if (hdr == SHC_HDR_ADD)
+        ht_delete(wp->pending, key, klen, NULL, NULL);
+    else
+        ht_set(wp->pending, entry->key, klen, entry, 0);
+
+    if (wp->tail)
+        wp->tail->next = entry;
+    else {
+        wp->head = entry;
+        gettimeofday(&wp->oldest, NULL);
+    }
+    wp->tail = entry;
+    wp->queued++;
+
+    pthread_cond_signal(&wp->cond);
+    MUTEX_UNLOCK(&wp->lock);
+
+    return 0;
+}
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
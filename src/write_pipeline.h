@@ -0,0 +1,99 @@
+/**
+ * @file write_pipeline.h
+ * @brief Pipeline forwarding the write commands (SET/ADD/DEL) to a peer
+ *
+ * The writes are queued and sent in batches by a background thread over a
+ * single persistent connection, the responses are then read (and the writes
+ * acknowledged) in the same order the commands have been sent.
+ * Writes to the same key still waiting to be flushed are coalesced, the last
+ * one wins and all the writers are notified with its result.
+ */
+#ifndef __WRITE_PIPELINE_H__
+#define __WRITE_PIPELINE_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+typedef struct __write_pipeline write_pipeline_t;
+
+/**
+ * @brief Callback notified once a write has been acknowledged by the peer
+ * @param rc 0 on success, 1 if an ADD found the key already existing,
+ *           -1 on errors
+ */
+typedef void (*write_pipeline_callback_t)(void *key, size_t klen, int rc, void *priv);
+
+typedef struct {
+    uint64_t writes;    // writes queued
+    uint64_t coalesced; // writes merged in a pending write for the same key
+    uint64_t batches;   // batches flushed
+    uint64_t errors;    // writes failed because of the connection
+} write_pipeline_stats_t;
+
+/**
+ * @brief Create a new pipeline (and start its thread)
+ * @param peer        The address of the peer
+ * @param auth        The secret used to sign the messages (NULL if none)
+ * @param tcp_timeout The timeout (in milliseconds) used when connecting to the peer
+ * @param window      The time (in microseconds) waited, since the oldest write
+ *                    has been queued, before flushing the writes
+ * @param batch_max   The maximum number of writes sent in a single batch
+ * @param stats       The stats to update (can be shared among pipelines,
+ *                    it's updated using the atomic builtins)
+ * @return A newly initialized pipeline, NULL on errors
+ */
+write_pipeline_t *write_pipeline_create(char *peer,
+                                        char *auth,
+                                        int tcp_timeout,
+                                        int window,
+                                        int batch_max,
+                                        write_pipeline_stats_t *stats);
+
+/**
+ * @brief Get a new reference to the pipeline
+ * @note The pipeline is created with a reference owned by the creator
+ */
+void write_pipeline_retain(write_pipeline_t *wp);
+
+/**
+ * @brief Release a reference to the pipeline, releasing the last one
+ *        stops the pipeline thread and releases all the resources
+ * @note The writes still waiting to be flushed are notified as failed
+ */
+void write_pipeline_release(write_pipeline_t *wp);
+
+/**
+ * @brief Wait until all the writes queued so far have been acknowledged
+ * @note The flush window is not waited while someone is draining the queue
+ */
+void write_pipeline_drain(write_pipeline_t *wp);
+
+/**
+ * @brief Queue a write
+ * @param hdr    The command (SHC_HDR_SET, SHC_HDR_ADD or SHC_HDR_DELETE)
+ * @param value  The value (ignored for SHC_HDR_DELETE)
+ * @param expire The expiration time (ignored for SHC_HDR_DELETE)
+ * @param cb     The callback notified once the write has been acknowledged
+ * @return 0 if the write has been queued, -1 otherwise
+ * @note ADD commands are never coalesced
+ */
+int write_pipeline_push(write_pipeline_t *wp,
+                        unsigned char hdr,
+                        void *key,
+                        size_t klen,
+                        void *value,
+                        size_t vlen,
+                        uint32_t expire,
+                        write_pipeline_callback_t cb,
+                        void *priv);
+
+/**
+ * @brief Change the flush window
+ * @param window The time (in microseconds) to wait before flushing the writes
+ */
+void write_pipeline_set_window(write_pipeline_t *wp, int window);
+
+#endif /* __WRITE_PIPELINE_H__ */
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
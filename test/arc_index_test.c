@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <ut.h>
+#include <libgen.h>
+
+#include <atomic_defs.h>
+#include <arc_index.h>
+
+#define NUM_KEYS 10000
+#define NUM_STABLE_KEYS 1000
+#define NUM_READERS 4
+#define NUM_COLLISIONS 64
+
+typedef struct {
+    char key[32];
+    size_t klen;
+} test_value_t;
+
+typedef struct __test_retired {
+    void *ptr;
+    struct __test_retired *next;
+} test_retired_t;
+
+// the tables replaced by a resize are released only at the end,
+// the readers might still be walking them
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static test_retired_t *retired = NULL;
+static int stop = 0;
+
+static int
+test_match(void *value, const void *key, size_t klen, void *priv)
+{
+    test_value_t *v = (test_value_t *)value;
+    return (v->klen == klen && memcmp(v->key, key, klen) == 0);
+}
+
+static void
+test_free_table(void *ptr, void *priv)
+{
+    test_retired_t *r = malloc(sizeof(test_retired_t));
+    r->ptr = ptr;
+    pthread_mutex_lock(&retired_lock);
+    r->next = retired;
+    retired = r;
+    pthread_mutex_unlock(&retired_lock);
+}
+
+static void
+test_free_retired()
+{
+    while (retired) {
+        test_retired_t *next = retired->next;
+        free(retired->ptr);
+        free(retired);
+        retired = next;
+    }
+}
+
+static test_value_t *
+test_values_create(const char *prefix, int num)
+{
+    test_value_t *values = calloc(num, sizeof(test_value_t));
+    int i;
+    for (i = 0; i < num; i++)
+        values[i].klen = sprintf(values[i].key, "%s:%d", prefix, i);
+    return values;
+}
+
+static int
+test_set(arc_index_t *index, test_value_t *v, uint64_t hash)
+{
+    return arc_index_set_if_not_exists(index, v->key, v->klen, hash, v);
+}
+
+static int
+test_delete(arc_index_t *index, test_value_t *v, uint64_t hash)
+{
+    return arc_index_delete_if_equals(index, v->key, v->klen, hash, v);
+}
+
+static void *
+test_get(arc_index_t *index, test_value_t *v, uint64_t hash)
+{
+    return arc_index_get(index, v->key, v->klen, hash);
+}
+
+#define HASH(__v) arc_index_hash((__v)->key, (__v)->klen)
+
+typedef struct {
+    arc_index_t *index;
+    test_value_t *values;
+    int misses;
+} test_reader_arg_t;
+
+static void *
+test_reader(void *priv)
+{
+    test_reader_arg_t *arg = (test_reader_arg_t *)priv;
+    int i = 0;
+    while (!ATOMIC_READ(stop)) {
+        test_value_t *v = &arg->values[i];
+        if (test_get(arg->index, v, HASH(v)) != v)
+            arg->misses++;
+        i = (i + 1) % NUM_STABLE_KEYS;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int i, n, failed;
+
+    ut_init(basename(argv[0]));
+
+    test_value_t *values = test_values_create("key", NUM_KEYS);
+    test_value_t dup = values[0];
+
+    ut_testing("arc_index_set_if_not_exists() on a new key == 0");
+    arc_index_t *index = arc_index_create(NUM_KEYS, test_match, NULL, NULL);
+    ut_validate_int(test_set(index, &values[0], HASH(&values[0])), 0);
+
+    ut_testing("arc_index_set_if_not_exists() on an existing key == 1");
+    ut_validate_int(test_set(index, &dup, HASH(&dup)), 1);
+
+    ut_testing("arc_index_get() returns the value set first");
+    if (test_get(index, &dup, HASH(&dup)) == &values[0])
+        ut_success();
+    else
+        ut_failure("unexpected value");
+
+    ut_testing("arc_index_count() == 1");
+    ut_validate_int(arc_index_count(index), 1);
+
+    ut_testing("arc_index_delete_if_equals() with a different value == -1");
+    ut_validate_int(test_delete(index, &dup, HASH(&dup)), -1);
+
+    ut_testing("the key is still there");
+    if (test_get(index, &values[0], HASH(&values[0])) == &values[0])
+        ut_success();
+    else
+        ut_failure("the key has been removed");
+
+    ut_testing("arc_index_delete_if_equals() with the stored value == 0");
+    ut_validate_int(test_delete(index, &values[0], HASH(&values[0])), 0);
+
+    ut_testing("the key is gone and arc_index_count() == 0");
+    if (!test_get(index, &values[0], HASH(&values[0])) && arc_index_count(index) == 0)
+        ut_success();
+    else
+        ut_failure("the key is still there");
+
+    ut_testing("arc_index_delete_if_equals() on a missing key == -1");
+    ut_validate_int(test_delete(index, &values[0], HASH(&values[0])), -1);
+    arc_index_destroy(index);
+
+    // all the keys share the same hash (and so the same tag and the same
+    // first group), only the match callback can tell them apart
+    ut_testing("%d keys with the same hash can be set, found and removed", NUM_COLLISIONS);
+    index = arc_index_create(NUM_COLLISIONS, test_match, NULL, NULL);
+    failed = 0;
+    for (i = 0; i < NUM_COLLISIONS && !failed; i++) {
+        if (test_set(index, &values[i], 0x1234) != 0) {
+            ut_failure("can't set key %s", values[i].key);
+            failed = 1;
+        }
+    }
+    for (i = 0; i < NUM_COLLISIONS && !failed; i++) {
+        if (test_get(index, &values[i], 0x1234) != &values[i]) {
+            ut_failure("key %s not found", values[i].key);
+            failed = 1;
+        }
+    }
+    // remove every other key, the others must still be reachable
+    for (i = 0; i < NUM_COLLISIONS && !failed; i += 2) {
+        if (test_delete(index, &values[i], 0x1234) != 0) {
+            ut_failure("can't remove key %s", values[i].key);
+            failed = 1;
+        }
+    }
+    for (i = 0; i < NUM_COLLISIONS && !failed; i++) {
+        void *expected = (i % 2) ? &values[i] : NULL;
+        if (test_get(index, &values[i], 0x1234) != expected) {
+            ut_failure("unexpected lookup result for key %s", values[i].key);
+            failed = 1;
+        }
+    }
+    if (!failed)
+        ut_success();
+    arc_index_destroy(index);
+
+    // same tag (the low 7 bits) but different hashes
+    ut_testing("keys with the same tag and different hashes are told apart");
+    index = arc_index_create(NUM_COLLISIONS, test_match, NULL, NULL);
+    failed = 0;
+    for (i = 0; i < NUM_COLLISIONS && !failed; i++) {
+        uint64_t hash = ((uint64_t)(i % 2) << 7) | 0x55;
+        if (test_set(index, &values[i], hash) != 0) {
+            ut_failure("can't set key %s", values[i].key);
+            failed = 1;
+        }
+    }
+    for (i = 0; i < NUM_COLLISIONS && !failed; i++) {
+        uint64_t hash = ((uint64_t)(i % 2) << 7) | 0x55;
+        uint64_t wrong_hash = ((uint64_t)((i + 1) % 2) << 7) | 0x55;
+        if (test_get(index, &values[i], hash) != &values[i] ||
+            test_get(index, &values[i], wrong_hash) != NULL)
+        {
+            ut_failure("unexpected lookup result for key %s", values[i].key);
+            failed = 1;
+        }
+    }
+    if (!failed)
+        ut_success();
+    arc_index_destroy(index);
+
+    // the tombstones left by the removals must be reused (or purged by
+    // rehashing at the same size), not make the table grow
+    ut_testing("set/remove cycles don't make the index grow");
+    index = arc_index_create(NUM_STABLE_KEYS, test_match, NULL, NULL);
+    size_t initial_size = arc_index_memory_usage(index);
+    failed = 0;
+    for (n = 0; n < 50 && !failed; n++) {
+        test_value_t *batch = &values[(n % 10) * NUM_STABLE_KEYS];
+        for (i = 0; i < NUM_STABLE_KEYS && !failed; i++) {
+            if (test_set(index, &batch[i], HASH(&batch[i])) != 0) {
+                ut_failure("can't set key %s", batch[i].key);
+                failed = 1;
+            }
+        }
+        for (i = 0; i < NUM_STABLE_KEYS && !failed; i++) {
+            if (test_delete(index, &batch[i], HASH(&batch[i])) != 0) {
+                ut_failure("can't remove key %s", batch[i].key);
+                failed = 1;
+            }
+        }
+    }
+    if (!failed) {
+        size_t size = arc_index_memory_usage(index);
+        // an old table might still be around if a rehash is in progress
+        if (arc_index_count(index) != 0)
+            ut_failure("%d keys left in the index", (int)arc_index_count(index));
+        else if (size > initial_size * 2)
+            ut_failure("the index grew from %d to %d bytes", (int)initial_size, (int)size);
+        else
+            ut_success();
+    }
+
+    ut_testing("a removed key can be set again");
+    if (test_set(index, &values[0], HASH(&values[0])) == 0 &&
+        test_get(index, &values[0], HASH(&values[0])) == &values[0] &&
+        arc_index_count(index) == 1)
+    {
+        ut_success();
+    } else {
+        ut_failure("can't set the key again");
+    }
+    arc_index_destroy(index);
+
+    // start small so that the index is resized several times while the
+    // readers keep looking up the keys set at the beginning
+    ut_testing("lookups during the incremental resizes never miss");
+    index = arc_index_create(1, test_match, test_free_table, NULL);
+    for (i = 0; i < NUM_STABLE_KEYS; i++)
+        test_set(index, &values[i], HASH(&values[i]));
+
+    pthread_t readers[NUM_READERS];
+    test_reader_arg_t args[NUM_READERS];
+    ATOMIC_SET(stop, 0);
+    for (i = 0; i < NUM_READERS; i++) {
+        args[i].index = index;
+        args[i].values = values;
+        args[i].misses = 0;
+        pthread_create(&readers[i], NULL, test_reader, &args[i]);
+    }
+    for (n = 0; n < 10; n++) {
+        for (i = NUM_STABLE_KEYS; i < NUM_KEYS; i++)
+            test_set(index, &values[i], HASH(&values[i]));
+        for (i = NUM_STABLE_KEYS; i < NUM_KEYS; i++)
+            test_delete(index, &values[i], HASH(&values[i]));
+    }
+    ATOMIC_SET(stop, 1);
+    int misses = 0;
+    for (i = 0; i < NUM_READERS; i++) {
+        pthread_join(readers[i], NULL);
+        misses += args[i].misses;
+    }
+    ut_validate_int(misses, 0);
+
+    ut_testing("all the keys are still there after the resizes");
+    failed = 0;
+    for (i = 0; i < NUM_STABLE_KEYS && !failed; i++) {
+        if (test_get(index, &values[i], HASH(&values[i])) != &values[i]) {
+            ut_failure("key %s not found", values[i].key);
+            failed = 1;
+        }
+    }
+    if (!failed)
+        ut_validate_int(arc_index_count(index), NUM_STABLE_KEYS);
+    arc_index_destroy(index);
+    test_free_retired();
+
+    free(values);
+
+    ut_summary();
+    exit(ut_failed);
+}
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <ut.h>
+#include <libgen.h>
+
+#include <atomic_defs.h>
+#include <arc.h>
+
+#define NUM_KEYS 10000
+#define NUM_HITTERS 4
+#define NUM_EPOCH_CACHES 2048
+
+typedef struct {
+    int generation;
+} test_obj_t;
+
+// objects created once the removal is started belong to generation 1
+static int generation = 0;
+static int stop = 0;
+
+static void
+test_init(const void *key, size_t klen, uint64_t hash, int async, arc_resource_t res, void *ptr, void *priv)
+{
+    ((test_obj_t *)ptr)->generation = ATOMIC_READ(generation);
+}
+
+static int
+test_fetch(void *obj, size_t *size, void *priv)
+{
+    *size = 100;
+    return 0;
+}
+
+static void
+test_store(void *obj, void *data, size_t size, void *priv)
+{
+}
+
+static void
+test_evict(void *obj, void *priv)
+{
+}
+
+static arc_ops_t test_ops = {
+    .init = test_init,
+    .fetch = test_fetch,
+    .store = test_store,
+    .evict = test_evict
+};
+
+static int
+test_key(char *key, int drop, int i)
+{
+    return sprintf(key, "%s:%d", drop ? "drop" : "keep", i);
+}
+
+static test_obj_t *
+test_lookup(arc_t *cache, int drop, int i, arc_resource_t *res)
+{
+    char key[32];
+    int klen = test_key(key, drop, i);
+    void *value = NULL;
+    *res = arc_lookup(cache, key, klen, arc_hash_key(key, klen), &value, 0);
+    return (test_obj_t *)value;
+}
+
+static void *
+test_hitter(void *priv)
+{
+    arc_t *cache = (arc_t *)priv;
+    unsigned int seed = (unsigned int)(uintptr_t)pthread_self();
+    while (!ATOMIC_READ(stop)) {
+        arc_resource_t res;
+        // keep moving the objects of both the prefixes to the head of the mfu list
+        test_lookup(cache, rand_r(&seed) % 2, rand_r(&seed) % NUM_KEYS, &res);
+        if (res)
+            arc_release_resource(cache, res);
+    }
+    return NULL;
+}
+
+// count the keys which are still holding an object created
+// before the removal started
+static int
+test_count_old(arc_t *cache, int drop)
+{
+    int count = 0;
+    int i;
+    for (i = 0; i < NUM_KEYS; i++) {
+        arc_resource_t res;
+        test_obj_t *obj = test_lookup(cache, drop, i, &res);
+        if (obj && obj->generation == 0)
+            count++;
+        if (res)
+            arc_release_resource(cache, res);
+    }
+    return count;
+}
+
+static arc_t *
+test_cache_create(int reclaim_mode)
+{
+    size_t *lists_size[5];
+    arc_t *cache = arc_create(&test_ops, 1<<26, sizeof(test_obj_t), lists_size, 0, reclaim_mode);
+
+    ATOMIC_SET(generation, 0);
+    // hit all the keys twice so that they end up in the mfu list
+    int i, n;
+    for (n = 0; n < 2; n++) {
+        for (i = 0; i < NUM_KEYS; i++) {
+            arc_resource_t res;
+            test_lookup(cache, 0, i, &res);
+            arc_release_resource(cache, res);
+            test_lookup(cache, 1, i, &res);
+            arc_release_resource(cache, res);
+        }
+    }
+    return cache;
+}
+
+int main(int argc, char **argv)
+{
+    int reclaim_modes[] = { ARC_RECLAIM_REFCNT, ARC_RECLAIM_EPOCH };
+    int m, i;
+
+    ut_init(basename(argv[0]));
+
+    for (m = 0; m < 2; m++) {
+        const char *mode = reclaim_modes[m] == ARC_RECLAIM_EPOCH ? "epoch" : "refcnt";
+
+        ut_testing("arc_remove_prefix() removes all the keys with the prefix (%s)", mode);
+        arc_t *cache = test_cache_create(reclaim_modes[m]);
+        ATOMIC_SET(generation, 1);
+        int removed = arc_remove_prefix(cache, "drop:", 5);
+        ut_validate_int(removed, NUM_KEYS);
+
+        ut_testing("arc_remove_prefix() leaves the other keys in the cache (%s)", mode);
+        ut_validate_int(test_count_old(cache, 0), NUM_KEYS);
+        arc_destroy(cache);
+
+        ut_testing("arc_remove_prefix() while the keys are being hit (%s)", mode);
+        cache = test_cache_create(reclaim_modes[m]);
+        pthread_t hitters[NUM_HITTERS];
+        ATOMIC_SET(stop, 0);
+        ATOMIC_SET(generation, 1);
+        for (i = 0; i < NUM_HITTERS; i++)
+            pthread_create(&hitters[i], NULL, test_hitter, cache);
+        removed = arc_remove_prefix(cache, "drop:", 5);
+        ATOMIC_SET(stop, 1);
+        for (i = 0; i < NUM_HITTERS; i++)
+            pthread_join(hitters[i], NULL);
+        // the objects hit during the walk are dropped by the hitters,
+        // so the walk itself can't visit more objects than the lists hold
+        if (removed <= NUM_KEYS)
+            ut_success();
+        else
+            ut_failure("%d objects removed out of %d", removed, NUM_KEYS);
+
+        ut_testing("no object created before the removal is left (%s)", mode);
+        ut_validate_int(test_count_old(cache, 1), 0);
+
+        ut_testing("the keys without the prefix are still cached (%s)", mode);
+        ut_validate_int(test_count_old(cache, 0), NUM_KEYS);
+        arc_destroy(cache);
+    }
+
+    // the caches in epoch mode share a single thread-specific key,
+    // there can be more of them than the keys a process can create
+    ut_testing("arc_create() %d caches in epoch mode", NUM_EPOCH_CACHES);
+    arc_t *caches[NUM_EPOCH_CACHES];
+    int failed = 0;
+    for (i = 0; i < NUM_EPOCH_CACHES; i++) {
+        size_t *lists_size[5];
+        caches[i] = arc_create(&test_ops, 1<<16, sizeof(test_obj_t), lists_size, 0, ARC_RECLAIM_EPOCH);
+        if (!caches[i]) {
+            ut_failure("can't create the cache %d", i);
+            failed = 1;
+            break;
+        }
+        arc_resource_t res;
+        test_lookup(caches[i], 0, i, &res);
+        if (!res) {
+            ut_failure("can't load a key in the cache %d", i);
+            failed = 1;
+            i++;
+            break;
+        }
+        arc_release_resource(caches[i], res);
+    }
+    if (!failed)
+        ut_success();
+    while (i--)
+        if (caches[i])
+            arc_destroy(caches[i]);
+
+    ut_summary();
+    exit(ut_failed);
+}
@@ -0,0 +1,147 @@
+#include <shardcache_client.h>
+#include <shardcache_storage.h>
+#include <unistd.h>
+#include <string.h>
+#include <ut.h>
+#include <libgen.h>
+
+#include <atomic_defs.h>
+
+#define SLOW_FETCH_TIME 500000 // usecs
+#define DEADLINE 100           // msecs
+
+typedef struct {
+    char data[64];
+    size_t dlen;
+    int error;
+} test_async_arg_t;
+
+static int
+test_fetch(void *key, size_t klen, void **value, size_t *vlen, void *priv)
+{
+    // the keys of the 'slow' namespace take a while to be loaded
+    if (klen >= 5 && memcmp(key, "slow:", 5) == 0)
+        usleep(SLOW_FETCH_TIME);
+    *value = malloc(klen);
+    memcpy(*value, key, klen);
+    *vlen = klen;
+    return 0;
+}
+
+static int
+test_async_cb(char *node, void *key, size_t klen, void *data, size_t dlen, int error, void *priv)
+{
+    test_async_arg_t *arg = (test_async_arg_t *)priv;
+    if (error) {
+        arg->error = 1;
+        return -1;
+    }
+    if (arg->dlen + dlen > sizeof(arg->data)) {
+        arg->error = 1;
+        return -1;
+    }
+    memcpy(arg->data + arg->dlen, data, dlen);
+    arg->dlen += dlen;
+    return 0;
+}
+
+static uint64_t
+test_counter(shardcache_t *cache, char *name)
+{
+    shardcache_counter_t *counters = NULL;
+    uint64_t value = 0;
+    int i, n = shardcache_get_counters(cache, &counters);
+    for (i = 0; i < n; i++) {
+        if (strcmp(counters[i].name, name) == 0) {
+            value = counters[i].value;
+            break;
+        }
+    }
+    free(counters);
+    return value;
+}
+
+int main(int argc, char **argv)
+{
+    shardcache_log_init("shardcached", LOG_WARNING);
+
+    ut_init(basename(argv[0]));
+
+    shardcache_storage_t storage;
+    memset(&storage, 0, sizeof(storage));
+    storage.version = SHARDCACHE_STORAGE_API_VERSION;
+    storage.fetch = test_fetch;
+
+    char *address_array[1] = { "127.0.0.1:9800" };
+    shardcache_node_t *node = shardcache_node_create("peer0", address_array, 1);
+
+    ut_testing("shardcache_create(peer0, [peer0], 1, &storage, NULL, 2, 0, 1<<29)");
+    shardcache_t *server = shardcache_create("peer0", &node, 1, &storage, NULL, 2, 0, 1<<29);
+    if (!server) {
+        ut_failure("Errors creating the shardcache instance");
+        ut_summary();
+        exit(ut_failed);
+    }
+    ut_success();
+
+    sleep(1); // let the server complete its startup
+
+    shardcache_client_t *client = shardcache_client_create(&node, 1, NULL);
+
+    ut_testing("shardcache_client_request_deadline(client, %d)", DEADLINE);
+    shardcache_client_request_deadline(client, DEADLINE);
+    ut_validate_int(shardcache_client_request_deadline(client, -1), DEADLINE);
+
+    // the deadline is a trailing record, the key must still be the
+    // first record and the value must be served as usual
+    ut_testing("a get carrying a deadline record is served");
+    void *value = NULL;
+    size_t size = shardcache_client_get(client, "fast:1", 6, &value);
+    if (size == 6 && memcmp(value, "fast:1", 6) == 0)
+        ut_success();
+    else
+        ut_failure("unexpected response (%d bytes)", (int)size);
+    free(value);
+
+    ut_testing("an async get carrying a deadline record is served");
+    test_async_arg_t arg;
+    memset(&arg, 0, sizeof(arg));
+    int rc = shardcache_client_get_async(client, "fast:2", 6, test_async_cb, &arg);
+    if (rc == 0 && !arg.error && arg.dlen == 6 && memcmp(arg.data, "fast:2", 6) == 0)
+        ut_success();
+    else
+        ut_failure("unexpected response (rc: %d, %d bytes)", rc, (int)arg.dlen);
+
+    ut_testing("no request has been dropped so far");
+    ut_validate_int(test_counter(server, "dropped_requests"), 0);
+
+    // the value is loaded well after the client gave up
+    ut_testing("a get past its deadline gets an empty response");
+    value = NULL;
+    size = shardcache_client_get(client, "slow:1", 6, &value);
+    free(value);
+    ut_validate_int(size, 0);
+
+    ut_testing("the expired request has been counted as dropped");
+    ut_validate_int(test_counter(server, "dropped_requests"), 1);
+
+    ut_testing("a get without a deadline for the same key is served");
+    shardcache_client_request_deadline(client, 0);
+    value = NULL;
+    size = shardcache_client_get(client, "slow:1", 6, &value);
+    if (size == 6 && memcmp(value, "slow:1", 6) == 0)
+        ut_success();
+    else
+        ut_failure("unexpected response (%d bytes)", (int)size);
+    free(value);
+
+    shardcache_client_destroy(client);
+
+    ut_testing("destroying the server");
+    shardcache_destroy(server);
+    shardcache_node_destroy(node);
+    ut_success();
+
+    ut_summary();
+    exit(ut_failed);
+}
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <ut.h>
+#include <libgen.h>
+
+#include <atomic_defs.h>
+#include <keyfilter.h>
+
+#define NUM_KEYS 1000
+#define NUM_CHECKERS 4
+#define NUM_REBUILDS 100
+
+static int stop = 0;
+
+// spread the test keys over the hash space as arc_hash_key() would
+static uint64_t
+test_hash(uint64_t i)
+{
+    uint64_t h = (i + 1) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 29);
+}
+
+// build a ready filter holding the keys [0, NUM_KEYS)
+static keyfilter_t *
+test_filter_create()
+{
+    keyfilter_t *kf = keyfilter_create(0.01);
+    keyfilter_rebuild_begin(kf, NUM_KEYS);
+    int i;
+    for (i = 0; i < NUM_KEYS; i++)
+        keyfilter_rebuild_add(kf, test_hash(i));
+    keyfilter_rebuild_end(kf, 1);
+    return kf;
+}
+
+// check the stored keys until told to stop, returning how many were missed
+static void *
+test_checker(void *priv)
+{
+    keyfilter_t *kf = (keyfilter_t *)priv;
+    intptr_t misses = 0;
+    int i = 0;
+    while (!ATOMIC_READ(stop)) {
+        if (!keyfilter_check(kf, test_hash(i)))
+            misses++;
+        i = (i + 1) % NUM_KEYS;
+    }
+    return (void *)misses;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    ut_init(basename(argv[0]));
+
+    ut_testing("keyfilter_check() on a filter not built yet");
+    keyfilter_t *kf = keyfilter_create(0.01);
+    ut_validate_int(keyfilter_check(kf, test_hash(0)), 1);
+    keyfilter_destroy(kf);
+
+    kf = test_filter_create();
+
+    ut_testing("keyfilter_check() finds all the keys of the storage index");
+    int found = 0;
+    for (i = 0; i < NUM_KEYS; i++)
+        found += keyfilter_check(kf, test_hash(i));
+    ut_validate_int(found, NUM_KEYS);
+
+    ut_testing("keyfilter_check() rejects (most of) the keys not stored");
+    int positives = 0;
+    for (i = NUM_KEYS; i < 2 * NUM_KEYS; i++)
+        positives += keyfilter_check(kf, test_hash(i));
+    if (positives < NUM_KEYS / 20)
+        ut_success();
+    else
+        ut_failure("%d false positives out of %d keys", positives, NUM_KEYS);
+
+    ut_testing("keyfilter_add() makes a new key visible");
+    keyfilter_add(kf, test_hash(NUM_KEYS));
+    keyfilter_commit(kf, test_hash(NUM_KEYS));
+    ut_validate_int(keyfilter_check(kf, test_hash(NUM_KEYS)), 1);
+
+    keyfilter_destroy(kf);
+
+    // the key is added, a rebuild begins and its scan goes past the key
+    // before it's actually stored (and committed)
+    ut_testing("a key stored while a rebuild is scanning the index is not lost");
+    kf = test_filter_create();
+    uint64_t hash = test_hash(2 * NUM_KEYS);
+    keyfilter_add(kf, hash);
+    keyfilter_rebuild_begin(kf, NUM_KEYS);
+    for (i = 0; i < NUM_KEYS; i++)
+        keyfilter_rebuild_add(kf, test_hash(i));
+    keyfilter_commit(kf, hash);
+    keyfilter_rebuild_end(kf, 1);
+    ut_validate_int(keyfilter_check(kf, hash), 1);
+    keyfilter_destroy(kf);
+
+    // same as above, but the rebuild completes before the key is committed
+    ut_testing("a key stored after a rebuild completed is not lost");
+    kf = test_filter_create();
+    hash = test_hash(2 * NUM_KEYS + 1);
+    keyfilter_add(kf, hash);
+    keyfilter_rebuild_begin(kf, NUM_KEYS);
+    for (i = 0; i < NUM_KEYS; i++)
+        keyfilter_rebuild_add(kf, test_hash(i));
+    keyfilter_rebuild_end(kf, 1);
+    keyfilter_commit(kf, hash);
+    ut_validate_int(keyfilter_check(kf, hash), 1);
+    keyfilter_destroy(kf);
+
+    // the lookups don't take any lock, the filters replaced meanwhile
+    // must stay valid (and the stored keys found) while being checked
+    ut_testing("keyfilter_check() while the filter is rebuilt %d times", NUM_REBUILDS);
+    kf = test_filter_create();
+    pthread_t checkers[NUM_CHECKERS];
+    ATOMIC_SET(stop, 0);
+    for (i = 0; i < NUM_CHECKERS; i++)
+        pthread_create(&checkers[i], NULL, test_checker, kf);
+    int n;
+    for (n = 0; n < NUM_REBUILDS; n++) {
+        keyfilter_rebuild_begin(kf, NUM_KEYS);
+        for (i = 0; i < NUM_KEYS; i++)
+            keyfilter_rebuild_add(kf, test_hash(i));
+        // every other rebuild is discarded
+        keyfilter_rebuild_end(kf, n % 2);
+    }
+    ATOMIC_SET(stop, 1);
+    intptr_t misses = 0;
+    for (i = 0; i < NUM_CHECKERS; i++) {
+        void *rc = NULL;
+        pthread_join(checkers[i], &rc);
+        misses += (intptr_t)rc;
+    }
+    ut_validate_int(misses, 0);
+    keyfilter_destroy(kf);
+
+    ut_summary();
+    exit(ut_failed);
+}
@@ -0,0 +1,326 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <ut.h>
+#include <libgen.h>
+
+#include <atomic_defs.h>
+#include <shardcache.h>
+#include <shardcache_storage.h>
+#include <arc.h>
+#include <l2cache.h>
+
+#define L2_SIZE (64<<10)
+#define L2_WRITE_RATE (1<<20)
+#define NUM_RECORDS 200
+#define NUM_PREFIX_KEYS 10
+#define VALUE_SIZE 1024
+
+#define CACHE_SIZE (1<<20)
+#define CACHE_VALUE_SIZE 4096
+#define NUM_CACHE_KEYS 1000
+
+static int storage_fetches = 0;
+
+static void
+test_value(char *key, size_t klen, char *value, size_t vlen)
+{
+    size_t i;
+    for (i = 0; i < vlen; i++)
+        value[i] = key[i % klen];
+}
+
+// wait for the writer thread to store all the admitted records
+static int
+test_l2_wait(l2cache_t *l2, uint64_t writes)
+{
+    int retries = 100;
+    while (ATOMIC_READ(l2cache_stats(l2)->writes) < writes && retries--)
+        usleep(10000);
+    return (ATOMIC_READ(l2cache_stats(l2)->writes) >= writes);
+}
+
+static int
+test_l2_admit(l2cache_t *l2, char *key, size_t klen)
+{
+    char value[VALUE_SIZE];
+    test_value(key, klen, value, sizeof(value));
+    return l2cache_admit(l2, key, klen, arc_hash_key(key, klen),
+                         value, sizeof(value), time(NULL), l2cache_version(l2));
+}
+
+// returns 1 if the key is found with the expected value,
+// 0 if not found, -1 if found with an unexpected value
+static int
+test_l2_get(l2cache_t *l2, char *key, size_t klen)
+{
+    void *data = NULL;
+    size_t dlen = 0;
+    time_t ts = 0;
+    if (l2cache_get(l2, key, klen, arc_hash_key(key, klen), &data, &dlen, &ts) != 0)
+        return 0;
+    char value[VALUE_SIZE];
+    test_value(key, klen, value, sizeof(value));
+    int ret = (dlen == sizeof(value) && memcmp(data, value, dlen) == 0) ? 1 : -1;
+    free(data);
+    return ret;
+}
+
+static int
+test_fetch(void *key, size_t klen, void **value, size_t *vlen, void *priv)
+{
+    ATOMIC_INCREMENT(storage_fetches);
+    *value = malloc(CACHE_VALUE_SIZE);
+    test_value(key, klen, *value, CACHE_VALUE_SIZE);
+    *vlen = CACHE_VALUE_SIZE;
+    return 0;
+}
+
+static uint64_t
+test_counter(shardcache_t *cache, char *name)
+{
+    shardcache_counter_t *counters = NULL;
+    uint64_t value = 0;
+    int i, n = shardcache_get_counters(cache, &counters);
+    for (i = 0; i < n; i++) {
+        if (strcmp(counters[i].name, name) == 0) {
+            value = counters[i].value;
+            break;
+        }
+    }
+    free(counters);
+    return value;
+}
+
+int main(int argc, char **argv)
+{
+    int i, failed;
+    char key[32];
+    int klen;
+    char path[64];
+
+    shardcache_log_init("shardcached", LOG_WARNING);
+
+    ut_init(basename(argv[0]));
+
+    snprintf(path, sizeof(path), "/tmp/l2cache_test.%d", getpid());
+
+    ut_testing("l2cache_create(%s, %d, %d)", path, L2_SIZE, L2_WRITE_RATE);
+    l2cache_t *l2 = l2cache_create(path, L2_SIZE, L2_WRITE_RATE);
+    if (!l2) {
+        ut_failure("Can't create the l2 cache");
+        ut_summary();
+        exit(ut_failed);
+    }
+    ut_success();
+
+    ut_testing("l2cache_admit() of a new key == 0");
+    ut_validate_int(test_l2_admit(l2, "first", 5), 0);
+
+    ut_testing("l2cache_admit() of a key already admitted == 1");
+    ut_validate_int(test_l2_admit(l2, "first", 5), 1);
+
+    ut_testing("l2cache_get() returns the data once written");
+    if (test_l2_wait(l2, 1))
+        ut_validate_int(test_l2_get(l2, "first", 5), 1);
+    else
+        ut_failure("the record hasn't been written");
+
+    // write a few times the size of the log, it must wrap around
+    // dropping the oldest records
+    ut_testing("admitting %d records of %d bytes in a log of %d bytes", NUM_RECORDS, VALUE_SIZE, L2_SIZE);
+    failed = 0;
+    for (i = 0; i < NUM_RECORDS && !failed; i++) {
+        klen = sprintf(key, "record:%d", i);
+        if (test_l2_admit(l2, key, klen) != 0) {
+            ut_failure("can't admit %s", key);
+            failed = 1;
+        }
+    }
+    if (!failed) {
+        if (test_l2_wait(l2, NUM_RECORDS + 1))
+            ut_success();
+        else
+            ut_failure("only %d records written",
+                       (int)ATOMIC_READ(l2cache_stats(l2)->writes));
+    }
+
+    ut_testing("the written bytes exceed the size of the log");
+    if (ATOMIC_READ(l2cache_stats(l2)->written_bytes) > L2_SIZE)
+        ut_success();
+    else
+        ut_failure("%d bytes written", (int)ATOMIC_READ(l2cache_stats(l2)->written_bytes));
+
+    ut_testing("the oldest records have been dropped by the wrap-around");
+    if (test_l2_get(l2, "first", 5) == 0 && test_l2_get(l2, "record:0", 8) == 0)
+        ut_success();
+    else
+        ut_failure("the oldest records are still there");
+
+    ut_testing("the newest record is still there");
+    klen = sprintf(key, "record:%d", NUM_RECORDS - 1);
+    ut_validate_int(test_l2_get(l2, key, klen), 1);
+
+    ut_testing("the items fit the log and can all be read back");
+    int items = (int)ATOMIC_READ(l2cache_stats(l2)->items);
+    int found = 0;
+    failed = 0;
+    for (i = 0; i < NUM_RECORDS && !failed; i++) {
+        klen = sprintf(key, "record:%d", i);
+        int ret = test_l2_get(l2, key, klen);
+        if (ret == -1) {
+            ut_failure("unexpected data for %s", key);
+            failed = 1;
+        }
+        found += ret;
+    }
+    if (!failed) {
+        if (items > 0 && items == found && items * VALUE_SIZE <= L2_SIZE)
+            ut_success();
+        else
+            ut_failure("%d items, %d found", items, found);
+    }
+    l2cache_destroy(l2);
+
+    ut_testing("l2cache_remove_prefix() drops only the keys with the prefix");
+    l2 = l2cache_create(path, L2_SIZE, L2_WRITE_RATE);
+    for (i = 0; i < NUM_PREFIX_KEYS; i++) {
+        klen = sprintf(key, "keep:%d", i);
+        test_l2_admit(l2, key, klen);
+        klen = sprintf(key, "drop:%d", i);
+        test_l2_admit(l2, key, klen);
+    }
+    test_l2_wait(l2, NUM_PREFIX_KEYS * 2);
+    uint64_t version = l2cache_version(l2);
+    l2cache_remove_prefix(l2, "drop:", 5);
+    failed = 0;
+    for (i = 0; i < NUM_PREFIX_KEYS && !failed; i++) {
+        klen = sprintf(key, "keep:%d", i);
+        if (test_l2_get(l2, key, klen) != 1) {
+            ut_failure("%s not found", key);
+            failed = 1;
+        }
+        klen = sprintf(key, "drop:%d", i);
+        if (test_l2_get(l2, key, klen) != 0) {
+            ut_failure("%s still there", key);
+            failed = 1;
+        }
+    }
+    if (!failed)
+        ut_validate_int((int)ATOMIC_READ(l2cache_stats(l2)->items), NUM_PREFIX_KEYS);
+
+    ut_testing("an object loaded before l2cache_remove_prefix() isn't admitted");
+    char value[VALUE_SIZE];
+    test_value("drop:0", 6, value, sizeof(value));
+    ut_validate_int(l2cache_admit(l2, "drop:0", 6, arc_hash_key("drop:0", 6),
+                                  value, sizeof(value), time(NULL), version), 1);
+
+    ut_testing("an object loaded after l2cache_remove_prefix() is admitted");
+    ut_validate_int(test_l2_admit(l2, "drop:0", 6), 0);
+    l2cache_destroy(l2);
+    unlink(path);
+
+    // the objects dropped from the arc are demoted to the l2 cache,
+    // a miss on one of them must be served from there (not the storage)
+    shardcache_storage_t storage;
+    memset(&storage, 0, sizeof(storage));
+    storage.version = SHARDCACHE_STORAGE_API_VERSION;
+    storage.fetch = test_fetch;
+
+    shardcache_node_t *node = shardcache_node_create("peer0", (char *[]){ "127.0.0.1:9790" }, 1);
+
+    ut_testing("shardcache_create(\"peer0\", &node, 1, &storage, NULL, 2, 0, %d)", CACHE_SIZE);
+    shardcache_t *cache = shardcache_create("peer0", &node, 1, &storage, NULL, 2, 0, CACHE_SIZE);
+    if (!cache) {
+        ut_failure("Errors creating the shardcache instance");
+        ut_summary();
+        exit(ut_failed);
+    }
+    ut_success();
+
+    sleep(1); // let the server complete its startup
+
+    ut_testing("shardcache_l2_enable(cache, %s, %d, 0) == 0", path, CACHE_SIZE * 16);
+    ut_validate_int(shardcache_l2_enable(cache, path, CACHE_SIZE * 16, 0), 0);
+
+    // load a few times the size of the cache
+    for (i = 0; i < NUM_CACHE_KEYS; i++) {
+        klen = sprintf(key, "demote:%d", i);
+        size_t vlen = 0;
+        void *v = shardcache_get(cache, key, klen, &vlen, NULL);
+        free(v);
+    }
+
+    ut_testing("the objects dropped from the cache are demoted to the l2 cache");
+    int retries = 100;
+    while (test_counter(cache, "l2_items") == 0 && retries--)
+        usleep(10000);
+    if (test_counter(cache, "l2_writes") > 0 && test_counter(cache, "l2_items") > 0)
+        ut_success();
+    else
+        ut_failure("nothing has been written to the l2 cache");
+
+    // look for a demoted key among the oldest ones (they have
+    // been dropped from the cache first)
+    ut_testing("a miss on a demoted key is served by the l2 cache");
+    found = 0;
+    failed = 0;
+    for (i = 0; i < NUM_CACHE_KEYS / 2 && !found && !failed; i++) {
+        klen = sprintf(key, "demote:%d", i);
+        int fetches = ATOMIC_READ(storage_fetches);
+        uint64_t hits = test_counter(cache, "l2_hits");
+        size_t vlen = 0;
+        char *v = shardcache_get(cache, key, klen, &vlen, NULL);
+        if (test_counter(cache, "l2_hits") > hits) {
+            char expected[CACHE_VALUE_SIZE];
+            test_value(key, klen, expected, sizeof(expected));
+            if (ATOMIC_READ(storage_fetches) != fetches) {
+                ut_failure("%s has been fetched from the storage", key);
+                failed = 1;
+            } else if (!v || vlen != sizeof(expected) || memcmp(v, expected, vlen) != 0) {
+                ut_failure("unexpected data for %s", key);
+                failed = 1;
+            } else {
+                found = 1;
+            }
+        }
+        free(v);
+    }
+    if (!failed) {
+        if (found)
+            ut_success();
+        else
+            ut_failure("no key has been served by the l2 cache");
+    }
+
+    ut_testing("the key served by the l2 cache has been promoted back to the cache");
+    if (found) {
+        int fetches = ATOMIC_READ(storage_fetches);
+        uint64_t hits = test_counter(cache, "l2_hits");
+        uint64_t misses = test_counter(cache, "cache_misses");
+        size_t vlen = 0;
+        void *v = shardcache_get(cache, key, klen, &vlen, NULL);
+        free(v);
+        if (test_counter(cache, "l2_hits") == hits &&
+            test_counter(cache, "cache_misses") == misses &&
+            ATOMIC_READ(storage_fetches) == fetches &&
+            vlen == CACHE_VALUE_SIZE)
+        {
+            ut_success();
+        } else {
+            ut_failure("%s hasn't been served from the cache", key);
+        }
+    } else {
+        ut_failure("no key has been served by the l2 cache");
+    }
+
+    shardcache_destroy(cache);
+    shardcache_node_destroy(node);
+    unlink(path);
+
+    ut_summary();
+    exit(ut_failed);
+}
@@ -0,0 +1,301 @@
+#include <shardcache.h>
+#include <unistd.h>
+#include <string.h>
+#include <ut.h>
+#include <libgen.h>
+
+#define CACHE_SIZE (1<<20)
+#define NS_SIZE (256<<10)
+#define NUM_HOT_KEYS 100
+#define HOT_VALUE_SIZE 1024
+#define NUM_SCAN_KEYS 1000
+#define SCAN_VALUE_SIZE 4096
+#define NUM_KEYS 50
+
+static uint64_t
+test_counter(shardcache_t *cache, char *name)
+{
+    shardcache_counter_t *counters = NULL;
+    uint64_t value = 0;
+    int i, n = shardcache_get_counters(cache, &counters);
+    for (i = 0; i < n; i++) {
+        if (strcmp(counters[i].name, name) == 0) {
+            value = counters[i].value;
+            break;
+        }
+    }
+    free(counters);
+    return value;
+}
+
+// the counters of a namespace (exported as ns[<prefix>].<counter>)
+static uint64_t
+test_ns_counter(shardcache_t *cache, char *prefix, char *name)
+{
+    char label[256];
+    snprintf(label, sizeof(label), "ns[%s].%s", prefix, name);
+    return test_counter(cache, label);
+}
+
+// fill keys[] with the first 'num' keys under the prefix owned by 'owner'
+static void
+test_keys(shardcache_t *owner, char *prefix, int num, char keys[][32])
+{
+    int i, n = 0;
+    for (i = 0; n < num; i++) {
+        int klen = snprintf(keys[n], 32, "%s%d", prefix, i);
+        if (shardcache_test_ownership(owner, keys[n], klen, NULL, NULL))
+            n++;
+    }
+}
+
+static void
+test_set_all(shardcache_t *cache, char keys[][32], int num, size_t vlen)
+{
+    char *value = malloc(vlen);
+    int i;
+    for (i = 0; i < num; i++) {
+        memset(value, 'a' + (i % 26), vlen);
+        shardcache_set(cache, keys[i], strlen(keys[i]), value, vlen);
+    }
+    free(value);
+}
+
+// returns the number of keys served with the expected value
+static int
+test_get_all(shardcache_t *cache, char keys[][32], int num, size_t vlen)
+{
+    int i, found = 0;
+    for (i = 0; i < num; i++) {
+        size_t size = 0;
+        char *value = shardcache_get(cache, keys[i], strlen(keys[i]), &size, NULL);
+        if (value && size == vlen && value[0] == 'a' + (i % 26) && value[vlen - 1] == value[0])
+            found++;
+        free(value);
+    }
+    return found;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    int num_nodes = 2;
+    shardcache_node_t *nodes[num_nodes];
+    shardcache_t *servers[num_nodes];
+
+    static char hot_keys[NUM_HOT_KEYS][32];
+    static char scan_keys[NUM_SCAN_KEYS][32];
+    static char keys[NUM_KEYS][32];
+    static char other_keys[NUM_KEYS][32];
+
+    shardcache_log_init("shardcached", LOG_WARNING);
+
+    ut_init(basename(argv[0]));
+
+    for (i = 0; i < num_nodes; i++) {
+        char label[32];
+        sprintf(label, "peer%d", i);
+        char address[32];
+        sprintf(address, "127.0.0.1:981%d", i);
+        char *address_array[1] = { address };
+        nodes[i] = shardcache_node_create(label, address_array, 1);
+    }
+
+    for (i = 0; i < num_nodes; i++) {
+        ut_testing("shardcache_create(nodes[%d].label, nodes, num_nodes, NULL, NULL, 2, 0, %d)", i, CACHE_SIZE);
+        servers[i] = shardcache_create(shardcache_node_get_label(nodes[i]),
+                                       nodes,
+                                       num_nodes,
+                                       NULL,
+                                       NULL,
+                                       2,
+                                       0,
+                                       CACHE_SIZE);
+        if (!servers[i]) {
+            ut_failure("Errors creating the shardcache instance");
+            ut_summary();
+            exit(ut_failed);
+        }
+        ut_success();
+    }
+
+    sleep(1); // let the servers complete their startup
+
+    shardcache_t *server = servers[0];
+
+    ut_testing("shardcache_namespace_add(server, \"scan:\", %d, 0, 0, 0) == 0", NS_SIZE);
+    ut_validate_int(shardcache_namespace_add(server, "scan:", NS_SIZE, 0, 0, 0), 0);
+
+    ut_testing("shardcache_namespace_add() with an existing prefix == -1");
+    ut_validate_int(shardcache_namespace_add(server, "scan:", NS_SIZE, 0, 0, 0), -1);
+
+    ut_testing("shardcache_namespace_add() with an empty prefix or no size == -1");
+    if (shardcache_namespace_add(server, "", NS_SIZE, 0, 0, 0) == -1 &&
+        shardcache_namespace_add(server, "empty:", 0, 0, 0, 0) == -1)
+    {
+        ut_success();
+    } else {
+        ut_failure("the namespace has been added");
+    }
+
+    // the hot keys are cached by the default arcs, a scan over the
+    // namespace (a few times the size of the whole cache) can't evict them
+    test_keys(server, "hot:", NUM_HOT_KEYS, hot_keys);
+    test_set_all(server, hot_keys, NUM_HOT_KEYS, HOT_VALUE_SIZE);
+    test_get_all(server, hot_keys, NUM_HOT_KEYS, HOT_VALUE_SIZE);
+    test_get_all(server, hot_keys, NUM_HOT_KEYS, HOT_VALUE_SIZE);
+
+    test_keys(server, "scan:", NUM_SCAN_KEYS, scan_keys);
+    test_set_all(server, scan_keys, NUM_SCAN_KEYS, SCAN_VALUE_SIZE);
+    ut_testing("the scan over the namespace is served");
+    ut_validate_int(test_get_all(server, scan_keys, NUM_SCAN_KEYS, SCAN_VALUE_SIZE), NUM_SCAN_KEYS);
+
+    sleep(2); // the size counters are refreshed every second
+
+    ut_testing("the namespace doesn't use more than its own budget");
+    uint64_t ns_size = test_ns_counter(server, "scan:", "cache_size");
+    if (ns_size > 0 && ns_size <= NS_SIZE + SCAN_VALUE_SIZE)
+        ut_success();
+    else
+        ut_failure("%llu bytes cached by the namespace (budget: %d)", (unsigned long long)ns_size, NS_SIZE);
+
+    ut_testing("the scan over the namespace didn't evict the hot keys");
+    uint64_t misses = test_counter(server, "cache_misses");
+    int found = test_get_all(server, hot_keys, NUM_HOT_KEYS, HOT_VALUE_SIZE);
+    if (found == NUM_HOT_KEYS && test_counter(server, "cache_misses") == misses)
+        ut_success();
+    else
+        ut_failure("%d cache misses for the hot keys", (int)(test_counter(server, "cache_misses") - misses));
+
+    // the keys of a namespace defined at runtime already cached by the
+    // namespace with the shorter prefix are dropped, the next lookups
+    // load them into the new namespace (the longest prefix wins)
+    ut_testing("shardcache_namespace_add(server, \"pre:\", %d, 0, 0, 0) == 0", CACHE_SIZE);
+    ut_validate_int(shardcache_namespace_add(server, "pre:", CACHE_SIZE, 0, 0, 0), 0);
+
+    test_keys(server, "pre:long:", NUM_KEYS, keys);
+    test_set_all(server, keys, NUM_KEYS, HOT_VALUE_SIZE);
+    test_get_all(server, keys, NUM_KEYS, HOT_VALUE_SIZE);
+    test_keys(server, "pre:short:", NUM_KEYS, other_keys);
+    test_set_all(server, other_keys, NUM_KEYS, HOT_VALUE_SIZE);
+    test_get_all(server, other_keys, NUM_KEYS, HOT_VALUE_SIZE);
+    sleep(2);
+
+    ut_testing("the keys are cached by the \"pre:\" namespace");
+    ut_validate_int(test_ns_counter(server, "pre:", "cached_items"), NUM_KEYS * 2);
+
+    ut_testing("shardcache_namespace_add(server, \"pre:long:\", %d, 1, 0, 0) == 0", CACHE_SIZE);
+    ut_validate_int(shardcache_namespace_add(server, "pre:long:", CACHE_SIZE, 1, 0, 0), 0);
+    sleep(2);
+
+    ut_testing("the keys under the new namespace have been dropped from \"pre:\"");
+    ut_validate_int(test_ns_counter(server, "pre:", "cached_items"), NUM_KEYS);
+
+    ut_testing("the dropped keys are loaded again into the new namespace");
+    found = test_get_all(server, keys, NUM_KEYS, HOT_VALUE_SIZE);
+    if (found == NUM_KEYS && test_ns_counter(server, "pre:long:", "cache_misses") == NUM_KEYS)
+        ut_success();
+    else
+        ut_failure("%d keys found, %d misses", found,
+                   (int)test_ns_counter(server, "pre:long:", "cache_misses"));
+
+    ut_testing("the other keys are still served by \"pre:\"");
+    misses = test_ns_counter(server, "pre:", "cache_misses");
+    found = test_get_all(server, other_keys, NUM_KEYS, HOT_VALUE_SIZE);
+    if (found == NUM_KEYS && test_ns_counter(server, "pre:", "cache_misses") == misses)
+        ut_success();
+    else
+        ut_failure("%d keys found, %d misses", found,
+                   (int)(test_ns_counter(server, "pre:", "cache_misses") - misses));
+
+    // only the namespace with the longest prefix sets an expire time
+    sleep(3);
+    ut_testing("the keys expire after the expire time of their namespace");
+    ut_validate_int(test_ns_counter(server, "pre:long:", "expires"), NUM_KEYS);
+
+    ut_testing("the keys of the namespace with no expire time don't expire");
+    if (test_ns_counter(server, "pre:", "expires") == 0 &&
+        test_ns_counter(server, "pre:", "cached_items") == NUM_KEYS)
+    {
+        ut_success();
+    } else {
+        ut_failure("%d keys expired", (int)test_ns_counter(server, "pre:", "expires"));
+    }
+
+    // the keys owned by the other node are cached when set
+    // only if the namespace asks for it
+    ut_testing("shardcache_namespace_add(server, \"set_on:\"/\"set_off:\", ..., cache_on_set) == 0");
+    if (shardcache_namespace_add(server, "set_on:", CACHE_SIZE, 0, 1, 0) == 0 &&
+        shardcache_namespace_add(server, "set_off:", CACHE_SIZE, 0, 0, 0) == 0)
+    {
+        ut_success();
+    } else {
+        ut_failure("can't add the namespaces");
+    }
+
+    test_keys(servers[1], "set_on:", NUM_KEYS, keys);
+    test_set_all(server, keys, NUM_KEYS, HOT_VALUE_SIZE);
+    test_keys(servers[1], "set_off:", NUM_KEYS, other_keys);
+    test_set_all(server, other_keys, NUM_KEYS, HOT_VALUE_SIZE);
+    sleep(2);
+
+    ut_testing("the keys set under a namespace with cache_on_set are cached");
+    ut_validate_int(test_ns_counter(server, "set_on:", "cached_items"), NUM_KEYS);
+
+    ut_testing("the keys set under a namespace without cache_on_set aren't cached");
+    ut_validate_int(test_ns_counter(server, "set_off:", "cached_items"), 0);
+
+    ut_testing("the keys cached on set are served without a cache miss");
+    found = test_get_all(server, keys, NUM_KEYS, HOT_VALUE_SIZE);
+    if (found == NUM_KEYS && test_ns_counter(server, "set_on:", "cache_misses") == 0)
+        ut_success();
+    else
+        ut_failure("%d keys found, %d misses", found,
+                   (int)test_ns_counter(server, "set_on:", "cache_misses"));
+
+    // the values fetched from the other node are kept only 10% of the
+    // times, unless the namespace forces caching
+    ut_testing("shardcache_namespace_add(server, \"force:\"/\"noforce:\", ..., force_caching) == 0");
+    if (shardcache_namespace_add(server, "force:", CACHE_SIZE, 0, 0, 1) == 0 &&
+        shardcache_namespace_add(server, "noforce:", CACHE_SIZE, 0, 0, 0) == 0)
+    {
+        ut_success();
+    } else {
+        ut_failure("can't add the namespaces");
+    }
+
+    test_keys(servers[1], "force:", NUM_KEYS, keys);
+    test_set_all(servers[1], keys, NUM_KEYS, HOT_VALUE_SIZE);
+    test_keys(servers[1], "noforce:", NUM_KEYS, other_keys);
+    test_set_all(servers[1], other_keys, NUM_KEYS, HOT_VALUE_SIZE);
+
+    ut_testing("the keys owned by the other node are served");
+    if (test_get_all(server, keys, NUM_KEYS, HOT_VALUE_SIZE) == NUM_KEYS &&
+        test_get_all(server, other_keys, NUM_KEYS, HOT_VALUE_SIZE) == NUM_KEYS)
+    {
+        ut_success();
+    } else {
+        ut_failure("some keys haven't been served");
+    }
+    sleep(2);
+
+    ut_testing("all the keys fetched under a namespace with force_caching are cached");
+    ut_validate_int(test_ns_counter(server, "force:", "cached_items"), NUM_KEYS);
+
+    ut_testing("not all the keys fetched under a namespace without force_caching are cached");
+    uint64_t cached = test_ns_counter(server, "noforce:", "cached_items");
+    if (cached < NUM_KEYS)
+        ut_success();
+    else
+        ut_failure("%d keys cached", (int)cached);
+
+    for (i = 0; i < num_nodes; i++) {
+        ut_testing("destroying server %d", i);
+        shardcache_destroy(servers[i]);
+        shardcache_node_destroy(nodes[i]);
+        ut_success();
+    }
+
+    ut_summary();
+    exit(ut_failed);
+}
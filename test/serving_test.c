@@ -0,0 +1,199 @@
+#include <shardcache_client.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <ut.h>
+#include <libgen.h>
+
+#include <atomic_defs.h>
+
+#define QUANTUM 1024
+#define BIG_SIZE (1<<20)
+#define NUM_BIG_SETS 8
+
+#define LOOK_AHEAD_MAX 16
+#define LOOK_AHEAD_MIN 2
+
+static int big_done = 0;
+
+static uint64_t
+test_counter(shardcache_t *cache, char *name)
+{
+    shardcache_counter_t *counters = NULL;
+    uint64_t value = 0;
+    int i, n = shardcache_get_counters(cache, &counters);
+    for (i = 0; i < n; i++) {
+        if (strcmp(counters[i].name, name) == 0) {
+            value = counters[i].value;
+            break;
+        }
+    }
+    free(counters);
+    return value;
+}
+
+// sets big values on its own connection, each request
+// costs about a thousand quanta
+static void *
+test_big_setter(void *priv)
+{
+    shardcache_node_t *node = (shardcache_node_t *)priv;
+    shardcache_client_t *client = shardcache_client_create(&node, 1, NULL);
+    char *value = malloc(BIG_SIZE);
+    memset(value, 'x', BIG_SIZE);
+    intptr_t failures = 0;
+    int i;
+    for (i = 0; i < NUM_BIG_SETS; i++) {
+        if (shardcache_client_set(client, "big_key", 7, value, BIG_SIZE, 0) != 0)
+            failures++;
+    }
+    free(value);
+    shardcache_client_destroy(client);
+    ATOMIC_SET(big_done, 1);
+    return (void *)failures;
+}
+
+int main(int argc, char **argv)
+{
+    shardcache_log_init("shardcached", LOG_WARNING);
+
+    ut_init(basename(argv[0]));
+
+    char *address_array[1] = { "127.0.0.1:9770" };
+    shardcache_node_t *node = shardcache_node_create("peer0", address_array, 1);
+
+    // a single worker, so that all the connections share it
+    ut_testing("shardcache_create(peer0, [peer0], 1, NULL, NULL, 1, 0, 1<<29)");
+    shardcache_t *server = shardcache_create("peer0", &node, 1, NULL, NULL, 1, 0, 1<<29);
+    if (!server) {
+        ut_failure("Errors creating the shardcache instance");
+        ut_summary();
+        exit(ut_failed);
+    }
+    ut_success();
+
+    ut_testing("shardcache_serving_quantum(server, %d)", QUANTUM);
+    shardcache_serving_quantum(server, QUANTUM);
+    ut_validate_int(shardcache_serving_quantum(server, -1), QUANTUM);
+
+    sleep(1); // let the server complete its startup
+
+    shardcache_client_t *client = shardcache_client_create(&node, 1, NULL);
+    shardcache_client_set(client, "small_key", 9, "small_value", 11, 0);
+
+    uint64_t turns = test_counter(server, "worker[0].turns");
+
+    pthread_t setter;
+    pthread_create(&setter, NULL, test_big_setter, node);
+
+    // the small requests keep being served on the other connection
+    ut_testing("small requests are served while big ones share the worker");
+    int small = 0, failed = 0;
+    while (!ATOMIC_READ(big_done) && !failed) {
+        void *value = NULL;
+        size_t size = shardcache_client_get(client, "small_key", 9, &value);
+        if (size != 11 || memcmp(value, "small_value", 11) != 0)
+            failed = 1;
+        free(value);
+        small++;
+        // not too many, each of them is a loop turn as well
+        usleep(10000);
+    }
+    if (failed)
+        ut_failure("small request %d failed", small);
+    else
+        ut_success();
+
+    ut_testing("all the big requests have been served");
+    void *rc = NULL;
+    pthread_join(setter, &rc);
+    ut_validate_int((intptr_t)rc, 0);
+
+    // each big request would need about BIG_SIZE / QUANTUM turns if the
+    // worker kept looping until its deficit covered the request
+    ut_testing("the worker didn't spin waiting for the deficit to cover the big requests");
+    uint64_t spent = test_counter(server, "worker[0].turns") - turns;
+    uint64_t spinning = (uint64_t)NUM_BIG_SETS * (BIG_SIZE / QUANTUM);
+    if (spent < spinning / 2)
+        ut_success();
+    else
+        ut_failure("%llu loop turns for %d big requests", (unsigned long long)spent, NUM_BIG_SETS);
+
+    shardcache_client_destroy(client);
+
+    ut_testing("destroying the server");
+    shardcache_destroy(server);
+    shardcache_node_destroy(node);
+    ut_success();
+
+    // a fresh server, so that the look-ahead gauge of the worker
+    // only accounts for the connection used below
+    address_array[0] = "127.0.0.1:9771";
+    node = shardcache_node_create("peer0", address_array, 1);
+    server = shardcache_create("peer0", &node, 1, NULL, NULL, 1, 0, 1<<29);
+    shardcache_serving_look_ahead(server, LOOK_AHEAD_MAX);
+    shardcache_serving_look_ahead_min(server, LOOK_AHEAD_MIN);
+    // every request misses the target
+    shardcache_serving_latency_target(server, 1);
+
+    sleep(1); // let the server complete its startup
+
+    client = shardcache_client_create(&node, 1, NULL);
+    shardcache_client_set(client, "small_key", 9, "small_value", 11, 0);
+
+    // the requests are sent one at a time, each of them has been
+    // received after the previous decrease and halves the look-ahead
+    ut_testing("the look-ahead is halved down to the minimum when the latency target is missed");
+    int i;
+    for (i = 0; i < 10; i++) {
+        void *value = NULL;
+        shardcache_client_get(client, "small_key", 9, &value);
+        free(value);
+    }
+    ut_validate_int(test_counter(server, "worker[0].look_ahead"), LOOK_AHEAD_MIN);
+
+    // now every request completes in time, the look-ahead grows by one
+    // each time a window of requests completes (2 + 3 + ... + 15 requests
+    // to get from the minimum to the maximum)
+    shardcache_serving_latency_target(server, 10000000);
+    ut_testing("the look-ahead grows while the requests complete within the latency target");
+    uint64_t look_ahead = LOOK_AHEAD_MIN;
+    int grown = 1;
+    for (i = 0; i < 20; i++) {
+        void *value = NULL;
+        shardcache_client_get(client, "small_key", 9, &value);
+        free(value);
+        uint64_t current = test_counter(server, "worker[0].look_ahead");
+        if (current < look_ahead)
+            grown = 0;
+        look_ahead = current;
+    }
+    if (grown && look_ahead > LOOK_AHEAD_MIN && look_ahead < LOOK_AHEAD_MAX)
+        ut_success();
+    else
+        ut_failure("the look-ahead went from %d to %llu", LOOK_AHEAD_MIN, (unsigned long long)look_ahead);
+
+    ut_testing("the look-ahead doesn't grow past the maximum");
+    for (i = 0; i < 200; i++) {
+        void *value = NULL;
+        shardcache_client_get(client, "small_key", 9, &value);
+        free(value);
+    }
+    ut_validate_int(test_counter(server, "worker[0].look_ahead"), LOOK_AHEAD_MAX);
+
+    ut_testing("the look-ahead is halved once the target is missed again");
+    shardcache_serving_latency_target(server, 1);
+    void *value = NULL;
+    shardcache_client_get(client, "small_key", 9, &value);
+    free(value);
+    // the look-ahead is adjusted once the response has been sent
+    usleep(100000);
+    ut_validate_int(test_counter(server, "worker[0].look_ahead"), LOOK_AHEAD_MAX / 2);
+
+    shardcache_client_destroy(client);
+    shardcache_destroy(server);
+    shardcache_node_destroy(node);
+
+    ut_summary();
+    exit(ut_failed);
+}
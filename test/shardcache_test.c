@@ -1,8 +1,47 @@
 #include <shardcache_client.h>
 #include <unistd.h>
+#include <string.h>
 #include <sys/types.h>
 #include <ut.h>
 #include <libgen.h>
+#include <atomic_defs.h>
+
+typedef struct {
+    char *data;
+    size_t dlen;
+    int done;
+    int error;
+} test_async_arg_t;
+
+static int
+test_async_cb(void *key,
+              size_t klen,
+              void *data,
+              size_t dlen,
+              size_t total_size,
+              struct timeval *timestamp,
+              void *priv)
+{
+    test_async_arg_t *arg = (test_async_arg_t *)priv;
+    if (dlen) {
+        arg->data = realloc(arg->data, arg->dlen + dlen);
+        memcpy(arg->data + arg->dlen, data, dlen);
+        arg->dlen += dlen;
+    } else {
+        if (!total_size)
+            arg->error = 1;
+        ATOMIC_SET(arg->done, 1);
+    }
+    return 0;
+}
+
+static void
+test_async_wait(test_async_arg_t *arg)
+{
+    int i;
+    for (i = 0; i < 5000 && !ATOMIC_READ(arg->done); i++)
+        usleep(1000);
+}
 
 int main(int argc, char **argv)
 {
@@ -120,6 +159,25 @@ int main(int argc, char **argv)
     ut_testing("shardcache_client_offset(client, test_key3, 9, 5, &partial, 6) == value3");
     size = shardcache_client_offset(client, "test_key3", 9, 5, &partial, 6);
     ut_validate_buffer(partial, 6, "value3", 6);
+
+    void *prefetch_keys[] = { "test_key2", "test_key3" };
+    size_t prefetch_klens[] = { 9, 9 };
+    ut_testing("shardcache_client_prefetch(client, [test_key2, test_key3], 2) == 0");
+    ret = shardcache_client_prefetch(client, prefetch_keys, prefetch_klens, 2);
+    ut_validate_int(ret, 0);
+
+    shardcache_client_set(client, "inv_key1", 8, "inv_value1", 10, 0);
+    shardcache_client_set(client, "inv_key2", 8, "inv_value2", 10, 0);
+    ut_testing("shardcache_client_invalidate(client, inv_, 4) == 0");
+    ret = shardcache_client_invalidate(client, "inv_", 4);
+    ut_validate_int(ret, 0);
+
+    // the command is broadcast to the other node asynchronously
+    sleep(1);
+
+    ut_testing("shardcache_client_exists(client, inv_key1/inv_key2, 8) == 0");
+    ret = shardcache_client_exists(client, "inv_key1", 8) + shardcache_client_exists(client, "inv_key2", 8);
+    ut_validate_int(ret, 0);
     
 
 
@@ -246,6 +304,54 @@ int main(int argc, char **argv)
     size = shardcache_client_get(client, volatile_key, strlen(volatile_key), (void **)&value);
     ut_validate_int(size, 0);
 
+    // fetch a big value from its owner and issue a head while the fetch
+    // is still in flight on the other node, the head must get just the
+    // first hlen bytes and the fetch the whole value
+    size_t big_size = 1<<20;
+    char *big_value = malloc(big_size);
+    for (i = 0; i < (int)big_size; i++)
+        big_value[i] = 'a' + (i % 26);
+    char *big_key = "big_key";
+    size_t big_klen = strlen(big_key);
+    shardcache_client_set(client, big_key, big_klen, big_value, big_size, 0);
+
+    shardcache_t *non_owner = NULL;
+    for (i = 0; i < num_nodes; i++) {
+        if (!shardcache_test_ownership(servers[i], big_key, big_klen, NULL, NULL)) {
+            non_owner = servers[i];
+            break;
+        }
+    }
+
+    test_async_arg_t get_arg = { 0 };
+    test_async_arg_t head_arg = { 0 };
+    ut_testing("shardcache_head_async(non_owner, big_key, 7, 16) during shardcache_get_async()");
+    rc = shardcache_get_async(non_owner, big_key, big_klen, test_async_cb, &get_arg);
+    if (rc == 0)
+        rc = shardcache_head_async(non_owner, big_key, big_klen, 16, test_async_cb, &head_arg);
+    if (rc == 0) {
+        test_async_wait(&head_arg);
+        test_async_wait(&get_arg);
+        if (!ATOMIC_READ(head_arg.done) || !ATOMIC_READ(get_arg.done))
+            ut_failure("timed out waiting for the async callbacks");
+        else if (head_arg.error || get_arg.error)
+            ut_failure("errors reported by the async callbacks");
+        else
+            ut_validate_buffer(head_arg.data, head_arg.dlen, big_value, 16);
+    } else {
+        ut_failure("can't issue the async requests");
+    }
+
+    ut_testing("shardcache_get_async(non_owner, big_key, 7) got the whole value");
+    ut_validate_buffer(get_arg.data, get_arg.dlen, big_value, big_size);
+
+    ut_testing("shardcache_head_async(non_owner, big_key, 7, 0) == -1");
+    ut_validate_int(shardcache_head_async(non_owner, big_key, big_klen, 0, test_async_cb, &head_arg), -1);
+
+    free(get_arg.data);
+    free(head_arg.data);
+    free(big_value);
+
     ut_testing("destroying all clients");
     shardcache_client_destroy(client);
     shardcache_client_destroy(client1);
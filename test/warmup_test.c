@@ -0,0 +1,142 @@
+#include <shardcache.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ut.h>
+#include <libgen.h>
+
+#define NUM_KEYS 200
+#define WARMUP_RATE 100
+
+static uint64_t
+test_counter(shardcache_t *cache, char *name)
+{
+    shardcache_counter_t *counters = NULL;
+    uint64_t value = 0;
+    int i, n = shardcache_get_counters(cache, &counters);
+    for (i = 0; i < n; i++) {
+        if (strcmp(counters[i].name, name) == 0) {
+            value = counters[i].value;
+            break;
+        }
+    }
+    free(counters);
+    return value;
+}
+
+int main(int argc, char **argv)
+{
+    int i, n;
+    int num_nodes = 2;
+    shardcache_node_t *nodes[num_nodes];
+    shardcache_t *servers[num_nodes];
+
+    shardcache_log_init("shardcached", LOG_WARNING);
+
+    ut_init(basename(argv[0]));
+
+    for (i = 0; i < num_nodes; i++) {
+        char label[32];
+        sprintf(label, "peer%d", i);
+        char address[32];
+        sprintf(address, "127.0.0.1:976%d", i);
+        char *address_array[1] = { address };
+        nodes[i] = shardcache_node_create(label, address_array, 1);
+    }
+
+    for (i = 0; i < num_nodes; i++) {
+        ut_testing("shardcache_create(nodes[%d].label, nodes, num_nodes, NULL, NULL, 2, 1<<29", i);
+        servers[i] = shardcache_create(shardcache_node_get_label(nodes[i]),
+                                       nodes,
+                                       num_nodes,
+                                       NULL,
+                                       NULL,
+                                       2,
+                                       0,
+                                       1<<29);
+        if (!servers[i]) {
+            ut_failure("Errors creating the shardcache instance");
+            ut_summary();
+            exit(ut_failed);
+        }
+        ut_success();
+    }
+
+    sleep(1); // let the servers complete their startup
+
+    // store the keys owned by peer1 and hit them twice, so that
+    // they end up in the mfu list and in the hot set sent to peer0
+    // (the warm_a keys are hit last, they come first in the hot set)
+    int num_hot = 0;
+    for (n = 0; n < 2; n++) {
+        char *prefix = n ? "warm_a" : "warm_b";
+        for (i = 0; i < NUM_KEYS; i++) {
+            char key[32];
+            int klen = sprintf(key, "%s:%d", prefix, i);
+            if (!shardcache_test_ownership(servers[1], key, klen, NULL, NULL))
+                continue;
+            shardcache_set(servers[1], key, klen, key, klen);
+            int h;
+            for (h = 0; h < 2; h++) {
+                size_t vlen = 0;
+                void *value = shardcache_get(servers[1], key, klen, &vlen, NULL);
+                free(value);
+            }
+            if (n)
+                num_hot++;
+        }
+    }
+
+    ut_testing("shardcache_warmup_rate(servers[0], %d)", WARMUP_RATE);
+    shardcache_warmup_rate(servers[0], WARMUP_RATE);
+    ut_validate_int(shardcache_warmup_rate(servers[0], -1), WARMUP_RATE);
+
+    // migrate everything to peer0, peer1 must know about the migration
+    // before peer0 asks for the hot set
+    shardcache_node_t *new_nodes[1] = { nodes[0] };
+    ut_testing("shardcache_migration_begin(servers[1], [peer0], 1, 0) == 0");
+    ut_validate_int(shardcache_migration_begin(servers[1], new_nodes, 1, 0), 0);
+
+    struct timeval start, now, diff;
+    gettimeofday(&start, NULL);
+
+    ut_testing("shardcache_migration_begin(servers[0], [peer0], 1, 0) == 0");
+    ut_validate_int(shardcache_migration_begin(servers[0], new_nodes, 1, 0), 0);
+
+    // the warm-up is running, the hot items under this prefix are stale
+    shardcache_invalidate(servers[0], "warm_b:", 7);
+
+    int retries = 100;
+    while (test_counter(servers[0], "warmup_loaded") < num_hot && retries--)
+        usleep(100000);
+    gettimeofday(&now, NULL);
+    timersub(&now, &start, &diff);
+    uint64_t elapsed = diff.tv_sec * 1000000 + diff.tv_usec;
+
+    ut_testing("the warm-up loaded all the %d hot items moving to peer0", num_hot);
+    ut_validate_int(test_counter(servers[0], "warmup_loaded"), num_hot);
+
+    ut_testing("the warm-up didn't go faster than %d items per second", WARMUP_RATE);
+    uint64_t expected = ((num_hot - 1) * 1000000) / WARMUP_RATE;
+    if (elapsed >= expected)
+        ut_success();
+    else
+        ut_failure("%d items loaded in %llu usecs (expected at least %llu usecs)",
+                   num_hot, (unsigned long long)elapsed, (unsigned long long)expected);
+
+    // give the warm-up the time to load any leftover
+    sleep(1);
+
+    ut_testing("the hot items under an invalidated prefix haven't been loaded");
+    ut_validate_int(test_counter(servers[0], "warmup_loaded"), num_hot);
+
+    for (i = 0; i < num_nodes; i++) {
+        ut_testing("destroying server %d", i);
+        shardcache_destroy(servers[i]);
+        shardcache_node_destroy(nodes[i]);
+        ut_success();
+    }
+
+    ut_summary();
+    exit(ut_failed);
+}
@@ -0,0 +1,200 @@
+#include <shardcache.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <ut.h>
+#include <libgen.h>
+
+#include <atomic_defs.h>
+#include <messaging.h>
+#include <write_pipeline.h>
+
+#define NUM_WRITES 100
+
+typedef struct {
+    pthread_mutex_t lock;
+    int results[NUM_WRITES];
+    int order[NUM_WRITES];
+    int count;
+} test_acks_t;
+
+typedef struct {
+    test_acks_t *acks;
+    int index;
+} test_write_t;
+
+static void
+test_ack(void *key, size_t klen, int rc, void *priv)
+{
+    test_write_t *w = (test_write_t *)priv;
+    test_acks_t *acks = w->acks;
+    pthread_mutex_lock(&acks->lock);
+    acks->results[w->index] = rc;
+    acks->order[acks->count++] = w->index;
+    pthread_mutex_unlock(&acks->lock);
+}
+
+static void
+test_acks_reset(test_acks_t *acks, test_write_t *writes)
+{
+    int i;
+    acks->count = 0;
+    for (i = 0; i < NUM_WRITES; i++) {
+        acks->results[i] = -2;
+        writes[i].acks = acks;
+        writes[i].index = i;
+    }
+}
+
+static int
+test_acks_count(test_acks_t *acks)
+{
+    pthread_mutex_lock(&acks->lock);
+    int count = acks->count;
+    pthread_mutex_unlock(&acks->lock);
+    return count;
+}
+
+static int
+test_push(write_pipeline_t *wp, unsigned char hdr, char *key, char *value, test_write_t *w)
+{
+    return write_pipeline_push(wp, hdr, key, strlen(key), value,
+                               value ? strlen(value) : 0, 0, test_ack, w);
+}
+
+static int
+test_check_value(shardcache_t *cache, char *key, char *expected)
+{
+    size_t vlen = 0;
+    char *value = shardcache_get(cache, key, strlen(key), &vlen, NULL);
+    int rc = (value && vlen == strlen(expected) && memcmp(value, expected, vlen) == 0);
+    free(value);
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    shardcache_log_init("shardcached", LOG_WARNING);
+
+    ut_init(basename(argv[0]));
+
+    char *peer = "127.0.0.1:9780";
+    char *address_array[1] = { peer };
+    shardcache_node_t *node = shardcache_node_create("peer0", address_array, 1);
+
+    ut_testing("shardcache_create(peer0, [peer0], 1, NULL, NULL, 2, 0, 1<<29)");
+    shardcache_t *server = shardcache_create("peer0", &node, 1, NULL, NULL, 2, 0, 1<<29);
+    if (!server) {
+        ut_failure("Errors creating the shardcache instance");
+        ut_summary();
+        exit(ut_failed);
+    }
+    ut_success();
+
+    sleep(1); // let the server complete its startup
+
+    test_acks_t acks;
+    test_write_t writes[NUM_WRITES];
+    pthread_mutex_init(&acks.lock, NULL);
+    write_pipeline_stats_t stats = { 0 };
+
+    // a window long enough to have all the writes queued before the flush
+    ut_testing("write_pipeline_create(peer, NULL, 1000, 200000, %d, &stats)", NUM_WRITES);
+    write_pipeline_t *wp = write_pipeline_create(peer, NULL, 1000, 200000, NUM_WRITES, &stats);
+    ut_validate_int((wp != NULL), 1);
+
+    ut_testing("the writes to the same key are coalesced");
+    test_acks_reset(&acks, writes);
+    for (i = 0; i < 10; i++) {
+        char value[32];
+        sprintf(value, "value%d", i);
+        test_push(wp, SHC_HDR_SET, "wp_key1", value, &writes[i]);
+    }
+    write_pipeline_drain(wp);
+    ut_validate_int(ATOMIC_READ(stats.coalesced), 9);
+
+    ut_testing("all the coalesced writers are notified with the result of the last one");
+    int failed = (test_acks_count(&acks) != 10);
+    for (i = 0; i < 10 && !failed; i++)
+        failed = (acks.results[i] != 0);
+    if (!failed)
+        ut_success();
+    else
+        ut_failure("%d writers notified", test_acks_count(&acks));
+
+    ut_testing("the last coalesced write wins");
+    ut_validate_int(test_check_value(server, "wp_key1", "value9"), 1);
+
+    // SET, ADD, SET on the same key: the ADD must see the first SET
+    // and the last SET must not be merged into the first one
+    ut_testing("the writes are not coalesced across an ADD");
+    uint64_t coalesced = ATOMIC_READ(stats.coalesced);
+    test_acks_reset(&acks, writes);
+    test_push(wp, SHC_HDR_SET, "wp_key2", "first", &writes[0]);
+    test_push(wp, SHC_HDR_ADD, "wp_key2", "added", &writes[1]);
+    test_push(wp, SHC_HDR_SET, "wp_key2", "last", &writes[2]);
+    write_pipeline_drain(wp);
+    ut_validate_int(ATOMIC_READ(stats.coalesced), coalesced);
+
+    ut_testing("the ADD found the key set by the write queued before it");
+    if (acks.results[0] == 0 && acks.results[1] == 1 && acks.results[2] == 0)
+        ut_success();
+    else
+        ut_failure("results: %d %d %d", acks.results[0], acks.results[1], acks.results[2]);
+
+    ut_testing("the write queued after the ADD is applied last");
+    ut_validate_int(test_check_value(server, "wp_key2", "last"), 1);
+
+    ut_testing("the writes to different keys are acknowledged in order");
+    test_acks_reset(&acks, writes);
+    for (i = 0; i < NUM_WRITES; i++) {
+        char key[32];
+        sprintf(key, "wp_order_%d", i);
+        test_push(wp, i % 3 == 2 ? SHC_HDR_DELETE : SHC_HDR_SET, key, key, &writes[i]);
+    }
+    write_pipeline_drain(wp);
+    failed = (test_acks_count(&acks) != NUM_WRITES);
+    for (i = 0; i < NUM_WRITES && !failed; i++)
+        failed = (acks.order[i] != i);
+    if (!failed)
+        ut_success();
+    else
+        ut_failure("write %d acknowledged out of order", i - 1);
+
+    write_pipeline_release(wp);
+
+    // with a window of 10 seconds the drain must not wait for it
+    ut_testing("write_pipeline_drain() flushes without waiting for the window");
+    wp = write_pipeline_create(peer, NULL, 1000, 10000000, NUM_WRITES, &stats);
+    test_acks_reset(&acks, writes);
+    test_push(wp, SHC_HDR_SET, "wp_key3", "drained", &writes[0]);
+    struct timeval start, end, diff;
+    gettimeofday(&start, NULL);
+    write_pipeline_drain(wp);
+    gettimeofday(&end, NULL);
+    timersub(&end, &start, &diff);
+    if (diff.tv_sec >= 5)
+        ut_failure("the drain took %d seconds", (int)diff.tv_sec);
+    else if (test_acks_count(&acks) != 1 || acks.results[0] != 0)
+        ut_failure("the write hasn't been acknowledged");
+    else
+        ut_success();
+
+    ut_testing("the drained write has been applied");
+    ut_validate_int(test_check_value(server, "wp_key3", "drained"), 1);
+
+    write_pipeline_release(wp);
+
+    ut_testing("destroying the server");
+    shardcache_destroy(server);
+    shardcache_node_destroy(node);
+    ut_success();
+
+    pthread_mutex_destroy(&acks.lock);
+
+    ut_summary();
+    exit(ut_failed);
+}
@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <hashtable.h>
+#include <arc_index.h>
+
+#define DEFAULT_NUM_KEYS    1000000
+#define DEFAULT_NUM_THREADS 4
+#define DEFAULT_DURATION    5
+
+/*
+ * Compares the index used by the ARC against a libhl hashtable
+ * (created the same way the ARC used to) on lookup throughput and memory
+ */
+
+typedef struct {
+    char key[32];
+    size_t klen;
+} item_t;
+
+typedef enum {
+    BENCH_INDEX_LOCKFREE,
+    BENCH_INDEX_LOCKED,
+    BENCH_HASHTABLE
+} bench_type_t;
+
+typedef struct {
+    bench_type_t type;
+    void *table;
+    item_t *items;
+    int num_items;
+    unsigned int seed;
+    uint64_t lookups;
+    uint64_t misses;
+} worker_thread_args_t;
+
+static int quit = 0;
+
+static int
+item_match(void *value, const void *key, size_t klen, void *priv)
+{
+    item_t *item = (item_t *)value;
+    return (item->klen == klen && memcmp(item->key, key, klen) == 0);
+}
+
+static void *
+item_get_cb(void *value, void *priv)
+{
+    return value;
+}
+
+static void *
+hashtable_get_cb(void *data, size_t dlen, void *user)
+{
+    return data;
+}
+
+static size_t
+heap_usage()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#elif defined(__GLIBC__)
+    struct mallinfo mi = mallinfo();
+    return (size_t)mi.uordblks + (size_t)mi.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+static void *
+worker_thread(void *priv)
+{
+    worker_thread_args_t *args = (worker_thread_args_t *)priv;
+
+    while (!__sync_fetch_and_add(&quit, 0)) {
+        int n;
+        for (n = 0; n < 1024; n++) {
+            item_t *item = &args->items[rand_r(&args->seed) % args->num_items];
+            void *value = NULL;
+            switch(args->type) {
+                case BENCH_INDEX_LOCKFREE:
+                    value = arc_index_get(args->table, item->key, item->klen,
+                                          arc_index_hash(item->key, item->klen));
+                    break;
+                case BENCH_INDEX_LOCKED:
+                    value = arc_index_get_locked(args->table, item->key, item->klen,
+                                                 arc_index_hash(item->key, item->klen),
+                                                 item_get_cb, NULL);
+                    break;
+                case BENCH_HASHTABLE:
+                    value = ht_get_deep_copy(args->table, item->key, item->klen,
+                                             NULL, hashtable_get_cb, NULL);
+                    break;
+            }
+            if (value != item)
+                args->misses++;
+        }
+        args->lookups += n;
+    }
+    return NULL;
+}
+
+static uint64_t
+run_benchmark(bench_type_t type, void *table, item_t *items, int num_items,
+              int num_threads, int duration, uint64_t *misses)
+{
+    pthread_t threads[num_threads];
+    worker_thread_args_t args[num_threads];
+    uint64_t lookups = 0;
+    int i;
+
+    __sync_lock_test_and_set(&quit, 0);
+
+    for (i = 0; i < num_threads; i++) {
+        args[i].type = type;
+        args[i].table = table;
+        args[i].items = items;
+        args[i].num_items = num_items;
+        args[i].seed = i + 1;
+        args[i].lookups = 0;
+        args[i].misses = 0;
+        pthread_create(&threads[i], NULL, worker_thread, &args[i]);
+    }
+
+    sleep(duration);
+    __sync_lock_test_and_set(&quit, 1);
+
+    *misses = 0;
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        lookups += args[i].lookups;
+        *misses += args[i].misses;
+    }
+
+    return lookups;
+}
+
+static void
+print_result(char *name, uint64_t lookups, uint64_t misses, int duration,
+             double load_time, size_t memory)
+{
+    printf("%-22s %12llu lookups/s  %8llu misses  load: %6.3fs  memory: %zu KB\n",
+           name,
+           (unsigned long long)(lookups / duration),
+           (unsigned long long)misses,
+           load_time,
+           memory / 1024);
+}
+
+static double
+elapsed(struct timeval *start)
+{
+    struct timeval now, diff;
+    gettimeofday(&now, NULL);
+    timersub(&now, start, &diff);
+    return diff.tv_sec + diff.tv_usec / 1e6;
+}
+
+static void
+usage(char *prog, int rc)
+{
+    printf("usage: %s [OPTIONS]...\n"
+           "    -k <num_keys>         the number of keys to load (defaults to: %d)\n"
+           "    -n <num_threads>      the number of threads doing lookups (defaults to: %d)\n"
+           "    -t <seconds>          the duration of each run (defaults to: %d)\n"
+           "    -g                    don't pre-size the index (let it grow incrementally)\n"
+           "    -h                    prints this help\n",
+           prog,
+           DEFAULT_NUM_KEYS,
+           DEFAULT_NUM_THREADS,
+           DEFAULT_DURATION);
+    exit(rc);
+}
+
+int
+main(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        { "num-keys",    2, 0, 'k' },
+        { "num-threads", 2, 0, 'n' },
+        { "duration",    2, 0, 't' },
+        { "grow",        0, 0, 'g' },
+        { "help",        0, 0, 'h' },
+        { NULL,          0, 0,  0  }
+    };
+
+    int num_items = DEFAULT_NUM_KEYS;
+    int num_threads = DEFAULT_NUM_THREADS;
+    int duration = DEFAULT_DURATION;
+    int presize = 1;
+    int option_index = 0;
+    int c, i;
+
+    while ((c = getopt_long(argc, argv, "k:n:t:gh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'k':
+                num_items = strtol(optarg, NULL, 10);
+                break;
+            case 'n':
+                num_threads = strtol(optarg, NULL, 10);
+                break;
+            case 't':
+                duration = strtol(optarg, NULL, 10);
+                break;
+            case 'g':
+                presize = 0;
+                break;
+            case 'h':
+                usage(argv[0], 0);
+                break;
+            default:
+                usage(argv[0], -1);
+        }
+    }
+
+    if (num_items <= 0 || num_threads <= 0 || duration <= 0)
+        usage(argv[0], -1);
+
+    item_t *items = calloc(num_items, sizeof(item_t));
+    for (i = 0; i < num_items; i++)
+        items[i].klen = snprintf(items[i].key, sizeof(items[i].key), "benchmark_key_%d", i);
+
+    struct timeval start;
+    uint64_t lookups, misses;
+    double load_time;
+    size_t memory;
+
+    // arc_index
+    memory = heap_usage();
+    gettimeofday(&start, NULL);
+    arc_index_t *index = arc_index_create(presize ? num_items : 0, item_match, NULL, NULL);
+    for (i = 0; i < num_items; i++) {
+        arc_index_set_if_not_exists(index, items[i].key, items[i].klen,
+                                    arc_index_hash(items[i].key, items[i].klen), &items[i]);
+    }
+    load_time = elapsed(&start);
+    memory = heap_usage() - memory;
+    if (!memory)
+        memory = arc_index_memory_usage(index);
+
+    lookups = run_benchmark(BENCH_INDEX_LOCKFREE, index, items, num_items, num_threads, duration, &misses);
+    print_result("arc_index (lock-free)", lookups, misses, duration, load_time, memory);
+
+    lookups = run_benchmark(BENCH_INDEX_LOCKED, index, items, num_items, num_threads, duration, &misses);
+    print_result("arc_index (locked)", lookups, misses, duration, load_time, memory);
+
+    arc_index_destroy(index);
+
+    // libhl hashtable, as created by the ARC before the dedicated index
+    memory = heap_usage();
+    gettimeofday(&start, NULL);
+    hashtable_t *table = ht_create(1<<16, 1<<22, NULL);
+    for (i = 0; i < num_items; i++)
+        ht_set_if_not_exists(table, items[i].key, items[i].klen, &items[i], sizeof(item_t));
+    load_time = elapsed(&start);
+    memory = heap_usage() - memory;
+
+    lookups = run_benchmark(BENCH_HASHTABLE, table, items, num_items, num_threads, duration, &misses);
+    print_result("libhl hashtable", lookups, misses, duration, load_time, memory);
+
+    ht_destroy(table);
+    free(items);
+
+    exit(0);
+}
+
+// vim: tabstop=4 shiftwidth=4 expandtab:
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
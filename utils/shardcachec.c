@@ -19,11 +19,19 @@ void usage(char *prgname) {
            "        add       <key> [ -e <expire> ] [ -i <input_file> (defaults to stdin) ]\n"
            "        exists    <key>\n"
            "        touch     <key>\n"
+           "        prefetch  <key> [ <key> ... ]\n"
            "        del       <key>\n"
            "        evict     <key>\n"
+           "        invalidate <prefix>\n"
            "        index   [ <node> ]\n"
            "        stats   [ <node> ]\n"
-           "        check   [ <node> ]\n\n", prgname);
+           "        hotkeys [ <node> ]\n"
+           "        slowlog [ <node> ]\n"
+           "        trace   <trace_id>\n"
+           "        check   [ <node> ]\n\n"
+           "   The requests carry the (hex) trace id found in the SHC_TRACE_ID\n"
+           "   environment variable (if any), the trace command merges the spans\n"
+           "   recorded by all the nodes for a trace\n\n", prgname);
     exit(-2);
 }
 
@@ -67,9 +75,96 @@ int print_chunk(char *peer,
     return error;
 }
 
+typedef struct {
+    double received;
+    char *node;
+    char *line;
+} trace_span_t;
+
+static int
+trace_span_cmp(const void *a, const void *b)
+{
+    const trace_span_t *sa = (const trace_span_t *)a;
+    const trace_span_t *sb = (const trace_span_t *)b;
+    return (sa->received > sb->received) - (sa->received < sb->received);
+}
+
+// collect the spans of a trace from all the nodes and print them
+// ordered by the time the requests have been received
+static int
+merge_trace(shardcache_client_t *client, uint64_t trace_id)
+{
+    char id[17];
+    snprintf(id, sizeof(id), "%016llx", (unsigned long long)trace_id);
+
+    trace_span_t *spans = NULL;
+    int num_spans = 0;
+    char *header = NULL;
+
+    int i;
+    for (i = 0; i < num_nodes; i++) {
+        char *label = shardcache_node_get_label(nodes[i]);
+        char *report = NULL;
+        size_t len = 0;
+        if (shardcache_client_traces(client, label, &report, &len) != 0) {
+            fprintf(stderr, "Error querying node: %s (%s)\n",
+                    label, shardcache_node_get_address(nodes[i]));
+            continue;
+        }
+
+        char *saveptr = NULL;
+        char *line = strtok_r(report, "\r\n", &saveptr);
+        while (line) {
+            if (line[0] == '#') {
+                if (!header)
+                    header = strdup(line + 2);
+            } else {
+                // received;cmd;hash;trace;...
+                char *trace = line;
+                int field;
+                for (field = 0; field < 3 && trace; field++) {
+                    trace = strchr(trace, ';');
+                    if (trace)
+                        trace++;
+                }
+                if (trace && strncmp(trace, id, 16) == 0 && trace[16] == ';') {
+                    spans = realloc(spans, sizeof(trace_span_t) * (num_spans + 1));
+                    spans[num_spans].received = strtod(line, NULL);
+                    spans[num_spans].node = label;
+                    spans[num_spans].line = strdup(line);
+                    num_spans++;
+                }
+            }
+            line = strtok_r(NULL, "\r\n", &saveptr);
+        }
+        free(report);
+    }
+
+    if (!num_spans) {
+        fprintf(stderr, "No spans found for trace %s\n", id);
+        free(header);
+        return -1;
+    }
+
+    qsort(spans, num_spans, sizeof(trace_span_t), trace_span_cmp);
+
+    printf("* Trace %s\n\n# node;%s\n", id, header ? header : "");
+    for (i = 0; i < num_spans; i++) {
+        printf("%s;%s\n", spans[i].node, spans[i].line);
+        free(spans[i].line);
+    }
+    printf("\n");
+
+    free(spans);
+    free(header);
+    return 0;
+}
+
 int main (int argc, char **argv) {
     if ((argc < 3) && (argc != 2 ||
         (strcmp(argv[1], "stats") != 0 && 
+         strcmp(argv[1], "hotkeys") != 0 &&
+         strcmp(argv[1], "slowlog") != 0 &&
          strcmp(argv[1], "check") != 0 &&
          strcmp(argv[1], "index") != 0)))
     {
@@ -90,6 +185,10 @@ int main (int argc, char **argv) {
 
     shardcache_client_t *client = shardcache_client_create(nodes, num_nodes, secret);
 
+    char *trace_id = getenv("SHC_TRACE_ID");
+    if (trace_id)
+        shardcache_client_trace(client, strtoull(trace_id, NULL, 16), 1);
+
     int rc = 0;
     int is_boolean = 0;
 
@@ -266,12 +365,31 @@ int main (int argc, char **argv) {
         rc = shardcache_client_del(client, argv[2], strlen(argv[2]));
     } else if (strcasecmp(cmd, "evict") == 0) {
         rc = shardcache_client_evict(client, argv[2], strlen(argv[2]));
+    } else if (strcasecmp(cmd, "invalidate") == 0) {
+        rc = shardcache_client_invalidate(client, argv[2], strlen(argv[2]));
     } else if (strcasecmp(cmd, "exists") == 0) {
         rc = shardcache_client_exists(client, argv[2], strlen(argv[2]));
         is_boolean = 1;
     } else if (strcasecmp(cmd, "touch") == 0) {
         rc = shardcache_client_touch(client, argv[2], strlen(argv[2]));
-    } else if (strcasecmp(cmd, "stats") == 0) {
+    } else if (strcasecmp(cmd, "prefetch") == 0) {
+        int num_keys = argc - 2;
+        void **keys = malloc(sizeof(void *) * num_keys);
+        size_t *klens = malloc(sizeof(size_t) * num_keys);
+        int i;
+        for (i = 0; i < num_keys; i++) {
+            keys[i] = argv[i + 2];
+            klens[i] = strlen(argv[i + 2]);
+        }
+        rc = shardcache_client_prefetch(client, keys, klens, num_keys);
+        free(keys);
+        free(klens);
+    } else if (strcasecmp(cmd, "stats") == 0 ||
+               strcasecmp(cmd, "hotkeys") == 0 ||
+               strcasecmp(cmd, "slowlog") == 0)
+    {
+        int hotkeys = (strcasecmp(cmd, "hotkeys") == 0);
+        int slowlog = (strcasecmp(cmd, "slowlog") == 0);
         int found = 0;
         char *selected_node = NULL;
         if (argc > 2)
@@ -286,18 +404,26 @@ int main (int argc, char **argv) {
             if (selected_node && strcmp(label, selected_node) != 0)
                 continue;
             found++;
-            printf("* Stats for node: %s (%s)\n\n", label, address);
-            int rc = shardcache_client_stats(client, label, &stats, &len); 
+            printf("* %s for node: %s (%s)\n\n",
+                   hotkeys ? "Hot keys" : slowlog ? "Slow requests" : "Stats", label, address);
+            int rc = hotkeys
+                   ? shardcache_client_hotkeys(client, label, &stats, &len)
+                   : slowlog
+                   ? shardcache_client_slowlog(client, label, &stats, &len)
+                   : shardcache_client_stats(client, label, &stats, &len); 
             if (rc == 0)
                 printf("%s\n", stats);
             else
                 printf("Error querying node: %s (%s)\n", label, address);
             if (stats)
                 free(stats);
+            stats = NULL;
             printf("\n");
         }
         if (found == 0 && selected_node)
             fprintf(stderr, "Error: Unknown node %s\n", selected_node);
+    } else if (strcasecmp(cmd, "trace") == 0) {
+        rc = merge_trace(client, strtoull(argv[2], NULL, 16));
     } else if (strcasecmp(cmd, "check") == 0) {
         int found = 0;
         char *selected_node = NULL;
@@ -332,16 +458,20 @@ int main (int argc, char **argv) {
                 continue;
             found++;
             printf("* Index for node: %s (%s)\n\n", label, address);
-            shardcache_storage_index_t *index = shardcache_client_index(client, label);
-            if (index) {
-                int n;
-                for (n = 0; n < index->size; n ++) {
-                    shardcache_storage_index_item_t *item = &index->items[n];
-                    char keystr[item->klen+1];
-                    snprintf(keystr, sizeof(keystr), "%s", (char *)item->key);
-                    printf("%s => %u\n", keystr, (uint32_t)item->vlen);
+            shardcache_client_index_iterator_t *it =
+                shardcache_client_index_iterator_create(client, label, 0, 0, UINT64_MAX);
+            if (it) {
+                void *key;
+                size_t klen, vlen;
+                int rc;
+                while ((rc = shardcache_client_index_iterator_next(it, &key, &klen, &vlen)) == 1) {
+                    char keystr[klen+1];
+                    snprintf(keystr, sizeof(keystr), "%s", (char *)key);
+                    printf("%s => %u\n", keystr, (uint32_t)vlen);
                 }
-                shardcache_free_index(index);
+                if (rc == -1)
+                    printf("%s NOT OK (%s)\n", label, shardcache_client_errstr(client));
+                shardcache_client_index_iterator_destroy(it);
             } else {
                 printf("%s NOT OK\n", label);
             }